@@ -4,6 +4,7 @@
 #include <renderer.h>
 #include <scene.h>
 #include <benchmark/benchmark.h>
+#include <gpuobjects/curlnoisetexture.h>
 #include <gpuobjects/framebuffer.h>
 #include <gpuobjects/particles.h>
 #include <utils/random_utils.h>
@@ -39,6 +40,13 @@ static auto default_start_life_func = []
     return particle_spawn_life;
 };
 
+static const SpawnDistribution default_spawn_distribution{
+    particles_spawn_direction, particles_spawn_randomness, particles_spawn_speed, particle_spawn_life, 0
+};
+
+// Fixed, the random numbers drawn are the same on every run
+static constexpr uint64_t BENCHMARK_SEED = 42;
+
 
 void error_callback(int code, const char* description)
 {
@@ -47,7 +55,7 @@ void error_callback(int code, const char* description)
 
 static void DoSetup(const benchmark::State& state)
 {
-    randInit();
+    randInit(BENCHMARK_SEED);
     glfwSetErrorCallback(error_callback);
 }
 
@@ -166,6 +174,307 @@ static void BM_DrawParticles(benchmark::State& state)
     }
 }
 
+// Start velocity and life of count particles: a std::function call per value drawing from the scalar generator, or a
+// SpawnDistribution batch
+static void BM_SampleSpawn(benchmark::State& state)
+{
+    const auto count = static_cast<size_t>(state.range(0));
+    const bool batch = state.range(1) != 0;
+    std::vector<glm::vec3> velocities(count);
+    std::vector<float> lives(count), scratch;
+    const std::function<glm::vec3()> velocity_func = default_start_velocity_func;
+    const std::function<float()> life_func = default_start_life_func;
+    for (auto _ : state)
+    {
+        if (batch)
+        {
+            default_spawn_distribution.sample(threadRandom(), count, velocities.data(), lives.data(), scratch);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                velocities[i] = velocity_func();
+                lives[i] = life_func();
+            }
+        }
+        benchmark::DoNotOptimize(velocities.data());
+        benchmark::DoNotOptimize(lives.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+
+// count points with every coordinate uniform in [min, max]
+static std::vector<glm::vec3> random_points(const int count, const float min, const float max)
+{
+    std::vector<float> coordinates(count * 3);
+    threadRandom().fill(coordinates.data(), coordinates.size(), min, max);
+    std::vector<glm::vec3> points(count);
+    for (int i = 0; i < count; i++)
+        points[i] = glm::vec3{coordinates[i * 3], coordinates[i * 3 + 1], coordinates[i * 3 + 2]};
+    return points;
+}
+
+// A pool of exactly as many particles as positions, all living for the whole benchmark with the same velocity
+static Particles living_particles(Renderer& renderer, const std::vector<glm::vec3>& positions,
+                                  const glm::vec3& velocity)
+{
+    const auto count = static_cast<int>(positions.size());
+    auto particles = Particles(count, renderer.loadShader("./src/shaders/billboard_particle.vert",
+                                                          "./src/shaders/billboard_particle.frag"), renderer);
+    const std::vector<glm::vec3> velocities(count, velocity);
+    const std::vector<float> lives(count, 1e9f);
+    const std::vector<glm::u8vec4> colors(count, glm::u8vec4{255});
+    particles.spawnParticles(count, positions.data(), velocities.data(), lives.data(), colors.data(), 0.1f);
+    return particles;
+}
+
+static void BM_AdvectParticles(benchmark::State& state)
+{
+    const auto particle_number = static_cast<int>(state.range(0));
+    const bool batch = state.range(1) != 0;
+    static const auto field = CurlNoiseField::bake(CurlNoiseSettings{});
+    constexpr float frequency = 0.05f;
+
+    Camera camera{};
+    Renderer renderer(camera, 1920, 1080);
+    renderer.init(true);
+    // spread over a few tiles of the field, as the particles of a dissolving object drift apart
+    auto particles = living_particles(renderer, random_points(particle_number, -40, 40), glm::vec3{0});
+    const std::function<void(Particles::Particle&, float)> scalar_func = [](Particles::Particle& p, const float dt)
+    {
+        p.pos(p.pos() + field.sample(p.pos() * frequency) * dt);
+    };
+    for (auto _ : state)
+    {
+        if (batch)
+            particles.advect(field, frequency, 1, 1.0f / 60);
+        else
+            particles.updateParticles(1.0f / 60, scalar_func);
+        benchmark::DoNotOptimize(particles.particles.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * particle_number));
+}
+
+static void BM_BakeCurlNoise(benchmark::State& state)
+{
+    const auto resolution = static_cast<int>(state.range(0));
+    for (auto _ : state)
+    {
+        auto field = CurlNoiseField::bake(CurlNoiseSettings{resolution});
+        benchmark::DoNotOptimize(field.data().data());
+    }
+}
+
+// The GPU side of the field, uploaded whole like at startup
+static void BM_UploadCurlNoiseTexture(benchmark::State& state)
+{
+    const auto resolution = static_cast<int>(state.range(0));
+    Camera camera{};
+    Renderer renderer(camera, 1920, 1080);
+    renderer.init(true);
+    const auto field = CurlNoiseField::bake(CurlNoiseSettings{resolution});
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        const CurlNoiseTexture texture(field);
+        glFinish();
+        bytes = texture.gpuBytes();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+// Points spread with about one per cell of side cell_size, the density of a dense cloud of particles
+static std::vector<glm::vec3> uniform_cloud(const int count, const float cell_size)
+{
+    return random_points(count, 0, cell_size * std::cbrt(static_cast<float>(count)));
+}
+
+static void BM_SpatialHashBuild(benchmark::State& state)
+{
+    const auto count = static_cast<int>(state.range(0));
+    const auto points = uniform_cloud(count, 0.1f);
+    SpatialHash grid(0.1f);
+    for (auto _ : state)
+    {
+        grid.build(points.data(), count, ThreadPool::shared());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+    state.counters["KB"] = static_cast<double>(grid.byteSize()) / 1024;
+}
+
+static void BM_ParticleCollisions(benchmark::State& state)
+{
+    const auto particle_number = static_cast<int>(state.range(0));
+    const bool separate = state.range(1) != 0;
+
+    Camera camera{};
+    Renderer renderer(camera, 1920, 1080);
+    renderer.init(true);
+    auto particles = living_particles(renderer, uniform_cloud(particle_number, 0.1f), glm::vec3{0, -1, 0});
+    const auto side = 0.1f * std::cbrt(static_cast<float>(particle_number));
+
+    ParticleCollisions collisions;
+    // the floor cuts the bottom tenth of the cloud, the sphere sits in its middle
+    collisions.settings.planes.push_back(CollisionPlane{glm::vec3{0, 1, 0}, side * 0.1f});
+    collisions.settings.spheres.push_back(CollisionSphere{glm::vec3{side * 0.5f}, side * 0.25f});
+    collisions.settings.particle_radius = separate ? 0.05f : 0;
+    for (auto _ : state)
+    {
+        collisions.resolve(particles);
+        benchmark::DoNotOptimize(particles.particles.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * particle_number));
+    state.counters["KB"] = static_cast<double>(collisions.byteSize()) / 1024;
+}
+
+static void BM_BakeMeshSdf(benchmark::State& state)
+{
+    const auto resolution = static_cast<int>(state.range(0));
+    const auto data = Model::import("./assets/models/bunny_lp.obj");
+    for (auto _ : state)
+    {
+        auto sdf = MeshSdf::bake(data->meshes, resolution);
+        benchmark::DoNotOptimize(sdf.data().data());
+    }
+}
+
+static void BM_MeshCollisions(benchmark::State& state)
+{
+    const auto particle_number = static_cast<int>(state.range(0));
+    const auto instance_number = static_cast<int>(state.range(1));
+    const auto data = Model::import("./assets/models/bunny_lp.obj");
+    const auto sdf = MeshSdf::bake(data->meshes, 64);
+
+    Camera camera{};
+    Renderer renderer(camera, 1920, 1080);
+    renderer.init(true);
+    // the instances on a cube grid like the ones of the scene, turned around y, and the particles all over the grid
+    const auto size = sdf.cellSize() * static_cast<float>(sdf.resolution() - 1);
+    const auto side = static_cast<int>(std::ceil(std::cbrt(static_cast<float>(instance_number))));
+    const auto spacing = size * 1.5f;
+    ParticleCollisions collisions;
+    for (int i = 0; i < instance_number; i++)
+    {
+        const auto offset = glm::vec3{static_cast<float>(i % side), static_cast<float>(i / side % side),
+                                      static_cast<float>(i / side / side)} * spacing;
+        collisions.settings.meshes.push_back(CollisionMesh{
+            &sdf, glm::rotate(glm::translate(glm::mat4{1}, offset), static_cast<float>(i), glm::vec3{0, 1, 0}),
+            CollisionMask{}
+        });
+    }
+    const auto rows = (instance_number + side - 1) / side;
+    const auto extent = glm::vec3{static_cast<float>(side), static_cast<float>(std::min(side, rows)),
+                                  static_cast<float>((rows + side - 1) / side)} * spacing;
+    auto positions = random_points(particle_number, 0, 1);
+    for (auto& p : positions)
+        p = sdf.origin() + p * extent;
+    auto particles = living_particles(renderer, positions, glm::vec3{0, -1, 0});
+
+    for (auto _ : state)
+    {
+        collisions.resolve(particles);
+        benchmark::DoNotOptimize(particles.particles.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * particle_number));
+    state.counters["contacts"] = collisions.lastStats().contacts;
+}
+
+static void BM_DepthCollisions(benchmark::State& state)
+{
+    const auto particle_number = static_cast<int>(state.range(0));
+    Camera camera{};
+    Renderer renderer(camera, 1920, 1080);
+    renderer.init(true);
+    // the depth a 1920x1080 frame reads back: a slope across the lower half of the screen, nothing above
+    const auto view_projection = renderer.projectionMatrix() * renderer.viewMatrix();
+    constexpr int width = 1920 / DepthCollider::DOWNSAMPLE, height = 1080 / DepthCollider::DOWNSAMPLE;
+    std::vector<float> depth(width * height, 1);
+    for (int y = 0; y < height / 2; y++)
+    {
+        for (int x = 0; x < width; x++)
+            depth[y * width + x] = 0.95f + 0.04f * static_cast<float>(x) / width;
+    }
+    ScreenDepth screen;
+    screen.build(depth.data(), width, height, view_projection);
+
+    // all on screen, at any depth
+    const auto to_world = glm::inverse(view_projection);
+    auto positions = random_points(particle_number, -1, 1);
+    for (auto& p : positions)
+    {
+        const auto world = to_world * glm::vec4{p, 1};
+        p = glm::vec3{world} / world.w;
+    }
+    auto particles = living_particles(renderer, positions, glm::vec3{0, 0, -1});
+
+    ParticleCollisions collisions;
+    collisions.settings.screen = &screen;
+    for (auto _ : state)
+    {
+        collisions.resolve(particles);
+        benchmark::DoNotOptimize(particles.particles.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * particle_number));
+}
+
+static void BM_ScreenDepthBuild(benchmark::State& state)
+{
+    const auto width = static_cast<int>(state.range(0)) / DepthCollider::DOWNSAMPLE;
+    const auto height = static_cast<int>(state.range(1)) / DepthCollider::DOWNSAMPLE;
+    std::vector<float> depth(width * height);
+    threadRandom().fill(depth.data(), depth.size(), 0.9f, 1);
+    const auto view_projection = glm::perspective(glm::radians(45.f), 16.f / 9, 0.1f, 100.f);
+    ScreenDepth screen;
+    for (auto _ : state)
+    {
+        screen.build(depth.data(), width, height, view_projection);
+        benchmark::DoNotOptimize(screen.normals.data());
+    }
+    state.counters["KB"] = static_cast<double>(screen.byteSize()) / 1024;
+}
+
+static void BM_GridFluidStep(benchmark::State& state)
+{
+    GridFluid air;
+    air.settings.resolution = static_cast<int>(state.range(0));
+    air.settings.max_iterations = static_cast<int>(state.range(1));
+    air.place(glm::vec3{-3}, 6);
+    // a sphere spinning around y in the middle of the grid, 60 steps per second
+    constexpr float dt = 1.0f / 60;
+    const std::vector<FluidMover> movers{
+        FluidMover{glm::vec3{0}, 1, glm::rotate(glm::mat4{1}, glm::radians(90.f) * dt, glm::vec3{0, 1, 0}), dt}
+    };
+    for (auto _ : state)
+    {
+        // every iteration is run, whatever it takes
+        air.step(dt, movers, 1e9f);
+        benchmark::ClobberMemory();
+    }
+    state.counters["KB"] = static_cast<double>(air.byteSize()) / 1024;
+}
+
+static void BM_AirDrag(benchmark::State& state)
+{
+    const auto particle_number = static_cast<int>(state.range(0));
+    Camera camera{};
+    Renderer renderer(camera, 1920, 1080);
+    renderer.init(true);
+    GridFluid air;
+    air.place(glm::vec3{-3}, 6);
+    constexpr float dt = 1.0f / 60;
+    air.step(dt, {FluidMover{glm::vec3{0}, 1, glm::translate(glm::mat4{1}, glm::vec3{0.1f, 0, 0}), dt}}, 1e9f);
+    // all in the grid
+    auto particles = living_particles(renderer, random_points(particle_number, -3, 3), glm::vec3{0, 1, 0});
+    for (auto _ : state)
+    {
+        particles.drag(air, 2, dt);
+        benchmark::DoNotOptimize(particles.particles.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * particle_number));
+}
+
 static void BM_CopyFrameBuffer(benchmark::State& state)
 {
     const auto w_resolution = static_cast<int>(state.range(0));
@@ -226,6 +535,61 @@ static void BM_ReadFrameBuffer(benchmark::State& state)
     }
 }
 
+static void BM_ImportModel(benchmark::State& state)
+{
+    const auto from_cache = state.range(0) != 0;
+    const string path = "./assets/models/bunny_lp.obj";
+    // Makes sure the mesh cache entry exists
+    benchmark::DoNotOptimize(Model::import(path));
+
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        const auto data = from_cache ? Model::import(path) : Model::importSource(path);
+        bytes += data->byteSize();
+        benchmark::DoNotOptimize(data->meshes[0].vertexData());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+
+// Parsing only, without the mesh optimizer and the levels of detail
+static void BM_ImportObj(benchmark::State& state)
+{
+    const string path = state.range(0) == 0 ? "./assets/models/bunny_lp.obj" : "./assets/models/sphere.obj";
+    ModelImportOptions options;
+    options.nativeObjLoader = state.range(1) != 0;
+    options.optimize = false;
+    options.generateLods = false;
+
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        const auto data = Model::importSource(path, options);
+        bytes += data->byteSize();
+        benchmark::DoNotOptimize(data->meshes[0].vertexData());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+
+// Mip chain and block compression of the noise texture, the work skipped by a texture cache hit
+static void BM_TranscodeTexture(benchmark::State& state)
+{
+    const auto format = state.range(0) == 0 ? TextureFormat::RGTC1 : TextureFormat::BPTC;
+    const auto image = Texture::decode("./assets/textures/Voronoi 7 - 512x512.png");
+    const size_t pixelCount = static_cast<size_t>(image->width) * image->height;
+    std::vector<unsigned char> pixels(pixelCount * TextureCodec::channels(format));
+    TextureCodec::convert(image->pixels.get(), image->nrChannels, pixelCount, TextureCodec::channels(format),
+                          pixels.data());
+    std::vector<unsigned char> encoded(TextureCodec::chainBytes(format, image->width, image->height));
+
+    for (auto _ : state)
+    {
+        TextureCodec::transcode(pixels.data(), image->width, image->height, format, encoded.data());
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * pixels.size()));
+}
+
 static void BM_Pipeline_Step_1(benchmark::State& state)
 {
     const auto w_resolution = static_cast<int>(state.range(0));
@@ -242,13 +606,13 @@ static void BM_Pipeline_Step_1(benchmark::State& state)
     auto scene = Scene(renderer, "./assets/models/plane.obj", "./assets/textures/UV_Grid_Sm.png",
                        "./assets/textures/Voronoi 7 - 512x512.png", N_100k,
                        800, 600);
+    renderer.waitForResources();
     scene.particles_update_func = default_particles_update_func;
-    scene.start_life_func = default_start_life_func;
-    scene.start_velocity_func = default_start_velocity_func;
+    scene.spawn_distribution = default_spawn_distribution;
     scene.disappearing_object_scale = 2;
     scene.disappearing_object_rotation = glm::rotate(glm::radians(90.f), glm::vec3{1.f, 0.f, 0.f});
     scene.init(false, 1);
-    scene.mainLoop(100);
+    scene.simulate(100);
     const auto pipeline = renderer.getPipeline();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     for (auto _ : state)
@@ -258,7 +622,8 @@ static void BM_Pipeline_Step_1(benchmark::State& state)
     }
 }
 
-static void BM_Pipeline_Step_2(benchmark::State& state)
+static void pipeline_step_2(benchmark::State& state, const string& model, const glm::quat& rotation,
+                            const ModelImportOptions& model_options)
 {
     const auto w_resolution = static_cast<int>(state.range(0));
     const auto h_resolution = static_cast<int>(state.range(1));
@@ -271,16 +636,16 @@ static void BM_Pipeline_Step_2(benchmark::State& state)
         0.1f, 10000.0f));
     camera.setTransform(inverse(lookAt(glm::vec3(0.0f, 0.0f, 30.0f), glm::vec3(0.0f, 0.0f, -7.0f),
                                        glm::vec3(0.0f, 1.0f, 0.0f))));
-    auto scene = Scene(renderer, "./assets/models/plane.obj", "./assets/textures/UV_Grid_Sm.png",
+    auto scene = Scene(renderer, model, "./assets/textures/UV_Grid_Sm.png",
                        "./assets/textures/Voronoi 7 - 512x512.png", N_100k,
-                       800, 600);
+                       800, 600, model_options);
+    renderer.waitForResources();
     scene.particles_update_func = default_particles_update_func;
-    scene.start_life_func = default_start_life_func;
-    scene.start_velocity_func = default_start_velocity_func;
+    scene.spawn_distribution = default_spawn_distribution;
     scene.disappearing_object_scale = 2;
-    scene.disappearing_object_rotation = glm::rotate(glm::radians(90.f), glm::vec3{1.f, 0.f, 0.f});
+    scene.disappearing_object_rotation = rotation;
     scene.init(false, 1);
-    scene.mainLoop(0);
+    scene.simulate(0);
     const auto pipeline = renderer.getPipeline();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     for (auto _ : state)
@@ -296,6 +661,57 @@ static void BM_Pipeline_Step_2(benchmark::State& state)
     }
 }
 
+static void BM_Pipeline_Step_2(benchmark::State& state)
+{
+    pipeline_step_2(state, "./assets/models/plane.obj", glm::rotate(glm::radians(90.f), glm::vec3{1.f, 0.f, 0.f}), {});
+}
+
+static void BM_Pipeline_Step_2_Bunny(benchmark::State& state)
+{
+    ModelImportOptions options;
+    options.optimize = state.range(2) != 0;
+    pipeline_step_2(state, "./assets/models/bunny_lp.obj", toQuat(glm::mat4{1}), options);
+}
+
+static void BM_MeshOptimizer(benchmark::State& state)
+{
+    ModelImportOptions options;
+    options.optimize = false;
+    options.generateLods = false;
+    const auto source = Model::importSource("./assets/models/bunny_lp.obj", options);
+    const auto& mesh = source->meshes[0];
+    const auto before = MeshOptimizer::acmr(mesh.indices, mesh.vertices.size());
+
+    MeshData optimized;
+    for (auto _ : state)
+    {
+        optimized.vertices = mesh.vertices;
+        optimized.indices = mesh.indices;
+        MeshOptimizer::optimize(optimized);
+        benchmark::DoNotOptimize(optimized.indices.data());
+    }
+    state.counters["acmr_before"] = before;
+    state.counters["acmr_after"] = MeshOptimizer::acmr(optimized.indices, optimized.vertices.size());
+}
+
+static void BM_MeshSimplifier(benchmark::State& state)
+{
+    ModelImportOptions options;
+    options.generateLods = false;
+    const auto source = Model::importSource("./assets/models/bunny_lp.obj", options);
+    const auto& mesh = source->meshes[0];
+    const auto ratio = static_cast<float>(state.range(0)) / 100.0f;
+    const auto target = static_cast<size_t>(mesh.indices.size() / 3 * ratio) * 3;
+
+    std::vector<GLuint> lod;
+    for (auto _ : state)
+    {
+        lod = MeshSimplifier::simplify(mesh.vertices, mesh.indices, target);
+        benchmark::DoNotOptimize(lod.data());
+    }
+    state.counters["triangles_before"] = static_cast<double>(mesh.indices.size() / 3);
+    state.counters["triangles_after"] = static_cast<double>(lod.size() / 3);
+}
 
 static void BM_Pipeline_Step_3(benchmark::State& state)
 {
@@ -317,13 +733,13 @@ static void BM_Pipeline_Step_3(benchmark::State& state)
     auto scene = Scene(renderer, "./assets/models/plane.obj", "./assets/textures/UV_Grid_Sm.png",
                        "./assets/textures/Voronoi 7 - 512x512.png", N_100k,
                        buf_w_resolution, buf_h_resolution);
+    renderer.waitForResources();
     scene.particles_update_func = default_particles_update_func;
-    scene.start_life_func = default_start_life_func;
-    scene.start_velocity_func = default_start_velocity_func;
+    scene.spawn_distribution = default_spawn_distribution;
     scene.disappearing_object_scale = scale;
     scene.disappearing_object_rotation = glm::rotate(glm::radians(90.f), glm::vec3{1.f, 0.f, 0.f});
     scene.init(false, 0.1);
-    scene.mainLoop(100);
+    scene.simulate(100);
     const auto pipeline = renderer.getPipeline();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     pipeline[0]();
@@ -363,13 +779,13 @@ static void BM_Pipeline_Step_4(benchmark::State& state)
     auto scene = Scene(renderer, "./assets/models/plane.obj", "./assets/textures/UV_Grid_Sm.png",
                        "./assets/textures/Voronoi 7 - 512x512.png", N_100k,
                        buf_w_resolution, buf_h_resolution);
+    renderer.waitForResources();
     scene.particles_update_func = default_particles_update_func;
-    scene.start_life_func = default_start_life_func;
-    scene.start_velocity_func = default_start_velocity_func;
+    scene.spawn_distribution = default_spawn_distribution;
     scene.disappearing_object_scale = scale;
     scene.disappearing_object_rotation = glm::rotate(glm::radians(90.f), glm::vec3{1.f, 0.f, 0.f});
     scene.init(true, 0.1);
-    scene.mainLoop(100);
+    scene.simulate(100);
     const auto pipeline = renderer.getPipeline();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     pipeline[0]();
@@ -409,13 +825,13 @@ static void BM_Pipeline_Complete(benchmark::State& state)
     auto scene = Scene(renderer, "./assets/models/plane.obj", "./assets/textures/UV_Grid_Sm.png",
                        "./assets/textures/Voronoi 7 - 512x512.png", N_100k,
                        buf_w_resolution, buf_h_resolution);
+    renderer.waitForResources();
     scene.particles_update_func = default_particles_update_func;
-    scene.start_life_func = default_start_life_func;
-    scene.start_velocity_func = default_start_velocity_func;
+    scene.spawn_distribution = default_spawn_distribution;
     scene.disappearing_object_scale = scale;
     scene.disappearing_object_rotation = glm::rotate(glm::radians(90.f), glm::vec3{1.f, 0.f, 0.f});
     scene.init(true, 0.1);
-    scene.mainLoop(100);
+    scene.simulate(100);
     const auto pipeline = renderer.getPipeline();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     for (const auto& f : pipeline)
@@ -425,6 +841,7 @@ static void BM_Pipeline_Complete(benchmark::State& state)
     state.SetLabel("particles spawned: " + std::to_string(scene.particles.livingParticles));
     for (auto _ : state)
     {
+        GLState::get().beginFrame();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         for (const auto& f : pipeline)
         {
@@ -432,6 +849,9 @@ static void BM_Pipeline_Complete(benchmark::State& state)
         }
         glFinish();
     }
+    const auto& gl_stats = GLState::get().currentFrameStats();
+    state.counters["gl_issued"] = gl_stats.issued;
+    state.counters["gl_elided"] = gl_stats.elided;
 }
 
 BENCHMARK(BM_UpdateParticles)->RangeMultiplier(2)->Range(512, N_1M)->Setup(DoSetup)->Teardown(DoTearDown)->Unit(
@@ -448,10 +868,42 @@ BENCHMARK(BM_DrawParticles)->Name("BM_DrawParticles(#particles/max)")->
                                  benchmark::CreateRange(N_1k, N_1M, 2),
                                  {N_1M}
                              })->Setup(DoSetup)->Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SampleSpawn)->Name("BM_SampleSpawn: (#particles/0 scalar std::function 1 batch)")->
+                           ArgsProduct({{N_1k, N_100k}, {0, 1}})->Setup(DoSetup)->Teardown(DoTearDown)->Unit(
+                               benchmark::kMicrosecond);
+BENCHMARK(BM_AdvectParticles)->Name("BM_AdvectParticles: curl noise (#particles/0 scalar std::function 1 batch)")->
+                               ArgsProduct({{N_100k, N_1M}, {0, 1}})->Setup(DoSetup)->Teardown(DoTearDown)->Unit(
+                                   benchmark::kMillisecond);
+BENCHMARK(BM_BakeCurlNoise)->Name("BM_BakeCurlNoise: (resolution)")->Arg(32)->Arg(64)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_UploadCurlNoiseTexture)->Name("BM_UploadCurlNoiseTexture: (resolution)")->Arg(32)->Arg(64)->
+                                      Setup(DoSetup)->Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SpatialHashBuild)->Arg(N_100k)->Arg(N_1M)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ParticleCollisions)->Name("BM_ParticleCollisions: (#particles) (0 colliders/1 and separation)")->
+                                  ArgsProduct({{N_100k, N_1M}, {0, 1}})->Setup(DoSetup)->Teardown(DoTearDown)->
+                                  Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BakeMeshSdf)->Name("BM_BakeMeshSdf: bunny_lp.obj (resolution)")->Arg(32)->Arg(64)->Unit(
+    benchmark::kMillisecond);
+BENCHMARK(BM_MeshCollisions)->Name("BM_MeshCollisions: bunny_lp.obj SDF 64^3 (#particles/#instances)")->
+                              ArgsProduct({{N_100k, N_1M}, {1, 64, 1024}})->Setup(DoSetup)->Teardown(DoTearDown)->
+                              Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DepthCollisions)->Name("BM_DepthCollisions: 1920x1080 frame (#particles)")->Arg(N_100k)->Arg(N_1M)->
+                               Setup(DoSetup)->Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ScreenDepthBuild)->Name("BM_ScreenDepthBuild: (frame w/frame h)")->Args({1280, 720})->Args({1920, 1080})->
+                                Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GridFluidStep)->Name("BM_GridFluidStep: (resolution) (pressure iterations)")->
+                             ArgsProduct({{16, 32, 64}, {10, 40}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AirDrag)->Name("BM_AirDrag: 32^3 grid (#particles)")->Arg(N_100k)->Arg(N_1M)->Setup(DoSetup)->
+                       Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_CopyFrameBuffer)->Args({800, 600})->Args({1280, 720})->Args({1920, 1080})->Setup(DoSetup)->
                                Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
 BENCHMARK(BM_ReadFrameBuffer)->Args({800, 600})->Args({1280, 720})->Args({1920, 1080})->Setup(DoSetup)->
                                Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ImportModel)->Name("BM_ImportModel: bunny_lp.obj (0 source file/1 mesh cache)")->Arg(0)->Arg(1)->Unit(
+    benchmark::kMillisecond);
+BENCHMARK(BM_ImportObj)->Name("BM_ImportObj: (0 bunny_lp.obj/1 sphere.obj) (0 Assimp/1 ObjLoader)")->
+                        ArgsProduct({{0, 1}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_TranscodeTexture)->Name("BM_TranscodeTexture: Voronoi 7 - 512x512.png (0 RGTC1/1 BPTC)")->Arg(0)->Arg(1)->
+    Unit(benchmark::kMillisecond);
 BENCHMARK(BM_Pipeline_Step_1)->
 Name("BM_Pipeline_Step_1: draw particles pixels to off-screen buffer (screen w/screen h/particle buf w/particle buf h)")->
 Args({800, 600})->Args({1280, 720})->Args({1920, 1080})->Setup(DoSetup)->Teardown(DoTearDown)->Unit(
@@ -459,6 +911,12 @@ Args({800, 600})->Args({1280, 720})->Args({1920, 1080})->Setup(DoSetup)->Teardow
 BENCHMARK(BM_Pipeline_Step_2)->Name("BM_Pipeline_Step_2: draw disappearing model (screen w/screen h)")->
                                Args({800, 600})->Args({1280, 720})->Args({1920, 1080})->
                                Setup(DoSetup)->Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Pipeline_Step_2_Bunny)->Name(
+    "BM_Pipeline_Step_2_Bunny: draw bunny_lp.obj (screen w/screen h/mesh optimizer off-on)")->
+Args({800, 600, 0})->Args({800, 600, 1})->Args({1920, 1080, 0})->Args({1920, 1080, 1})->Setup(DoSetup)->Teardown(DoTearDown)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MeshOptimizer)->Name("BM_MeshOptimizer: bunny_lp.obj")->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MeshSimplifier)->Name("BM_MeshSimplifier: bunny_lp.obj, % of triangles")->Arg(50)->Arg(12)->Unit(
+    benchmark::kMillisecond);
 BENCHMARK(BM_Pipeline_Step_3)->Name(
                                  "BM_Pipeline_Step_3: read off-screen buffer and spawn particles (screen w/screen h/particle buf w/particle buf h)")
                              ->
@@ -0,0 +1,260 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/threadpool.h>
+
+// How CurlNoiseField::bake builds the field
+struct CurlNoiseSettings
+{
+    // cells per side of the grid, rounded up to a power of two
+    int resolution{64};
+    // noise lattice cells per side of the tile in the first octave, each octave doubles it
+    int period{4};
+    int octaves{3};
+    uint64_t seed{1};
+};
+
+/*
+Tileable field of divergence-free velocities for turbulent particle motion: the curl of a vector potential of periodic
+gradient noise, baked once on a grid of resolution^3 cells covering a tile of side 1 and repeated in every direction.
+The velocities are scaled so that their RMS length is 1.
+A cell is 4 floats (x, y, z, 0), a trilinear sample reads 8 cells of 16 bytes and the grid uploads as is to an RGBA32F
+3D texture (see gpuobjects/curlnoisetexture.h). The batch sample computes the cells and the weights of LANES positions
+at a time in lane arrays, the loads of the corners are gathers but the arithmetic around them becomes SIMD instructions.
+*/
+class CurlNoiseField
+{
+public:
+    static constexpr int LANES = 8;
+
+    CurlNoiseField() = default;
+
+    // The potential and then its curl are computed in ranges of slices of the grid on the workers of pool
+    static CurlNoiseField bake(const CurlNoiseSettings& settings, ThreadPool& pool = ThreadPool::shared())
+    {
+        CurlNoiseField field;
+        int n = 1;
+        while (n < settings.resolution)
+            n *= 2;
+        field.n = n;
+        field.cells.assign(static_cast<size_t>(n) * n * n * 4, 0);
+
+        // three independent noises, one per component of the potential
+        std::vector<float> potential(static_cast<size_t>(n) * n * n * 3);
+        pool.parallelFor(static_cast<size_t>(n), 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto z = static_cast<int>(begin); z < static_cast<int>(end); z++)
+            {
+                for (int y = 0; y < n; y++)
+                {
+                    for (int x = 0; x < n; x++)
+                    {
+                        const auto p = glm::vec3{static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)} /
+                            static_cast<float>(n);
+                        const auto cell = (static_cast<size_t>(z) * n + y) * n + x;
+                        for (int c = 0; c < 3; c++)
+                            potential[cell * 3 + c] = fractalNoise(p, settings, settings.seed * 3 + c);
+                    }
+                }
+            }
+        });
+
+        // central differences on the periodic grid, their curl has no divergence on the grid either
+        std::vector<double> sliceSquares(n, 0);
+        const auto h = 2.0f / static_cast<float>(n);
+        const auto at = [&](const int x, const int y, const int z, const int c)
+        {
+            const auto m = n - 1;
+            return potential[((static_cast<size_t>(z & m) * n + (y & m)) * n + (x & m)) * 3 + c];
+        };
+        pool.parallelFor(static_cast<size_t>(n), 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto z = static_cast<int>(begin); z < static_cast<int>(end); z++)
+            {
+                for (int y = 0; y < n; y++)
+                {
+                    for (int x = 0; x < n; x++)
+                    {
+                        const auto dy = [&](const int c) { return (at(x, y + 1, z, c) - at(x, y - 1, z, c)) / h; };
+                        const auto dz = [&](const int c) { return (at(x, y, z + 1, c) - at(x, y, z - 1, c)) / h; };
+                        const auto dx = [&](const int c) { return (at(x + 1, y, z, c) - at(x - 1, y, z, c)) / h; };
+                        const auto curl = glm::vec3{dy(2) - dz(1), dz(0) - dx(2), dx(1) - dy(0)};
+                        const auto cell = ((static_cast<size_t>(z) * n + y) * n + x) * 4;
+                        field.cells[cell] = curl.x;
+                        field.cells[cell + 1] = curl.y;
+                        field.cells[cell + 2] = curl.z;
+                        sliceSquares[z] += glm::dot(curl, curl);
+                    }
+                }
+            }
+        });
+
+        double squares = 0;
+        for (const auto s : sliceSquares)
+            squares += s;
+        if (squares > 0)
+        {
+            const auto scale = static_cast<float>(1 / std::sqrt(squares / static_cast<double>(n) / n / n));
+            for (auto& v : field.cells)
+                v *= scale;
+        }
+        return field;
+    }
+
+    // p in tiles, any value, the field repeats
+    [[nodiscard]] glm::vec3 sample(const glm::vec3& p) const
+    {
+        if (n == 0)
+            return glm::vec3{0};
+        const auto m = n - 1;
+        const auto f = p * static_cast<float>(n);
+        const auto x0 = std::floor(f.x), y0 = std::floor(f.y), z0 = std::floor(f.z);
+        const auto t = f - glm::vec3{x0, y0, z0};
+        const int ix = static_cast<int>(x0), iy = static_cast<int>(y0), iz = static_cast<int>(z0);
+        glm::vec3 out{0};
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const int cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+            const auto cell = ((static_cast<size_t>((iz + cz) & m) * n + ((iy + cy) & m)) * n + ((ix + cx) & m)) * 4;
+            const auto w = (cx ? t.x : 1 - t.x) * (cy ? t.y : 1 - t.y) * (cz ? t.z : 1 - t.z);
+            out += glm::vec3{cells[cell], cells[cell + 1], cells[cell + 2]} * w;
+        }
+        return out;
+    }
+
+    // count samples at positions * scale
+    void sample(const glm::vec3* positions, glm::vec3* out, const size_t count, const float scale = 1) const
+    {
+        if (n == 0)
+        {
+            for (size_t i = 0; i < count; i++)
+                out[i] = glm::vec3{0};
+            return;
+        }
+        const auto m = n - 1;
+        const auto cellScale = scale * static_cast<float>(n);
+        const float* data = cells.data();
+        for (size_t start = 0; start < count; start += LANES)
+        {
+            const auto lanes = count - start < LANES ? static_cast<int>(count - start) : LANES;
+            alignas(32) float tx[LANES]{}, ty[LANES]{}, tz[LANES]{};
+            alignas(32) int ix[LANES]{}, iy[LANES]{}, iz[LANES]{};
+            for (int l = 0; l < LANES; l++)
+            {
+                const auto& p = positions[start + (l < lanes ? l : 0)];
+                const auto fx = p.x * cellScale, fy = p.y * cellScale, fz = p.z * cellScale;
+                const auto x0 = std::floor(fx), y0 = std::floor(fy), z0 = std::floor(fz);
+                tx[l] = fx - x0;
+                ty[l] = fy - y0;
+                tz[l] = fz - z0;
+                ix[l] = static_cast<int>(x0);
+                iy[l] = static_cast<int>(y0);
+                iz[l] = static_cast<int>(z0);
+            }
+
+            alignas(32) float rx[LANES]{}, ry[LANES]{}, rz[LANES]{};
+            for (int corner = 0; corner < 8; corner++)
+            {
+                const int cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+                alignas(32) float vx[LANES], vy[LANES], vz[LANES];
+                for (int l = 0; l < LANES; l++)
+                {
+                    const auto cell = ((static_cast<size_t>((iz[l] + cz) & m) * n + ((iy[l] + cy) & m)) * n +
+                        ((ix[l] + cx) & m)) * 4;
+                    vx[l] = data[cell];
+                    vy[l] = data[cell + 1];
+                    vz[l] = data[cell + 2];
+                }
+                for (int l = 0; l < LANES; l++)
+                {
+                    const auto w = (cx ? tx[l] : 1 - tx[l]) * (cy ? ty[l] : 1 - ty[l]) * (cz ? tz[l] : 1 - tz[l]);
+                    rx[l] += w * vx[l];
+                    ry[l] += w * vy[l];
+                    rz[l] += w * vz[l];
+                }
+            }
+            for (int l = 0; l < lanes; l++)
+                out[start + l] = glm::vec3{rx[l], ry[l], rz[l]};
+        }
+    }
+
+    // cells per side, 0 until baked
+    [[nodiscard]] int resolution() const
+    {
+        return n;
+    }
+
+    // resolution^3 cells of (x, y, z, 0), x first
+    [[nodiscard]] const std::vector<float>& data() const
+    {
+        return cells;
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return cells.size() * sizeof(float);
+    }
+
+private:
+    int n{0};
+    std::vector<float> cells;
+
+    static uint32_t hash(uint32_t x, uint32_t y, uint32_t z, const uint64_t seed)
+    {
+        uint32_t h = static_cast<uint32_t>(seed) ^ static_cast<uint32_t>(seed >> 32) * 0x27D4EB2Du;
+        h ^= x * 0x8DA6B343u;
+        h ^= y * 0xD8163841u;
+        h ^= z * 0xCB1AB31Fu;
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        h *= 0x297A2D39u;
+        return h ^ (h >> 15);
+    }
+
+    // Gradient noise on a lattice of period cells, p in lattice cells. The gradients are the 12 edge directions
+    static float gradientNoise(const glm::vec3& p, const int period, const uint64_t seed)
+    {
+        const auto x0 = std::floor(p.x), y0 = std::floor(p.y), z0 = std::floor(p.z);
+        const auto f = p - glm::vec3{x0, y0, z0};
+        const auto fade = [](const float t) { return t * t * t * (t * (t * 6 - 15) + 10); };
+        const auto u = glm::vec3{fade(f.x), fade(f.y), fade(f.z)};
+        const auto wrap = [period](const float c)
+        {
+            return static_cast<uint32_t>((static_cast<int>(c) % period + period) % period);
+        };
+        float corners[8];
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const int cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+            const auto h = hash(wrap(x0 + cx), wrap(y0 + cy), wrap(z0 + cz), seed) % 12;
+            const auto d = f - glm::vec3{static_cast<float>(cx), static_cast<float>(cy), static_cast<float>(cz)};
+            // (1, 1, 0), (1, 0, 1) and (0, 1, 1) with every sign
+            const auto a = h & 1 ? -1.0f : 1.0f;
+            const auto b = h & 2 ? -1.0f : 1.0f;
+            const auto axes = h >> 2;
+            corners[corner] = axes == 0 ? a * d.x + b * d.y : axes == 1 ? a * d.x + b * d.z : a * d.y + b * d.z;
+        }
+        const auto lerp = [](const float a, const float b, const float t) { return a + (b - a) * t; };
+        const auto x00 = lerp(corners[0], corners[1], u.x), x10 = lerp(corners[2], corners[3], u.x);
+        const auto x01 = lerp(corners[4], corners[5], u.x), x11 = lerp(corners[6], corners[7], u.x);
+        return lerp(lerp(x00, x10, u.y), lerp(x01, x11, u.y), u.z);
+    }
+
+    // p in tiles, every octave repeats on the tile
+    static float fractalNoise(const glm::vec3& p, const CurlNoiseSettings& settings, const uint64_t seed)
+    {
+        float value = 0, amplitude = 1;
+        int period = settings.period > 0 ? settings.period : 1;
+        for (int octave = 0; octave < settings.octaves; octave++)
+        {
+            value += amplitude * gradientNoise(p * static_cast<float>(period), period, seed + octave * 0x9E3779B9ull);
+            amplitude *= 0.5f;
+            period *= 2;
+        }
+        return value;
+    }
+};
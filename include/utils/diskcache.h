@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Helpers shared by the on-disk caches (program binaries, ...).
+Everything lives under ./.cache and can be deleted at any time, setting RTGP_DISK_CACHE=0 disables the caches.
+*/
+
+static constexpr const char* DISK_CACHE_DIRECTORY = "./.cache";
+
+inline bool diskCacheEnabled()
+{
+    static const bool enabled = []
+    {
+        const char* env = std::getenv("RTGP_DISK_CACHE");
+        return env == nullptr || std::strcmp(env, "0") != 0;
+    }();
+    return enabled;
+}
+
+// 64 bit FNV-1a, pass the previous hash to chain several buffers
+inline uint64_t fnv1a(const void* data, const size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline uint64_t fnv1a(const std::string& s, const uint64_t hash = 0xcbf29ce484222325ull)
+{
+    // The length is hashed too so that ("ab", "c") and ("a", "bc") differ
+    const uint64_t size = s.size();
+    return fnv1a(s.data(), s.size(), fnv1a(&size, sizeof(size), hash));
+}
+
+// Changes when the file is modified: hash of its size and modification time
+inline uint64_t sourceFileKey(const std::string& path)
+{
+    std::error_code ec;
+    const uint64_t size = std::filesystem::file_size(path, ec);
+    const auto time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+    return fnv1a(&time, sizeof(time), fnv1a(&size, sizeof(size)));
+}
+
+// Path of a cache entry, creates the subdirectory if needed
+inline std::filesystem::path diskCachePath(const std::string& subdirectory, const uint64_t key,
+                                           const std::string& extension)
+{
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    const auto dir = std::filesystem::path(DISK_CACHE_DIRECTORY) / subdirectory;
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    return dir / (name + extension);
+}
+
+inline bool readFile(const std::filesystem::path& path, std::vector<char>& out)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    const auto size = static_cast<std::streamsize>(file.tellg());
+    out.resize(size);
+    file.seekg(0);
+    return static_cast<bool>(file.read(out.data(), size));
+}
+
+// Writes a temporary file and renames it, readers never see a partially written entry. The temporary name is unique
+// per write (thread, counter and time) so that concurrent writers of the same entry, in this process or another one,
+// never share it
+inline bool writeFileAtomic(const std::filesystem::path& path, const std::vector<std::pair<const void*, size_t>>& parts)
+{
+    static std::atomic<uint64_t> writes{0};
+    const uint64_t ids[] = {writes.fetch_add(1, std::memory_order_relaxed),
+                            std::hash<std::thread::id>{}(std::this_thread::get_id()),
+                            static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())};
+    char suffix[23];
+    std::snprintf(suffix, sizeof(suffix), ".%016llx.tmp", static_cast<unsigned long long>(fnv1a(ids, sizeof(ids))));
+    auto tmp = path;
+    tmp += suffix;
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        for (const auto& [data, size] : parts)
+            file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!file)
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cmath>
+
+/*
+Accumulator of a fixed timestep simulation. The time of every frame is added up and spent in whole steps of step
+seconds, what is left waits for the next frame and alpha() is how far the frame is between the last two steps, for
+rendering the interpolated state. Beyond maxSubsteps steps in a frame the whole steps left are dropped: under load the
+simulation slows down instead of taking longer and longer frames to catch up.
+*/
+class FixedStep
+{
+public:
+    float step{1.0f / 60};
+    int maxSubsteps{8};
+
+    FixedStep() = default;
+
+    FixedStep(const float step, const int maxSubsteps): step{step}, maxSubsteps{maxSubsteps}
+    {
+    }
+
+    // Steps to simulate for a frame of dt seconds
+    int advance(const float dt)
+    {
+        accumulator += dt;
+        // a frame as long as the step must give one step, not zero because of rounding
+        const auto whole = static_cast<long>(std::floor(accumulator / step + STEP_TOLERANCE));
+        accumulator = std::fmax(accumulator - static_cast<double>(whole) * step, 0.0);
+        _lastSteps = static_cast<int>(whole < maxSubsteps ? whole : maxSubsteps);
+        _droppedSeconds += static_cast<double>(whole - _lastSteps) * step;
+        return _lastSteps;
+    }
+
+    // [0, 1], how far the time left over is into the next step: drawn as mix(previous, last, alpha), 0 draws the state
+    // before the last step and 1 the state of the last step
+    [[nodiscard]] float alpha() const
+    {
+        return static_cast<float>(std::fmin(accumulator / step, 1.0));
+    }
+
+    [[nodiscard]] int lastSteps() const
+    {
+        return _lastSteps;
+    }
+
+    // simulated time lost to the substep limit since the last reset
+    [[nodiscard]] double droppedSeconds() const
+    {
+        return _droppedSeconds;
+    }
+
+    void reset()
+    {
+        accumulator = 0;
+        _lastSteps = 0;
+        _droppedSeconds = 0;
+    }
+
+private:
+    static constexpr double STEP_TOLERANCE = 1e-4;
+
+    double accumulator{0};
+    int _lastSteps{0};
+    double _droppedSeconds{0};
+};
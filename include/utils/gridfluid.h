@@ -0,0 +1,385 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/nocopy.h>
+#include <utils/threadpool.h>
+
+// How GridFluid simulates the air, can be changed at any time. A new resolution applies at the next place()
+struct GridFluidSettings
+{
+    // cells per side of the grid
+    int resolution{32};
+    // solver time per frame, the pressure iterations stop when it is spent
+    float budget_ms{1};
+    int max_iterations{40};
+    // fraction of the velocity of the air lost per second
+    float dissipation{0.5f};
+    // how fast the particles take the velocity of the air, per second. 0 turns the air off
+    float coupling{0};
+
+    [[nodiscard]] bool enabled() const
+    {
+        return coupling > 0 && resolution > 1;
+    }
+};
+
+// A moving object pushing the air: the cells within radius of center take the velocity of the object, its motion over
+// seconds. Several steps in a row can share one mover, the object keeps its velocity over all of them
+struct FluidMover
+{
+    glm::vec3 center{0};
+    float radius{0};
+    // world positions seconds ago to the current ones
+    glm::mat4 motion{1};
+    float seconds{1};
+};
+
+// Work of the last GridFluid::step
+struct GridFluidStats
+{
+    int iterations{0};
+    double ms{0};
+};
+
+/*
+Air in a cubic box, on a grid of resolution^3 cells with the velocity at their centers, one step of a stable fluid
+solver per simulation step:
+1. the cells inside the movers take their velocity, the motion of the mover at the cell over its seconds
+2. semi-Lagrangian advection: every cell takes the velocity found dt back along its own, trilinear, with dissipation
+3. divergence, then Jacobi iterations of the pressure starting from the one of the previous step, as many as fit the
+   time left in the budget and at least MIN_ITERATIONS
+4. the pressure gradient is subtracted, the air swirls around the movers instead of piling up
+The walls of the box are closed. Every stage is split in z slices on the workers of the pool it receives, and the
+components are in separate arrays so that the rows along x are plain float loops the compiler vectorizes. The particles
+read the grid with sample(), LANES at a time like CurlNoiseField, the cost of the solver does not depend on them.
+*/
+class GridFluid : NoCopy
+{
+public:
+    static constexpr int LANES = 8;
+    static constexpr int MIN_ITERATIONS = 2;
+
+    GridFluidSettings settings;
+
+    explicit GridFluid(ThreadPool& pool = ThreadPool::shared()): NoCopy{}, pool{pool}
+    {
+    }
+
+    // The grid covers the cube from origin of side size, the air is still again
+    void place(const glm::vec3& origin, const float size)
+    {
+        n = std::max(settings.resolution, 2);
+        _origin = origin;
+        h = size / static_cast<float>(n);
+        const auto cells = static_cast<size_t>(n) * n * n;
+        for (auto* field : {&u, &v, &w, &u0, &v0, &w0, &pressure, &scratch, &rhs})
+            field->assign(cells, 0);
+    }
+
+    // true if the box from min to max is in the grid, at least margin cells from its walls
+    [[nodiscard]] bool contains(const glm::vec3& min, const glm::vec3& max, const float margin) const
+    {
+        if (n == 0)
+            return false;
+        const auto inner = margin * h;
+        const auto end = _origin + glm::vec3{h * static_cast<float>(n)};
+        return min.x >= _origin.x + inner && min.y >= _origin.y + inner && min.z >= _origin.z + inner &&
+            max.x <= end.x - inner && max.y <= end.y - inner && max.z <= end.z - inner;
+    }
+
+    void step(const float dt, const std::vector<FluidMover>& movers, const float budgetMs)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        _lastStats = GridFluidStats{};
+        if (n == 0 || dt <= 0)
+            return;
+        stir(movers);
+        advect(dt);
+        project(start, budgetMs);
+        _lastStats.ms = elapsedMs(start);
+    }
+
+    // Velocity of the air at p in world space, w is 1 inside the grid and 0 (no air) outside
+    [[nodiscard]] glm::vec4 sample(const glm::vec3& p) const
+    {
+        glm::vec4 out;
+        sample(&p, &out, 1);
+        return out;
+    }
+
+    void sample(const glm::vec3* positions, glm::vec4* out, const size_t count) const
+    {
+        if (n == 0)
+        {
+            for (size_t i = 0; i < count; i++)
+                out[i] = glm::vec4{0};
+            return;
+        }
+        const auto inverse = 1 / h;
+        const auto last = static_cast<float>(n - 1);
+        const auto side = static_cast<float>(n);
+        for (size_t start = 0; start < count; start += LANES)
+        {
+            const auto lanes = count - start < LANES ? static_cast<int>(count - start) : LANES;
+            alignas(32) float tx[LANES]{}, ty[LANES]{}, tz[LANES]{}, inside[LANES]{};
+            alignas(32) int cell[LANES]{};
+            for (int l = 0; l < LANES; l++)
+            {
+                const auto& p = positions[start + (l < lanes ? l : 0)];
+                const auto gx = (p.x - _origin.x) * inverse, gy = (p.y - _origin.y) * inverse;
+                const auto gz = (p.z - _origin.z) * inverse;
+                inside[l] = gx >= 0 && gy >= 0 && gz >= 0 && gx <= side && gy <= side && gz <= side ? 1.0f : 0.0f;
+                // cell centers are at + 0.5, the lower corner of the interpolation is at most n - 2
+                const auto fx = std::clamp(gx - 0.5f, 0.0f, last), fy = std::clamp(gy - 0.5f, 0.0f, last);
+                const auto fz = std::clamp(gz - 0.5f, 0.0f, last);
+                const auto x0 = std::min(std::floor(fx), last - 1), y0 = std::min(std::floor(fy), last - 1);
+                const auto z0 = std::min(std::floor(fz), last - 1);
+                tx[l] = fx - x0;
+                ty[l] = fy - y0;
+                tz[l] = fz - z0;
+                cell[l] = (static_cast<int>(z0) * n + static_cast<int>(y0)) * n + static_cast<int>(x0);
+            }
+
+            alignas(32) float rx[LANES]{}, ry[LANES]{}, rz[LANES]{};
+            for (int corner = 0; corner < 8; corner++)
+            {
+                const int cx = corner & 1, cy = (corner >> 1) & 1, cz = corner >> 2;
+                const auto offset = (cz * n + cy) * n + cx;
+                alignas(32) float vx[LANES], vy[LANES], vz[LANES];
+                for (int l = 0; l < LANES; l++)
+                {
+                    vx[l] = u[cell[l] + offset];
+                    vy[l] = v[cell[l] + offset];
+                    vz[l] = w[cell[l] + offset];
+                }
+                for (int l = 0; l < LANES; l++)
+                {
+                    const auto weight = (cx ? tx[l] : 1 - tx[l]) * (cy ? ty[l] : 1 - ty[l]) *
+                        (cz ? tz[l] : 1 - tz[l]) * inside[l];
+                    rx[l] += weight * vx[l];
+                    ry[l] += weight * vy[l];
+                    rz[l] += weight * vz[l];
+                }
+            }
+            for (int l = 0; l < lanes; l++)
+                out[start + l] = glm::vec4{rx[l], ry[l], rz[l], inside[l]};
+        }
+    }
+
+    // cells per side, 0 until placed
+    [[nodiscard]] int resolution() const
+    {
+        return n;
+    }
+
+    [[nodiscard]] const glm::vec3& origin() const
+    {
+        return _origin;
+    }
+
+    [[nodiscard]] float cellSize() const
+    {
+        return h;
+    }
+
+    [[nodiscard]] const GridFluidStats& lastStats() const
+    {
+        return _lastStats;
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return (u.capacity() + v.capacity() + w.capacity() + u0.capacity() + v0.capacity() + w0.capacity() +
+            pressure.capacity() + scratch.capacity() + rhs.capacity()) * sizeof(float);
+    }
+
+private:
+    int n{0};
+    glm::vec3 _origin{0};
+    float h{1};
+    // velocity, x first, and the one of the previous step while advecting
+    std::vector<float> u, v, w, u0, v0, w0;
+    // the pressure is kept from step to step, the iterations start from it
+    std::vector<float> pressure, scratch;
+    // cellSize^2 * divergence, the right hand side of the pressure equation
+    std::vector<float> rhs;
+    GridFluidStats _lastStats;
+    ThreadPool& pool;
+
+    static double elapsedMs(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    [[nodiscard]] size_t index(const int x, const int y, const int z) const
+    {
+        return (static_cast<size_t>(z) * n + y) * n + x;
+    }
+
+    // Calls row(y, z) for every row of cells, a range of z slices per job
+    template <typename F>
+    void forEachRow(F&& row)
+    {
+        pool.parallelFor(static_cast<size_t>(n), 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto z = static_cast<int>(begin); z < static_cast<int>(end); z++)
+            {
+                for (int y = 0; y < n; y++)
+                    row(y, z);
+            }
+        });
+    }
+
+    void stir(const std::vector<FluidMover>& movers)
+    {
+        if (movers.empty())
+            return;
+        forEachRow([&](const int y, const int z)
+        {
+            const auto cy = _origin.y + (static_cast<float>(y) + 0.5f) * h;
+            const auto cz = _origin.z + (static_cast<float>(z) + 0.5f) * h;
+            for (const auto& mover : movers)
+            {
+                const auto dy = cy - mover.center.y, dz = cz - mover.center.z;
+                const auto reach2 = mover.radius * mover.radius - dy * dy - dz * dz;
+                if (reach2 <= 0)
+                    continue;
+                // the cells of the row inside the sphere
+                const auto reach = std::sqrt(reach2);
+                const auto from = (mover.center.x - reach - _origin.x) / h - 0.5f;
+                const auto to = (mover.center.x + reach - _origin.x) / h - 0.5f;
+                const auto first = std::max(0, static_cast<int>(std::ceil(std::max(from, -1.0f))));
+                const auto last = std::min(n - 1, static_cast<int>(std::floor(std::min(to, static_cast<float>(n)))));
+                const auto perSecond = 1 / mover.seconds;
+                for (int x = first; x <= last; x++)
+                {
+                    const auto p = glm::vec3{_origin.x + (static_cast<float>(x) + 0.5f) * h, cy, cz};
+                    const auto velocity = (glm::vec3{mover.motion * glm::vec4{p, 1}} - p) * perSecond;
+                    const auto i = index(x, y, z);
+                    u[i] = velocity.x;
+                    v[i] = velocity.y;
+                    w[i] = velocity.z;
+                }
+            }
+        });
+    }
+
+    void advect(const float dt)
+    {
+        std::swap(u, u0);
+        std::swap(v, v0);
+        std::swap(w, w0);
+        const auto cells = dt / h;
+        const auto keep = std::exp(-settings.dissipation * dt);
+        const auto side = n;
+        const auto last = static_cast<float>(n - 1);
+        const auto plane = static_cast<size_t>(n) * n;
+        const float* from[3] = {u0.data(), v0.data(), w0.data()};
+        float* to[3] = {u.data(), v.data(), w.data()};
+        forEachRow([&](const int y, const int z)
+        {
+            const auto row = index(0, y, z);
+            for (int x = 0; x < side; x++)
+            {
+                const auto i = row + x;
+                // the positions are clamped to the grid, the truncation is the floor
+                const auto fx = std::clamp(static_cast<float>(x) - from[0][i] * cells, 0.0f, last);
+                const auto fy = std::clamp(static_cast<float>(y) - from[1][i] * cells, 0.0f, last);
+                const auto fz = std::clamp(static_cast<float>(z) - from[2][i] * cells, 0.0f, last);
+                const auto x0 = std::min(static_cast<int>(fx), side - 2), y0 = std::min(static_cast<int>(fy), side - 2);
+                const auto z0 = std::min(static_cast<int>(fz), side - 2);
+                const auto tx = fx - static_cast<float>(x0), ty = fy - static_cast<float>(y0);
+                const auto tz = fz - static_cast<float>(z0);
+                const auto c = (static_cast<size_t>(z0) * side + y0) * side + x0;
+                for (int component = 0; component < 3; component++)
+                {
+                    const auto* a = from[component];
+                    const auto face = [&](const size_t base)
+                    {
+                        const auto bottom = a[base] + (a[base + 1] - a[base]) * tx;
+                        const auto top = a[base + side] + (a[base + side + 1] - a[base + side]) * tx;
+                        return bottom + (top - bottom) * ty;
+                    };
+                    const auto back = face(c);
+                    to[component][i] = (back + (face(c + plane) - back) * tz) * keep;
+                }
+            }
+        });
+    }
+
+    void project(const std::chrono::steady_clock::time_point start, const float budgetMs)
+    {
+        // central differences, the velocity beyond the closed walls is 0
+        const auto halfH = 0.5f * h;
+        forEachRow([&](const int y, const int z)
+        {
+            const auto row = index(0, y, z);
+            const auto plane = static_cast<size_t>(n) * n;
+            for (int x = 0; x < n; x++)
+            {
+                const auto i = row + x;
+                const auto dx = (x + 1 < n ? u[i + 1] : 0) - (x > 0 ? u[i - 1] : 0);
+                const auto dy = (y + 1 < n ? v[i + n] : 0) - (y > 0 ? v[i - n] : 0);
+                const auto dz = (z + 1 < n ? w[i + plane] : 0) - (z > 0 ? w[i - plane] : 0);
+                rhs[i] = (dx + dy + dz) * halfH;
+            }
+        });
+
+        // the pressure beyond the walls is the one of the wall cell, the rows clamp their neighbors
+        const auto jacobi = [&]
+        {
+            forEachRow([&](const int y, const int z)
+            {
+                const auto* p = pressure.data();
+                const auto* center = p + index(0, y, z);
+                const auto* below = p + index(0, std::max(y - 1, 0), z);
+                const auto* above = p + index(0, std::min(y + 1, n - 1), z);
+                const auto* behind = p + index(0, y, std::max(z - 1, 0));
+                const auto* front = p + index(0, y, std::min(z + 1, n - 1));
+                const auto* b = rhs.data() + index(0, y, z);
+                auto* out = scratch.data() + index(0, y, z);
+                constexpr auto sixth = 1.0f / 6;
+                out[0] = (center[0] + center[1] + below[0] + above[0] + behind[0] + front[0] - b[0]) * sixth;
+                for (int x = 1; x < n - 1; x++)
+                {
+                    out[x] = (center[x - 1] + center[x + 1] + below[x] + above[x] + behind[x] + front[x] - b[x]) *
+                        sixth;
+                }
+                const auto e = n - 1;
+                out[e] = (center[e - 1] + center[e] + below[e] + above[e] + behind[e] + front[e] - b[e]) * sixth;
+            });
+            std::swap(pressure, scratch);
+        };
+        const auto iterationStart = std::chrono::steady_clock::now();
+        const auto spent = elapsedMs(start);
+        int iterations = 0;
+        double perIteration = 0;
+        while (iterations < settings.max_iterations &&
+            (iterations < MIN_ITERATIONS || spent + perIteration * (iterations + 1) <= budgetMs))
+        {
+            jacobi();
+            iterations++;
+            perIteration = elapsedMs(iterationStart) / iterations;
+        }
+        _lastStats.iterations = iterations;
+
+        const auto inverse2H = 0.5f / h;
+        forEachRow([&](const int y, const int z)
+        {
+            const auto row = index(0, y, z);
+            const auto plane = static_cast<size_t>(n) * n;
+            const auto* p = pressure.data();
+            for (int x = 0; x < n; x++)
+            {
+                const auto i = row + x;
+                u[i] -= (p[x + 1 < n ? i + 1 : i] - p[x > 0 ? i - 1 : i]) * inverse2H;
+                v[i] -= (p[y + 1 < n ? i + n : i] - p[y > 0 ? i - n : i]) * inverse2H;
+                w[i] -= (p[z + 1 < n ? i + plane : i] - p[z > 0 ? i - plane : i]) * inverse2H;
+            }
+        });
+    }
+};
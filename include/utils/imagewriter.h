@@ -0,0 +1,131 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+Writers of RGBA8 images as read back from OpenGL, the first row of the pixels is the bottom one.
+PNG files use stored (uncompressed) deflate blocks: they are as large as the raw pixels but take no time to encode, any
+decoder reads them. Raw files are the top-down pixels only, e.g. for ffmpeg -f rawvideo -pix_fmt rgba -s WxH
+*/
+class ImageWriter
+{
+public:
+    static bool writePng(const std::string& path, const int width, const int height, const unsigned char* pixels)
+    {
+        const size_t rowBytes = static_cast<size_t>(width) * 4;
+        // scanlines top-down, each with filter type none
+        std::vector<unsigned char> filtered((rowBytes + 1) * height);
+        for (int y = 0; y < height; y++)
+        {
+            const auto row = filtered.data() + (rowBytes + 1) * y;
+            row[0] = 0;
+            std::memcpy(row + 1, pixels + rowBytes * (height - 1 - y), rowBytes);
+        }
+
+        // zlib stream: header, stored blocks of at most 65535 bytes, adler32 of the data
+        std::vector<unsigned char> zlib{0x78, 0x01};
+        zlib.reserve(filtered.size() + filtered.size() / MAX_STORED_BLOCK * 5 + 16);
+        for (size_t offset = 0; offset < filtered.size() || offset == 0; offset += MAX_STORED_BLOCK)
+        {
+            const auto length = static_cast<uint16_t>(std::min(MAX_STORED_BLOCK, filtered.size() - offset));
+            zlib.push_back(offset + length == filtered.size() ? 1 : 0);
+            zlib.push_back(length & 0xFF);
+            zlib.push_back(length >> 8);
+            zlib.push_back(~length & 0xFF);
+            zlib.push_back((~length >> 8) & 0xFF);
+            zlib.insert(zlib.end(), filtered.begin() + offset, filtered.begin() + offset + length);
+        }
+        appendBigEndian(zlib, adler32(filtered.data(), filtered.size()));
+
+        std::vector<unsigned char> header;
+        appendBigEndian(header, static_cast<uint32_t>(width));
+        appendBigEndian(header, static_cast<uint32_t>(height));
+        // 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+        header.insert(header.end(), {8, 6, 0, 0, 0});
+
+        std::ofstream file(path, std::ios::binary);
+        constexpr unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+        writeChunk(file, "IHDR", header);
+        writeChunk(file, "IDAT", zlib);
+        writeChunk(file, "IEND", {});
+        return static_cast<bool>(file);
+    }
+
+    static bool writeRaw(const std::string& path, const int width, const int height, const unsigned char* pixels)
+    {
+        const size_t rowBytes = static_cast<size_t>(width) * 4;
+        std::ofstream file(path, std::ios::binary);
+        for (int y = height - 1; y >= 0; y--)
+            file.write(reinterpret_cast<const char*>(pixels + rowBytes * y), static_cast<std::streamsize>(rowBytes));
+        return static_cast<bool>(file);
+    }
+
+private:
+    static constexpr size_t MAX_STORED_BLOCK = 65535;
+
+    static uint32_t adler32(const unsigned char* data, const size_t size)
+    {
+        // 5552 is the largest run of sums that cannot overflow before the modulo
+        constexpr size_t RUN = 5552;
+        uint32_t a = 1, b = 0;
+        for (size_t start = 0; start < size; start += RUN)
+        {
+            const auto end = std::min(size, start + RUN);
+            for (size_t i = start; i < end; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    static void appendBigEndian(std::vector<unsigned char>& out, const uint32_t value)
+    {
+        out.insert(out.end(), {
+                       static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+                       static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value)
+                   });
+    }
+
+    static void writeChunk(std::ofstream& file, const char (&type)[5], const std::vector<unsigned char>& data)
+    {
+        std::vector<unsigned char> length;
+        appendBigEndian(length, static_cast<uint32_t>(data.size()));
+        file.write(reinterpret_cast<const char*>(length.data()), 4);
+        file.write(type, 4);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        uint32_t crc = crc32Update(0xFFFFFFFFu, reinterpret_cast<const unsigned char*>(type), 4);
+        crc = crc32Update(crc, data.data(), data.size()) ^ 0xFFFFFFFFu;
+        std::vector<unsigned char> crcBytes;
+        appendBigEndian(crcBytes, crc);
+        file.write(reinterpret_cast<const char*>(crcBytes.data()), 4);
+    }
+
+    static uint32_t crc32Update(uint32_t crc, const unsigned char* data, const size_t size)
+    {
+        static const auto table = []
+        {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[n] = c;
+            }
+            return t;
+        }();
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+};
@@ -0,0 +1,171 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+Streaming JSON writer, the commas and the indentation follow the nesting. Inside an object every value is preceded by
+key(), inside an array it is not. Nothing is checked, an unbalanced begin/end writes invalid JSON
+*/
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::ostream& out): out(out)
+    {
+    }
+
+    JsonWriter& beginObject()
+    {
+        return open('{');
+    }
+
+    JsonWriter& endObject()
+    {
+        return close('}');
+    }
+
+    JsonWriter& beginArray()
+    {
+        return open('[');
+    }
+
+    JsonWriter& endArray()
+    {
+        return close(']');
+    }
+
+    JsonWriter& key(const std::string& name)
+    {
+        separate();
+        string(name);
+        out << ": ";
+        afterKey = true;
+        return *this;
+    }
+
+    JsonWriter& value(const std::string& text)
+    {
+        separate();
+        string(text);
+        return *this;
+    }
+
+    JsonWriter& value(const char* text)
+    {
+        return value(std::string(text));
+    }
+
+    JsonWriter& value(const bool b)
+    {
+        separate();
+        out << (b ? "true" : "false");
+        return *this;
+    }
+
+    // NaN and infinities are not JSON, they are written as null
+    JsonWriter& value(const double number)
+    {
+        separate();
+        if (!std::isfinite(number))
+        {
+            out << "null";
+            return *this;
+        }
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.6g", number);
+        out << buffer;
+        return *this;
+    }
+
+    template <typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+    JsonWriter& value(const Integer number)
+    {
+        separate();
+        out << number;
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& field(const std::string& name, const T& v)
+    {
+        return key(name).value(v);
+    }
+
+private:
+    std::ostream& out;
+    // elements written so far in every open object or array
+    std::vector<int> counts;
+    bool afterKey{false};
+
+    JsonWriter& open(const char bracket)
+    {
+        separate();
+        out << bracket;
+        counts.push_back(0);
+        return *this;
+    }
+
+    JsonWriter& close(const char bracket)
+    {
+        const bool empty = counts.back() == 0;
+        counts.pop_back();
+        if (!empty)
+            newLine();
+        out << bracket;
+        if (counts.empty())
+            out << '\n';
+        return *this;
+    }
+
+    // Comma and new line before an element, nothing before the value of a key
+    void separate()
+    {
+        if (afterKey)
+        {
+            afterKey = false;
+            return;
+        }
+        if (counts.empty())
+            return;
+        if (counts.back()++ > 0)
+            out << ',';
+        newLine();
+    }
+
+    void newLine()
+    {
+        out << '\n' << std::string(counts.size() * 2, ' ');
+    }
+
+    void string(const std::string& text)
+    {
+        out << '"';
+        for (const char c : text)
+        {
+            switch (c)
+            {
+            case '"': out << "\\\"";
+                break;
+            case '\\': out << "\\\\";
+                break;
+            case '\n': out << "\\n";
+                break;
+            case '\t': out << "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out << escaped;
+                }
+                else
+                    out << c;
+            }
+        }
+        out << '"';
+    }
+};
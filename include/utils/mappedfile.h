@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <utils/nocopy.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+// unistd.h is avoided on purpose, it declares names like pause() that clash with the application globals
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Read-only memory mapping of a whole file. data() is nullptr if the file could not be mapped
+class MappedFile : NoCopy
+{
+public:
+    explicit MappedFile(const std::string& path): NoCopy{}
+    {
+#ifdef _WIN32
+        const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            if (const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr))
+            {
+                _data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (_data)
+                    _size = static_cast<size_t>(size.QuadPart);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return;
+        const int fd = fileno(file);
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                _data = data;
+                _size = static_cast<size_t>(st.st_size);
+                // The whole file is going to be read right away
+                madvise(_data, _size, MADV_WILLNEED);
+            }
+        }
+        std::fclose(file);
+#endif
+    }
+
+    ~MappedFile()
+    {
+        if (!_data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+#else
+        munmap(_data, _size);
+#endif
+    }
+
+    [[nodiscard]] const unsigned char* data() const { return static_cast<const unsigned char*>(_data); }
+    [[nodiscard]] size_t size() const { return _size; }
+
+private:
+    void* _data{nullptr};
+    size_t _size{0};
+};
@@ -1,20 +1,170 @@
 #pragma once
-#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 
-//TODO: change this with a proper random library
+/*
+xoshiro128+ generator with LANES independent states laid out by lane. A batch step advances every lane with the same
+operations on adjacent words, which the compiler turns into SIMD instructions. The scalar draws are served from the last
+batch, so a sequence of scalar and batch calls gives the same numbers for the same seed on every run.
+Floats come from the upper 24 bits of the outputs, the lower bits of xoshiro128+ are the weak ones.
+*/
+class Random
+{
+public:
+    static constexpr int LANES = 8;
+
+    explicit Random(const uint64_t seed = 0)
+    {
+        this->seed(seed);
+    }
+
+    void seed(uint64_t seed)
+    {
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            s0[lane] = splitmix32(seed);
+            s1[lane] = splitmix32(seed);
+            s2[lane] = splitmix32(seed);
+            s3[lane] = splitmix32(seed);
+            // the all zero state never leaves zero
+            if ((s0[lane] | s1[lane] | s2[lane] | s3[lane]) == 0)
+                s0[lane] = 1;
+        }
+        buffered = LANES;
+    }
+
+    uint32_t next()
+    {
+        if (buffered == LANES)
+        {
+            step(batch);
+            buffered = 0;
+        }
+        return batch[buffered++];
+    }
+
+    // [0, 1)
+    float zeroOne()
+    {
+        return toUnit(next());
+    }
+
+    // [-1, 1)
+    float minusOneOne()
+    {
+        return zeroOne() * 2 - 1;
+    }
+
+    // count floats in [min, max), whole batches are written without going through the scalar path
+    void fill(float* out, const size_t count, const float min = 0, const float max = 1)
+    {
+        const auto range = max - min;
+        size_t i = 0;
+        for (; i + LANES <= count; i += LANES)
+        {
+            alignas(32) uint32_t bits[LANES];
+            step(bits);
+            for (int lane = 0; lane < LANES; lane++)
+                out[i + lane] = min + toUnit(bits[lane]) * range;
+        }
+        for (; i < count; i++)
+            out[i] = min + zeroOne() * range;
+    }
+
+private:
+    alignas(32) uint32_t s0[LANES]{}, s1[LANES]{}, s2[LANES]{}, s3[LANES]{};
+    alignas(32) uint32_t batch[LANES]{};
+    int buffered{LANES};
+
+    void step(uint32_t (&out)[LANES])
+    {
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            out[lane] = s0[lane] + s3[lane];
+            const uint32_t t = s1[lane] << 9;
+            s2[lane] ^= s0[lane];
+            s3[lane] ^= s1[lane];
+            s1[lane] ^= s2[lane];
+            s0[lane] ^= s3[lane];
+            s2[lane] ^= t;
+            s3[lane] = (s3[lane] << 11) | (s3[lane] >> 21);
+        }
+    }
+
+    static float toUnit(const uint32_t bits)
+    {
+        return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static uint32_t splitmix32(uint64_t& state)
+    {
+        uint64_t z = state += 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+    }
+};
 
-static void randInit()
+namespace detail
 {
-    std::srand(std::time(nullptr));
+    inline std::atomic<uint64_t> randSeed{0};
+    // bumped by randInit, the generators of the other threads are seeded again on their next use
+    inline std::atomic<uint32_t> randGeneration{0};
+    inline std::atomic<uint64_t> randThreads{0};
+
+    struct ThreadRandom
+    {
+        Random random;
+        uint32_t generation{~0u};
+        // 0 is the stream of the seed itself, taken by the thread calling randInit
+        uint64_t ordinal{randThreads.fetch_add(1) + 1};
+    };
+
+    inline ThreadRandom& threadRandomState()
+    {
+        thread_local ThreadRandom state;
+        return state;
+    }
+}
+
+// Generator of the calling thread. The thread that called randInit draws the stream of the seed, the others a stream
+// derived from the seed and from the order in which they first drew a number
+inline Random& threadRandom()
+{
+    auto& state = detail::threadRandomState();
+    if (const auto current = detail::randGeneration.load(std::memory_order_acquire); state.generation != current)
+    {
+        state.random.seed(detail::randSeed.load(std::memory_order_relaxed) + state.ordinal * 0x9E3779B97F4A7C15ull);
+        state.generation = current;
+    }
+    return state.random;
 }
 
-static GLfloat randZeroOne()
+// Seeds the generators of every thread, returns the seed
+inline uint64_t randInit(const uint64_t seed)
 {
-    return static_cast<GLfloat>(std::rand()) / static_cast<GLfloat>(RAND_MAX);
+    detail::randSeed.store(seed, std::memory_order_relaxed);
+    const auto generation = detail::randGeneration.fetch_add(1, std::memory_order_release) + 1;
+    auto& state = detail::threadRandomState();
+    state.random.seed(seed);
+    state.generation = generation;
+    return seed;
 }
 
-static GLfloat randMinusOneOne()
+// Seed from the clock, a different sequence every run
+inline uint64_t randInit()
 {
-    return randZeroOne() * 2 - 1;
+    return randInit(static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count()));
 }
 
+inline float randZeroOne()
+{
+    return threadRandom().zeroOne();
+}
+
+inline float randMinusOneOne()
+{
+    return threadRandom().minusOneOne();
+}
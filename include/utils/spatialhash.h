@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/threadpool.h>
+
+/*
+Points bucketed by the cell of a uniform grid they fall in, for neighbor queries within cellSize. Cells are hashed to
+a table of a power of two buckets, twice the points and at most maxBuckets, so the memory does not depend on how far
+apart the points are: 8 bytes per bucket and 20 per point. Cells that share a bucket only cost distance checks.
+A query reads nine runs of three consecutive buckets, see hash.
+The points are copied in bucket order, a query reads them from a few contiguous runs, and walking the points in order()
+keeps the buckets of consecutive queries in cache.
+build is a counting sort of the bucket keys in three parallel passes over the points and the buckets, linear in both:
+1. keys of the points and the number of points per bucket (atomic increments)
+2. prefix sum of the counts: the start of every bucket, ranges of buckets are summed in parallel and then offset
+3. every point and its index are written at the next free slot of its bucket (atomic increments), the order within a
+   bucket is the order in which the threads got there
+*/
+class SpatialHash
+{
+public:
+    explicit SpatialHash(const float cellSize = 1, const size_t maxBuckets = size_t{1} << 22):
+        _cellSize{cellSize}, maxBuckets{maxBuckets}
+    {
+    }
+
+    void cellSize(const float size)
+    {
+        _cellSize = size;
+    }
+
+    [[nodiscard]] float cellSize() const
+    {
+        return _cellSize;
+    }
+
+    void build(const glm::vec3* points, const size_t count, ThreadPool& pool)
+    {
+        size_t buckets = 1024;
+        while (buckets < count * 2 && buckets < maxBuckets)
+            buckets *= 2;
+        if (buckets != bucketCount)
+        {
+            bucketCount = buckets;
+            cursors.reset(new std::atomic<uint32_t>[bucketCount]);
+            starts.resize(bucketCount + 1);
+        }
+        keys.resize(count);
+        entries.resize(count);
+        sorted.resize(count);
+        const auto inverse = 1 / _cellSize;
+        const auto mask = static_cast<uint32_t>(bucketCount - 1);
+        pool.parallelFor(bucketCount, GRAIN * 16, [&](const size_t begin, const size_t end)
+        {
+            for (size_t b = begin; b < end; b++)
+                cursors[b].store(0, std::memory_order_relaxed);
+        });
+
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const auto key = hash(cellOf(points[i], inverse)) & mask;
+                keys[i] = key;
+                cursors[key].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        // exclusive prefix sum, the sums of the ranges first and then each range from its offset
+        const size_t ranges = std::min<size_t>(pool.size() + 1, bucketCount / (GRAIN * 16) + 1);
+        const size_t rangeSize = (bucketCount + ranges - 1) / ranges;
+        std::vector<uint32_t> offsets(ranges + 1, 0);
+        pool.parallelFor(ranges, 1, [&](const size_t begin, const size_t end)
+        {
+            for (size_t r = begin; r < end; r++)
+            {
+                uint32_t sum = 0;
+                for (size_t b = r * rangeSize; b < std::min(bucketCount, (r + 1) * rangeSize); b++)
+                    sum += cursors[b].load(std::memory_order_relaxed);
+                offsets[r + 1] = sum;
+            }
+        });
+        for (size_t r = 0; r < ranges; r++)
+            offsets[r + 1] += offsets[r];
+        pool.parallelFor(ranges, 1, [&](const size_t begin, const size_t end)
+        {
+            for (size_t r = begin; r < end; r++)
+            {
+                uint32_t offset = offsets[r];
+                for (size_t b = r * rangeSize; b < std::min(bucketCount, (r + 1) * rangeSize); b++)
+                {
+                    starts[b] = offset;
+                    offset += cursors[b].exchange(offset, std::memory_order_relaxed);
+                }
+            }
+        });
+        starts[bucketCount] = static_cast<uint32_t>(count);
+
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const auto slot = cursors[keys[i]].fetch_add(1, std::memory_order_relaxed);
+                entries[slot] = static_cast<uint32_t>(i);
+                sorted[slot] = points[i];
+            }
+        });
+    }
+
+    // Calls f(index, point) for every point in the cells around p: the ones within cellSize of it and some more
+    template <typename F>
+    void forEachNear(const glm::vec3& p, F&& f) const
+    {
+        if (bucketCount == 0)
+            return;
+        const auto cell = cellOf(p, 1 / _cellSize);
+        const auto mask = static_cast<uint32_t>(bucketCount - 1);
+        // first bucket of the rows visited so far
+        uint32_t rows[9];
+        int rowCount = 0;
+        for (int dz = -1; dz <= 1; dz++)
+        {
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                const auto first = hash(cell + glm::ivec3{-1, dy, dz}) & mask;
+                const auto visited = [&](const uint32_t key)
+                {
+                    for (int r = 0; r < rowCount; r++)
+                    {
+                        if (((key - rows[r]) & mask) < 3)
+                            return true;
+                    }
+                    return false;
+                };
+                // rows hashed next to each other share buckets, or the row wraps around the table: bucket by bucket,
+                // the shared buckets visited once
+                if (visited(first) || visited((first + 2) & mask) || first + 3 > bucketCount)
+                {
+                    for (uint32_t dx = 0; dx < 3; dx++)
+                    {
+                        const auto key = (first + dx) & mask;
+                        if (visited(key))
+                            continue;
+                        for (auto e = starts[key]; e < starts[key + 1]; e++)
+                            f(entries[e], sorted[e]);
+                    }
+                }
+                else
+                {
+                    for (auto e = starts[first]; e < starts[first + 3]; e++)
+                        f(entries[e], sorted[e]);
+                }
+                rows[rowCount++] = first;
+            }
+        }
+    }
+
+    // Indices of the points of the last build, bucket by bucket
+    [[nodiscard]] const std::vector<uint32_t>& order() const
+    {
+        return entries;
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return bucketCount * sizeof(std::atomic<uint32_t>) + starts.capacity() * sizeof(uint32_t) +
+            (keys.capacity() + entries.capacity()) * sizeof(uint32_t) + sorted.capacity() * sizeof(glm::vec3);
+    }
+
+private:
+    static constexpr size_t GRAIN = 4096;
+
+    float _cellSize;
+    size_t maxBuckets;
+    size_t bucketCount{0};
+    // points per bucket, then the next free slot of every bucket while the points are written
+    std::unique_ptr<std::atomic<uint32_t>[]> cursors;
+    // the points of bucket b are entries[starts[b]] to entries[starts[b + 1]]
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> keys;
+    // point indices sorted by bucket, and the points in the same order
+    std::vector<uint32_t> entries;
+    std::vector<glm::vec3> sorted;
+
+    static glm::ivec3 cellOf(const glm::vec3& p, const float inverseCellSize)
+    {
+        return glm::ivec3{
+            static_cast<int>(std::floor(p.x * inverseCellSize)), static_cast<int>(std::floor(p.y * inverseCellSize)),
+            static_cast<int>(std::floor(p.z * inverseCellSize))
+        };
+    }
+
+    // The rows of cells along x are hashed and the cells of a row are consecutive buckets: the three cells of a query
+    // along x are three consecutive buckets, points next to each other along x are next to each other in order()
+    static uint32_t hash(const glm::ivec3& cell)
+    {
+        return (static_cast<uint32_t>(cell.y) * 19349663u ^ static_cast<uint32_t>(cell.z) * 83492791u) +
+            static_cast<uint32_t>(cell.x);
+    }
+};
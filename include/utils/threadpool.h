@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utils/nocopy.h>
+
+// Fixed size pool of worker threads consuming a FIFO queue of jobs
+class ThreadPool : NoCopy
+{
+public:
+    explicit ThreadPool(const unsigned int threads = defaultThreadCount()): NoCopy{}
+    {
+        for (unsigned int i = 0; i < std::max(threads, 1u); i++)
+        {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    // The pool the subsystems (loader, bakes, collisions, air, capture writers) receive by default, created on first
+    // use. A pool each would start more threads than there are cores
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ~ThreadPool()
+    {
+        shutdown();
+    }
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (stopping)
+                return;
+            jobs.emplace_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    // Blocks until the queue is empty and no job is running
+    void waitIdle()
+    {
+        std::unique_lock lock(mutex);
+        idle.wait(lock, [this] { return jobs.empty() && runningJobs == 0; });
+    }
+
+    // Drops the jobs that have not started yet and joins the workers
+    void shutdown()
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (stopping)
+                return;
+            stopping = true;
+            jobs.clear();
+        }
+        jobAvailable.notify_all();
+        for (auto& w : workers)
+        {
+            if (w.joinable())
+                w.join();
+        }
+    }
+
+    [[nodiscard]] unsigned int size() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    // Runs body(begin, end) over [0, count) split in ranges of at least grain items, on the workers and on the calling
+    // thread, and returns once every range is done. Jobs already queued are not waited for, but they delay the workers.
+    // Can be called from a job of the same pool: the calling thread takes every range no worker has started, it only
+    // waits for the ones that are running
+    void parallelFor(const size_t count, const size_t grain, const std::function<void(size_t, size_t)>& body)
+    {
+        if (count == 0)
+            return;
+        const auto ranges = std::max<size_t>(1, std::min<size_t>((count + grain - 1) / std::max<size_t>(grain, 1),
+                                                                 (size() + 1) * 4));
+        const auto rangeSize = (count + ranges - 1) / ranges;
+        if (ranges == 1)
+        {
+            body(0, count);
+            return;
+        }
+        // a worker can start after the last range is done, it finds nothing left but still needs the counters
+        struct Progress
+        {
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> done{0};
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        const auto progress = std::make_shared<Progress>();
+        const auto work = [progress, ranges, rangeSize, count, &body]
+        {
+            for (size_t r = progress->next++; r < ranges; r = progress->next++)
+            {
+                body(std::min(count, r * rangeSize), std::min(count, (r + 1) * rangeSize));
+                if (++progress->done == ranges)
+                {
+                    std::lock_guard lock(progress->mutex);
+                    progress->finished.notify_all();
+                }
+            }
+        };
+        for (size_t i = 0; i < std::min<size_t>(size(), ranges - 1); i++)
+            submit(work);
+        work();
+        std::unique_lock lock(progress->mutex);
+        progress->finished.wait(lock, [&] { return progress->done == ranges; });
+    }
+
+    static unsigned int defaultThreadCount()
+    {
+        // Leave one core to the render thread
+        const auto hw = std::thread::hardware_concurrency();
+        return hw > 1 ? hw - 1 : 1;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable idle;
+    unsigned int runningJobs{0};
+    bool stopping{false};
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(mutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    break;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                runningJobs++;
+            }
+            job();
+            {
+                std::lock_guard lock(mutex);
+                runningJobs--;
+                if (jobs.empty() && runningJobs == 0)
+                    idle.notify_all();
+            }
+        }
+        std::lock_guard lock(mutex);
+        idle.notify_all();
+    }
+};
+
+// Jobs of one owner on a pool shared with others. wait() returns once the jobs submitted so far are done, the destructor
+// drops the ones that have not started and waits for the running ones, so the jobs can use the members of the owner
+class JobGroup : NoCopy
+{
+public:
+    explicit JobGroup(ThreadPool& pool = ThreadPool::shared()): NoCopy{}, pool{pool}
+    {
+    }
+
+    ~JobGroup()
+    {
+        cancel();
+        wait();
+    }
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard lock(state->mutex);
+            state->pending++;
+        }
+        // destroyed once the job ran or was dropped by the pool
+        auto ticket = std::make_shared<Ticket>(state);
+        pool.submit([ticket = std::move(ticket), job = std::move(job)]
+        {
+            if (!ticket->state->cancelled)
+                job();
+        });
+    }
+
+    // Blocks until the jobs submitted so far are done. Not from one of the jobs
+    void wait()
+    {
+        std::unique_lock lock(state->mutex);
+        state->finished.wait(lock, [this] { return state->pending == 0; });
+    }
+
+    // The jobs that have not started yet are skipped
+    void cancel()
+    {
+        state->cancelled = true;
+    }
+
+    [[nodiscard]] unsigned int threads() const
+    {
+        return pool.size();
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t pending{0};
+        std::atomic<bool> cancelled{false};
+    };
+
+    struct Ticket : NoCopy
+    {
+        std::shared_ptr<State> state;
+
+        explicit Ticket(std::shared_ptr<State> state): NoCopy{}, state{std::move(state)}
+        {
+        }
+
+        ~Ticket()
+        {
+            {
+                std::lock_guard lock(state->mutex);
+                state->pending--;
+            }
+            state->finished.notify_all();
+        }
+    };
+
+    ThreadPool& pool;
+    std::shared_ptr<State> state{std::make_shared<State>()};
+};
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <iostream>
 
 // Loader for OpenGL extensions
@@ -24,6 +27,8 @@
 
 #include "renderer.h"
 #include "scene.h"
+#include "framecapture.h"
+#include "scenario.h"
 #include <utils/random_utils.h>
 #include "camera.h"
 #include "input.h"
@@ -31,6 +36,7 @@
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <chrono>
 #include <filesystem>
 
 #include "imGuIZMOquat.h"
@@ -43,6 +49,9 @@ static string selected_noise_texture = "./assets/textures/Voronoi 7 - 512x512.pn
 static std::vector<string> texture_files{};
 
 static float dt_multiplier = 1;
+// the simulation runs at a fixed rate whatever the frame rate, see FixedStep
+static float simulation_rate = 60;
+static int max_substeps = 8;
 static bool show_debug_buffer = false;
 static bool draw_particles = true;
 static vec3 particles_spawn_direction{0.775614f, 0.441849f, -0.450769f};
@@ -50,18 +59,76 @@ static vec3 particles_spawn_randomness{0.15, 0.15, 0.15};
 static float particles_spawn_speed = 3.5;
 static float particle_spawn_life = 5;
 static float particle_added_spawn_life_randomness = 0.8;
+// curl-noise turbulence, the field is baked the first time the strength is not 0
+static float turbulence_strength = 0;
+static float turbulence_frequency = 0.05f;
+static CurlNoiseField turbulence_field;
+// air pushed around by the objects, off while the coupling is 0
+static float air_coupling = 0;
+static int air_resolution = 32;
+static float air_budget_ms = 1;
+static float air_dissipation = 0.5f;
+// colliders of the particles, the sphere follows the object
+static bool collision_floor = false;
+static float collision_floor_height = -1;
+static bool collision_sphere = false;
+static float collision_sphere_radius = 1;
+static float collision_particle_radius = 0;
+static float collision_restitution = 0.3f;
+static float collision_friction = 0.2f;
+// the model is imported with a signed distance field of this resolution, the particles bounce off it
+static bool collision_object = false;
+static constexpr int COLLISION_SDF_RESOLUTION = 64;
+// the particles bounce off the objects as they are drawn, through a small depth buffer read back every frame
+static bool collision_depth = false;
+static float collision_depth_thickness = 0.5f;
 static int particle_number = 100000;
 static quat disappearing_object_rotation = toQuat(mat4{1});
 static float disappearing_object_scale = 2.f;
 static vec3 disappearing_object_position{1.f};
+static int object_count = 1;
 static int particles_framebuffer_width_height[2] = {800, 600};
 static float particle_size = 0.1f;
 static bool particle_size_auto_scaling = true;
+static bool debug_diagnostics = false;
+static bool scene_loading = false;
+// a menu option of the scene changed, applied in place by Scene::reconfigure
+static bool reconfigure_scene = false;
+
+// Offline rendering, set from the command line (see parse_arguments)
+struct CaptureSettings
+{
+    // 0 runs interactively
+    int frames{0};
+    float fps{60};
+    // 0 is the window size
+    int width{0}, height{0};
+    CaptureFormat format{CaptureFormat::Png};
+    string directory{"./capture"};
+    // hidden window, nothing is shown
+    bool headless{false};
+};
+
+static CaptureSettings capture_settings;
+// --scenario, runs the file headless and writes the timings, see scenario.h
+static string scenario_path;
+static string scenario_output;
 
 void menu_window(GLFWwindow* window, ImGuiIO& io);
+static bool parse_arguments(int argc, char* argv[], int& w, int& h);
+static void reconfigure(Scene& scene, const Renderer& r);
+static void apply_scene_settings(Scene& scene);
+static int run_capture(Renderer& r, Scene& scene, FrameCapture& frame_capture);
+static int run_scenario(Renderer& r, Camera& camera, const Scenario& scenario);
+
+static double ms_since(const std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
 int main(int argc, char* argv[])
 {
+    const auto startup_begin = std::chrono::steady_clock::now();
     particles_spawn_direction = normalize(particles_spawn_direction);
     for (const auto& entry : std::filesystem::directory_iterator("./assets/models"))
     {
@@ -71,21 +138,59 @@ int main(int argc, char* argv[])
     {
         texture_files.push_back(entry.path().string());
     }
-    randInit();
+    // RTGP_DIAGNOSTICS=debug starts with per-draw program validation and synchronous GL debug output
+    if (const char* diagnostics = std::getenv("RTGP_DIAGNOSTICS"); diagnostics && string(diagnostics) == "debug")
+    {
+        debug_diagnostics = true;
+        Diagnostics::get().level(DiagnosticsLevel::Debug);
+    }
     Camera camera{};
     int w = 1920;
     int h = 1080;
-    if (argc >= 3)
+    if (!parse_arguments(argc, argv, w, h))
+    {
+        return 1;
+    }
+    Scenario scenario;
+    if (!scenario_path.empty())
+    {
+        if (!Scenario::load(scenario_path, scenario))
+            return 1;
+        if (!scenario_output.empty())
+            scenario.output = scenario_output;
+    }
+    // RTGP_SEED=<n> replays the same particles on every run, a scenario is seeded by its own file (run_scenario)
+    else if (const char* seed = std::getenv("RTGP_SEED"))
     {
-        w = std::stoi(argv[1]);
-        h = std::stoi(argv[2]);
+        uint64_t value = 0;
+        const auto end = seed + std::strlen(seed);
+        if (const auto [last, error] = std::from_chars(seed, end, value); error != std::errc{} || last != end)
+        {
+            std::cout << "RTGP_SEED must be an unsigned integer, not \"" << seed << "\"" << std::endl;
+            return 1;
+        }
+        std::cout << "random seed: " << randInit(value) << std::endl;
     }
+    else
+        std::cout << "random seed: " << randInit() << std::endl;
     Renderer r(camera, w, h);
-    auto init_res = r.init();
+    auto init_res = r.init(capture_settings.headless || !scenario_path.empty());
     if (init_res != 0)
     {
         return init_res;
     }
+    if (!scenario_path.empty())
+        return run_scenario(r, camera, scenario);
+    // In capture mode the frames are rendered off-screen at the capture size, the window only shows them
+    std::unique_ptr<FrameCapture> frame_capture;
+    if (capture_settings.frames > 0)
+    {
+        frame_capture = std::make_unique<FrameCapture>(capture_settings.width ? capture_settings.width : w,
+                                                       capture_settings.height ? capture_settings.height : h,
+                                                       capture_settings.format, capture_settings.directory);
+        r.setRenderTarget(&frame_capture->target());
+    }
+    const auto gl_init_ms = ms_since(startup_begin);
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -103,55 +208,47 @@ int main(int argc, char* argv[])
     r.setKeyCallback(key_callback);
     r.setCursorPosCallback(mouse_callback);
 
+    // Every texture that can be selected is loaded in the texture library, switching them needs no GL allocations
+    r.requestLibraryTextures(texture_files);
     int frames = 0;
     float cumulative_dt = 0;
     auto scene = Scene(r, selected_model, selected_texture, selected_noise_texture, particle_number,
                        particles_framebuffer_width_height[0], particles_framebuffer_width_height[1]);
     scene.init(draw_particles, particle_size);
 
+    if (frame_capture)
+    {
+        const auto result = run_capture(r, scene, *frame_capture);
+        frame_capture.reset();
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+        return result;
+    }
+
     // Main loop
     while (!r.shouldClose())
     {
+        if (reconfigure_scene || reset_scene)
+        {
+            reconfigure(scene, r);
+        }
         if (reset_scene)
         {
             std::cout << "resetting scene with model: " << selected_model << " texture: " << selected_texture <<
                 std::endl;
-            scene.~Scene();
-            if (particle_size_auto_scaling)
-            {
-                const auto ratio = static_cast<float>(particles_framebuffer_width_height[0] *
-                    particles_framebuffer_width_height[1]) / static_cast<float>(w * h);
-                particle_size = (1 / (ratio + 0.08f)) * 0.03f;
-            }
-            new(&scene) Scene(r, selected_model, selected_texture, selected_noise_texture, particle_number,
-                              particles_framebuffer_width_height[0], particles_framebuffer_width_height[1]);
-            scene.init(draw_particles, particle_size);
+            scene.reset();
             reset_scene = false;
         }
         // Set values from menu
         camera.sensitivity = mouse_sensitivity;
-        scene.show_debug_buffer = show_debug_buffer;
-        scene.particles_update_func = [](Particles::Particle& p, const float dt)
-        {
-            p.pos(p.pos() + p.velocity() * dt);
-        };
-        scene.start_velocity_func = []
+        apply_scene_settings(scene);
+        scene_loading = scene.loading();
+        if (const auto level = debug_diagnostics ? DiagnosticsLevel::Debug : DiagnosticsLevel::Release;
+            level != Diagnostics::get().level())
         {
-            const auto random_dir = vec3{randMinusOneOne(), randMinusOneOne(), randMinusOneOne()};
-            const auto direction = vec3{
-                lerp(particles_spawn_direction[0], random_dir[0], particles_spawn_randomness[0]),
-                lerp(particles_spawn_direction[1], random_dir[1], particles_spawn_randomness[1]),
-                lerp(particles_spawn_direction[2], random_dir[2], particles_spawn_randomness[2]),
-            };
-            return normalize(direction) * particles_spawn_speed;
-        };
-        scene.start_life_func = []
-        {
-            return particle_spawn_life + randZeroOne() * particle_spawn_life * particle_added_spawn_life_randomness;
-        };
-        scene.disappearing_object_rotation = disappearing_object_rotation;
-        scene.disappearing_object_scale = disappearing_object_scale;
-        scene.disappearing_object_position = disappearing_object_position;
+            r.setDiagnosticsLevel(level);
+        }
 
         glfwPollEvents();
         keypresses_handling();
@@ -190,6 +287,42 @@ int main(int argc, char* argv[])
             std::cout << "dt: " << dt * 1000 << "ms" << std::endl;
             std::cout << "FPS: " << 1 / dt << std::endl;
             std::cout << "num of active particles: " << scene.particles.livingParticles << std::endl;
+            const auto& gl_stats = GLState::get().lastFrameStats();
+            std::cout << "GL state changes: " << gl_stats.issued << " issued, " << gl_stats.elided << " elided" <<
+                std::endl;
+            size_t cpu_bytes = 0, gpu_bytes = 0;
+            const auto resources = r.resourceMemory();
+            for (const auto& resource : resources)
+            {
+                cpu_bytes += resource.cpuBytes;
+                gpu_bytes += resource.gpuBytes;
+            }
+            std::cout << "resources: " << resources.size() << " loaded, " << cpu_bytes / 1024 << "KB CPU, " <<
+                gpu_bytes / 1024 << "KB GPU" << std::endl;
+            const auto& library = r.textureLibrary();
+            std::cout << "texture library: " << library.size() << " textures in " << library.arrayCount() <<
+                " arrays, " << library.gpuBytes() / 1024 << "KB GPU" << std::endl;
+            if (const auto& instances = scene.disappearingObject().instances(); instances.size() > 1)
+            {
+                const auto dissolved = std::count_if(instances.begin(), instances.end(),
+                                                     [](const auto& instance) { return instance.threshold >= 1; });
+                std::cout << "objects: " << instances.size() << ", " << dissolved << " dissolved" << std::endl;
+            }
+            if (const auto dropped = scene.fixed_step.droppedSeconds(); dropped > 0)
+                std::cout << "simulation: " << dropped << "s dropped over the substep limit" << std::endl;
+            if (const auto& collisions = scene.collisions.lastStats(); collisions.ms > 0)
+                std::cout << "collisions: " << collisions.contacts << " contacts, " << collisions.separated <<
+                    " separated in " << collisions.ms << "ms, " << scene.collisions.byteSize() / 1024 << "KB" <<
+                    std::endl;
+            if (const auto& air = scene.air.lastStats(); air.ms > 0)
+                std::cout << "air: " << scene.air.resolution() << "^3 grid, " << air.iterations <<
+                    " pressure iterations in " << air.ms << "ms, " << scene.air.byteSize() / 1024 << "KB" << std::endl;
+            if (const auto* depth = scene.depthCollider(); depth && scene.depth_collisions)
+                std::cout << "depth collider: " << depth->depth().width << "x" << depth->depth().height << ", " <<
+                    depth->byteSize() / 1024 << "KB" << std::endl;
+            if (const auto& reconfigure = scene.lastReconfigure(); reconfigure.count > 0)
+                std::cout << "scene reconfigurations: " << reconfigure.count << ", last " << reconfigure.ms << "ms" <<
+                    std::endl;
         }
         if (!pause)
         {
@@ -199,6 +332,25 @@ int main(int argc, char* argv[])
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         r.swapBuffers();
+
+        if (frames == 1)
+        {
+            const auto& programs = ProgramBinaryCache::get().stats();
+            std::cout << "startup: window and GL context " << gl_init_ms << "ms" << std::endl;
+            std::cout << "startup: shader programs " << programs.seconds * 1000 << "ms (" << programs.compiled <<
+                " compiled, " << programs.loaded << " from binary cache, " << programs.rejected << " rejected)" <<
+                std::endl;
+            std::cout << "startup: first frame " << ms_since(startup_begin) << "ms" << std::endl;
+        }
+        if (static bool resources_reported = false; !resources_reported && !scene_loading)
+        {
+            std::cout << "startup: resources loaded " << ms_since(startup_begin) << "ms" << std::endl;
+            resources_reported = true;
+        }
+    }
+    if (Diagnostics::get().totalMessages() > 0)
+    {
+        Diagnostics::get().dump(std::cout);
     }
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -206,6 +358,270 @@ int main(int argc, char* argv[])
     return 0;
 }
 
+// Applies the scene options of the menu that need a reconfiguration
+static void reconfigure(Scene& scene, const Renderer& r)
+{
+    if (particle_size_auto_scaling)
+    {
+        const auto ratio = static_cast<float>(particles_framebuffer_width_height[0] *
+            particles_framebuffer_width_height[1]) / static_cast<float>(r.screenWidth() * r.screenHeight());
+        particle_size = (1 / (ratio + 0.08f)) * 0.03f;
+    }
+    SceneConfig config = scene.configuration();
+    config.model = selected_model;
+    config.texture = selected_texture;
+    config.noise_texture = selected_noise_texture;
+    config.particle_number = particle_number;
+    config.particles_framebuffer_width = particles_framebuffer_width_height[0];
+    config.particles_framebuffer_height = particles_framebuffer_width_height[1];
+    config.draw_particles = draw_particles;
+    config.particle_size = particle_size;
+    config.object_count = object_count;
+    config.model_options.sdfResolution = collision_object ? COLLISION_SDF_RESOLUTION : 0;
+    scene.reconfigure(config);
+    if (const auto& stats = scene.lastReconfigure(); !stats.changed.empty())
+        std::cout << "scene reconfigured (" << stats.changed << ") in " << stats.ms << "ms" << std::endl;
+    reconfigure_scene = false;
+}
+
+// Applies the scene options of the menu read every frame
+static void apply_scene_settings(Scene& scene)
+{
+    if (turbulence_strength != 0 && turbulence_field.resolution() == 0)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        turbulence_field = CurlNoiseField::bake(CurlNoiseSettings{});
+        std::cout << "curl noise: " << turbulence_field.resolution() << "^3 field baked in " << ms_since(start) << "ms, "
+            << turbulence_field.byteSize() / 1024 << "KB" << std::endl;
+    }
+    scene.turbulence = Turbulence{&turbulence_field, turbulence_frequency, turbulence_strength};
+    scene.air.settings.coupling = air_coupling;
+    scene.air.settings.resolution = air_resolution;
+    scene.air.settings.budget_ms = air_budget_ms;
+    scene.air.settings.dissipation = air_dissipation;
+    auto& collisions = scene.collisions.settings;
+    collisions.planes.clear();
+    if (collision_floor)
+        collisions.planes.push_back(CollisionPlane{vec3{0, 1, 0}, collision_floor_height});
+    collisions.spheres.clear();
+    if (collision_sphere)
+        collisions.spheres.push_back(CollisionSphere{disappearing_object_position, collision_sphere_radius});
+    collisions.particle_radius = collision_particle_radius;
+    collisions.restitution = collision_restitution;
+    collisions.friction = collision_friction;
+    collisions.screen_thickness = collision_depth_thickness;
+    scene.depth_collisions = collision_depth;
+    scene.show_debug_buffer = show_debug_buffer;
+    scene.particles_update_func = [](Particles::Particle& p, const float dt)
+    {
+        p.pos(p.pos() + p.velocity() * dt);
+    };
+    scene.spawn_distribution = SpawnDistribution{
+        particles_spawn_direction, particles_spawn_randomness, particles_spawn_speed, particle_spawn_life,
+        particle_added_spawn_life_randomness
+    };
+    scene.disappearing_object_rotation = disappearing_object_rotation;
+    scene.disappearing_object_scale = disappearing_object_scale;
+    scene.disappearing_object_position = disappearing_object_position;
+    scene.fixed_step.step = 1 / simulation_rate;
+    scene.fixed_step.maxSubsteps = max_substeps;
+}
+
+// Renders capture_settings.frames frames with a fixed timestep of 1 / fps, once every resource is loaded, and writes
+// them. The window, unless headless, shows a scaled copy of each frame
+static int run_capture(Renderer& r, Scene& scene, FrameCapture& frame_capture)
+{
+    reconfigure(scene, r);
+    apply_scene_settings(scene);
+    r.waitForResources();
+    if (scene.loading())
+        std::cout << "capture: some resources failed to load" << std::endl;
+
+    const auto& target = frame_capture.target();
+    std::cout << "capture: " << capture_settings.frames << " frames " << target.width() << "x" << target.height() <<
+        " at " << capture_settings.fps << " fps to " << frame_capture.outputDirectory() << std::endl;
+    const float dt = 1 / capture_settings.fps;
+    int window_w, window_h;
+    glfwGetFramebufferSize(r.getGlfwWindow(), &window_w, &window_h);
+    for (int frame = 0; frame < capture_settings.frames && !r.shouldClose(); frame++)
+    {
+        scene.mainLoop(dt * dt_multiplier);
+        r.render();
+        frame_capture.capture();
+        if (!capture_settings.headless)
+        {
+            target.blitToWindow(window_w, window_h);
+            r.swapBuffers();
+            glfwPollEvents();
+        }
+    }
+    frame_capture.finish();
+
+    const auto& stats = frame_capture.stats();
+    std::cout << "capture: " << stats.frames << " frames in " << stats.seconds << "s, " << stats.fps() <<
+        " frames/s, " << stats.bytes / (1024 * 1024) << "MB read back" << std::endl;
+    std::cout << "capture: render thread waited " << stats.readbackWaitMs << "ms for readbacks, " <<
+        stats.writerWaitMs << "ms for the writers" << std::endl;
+    if (capture_settings.format == CaptureFormat::Raw)
+        std::cout << "capture: raw frames are RGBA8, e.g. ffmpeg -f rawvideo -pix_fmt rgba -s " << target.width() <<
+            "x" << target.height() << " -r " << capture_settings.fps << " -i <frame>" << std::endl;
+    if (Diagnostics::get().totalMessages() > 0)
+    {
+        Diagnostics::get().dump(std::cout);
+    }
+    return 0;
+}
+
+// Renders the scenario in an off-screen target of its size, without UI, once every resource is loaded. The warmup
+// frames are left out, then every frame is timed as a whole and per pipeline step and the timings are written as JSON
+static int run_scenario(Renderer& r, Camera& camera, const Scenario& scenario)
+{
+    std::cout << "random seed: " << randInit(scenario.seed) << std::endl;
+    const FrameBuffer target(scenario.width, scenario.height);
+    r.setRenderTarget(&target);
+    r.setProjectionMatrix(perspective(45.0f, static_cast<float>(r.screenWidth()) / static_cast<float>(r.screenHeight()),
+                                      0.1f, 10000.0f));
+    camera.setTransform(inverse(lookAt(scenario.camera_position, scenario.camera_target, vec3(0.0f, 1.0f, 0.0f))));
+
+    auto scene = Scene(r, scenario.scene);
+    scene.init(scenario.scene.draw_particles, scenario.scene.particle_size);
+    scene.particles_update_func = [](Particles::Particle& p, const float dt)
+    {
+        p.pos(p.pos() + p.velocity() * dt);
+    };
+    scene.spawn_distribution = scenario.spawn;
+    scene.disappearing_object_rotation = scenario.objectRotation();
+    scene.disappearing_object_scale = scenario.object_scale;
+    scene.disappearing_object_position = scenario.object_position;
+    scene.fixed_step = FixedStep(1 / scenario.simulation_rate, scenario.max_substeps);
+    if (scenario.turbulence_strength != 0)
+    {
+        turbulence_field = CurlNoiseField::bake(CurlNoiseSettings{});
+        scene.turbulence = Turbulence{&turbulence_field, scenario.turbulence_frequency, scenario.turbulence_strength};
+    }
+    scene.air.settings = scenario.air;
+    scene.collisions.settings = scenario.collisions;
+    scene.depth_collisions = scenario.collision_depth;
+    r.waitForResources();
+    if (scene.loading())
+        std::cout << "scenario: some resources failed to load" << std::endl;
+
+    std::cout << "scenario: " << scenario.path << ", " << scenario.warmup_frames << " warmup and " << scenario.frames <<
+        " measured frames " << target.width() << "x" << target.height() << std::endl;
+    StageTimer timer;
+    ScenarioReport report;
+    const float dt = 1 / scenario.fps;
+    const auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < scenario.warmup_frames + scenario.frames; frame++)
+    {
+        const bool measured = frame >= scenario.warmup_frames;
+        if (frame == scenario.warmup_frames)
+            r.setStageTimer(&timer);
+        const auto frame_start = std::chrono::steady_clock::now();
+        scene.mainLoop(dt);
+        const auto update_ms = ms_since(frame_start);
+        r.render();
+        // the frame time includes the GPU work, nothing is left running into the next frame
+        glFinish();
+        if (measured)
+            report.add({
+                ms_since(frame_start), update_ms, scene.fixed_step.lastSteps(), scene.lastSpawn(),
+                scene.particles.getLivingParticles()
+            });
+    }
+    r.setStageTimer(nullptr);
+    timer.finish();
+    const auto seconds = ms_since(start) / 1000;
+    r.setRenderTarget(nullptr);
+
+    if (!report.write(scenario, r.pipelineNames(), timer, seconds))
+        return 1;
+    std::cout << "scenario: " << scenario.warmup_frames + scenario.frames << " frames in " << seconds <<
+        "s, timings written to " << scenario.output << std::endl;
+    if (Diagnostics::get().totalMessages() > 0)
+    {
+        Diagnostics::get().dump(std::cout);
+    }
+    return 0;
+}
+
+static void print_usage()
+{
+    std::cout << "usage: RTGP-Project [width height] [--capture <frames>] [--fps <n>] [--capture-size <w>x<h>]" <<
+        " [--capture-format png|raw] [--capture-dir <directory>] [--headless]" << std::endl;
+    std::cout << "       RTGP-Project --scenario <file> [--output <file.json>]" << std::endl;
+}
+
+static bool parse_arguments(const int argc, char* argv[], int& w, int& h)
+{
+    std::vector<string> positional;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const string arg = argv[i];
+            const auto value = [&]() -> string
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+            if (arg == "--capture")
+                capture_settings.frames = std::stoi(value());
+            else if (arg == "--fps")
+                capture_settings.fps = std::stof(value());
+            else if (arg == "--capture-size")
+            {
+                const auto size = value();
+                const auto x = size.find('x');
+                if (x == string::npos)
+                    throw std::invalid_argument("--capture-size is <width>x<height>");
+                capture_settings.width = std::stoi(size.substr(0, x));
+                capture_settings.height = std::stoi(size.substr(x + 1));
+            }
+            else if (arg == "--capture-format")
+            {
+                const auto format = value();
+                if (format != "png" && format != "raw")
+                    throw std::invalid_argument("--capture-format is png or raw");
+                capture_settings.format = format == "png" ? CaptureFormat::Png : CaptureFormat::Raw;
+            }
+            else if (arg == "--capture-dir")
+                capture_settings.directory = value();
+            else if (arg == "--headless")
+                capture_settings.headless = true;
+            else if (arg == "--scenario")
+                scenario_path = value();
+            else if (arg == "--output")
+                scenario_output = value();
+            else if (arg.rfind("--", 0) == 0)
+                throw std::invalid_argument("unknown option " + arg);
+            else
+                positional.push_back(arg);
+        }
+        if (positional.size() >= 2)
+        {
+            w = std::stoi(positional[0]);
+            h = std::stoi(positional[1]);
+        }
+        if (!scenario_output.empty() && scenario_path.empty())
+            throw std::invalid_argument("--output needs --scenario");
+        if (!scenario_path.empty() && capture_settings.frames > 0)
+            throw std::invalid_argument("--scenario and --capture cannot be used together");
+        if (capture_settings.headless && capture_settings.frames <= 0 && scenario_path.empty())
+            throw std::invalid_argument("--headless needs --capture or --scenario");
+        if (capture_settings.fps <= 0 || capture_settings.width < 0 || capture_settings.height < 0)
+            throw std::invalid_argument("the capture fps and size must be positive");
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+        print_usage();
+        return false;
+    }
+    return true;
+}
+
 static void HelpMarker(const char* desc)
 {
     ImGui::TextDisabled("(?)");
@@ -226,6 +642,13 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
     ImGui::Text("Press esc to close the menu and move the object");
 
     ImGui::SliderFloat("dt_multiplier", &dt_multiplier, 0.0f, 5.0f);
+    ImGui::SliderFloat("Simulation rate (Hz)", &simulation_rate, 10.0f, 240.0f, "%.0f");
+    ImGui::SameLine();
+    HelpMarker("The simulation advances in fixed steps, the particles are drawn between the last two of them. A lower "
+        "rate costs less at any frame rate");
+    ImGui::SliderInt("Max substeps per frame", &max_substeps, 1, 16);
+    ImGui::SameLine();
+    HelpMarker("Beyond this many steps in a frame the simulation slows down instead of catching up");
     ImGui::SliderFloat("mouse sensitivity", &mouse_sensitivity, 0.0f, 1.0f);
 
     // Model selection
@@ -239,7 +662,7 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
             {
                 selected_model_idx = i;
                 selected_model = model_files[selected_model_idx];
-                reset_scene = true;
+                reconfigure_scene = true;
             }
 
             // Set the initial focus when opening the combo (scrolling + keyboard navigation focus)
@@ -260,7 +683,7 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
             {
                 selected_texure_idx = i;
                 selected_texture = texture_files[selected_texure_idx];
-                reset_scene = true;
+                reconfigure_scene = true;
             }
 
             if (is_selected)
@@ -287,7 +710,7 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
                 {
                     selected_noise_texture_idx = i;
                     selected_noise_texture = texture_files[selected_noise_texture_idx];
-                    reset_scene = true;
+                    reconfigure_scene = true;
                 }
 
                 if (is_selected)
@@ -296,9 +719,10 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
             ImGui::EndCombo();
         }
     }
-    else
+    else if (selected_noise_texture != selected_texture)
     {
         selected_noise_texture = selected_texture;
+        reconfigure_scene = true;
     }
 
     ImGui::SeparatorText("Object control");
@@ -312,31 +736,36 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
     ImGui::gizmo3D("Rotate object", disappearing_object_rotation, 200,
                    imguiGizmo::mode3Axes | imguiGizmo::cubeAtOrigin);
     ImGui::DragFloat("Scale object", &disappearing_object_scale, 0.005f, 0.0f, 20.f, "%.3f");
+    if (ImGui::SliderInt("Number of objects", &object_count, 1, 1024, "%d", ImGuiSliderFlags_Logarithmic))
+        reconfigure_scene = true;
+    ImGui::SameLine();
+    HelpMarker("Copies of the object laid out on a grid, each dissolving at its own speed. They are drawn with a single "
+        "instanced draw per pass");
 
     ImGui::SeparatorText("Particle spawn");
     if (ImGui::Checkbox("draw particles", &draw_particles))
-        reset_scene = true;
+        reconfigure_scene = true;
     ImGui::Text("The options below affect only the particles that are not yet spawned");
     if (ImGui::SliderInt("Number of max particles", &particle_number, 0, 1000000000, "%d",
                          ImGuiSliderFlags_Logarithmic))
-        reset_scene = true;
+        reconfigure_scene = true;
     ImGui::gizmo3D("Particles Direction", particles_spawn_direction, 200, imguiGizmo::modeDirection);
     ImGui::SliderFloat3("Randomness XYZ", &particles_spawn_randomness[0], 0.f, 1.f, "%.3f");
     ImGui::DragFloat("Speed", &particles_spawn_speed, 0.005f, 0.0f, 10.f, "%.3f", ImGuiSliderFlags_Logarithmic);
 
     if (ImGui::Checkbox("Particle size auto scaling", &particle_size_auto_scaling))
-        reset_scene = true;
+        reconfigure_scene = true;
     ImGui::SameLine();
     HelpMarker("If checked the particle size roughly scales with the resolution of the particle buffer");
     if (!particle_size_auto_scaling)
     {
         if (ImGui::DragFloat("Size", &particle_size, 0.005f, 0.0f, 10.f, "%.3f", ImGuiSliderFlags_Logarithmic))
-            reset_scene = true;
+            reconfigure_scene = true;
     }
     ImGui::SeparatorText("Other options");
     if (ImGui::DragInt2("Particle buffer resolution (width, height)", particles_framebuffer_width_height, 1.f, 1.f,
                         4000.f, "%d"))
-        reset_scene = true;
+        reconfigure_scene = true;
 
     ImGui::SeparatorText("Particle lifetime");
     ImGui::Text("The options below affect only the particles that are not yet spawned");
@@ -344,7 +773,56 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
                      ImGuiSliderFlags_Logarithmic);
     ImGui::SliderFloat("Particle added spawn life randomness", &particle_added_spawn_life_randomness, 0.f, 1.f, "%.3f");
 
+    ImGui::SeparatorText("Turbulence");
+    ImGui::DragFloat("Turbulence strength", &turbulence_strength, 0.01f, 0.f, 20.f, "%.3f");
+    ImGui::SameLine();
+    HelpMarker("The particles drift along a swirling, divergence-free flow: a tileable curl-noise field baked once on a "
+        "grid and sampled with trilinear interpolation");
+    ImGui::DragFloat("Turbulence frequency", &turbulence_frequency, 0.001f, 0.001f, 1.f, "%.3f",
+                     ImGuiSliderFlags_Logarithmic);
+
+    ImGui::SeparatorText("Air");
+    ImGui::DragFloat("Air coupling", &air_coupling, 0.01f, 0.f, 50.f, "%.3f");
+    ImGui::SameLine();
+    HelpMarker("The particles are carried by the air the objects push around as they move: a small grid fluid in a box "
+        "around them, solved on the worker threads every simulation step. 0 turns it off");
+    ImGui::SliderInt("Air resolution", &air_resolution, 8, 64);
+    ImGui::DragFloat("Air budget (ms per frame)", &air_budget_ms, 0.01f, 0.f, 16.f, "%.3f");
+    ImGui::SameLine();
+    HelpMarker("The pressure iterations stop when the budget is spent, the air is then less divergence-free");
+    ImGui::SliderFloat("Air dissipation", &air_dissipation, 0.f, 5.f, "%.3f");
+
+    ImGui::SeparatorText("Collisions");
+    ImGui::Checkbox("Floor", &collision_floor);
+    ImGui::SameLine();
+    ImGui::DragFloat("Floor height", &collision_floor_height, 0.05f);
+    if (ImGui::Checkbox("Object", &collision_object))
+        reconfigure_scene = true;
+    ImGui::SameLine();
+    HelpMarker("The particles bounce off the objects not yet dissolved. The model is reloaded with a signed distance "
+        "field baked on the loader threads and cached on disk");
+    ImGui::Checkbox("Visible surfaces", &collision_depth);
+    ImGui::SameLine();
+    ImGui::DragFloat("Thickness", &collision_depth_thickness, 0.01f, 0.f, 10.f, "%.3f");
+    ImGui::SameLine();
+    HelpMarker("The particles bounce off the objects as they are drawn, dissolve included: the depth of the frame is "
+        "reduced to a quarter of its size, read back without stalling. Only the side facing the camera is known, the "
+        "surfaces are that thick");
+    ImGui::Checkbox("Sphere around the object", &collision_sphere);
+    ImGui::SameLine();
+    ImGui::DragFloat("Sphere radius", &collision_sphere_radius, 0.01f, 0.f, 100.f, "%.3f");
+    ImGui::DragFloat("Particle radius", &collision_particle_radius, 0.001f, 0.f, 1.f, "%.3f");
+    ImGui::SameLine();
+    HelpMarker("Particles closer than twice the radius push each other apart, found through a spatial hash rebuilt "
+        "every step. 0 turns it off");
+    ImGui::SliderFloat("Restitution", &collision_restitution, 0.f, 1.f, "%.3f");
+    ImGui::SliderFloat("Friction", &collision_friction, 0.f, 1.f, "%.3f");
+
     ImGui::Checkbox("Show debug buffer (particles spawned in the current frame)", &show_debug_buffer);
+    ImGui::Checkbox("Debug diagnostics", &debug_diagnostics);
+    ImGui::SameLine();
+    HelpMarker("Validates the shader programs before every draw and makes the GL debug output synchronous, slow");
+    ImGui::Text("GL debug messages: %lu", Diagnostics::get().totalMessages());
     static bool vsync = true;
     if (ImGui::Checkbox("Vsync", &vsync))
     {
@@ -355,6 +833,8 @@ void menu_window(GLFWwindow* window, ImGuiIO& io)
         reset_scene = true;
     if (ImGui::Button("Quit"))
         glfwSetWindowShouldClose(window, GL_TRUE);
+    if (scene_loading)
+        ImGui::Text("Loading resources...");
     ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
     ImGui::End();
 }
@@ -22,7 +22,7 @@ public:
         glGenBuffers(1, &_vbo);
         glGenBuffers(1, &_ebo);
 
-        glBindVertexArray(_vao);
+        GLState::get().bindVertexArray(_vao);
 
         glBindBuffer(GL_ARRAY_BUFFER, _vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
@@ -37,13 +37,14 @@ public:
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(sizeof(GLfloat) * 3));
 
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        GLState::get().bindVertexArray(0);
     }
 
     ~DebugBuffer()
     {
         if (_vao)
         {
+            GLState::get().forgetVertexArray(_vao);
             glDeleteVertexArrays(1, &_vao);
             glDeleteBuffers(1, &_vbo);
             glDeleteBuffers(1, &_ebo);
@@ -53,10 +54,10 @@ public:
 
     void DisplayFramebufferTexture(const GLuint textureID) const
     {
+        auto& state = GLState::get();
         shader.use();
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        state.bindTexture(0, GL_TEXTURE_2D, textureID);
 
         glm::mat4 m{1};
 
@@ -67,13 +68,10 @@ public:
         glUniformMatrix4fv(glGetUniformLocation(shader.program(), "modelMatrix"), 1, GL_FALSE,
                            value_ptr(m));
 
-        glBindVertexArray(_vao);
+        state.bindVertexArray(_vao);
 
         shader.validateProgram();
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
-
-        glBindVertexArray(0);
-        glBindTexture(GL_TEXTURE_2D, 0);
     }
 
 private:
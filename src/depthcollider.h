@@ -0,0 +1,132 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include <gpuobjects/framebuffer.h>
+#include <gpuobjects/glstate.h>
+#include <gpuobjects/shader.h>
+#include <utils/nocopy.h>
+#include "particlecollisions.h"
+
+/*
+Depth of the intact part of the objects at 1 / DOWNSAMPLE of the frame size, for the particle collisions (ScreenDepth).
+The depth of the frame is reused, the cost and the readback (a few hundred KB) do not depend on the meshes.
+1. render thread (downsample): once the objects are drawn in the frame (a render target, or the off-screen window frame
+   of Renderer::setOffscreenWindow) one triangle over the small target writes the nearest depth of every
+   DOWNSAMPLE x DOWNSAMPLE block of it (depth_min.frag), so that thin geometry is not lost. The depth is copied to the
+   next PBO of a ring of RING_SIZE with a fence after the copy, together with the view-projection of the frame
+2. render thread (update): the newest PBO whose fence is signaled is mapped and turned into the ScreenDepth, never
+   waiting for the GPU. The depth is RING_SIZE - 1 frames old, the collisions project with the matrix it was drawn with
+*/
+class DepthCollider : NoCopy
+{
+public:
+    static constexpr int RING_SIZE = 3;
+    static constexpr int DOWNSAMPLE = 4;
+
+    // reduce: fullscreen.vert and depth_min.frag. width and height of the frame, the target is DOWNSAMPLE times smaller
+    DepthCollider(const Shader& reduce, const GLuint width, const GLuint height):
+        NoCopy{}, reduce{reduce}, frameWidth{width}, frameHeight{height},
+        _target(std::max(width / DOWNSAMPLE, 1u), std::max(height / DOWNSAMPLE, 1u))
+    {
+        for (int i = 0; i < RING_SIZE; i++)
+            ring.push_back(Slot{_target.createPboReadDepthBuffer()});
+        // the triangle has no vertex attributes, but a core context draws only with a vertex array bound
+        glGenVertexArrays(1, &emptyVao);
+    }
+
+    ~DepthCollider()
+    {
+        for (auto& slot : ring)
+        {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+        }
+        GLState::get().forgetVertexArray(emptyVao);
+        glDeleteVertexArrays(1, &emptyVao);
+    }
+
+    [[nodiscard]] bool matches(const GLuint width, const GLuint height) const
+    {
+        return width == frameWidth && height == frameHeight;
+    }
+
+    // Render thread, after the objects are drawn in frame with viewProjection. The target is left bound
+    void downsample(const FrameBuffer& frame, const glm::mat4& viewProjection)
+    {
+        auto& state = GLState::get();
+        _target.bind();
+        reduce.use();
+        glUniform1i(glGetUniformLocation(reduce.program(), "downsample"), DOWNSAMPLE);
+        state.bindTexture(0, GL_TEXTURE_2D, frame.depthTextureId());
+        state.bindVertexArray(emptyVao);
+        // every pixel is written, nothing to clear or test against
+        glDepthFunc(GL_ALWAYS);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LESS);
+
+        auto& slot = ring[nextFrame % RING_SIZE];
+        // not read back yet, a newer depth is already on its way: dropped instead of waited for
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        slot.pbo.readAsync();
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.viewProjection = viewProjection;
+        nextFrame++;
+    }
+
+    // true if depth() changed
+    bool update()
+    {
+        for (int age = 1; age <= RING_SIZE; age++)
+        {
+            auto& slot = ring[(nextFrame - age + RING_SIZE) % RING_SIZE];
+            if (!slot.fence)
+                continue;
+            const auto status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                continue;
+            if (const auto mapped = slot.pbo.mapRead())
+                _depth.build(reinterpret_cast<const float*>(mapped), static_cast<int>(_target.width()),
+                             static_cast<int>(_target.height()), slot.viewProjection);
+            slot.pbo.unbind();
+            // this one and the older copies, which are done too and out of date
+            for (; age <= RING_SIZE; age++)
+            {
+                auto& older = ring[(nextFrame - age + RING_SIZE) % RING_SIZE];
+                if (older.fence)
+                    glDeleteSync(older.fence);
+                older.fence = nullptr;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    [[nodiscard]] const ScreenDepth& depth() const
+    {
+        return _depth;
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return _depth.byteSize();
+    }
+
+private:
+    struct Slot
+    {
+        PboReadBuffer pbo;
+        GLsync fence{nullptr};
+        glm::mat4 viewProjection{1};
+    };
+
+    const Shader& reduce;
+    GLuint emptyVao{0};
+    GLuint frameWidth, frameHeight;
+    FrameBuffer _target;
+    std::vector<Slot> ring;
+    int nextFrame{0};
+    ScreenDepth _depth;
+};
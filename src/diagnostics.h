@@ -0,0 +1,193 @@
+#pragma once
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <utils/nocopy.h>
+
+enum class DiagnosticsLevel
+{
+    // Programs are validated once after linking, GL debug output is asynchronous and only reports real problems
+    Release,
+    // Programs are validated before every draw, GL debug output is synchronous and reports everything
+    Debug,
+};
+
+/*
+Collects GL debug messages in a bounded ring.
+Repeated messages (same source, type, id, severity, stage and text) only bump a counter, the first occurrence is also
+printed. Every message is attributed to the stage that was running when it was generated (the pipeline step index set by
+the renderer). With asynchronous debug output the driver may report a message a bit later than the call that caused it,
+so the attribution is exact only in Debug.
+*/
+class Diagnostics : NoCopy
+{
+public:
+    static constexpr int STAGE_OUTSIDE_PIPELINE = -1;
+    static constexpr size_t LOG_CAPACITY = 128;
+
+    struct Message
+    {
+        GLenum source{0}, type{0}, severity{0};
+        GLuint id{0};
+        int stage{STAGE_OUTSIDE_PIPELINE};
+        std::string text;
+        unsigned int count{0};
+    };
+
+    static Diagnostics& get()
+    {
+        static Diagnostics diagnostics;
+        return diagnostics;
+    }
+
+    [[nodiscard]] DiagnosticsLevel level() const
+    {
+        return _level.load(std::memory_order_relaxed);
+    }
+
+    void level(const DiagnosticsLevel level)
+    {
+        _level.store(level, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool perDrawValidation() const
+    {
+        return level() == DiagnosticsLevel::Debug;
+    }
+
+    void stage(const int stage)
+    {
+        _stage.store(stage, std::memory_order_relaxed);
+    }
+
+    void record(const GLenum source, const GLenum type, const GLuint id, const GLenum severity, const GLchar* message)
+    {
+        const auto stage = _stage.load(std::memory_order_relaxed);
+        std::lock_guard lock(_mutex);
+        for (auto& m : _log)
+        {
+            if (m.id == id && m.source == source && m.type == type && m.severity == severity && m.stage == stage &&
+                m.text == message)
+            {
+                m.count++;
+                _totalMessages++;
+                return;
+            }
+        }
+        Message m{source, type, severity, id, stage, message, 1};
+        print(std::cout, m);
+        if (_log.size() < LOG_CAPACITY)
+        {
+            _log.emplace_back(std::move(m));
+        }
+        else
+        {
+            _log[_next] = std::move(m);
+            _next = (_next + 1) % LOG_CAPACITY;
+        }
+        _totalMessages++;
+    }
+
+    // Snapshot of the ring, oldest first
+    [[nodiscard]] std::vector<Message> messages() const
+    {
+        std::lock_guard lock(_mutex);
+        std::vector<Message> out;
+        out.reserve(_log.size());
+        for (size_t i = 0; i < _log.size(); i++)
+            out.emplace_back(_log[(_next + i) % _log.size()]);
+        return out;
+    }
+
+    [[nodiscard]] unsigned long totalMessages() const
+    {
+        std::lock_guard lock(_mutex);
+        return _totalMessages;
+    }
+
+    void clear()
+    {
+        std::lock_guard lock(_mutex);
+        _log.clear();
+        _next = 0;
+        _totalMessages = 0;
+    }
+
+    void dump(std::ostream& out) const
+    {
+        const auto log = messages();
+        out << "GL debug log: " << log.size() << " unique messages, " << totalMessages() << " total" << '\n';
+        for (const auto& m : log)
+            print(out, m);
+    }
+
+    static void print(std::ostream& out, const Message& m)
+    {
+        out << '[';
+        if (m.stage == STAGE_OUTSIDE_PIPELINE)
+            out << "outside pipeline";
+        else
+            out << "pipeline step " << m.stage;
+        out << "] " << sourceString(m.source) << ", " << typeString(m.type) << ", " << severityString(m.severity) <<
+            ", " << m.id << ": " << m.text;
+        if (m.count > 1)
+            out << " (x" << m.count << ')';
+        out << '\n';
+    }
+
+    static const char* sourceString(const GLenum source)
+    {
+        switch (source)
+        {
+        case GL_DEBUG_SOURCE_API: return "API";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "WINDOW SYSTEM";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "SHADER COMPILER";
+        case GL_DEBUG_SOURCE_THIRD_PARTY: return "THIRD PARTY";
+        case GL_DEBUG_SOURCE_APPLICATION: return "APPLICATION";
+        case GL_DEBUG_SOURCE_OTHER: return "OTHER";
+        default: return "GL_DEBUG source Enum not recognized";
+        }
+    }
+
+    static const char* typeString(const GLenum type)
+    {
+        switch (type)
+        {
+        case GL_DEBUG_TYPE_ERROR: return "ERROR";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED_BEHAVIOR";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "UNDEFINED_BEHAVIOR";
+        case GL_DEBUG_TYPE_PORTABILITY: return "PORTABILITY";
+        case GL_DEBUG_TYPE_PERFORMANCE: return "PERFORMANCE";
+        case GL_DEBUG_TYPE_MARKER: return "MARKER";
+        case GL_DEBUG_TYPE_OTHER: return "OTHER";
+        default: return "GL_DEBUG type Enum not recognized";
+        }
+    }
+
+    static const char* severityString(const GLenum severity)
+    {
+        switch (severity)
+        {
+        case GL_DEBUG_SEVERITY_NOTIFICATION: return "NOTIFICATION";
+        case GL_DEBUG_SEVERITY_LOW: return "LOW";
+        case GL_DEBUG_SEVERITY_MEDIUM: return "MEDIUM";
+        case GL_DEBUG_SEVERITY_HIGH: return "HIGH";
+        default: return "GL_DEBUG severity Enum not recognized";
+        }
+    }
+
+private:
+    std::atomic<DiagnosticsLevel> _level{DiagnosticsLevel::Release};
+    std::atomic<int> _stage{STAGE_OUTSIDE_PIPELINE};
+    mutable std::mutex _mutex;
+    std::vector<Message> _log;
+    size_t _next{0};
+    unsigned long _totalMessages{0};
+
+    Diagnostics(): NoCopy{}
+    {
+    }
+};
@@ -1,78 +1,278 @@
 #pragma once
+#include <cmath>
+#include <vector>
 #include <renderobject.h>
+#include <glm/gtc/constants.hpp>
+#include <gpuobjects/instancebuffer.h>
 #include <gpuobjects/shader.h>
 
 #include "renderer.h"
 
+/*
+Instances of the same model dissolving with the same textures, each with its own place and threshold. Both passes are
+a single instanced draw: the model matrices and the thresholds of the instances drawn are packed in an InstanceBuffer
+every frame, the shader reads them by gl_InstanceID (see dissolve_instanced.vert). The instances are laid out on a grid
+next to the scene object, instance 0 is the scene object itself.
+*/
 class DisappearingObject : public RenderObject
 {
 public:
-    DisappearingObject(const Shader& shader, const Renderer& renderer,
-                       const std::vector<std::reference_wrapper<const Texture>>& textures, const Model& model,
-                       const SceneObject& scene_object): RenderObject(shader, renderer, textures, model, scene_object)
+    struct Instance
+    {
+        // grid cell, in units of instanceSpacing()
+        glm::vec3 offset{0};
+        float threshold{0};
+        float prevThreshold{0};
+        // of the threshold, relative to the one of the scene
+        float speed{1};
+        // multiplies the color of the particles the instance spawns
+        glm::vec4 particleColor{1};
+        unsigned int spawnedParticles{0};
+    };
+
+    // texels of InstanceBuffer per instance, must match dissolve_instanced.vert
+    static constexpr int INSTANCE_TEXELS = 5;
+
+    // The level of detail drawn is the coarsest one with at least a triangle every PIXELS_PER_TRIANGLE pixels of the
+    // projected bounding sphere
+    static constexpr float PIXELS_PER_TRIANGLE = 16.0f;
+    // The spawn pass only decides where the particles are emitted, it can use a coarser level than the visible mesh
+    static constexpr int SPAWN_LOD_BIAS = 1;
+
+    DisappearingObject(const Shader& shader, const Renderer& renderer, const TextureLibrary& library,
+                       const ModelHandle& model, const SceneObject& scene_object):
+        RenderObject(shader, renderer, {}, model, scene_object), library{library}, _instances(1)
     {
     }
 
-    void draw() const
+    // Color and mask layers of the texture library, switching them changes only the uniforms
+    void textures(const TextureLibrary::Entry* color, const TextureLibrary::Entry* mask)
     {
-        if (curThreshold >= 1)
+        colorEntry = color;
+        maskEntry = mask;
+    }
+
+    // True once the model and the texture library layers are uploaded (or failed to load)
+    [[nodiscard]] bool loaded() const
+    {
+        return RenderObject::loaded() && (!colorEntry || colorEntry->settled()) && (!maskEntry || maskEntry->settled());
+    }
+
+    void draw()
+    {
+        const auto count = packInstances([](const Instance& instance) { return instance.threshold < 1; });
+        if (count == 0)
         {
             return;
         }
 
         shader.use();
-        bindTextures();
-
-        glUniform1i(glGetUniformLocation(shader.program(), "texSampler"), 0);
-        glUniform1i(glGetUniformLocation(shader.program(), "maskSampler"), 1);
+        bindLayers();
 
-        glUniform1f(glGetUniformLocation(shader.program(), "threshold"), curThreshold);
-        glUniform1f(glGetUniformLocation(shader.program(), "lowerBoundThreshold"), 0);
         glUniform1i(glGetUniformLocation(shader.program(), "invert"), false);
-        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "projectionMatrix"), 1, GL_FALSE,
-                           value_ptr(renderer.projectionMatrix()));
-        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "viewMatrix"), 1, GL_FALSE,
-                           value_ptr(renderer.viewMatrix()));
-        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "modelMatrix"), 1, GL_FALSE,
-                           value_ptr(sceneObject.worldModelMatrix()));
-        shader.validateProgram();
-        model.Draw();
+        drawInstances(lod(), count);
     }
 
-    void drawRemovedFragments() const
+    // Only the instances whose threshold grew since the last frame have fragments to remove
+    void drawRemovedFragments()
     {
-        shader.use();
-        bindTextures();
+        const auto count = packInstances([](const Instance& instance)
+        {
+            return instance.threshold > instance.prevThreshold;
+        });
+        if (count == 0)
+        {
+            return;
+        }
 
-        glUniform1i(glGetUniformLocation(shader.program(), "texSampler"), 0);
-        glUniform1i(glGetUniformLocation(shader.program(), "maskSampler"), 1);
+        shader.use();
+        bindLayers();
 
-        glUniform1f(glGetUniformLocation(shader.program(), "threshold"), curThreshold);
-        glUniform1f(glGetUniformLocation(shader.program(), "lowerBoundThreshold"), prevThreshold);
         glUniform1i(glGetUniformLocation(shader.program(), "invert"), true);
-        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "projectionMatrix"), 1, GL_FALSE,
-                           value_ptr(renderer.projectionMatrix()));
-        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "viewMatrix"), 1, GL_FALSE,
-                           value_ptr(renderer.viewMatrix()));
-        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "modelMatrix"), 1, GL_FALSE,
-                           value_ptr(sceneObject.worldModelMatrix()));
-        shader.validateProgram();
-        model.Draw();
+        drawInstances(lod() + SPAWN_LOD_BIAS, count);
+    }
+
+    // Level of detail of instance 0 for the current camera, 0 when the camera is inside the bounding sphere. All the
+    // instances are drawn with it
+    [[nodiscard]] int lod() const
+    {
+        const auto& m = model.get();
+        const auto lodCount = m.lodCount();
+        if (lodCount <= 1)
+            return 0;
+        const auto sphere = m.boundingSphere();
+        const auto world = sceneObject.worldModelMatrix();
+        const auto scale = glm::max(glm::length(glm::vec3{world[0]}),
+                                    glm::max(glm::length(glm::vec3{world[1]}), glm::length(glm::vec3{world[2]})));
+        const auto radius = sphere.w * scale;
+        const auto distance = -(renderer.viewMatrix() * world * glm::vec4{glm::vec3{sphere}, 1.0f}).z;
+        if (distance <= radius)
+            return 0;
+        const auto pixelRadius = radius / distance * renderer.projectionMatrix()[1][1] *
+            static_cast<float>(renderer.screenHeight()) * 0.5f;
+        const auto targetTriangles = glm::pi<float>() * pixelRadius * pixelRadius / PIXELS_PER_TRIANGLE;
+        for (int lod = lodCount - 1; lod > 0; lod--)
+        {
+            if (static_cast<float>(m.triangleCount(lod)) >= targetTriangles)
+                return lod;
+        }
+        return 0;
     }
 
 
+    // Threshold of instance 0
     [[nodiscard]] float threshold() const
     {
-        return curThreshold;
+        return _instances.front().threshold;
+    }
+
+    // Every instance advances by delta times its speed. The band drawn by drawRemovedFragments grows until
+    // startSpawnBand, a frame simulated in several steps spawns the particles of all of them at once
+    void advance(const float delta)
+    {
+        for (auto& instance : _instances)
+            instance.threshold = glm::clamp(instance.threshold + delta * instance.speed, 0.0f, 1.0f);
+    }
+
+    // The next band starts at the current thresholds, empty until the next advance
+    void startSpawnBand()
+    {
+        for (auto& instance : _instances)
+            instance.prevThreshold = instance.threshold;
+    }
+
+    // Whole again, as before the first threshold change
+    void restart()
+    {
+        for (auto& instance : _instances)
+        {
+            instance.threshold = 0;
+            instance.prevThreshold = 0;
+            instance.spawnedParticles = 0;
+        }
+    }
+
+    // count instances on a square grid growing to the right of and behind the scene object. The instances already
+    // there keep their thresholds, the new ones start whole. Their speed and particle color vary with the index
+    void layoutInstances(const int count)
+    {
+        _instances.resize(std::max(count, 1));
+        const auto columns = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(_instances.size()))));
+        for (size_t i = 0; i < _instances.size(); i++)
+        {
+            auto& instance = _instances[i];
+            const auto index = static_cast<int>(i);
+            instance.offset = glm::vec3{index % columns, 0, -(index / columns)};
+            if (i == 0)
+                continue;
+            // golden ratio hue steps keep neighbouring instances apart
+            const auto hue = std::fmod(static_cast<float>(i) * 0.618034f, 1.0f);
+            const auto channel = [hue](const float shift)
+            {
+                return glm::clamp(std::abs(std::fmod(hue * 6.0f + shift, 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+            };
+            instance.particleColor = glm::vec4{channel(0), channel(4), channel(2), 1};
+            instance.speed = 0.5f + std::fmod(static_cast<float>(i) * 0.754878f, 1.0f);
+        }
+    }
+
+    [[nodiscard]] const std::vector<Instance>& instances() const
+    {
+        return _instances;
+    }
+
+    // id as written in the object-ID attachment, 0 is no instance
+    void spawned(const GLuint objectId, const unsigned int particles)
+    {
+        if (objectId > 0 && objectId <= _instances.size())
+            _instances[objectId - 1].spawnedParticles += particles;
+    }
+
+    // Of the model, in model space
+    [[nodiscard]] glm::vec4 boundingSphere() const
+    {
+        return model.get().boundingSphere();
+    }
+
+    // Distance between the grid cells, the bounding sphere of the model scaled by the scene object
+    [[nodiscard]] float instanceSpacing() const
+    {
+        const auto& m = sceneObject.modelMatrix;
+        const auto scale = glm::max(glm::length(glm::vec3{m[0]}),
+                                    glm::max(glm::length(glm::vec3{m[1]}), glm::length(glm::vec3{m[2]})));
+        return 2.2f * model.get().boundingSphere().w * scale;
+    }
+
+    // Model to world of an instance
+    [[nodiscard]] glm::mat4 instanceMatrix(const Instance& instance, const float spacing) const
+    {
+        return sceneObject.worldSpaceTransform * glm::translate(glm::mat4{1}, instance.offset * spacing) *
+            sceneObject.modelMatrix;
+    }
+
+    // Signed distance field of the model, nullptr unless it was imported with one
+    [[nodiscard]] const MeshSdf* sdf() const
+    {
+        return model.get().sdf.get();
     }
 
-    void threshold(const float threshold)
+    // Library entry of the mask, nullptr if none was set
+    [[nodiscard]] const TextureLibrary::Entry* mask() const
     {
-        prevThreshold = curThreshold;
-        curThreshold = glm::clamp(threshold, 0.0f, 1.0f);
+        return maskEntry;
     }
 
 private:
-    float curThreshold{0};
-    float prevThreshold{0};
+    const TextureLibrary& library;
+    const TextureLibrary::Entry* colorEntry{nullptr};
+    const TextureLibrary::Entry* maskEntry{nullptr};
+    std::vector<Instance> _instances;
+    InstanceBuffer instanceBuffer;
+    std::vector<glm::vec4> instanceTexels;
+
+    // Packs the instances accepted by filter in the instance buffer, returns how many
+    template <typename Filter>
+    GLsizei packInstances(const Filter& filter)
+    {
+        instanceTexels.clear();
+        const auto spacing = instanceSpacing();
+        for (size_t i = 0; i < _instances.size(); i++)
+        {
+            const auto& instance = _instances[i];
+            if (!filter(instance))
+                continue;
+            const auto world = instanceMatrix(instance, spacing);
+            for (int column = 0; column < 4; column++)
+                instanceTexels.push_back(world[column]);
+            instanceTexels.emplace_back(instance.threshold, instance.prevThreshold, static_cast<float>(i), 0);
+        }
+        if (instanceTexels.empty())
+            return 0;
+        instanceBuffer.upload(instanceTexels);
+        return static_cast<GLsizei>(instanceTexels.size() / INSTANCE_TEXELS);
+    }
+
+    void drawInstances(const int lod, const GLsizei count) const
+    {
+        instanceBuffer.bind(2);
+        glUniform1i(glGetUniformLocation(shader.program(), "instances"), 2);
+        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "projectionMatrix"), 1, GL_FALSE,
+                           value_ptr(renderer.projectionMatrix()));
+        glUniformMatrix4fv(glGetUniformLocation(shader.program(), "viewMatrix"), 1, GL_FALSE,
+                           value_ptr(renderer.viewMatrix()));
+        shader.validateProgram();
+        model.get().DrawInstanced(lod, count);
+    }
+
+    void bindLayers() const
+    {
+        const auto color = library.color(colorEntry);
+        const auto mask = library.mask(maskEntry);
+        color.array->bind(0);
+        mask.array->bind(1);
+        glUniform1i(glGetUniformLocation(shader.program(), "texSampler"), 0);
+        glUniform1i(glGetUniformLocation(shader.program(), "maskSampler"), 1);
+        glUniform1i(glGetUniformLocation(shader.program(), "texLayer"), color.layer);
+        glUniform1i(glGetUniformLocation(shader.program(), "maskLayer"), mask.layer);
+    }
 };
@@ -0,0 +1,192 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <gpuobjects/framebuffer.h>
+#include <utils/imagewriter.h>
+#include <utils/nocopy.h>
+#include <utils/threadpool.h>
+
+enum class CaptureFormat
+{
+    Png,
+    Raw,
+};
+
+struct CaptureStats
+{
+    int frames{0};
+    // from the first capture() to the end of finish()
+    double seconds{0};
+    // render thread time spent waiting for a readback and for the writers
+    double readbackWaitMs{0};
+    double writerWaitMs{0};
+    size_t bytes{0};
+
+    [[nodiscard]] double fps() const
+    {
+        return seconds > 0 ? frames / seconds : 0;
+    }
+};
+
+/*
+Frames rendered in an off-screen target of any size and written to numbered files:
+1. render thread (capture): the target is copied to the next PBO of a ring of RING_SIZE, with a fence after the copy.
+   The GPU keeps going, the copy is read back only when its PBO comes round again, RING_SIZE - 1 frames later
+2. render thread (retire): the oldest PBO is mapped once its fence is signaled and the pixels are copied to a buffer
+3. writer jobs on the shared pool: the buffer is encoded and written, then given back for the next frames
+At most twice as many frames as pool threads wait to be written, beyond that the render thread waits for them.
+*/
+class FrameCapture : NoCopy
+{
+public:
+    static constexpr int RING_SIZE = 3;
+
+    FrameCapture(const GLuint width, const GLuint height, const CaptureFormat format, std::string directory):
+        NoCopy{}, _target(width, height), format{format}, directory{std::move(directory)}
+    {
+        maxQueuedFrames = 2 * writers.threads();
+        std::error_code ec;
+        std::filesystem::create_directories(this->directory, ec);
+        if (ec)
+            std::cout << "Failed to create the capture directory " << this->directory << ": " << ec.message() <<
+                std::endl;
+        for (int i = 0; i < RING_SIZE; i++)
+            ring.push_back(Slot{_target.createPboReadColorBuffer()});
+    }
+
+    ~FrameCapture()
+    {
+        finish();
+    }
+
+    // Renderer::setRenderTarget(&target()) renders the frames here
+    [[nodiscard]] const FrameBuffer& target() const
+    {
+        return _target;
+    }
+
+    // Render thread, after the frame is rendered in target()
+    void capture()
+    {
+        if (_stats.frames == 0)
+            start = std::chrono::steady_clock::now();
+        auto& slot = ring[nextFrame % RING_SIZE];
+        if (slot.fence)
+            retire(slot);
+        _target.bind();
+        slot.pbo.readAsync();
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = nextFrame++;
+        _stats.frames++;
+        finished = false;
+    }
+
+    // Reads back the frames still in the ring and waits for the writers, once per run of captures
+    void finish()
+    {
+        if (finished)
+            return;
+        finished = true;
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            if (auto& slot = ring[(nextFrame + i) % RING_SIZE]; slot.fence)
+                retire(slot);
+        }
+        writers.wait();
+        if (_stats.frames > 0)
+            _stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    [[nodiscard]] const CaptureStats& stats() const
+    {
+        return _stats;
+    }
+
+    [[nodiscard]] const std::string& outputDirectory() const
+    {
+        return directory;
+    }
+
+private:
+    struct Slot
+    {
+        PboReadBuffer pbo;
+        GLsync fence{nullptr};
+        int frame{0};
+    };
+
+    FrameBuffer _target;
+    CaptureFormat format;
+    std::string directory;
+    std::vector<Slot> ring;
+    int nextFrame{0};
+    CaptureStats _stats;
+    std::chrono::steady_clock::time_point start;
+    // finish() was called after the last capture(), the destructor has nothing left to do
+    bool finished{false};
+    size_t maxQueuedFrames{0};
+    // buffers of the frames waiting for the writers and the free ones
+    std::mutex mutex;
+    std::condition_variable frameWritten;
+    size_t queuedFrames{0};
+    std::vector<std::vector<unsigned char>> freeBuffers;
+    // last, the jobs use the members above
+    JobGroup writers{};
+
+    void retire(Slot& slot)
+    {
+        const auto waitStart = std::chrono::steady_clock::now();
+        while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+        {
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        const auto readbackDone = std::chrono::steady_clock::now();
+
+        std::vector<unsigned char> pixels;
+        {
+            std::unique_lock lock(mutex);
+            frameWritten.wait(lock, [this] { return queuedFrames < maxQueuedFrames; });
+            queuedFrames++;
+            if (!freeBuffers.empty())
+            {
+                pixels = std::move(freeBuffers.back());
+                freeBuffers.pop_back();
+            }
+        }
+        const auto writerDone = std::chrono::steady_clock::now();
+        _stats.readbackWaitMs += std::chrono::duration<double, std::milli>(readbackDone - waitStart).count();
+        _stats.writerWaitMs += std::chrono::duration<double, std::milli>(writerDone - readbackDone).count();
+
+        pixels.resize(slot.pbo.bufferSize());
+        if (const auto mapped = slot.pbo.mapRead())
+            std::memcpy(pixels.data(), mapped, pixels.size());
+        slot.pbo.unbind();
+        _stats.bytes += pixels.size();
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%05d.%s", slot.frame, format == CaptureFormat::Png ? "png" : "rgba");
+        writers.submit([this, pixels = std::move(pixels), path = (std::filesystem::path(directory) / name).string(),
+                width = static_cast<int>(_target.width()), height = static_cast<int>(_target.height())]() mutable
+            {
+                const bool written = format == CaptureFormat::Png
+                                         ? ImageWriter::writePng(path, width, height, pixels.data())
+                                         : ImageWriter::writeRaw(path, width, height, pixels.data());
+                if (!written)
+                    std::cout << "Failed to write " << path << std::endl;
+                {
+                    std::lock_guard lock(mutex);
+                    freeBuffers.push_back(std::move(pixels));
+                    queuedFrames--;
+                }
+                frameWritten.notify_one();
+            });
+    }
+};
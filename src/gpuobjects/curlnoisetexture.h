@@ -0,0 +1,84 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <utils/curlnoise.h>
+#include <utils/nocopy.h>
+
+#include "glstate.h"
+
+// A CurlNoiseField as an RGBA32F 3D texture with trilinear filtering and repeat wrapping, for a particle simulation on
+// the GPU. texture(sampler, p * scale + offset()).xyz in a shader is CurlNoiseField::sample(p, scale): the texel
+// centers are half a texel away from the grid points of the field
+class CurlNoiseTexture : NoCopy
+{
+public:
+    explicit CurlNoiseTexture(const CurlNoiseField& field): NoCopy{}, resolution{field.resolution()}
+    {
+        glGenTextures(1, &textureId);
+        GLState::get().bindTexture(0, GL_TEXTURE_3D, textureId);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, resolution, resolution, resolution, 0, GL_RGBA, GL_FLOAT,
+                     field.data().data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    void bind(const GLuint unit) const
+    {
+        GLState::get().bindTexture(unit, GL_TEXTURE_3D, textureId);
+    }
+
+    [[nodiscard]] GLuint id() const
+    {
+        return textureId;
+    }
+
+    // Added to the texture coordinates, see above
+    [[nodiscard]] glm::vec3 offset() const
+    {
+        return glm::vec3{resolution > 0 ? 0.5f / static_cast<float>(resolution) : 0};
+    }
+
+    [[nodiscard]] size_t gpuBytes() const
+    {
+        return static_cast<size_t>(resolution) * resolution * resolution * 4 * sizeof(float);
+    }
+
+    ~CurlNoiseTexture()
+    {
+        freeGPUResources();
+    }
+
+    CurlNoiseTexture(CurlNoiseTexture&& other) noexcept: NoCopy{}, textureId{other.textureId},
+                                                         resolution{other.resolution}
+    {
+        other.textureId = 0;
+        other.resolution = 0;
+    };
+
+    CurlNoiseTexture& operator=(CurlNoiseTexture&& other) noexcept
+    {
+        freeGPUResources();
+        this->textureId = other.textureId;
+        this->resolution = other.resolution;
+
+        other.textureId = 0;
+        other.resolution = 0;
+        return *this;
+    };
+
+private:
+    GLuint textureId{0};
+    int resolution{0};
+
+    void freeGPUResources()
+    {
+        if (textureId)
+        {
+            GLState::get().forgetTexture(textureId);
+            glDeleteTextures(1, &textureId);
+            textureId = 0;
+        }
+    }
+};
@@ -1,18 +1,23 @@
 #pragma once
 #include <utils/nocopy.h>
 
+#include "glstate.h"
 #include "pboreadbuffer.h"
 
+// Color and depth render targets, optionally with a GL_R32UI object-ID attachment written by the fragment output at
+// location 1 (0 where nothing was drawn)
 class FrameBuffer : NoCopy
 {
 public:
-    explicit FrameBuffer(const GLuint width, const GLuint height): NoCopy{}, _width{width}, _height{height}
+    explicit FrameBuffer(const GLuint width, const GLuint height, const bool objectIds = false): NoCopy{},
+        _width{width}, _height{height}
     {
+        auto& state = GLState::get();
         glGenFramebuffers(1, &frameBufferId);
-        glBindFramebuffer(GL_FRAMEBUFFER, frameBufferId);
+        state.bindFramebuffer(frameBufferId);
 
         glGenTextures(1, &_colorBufferTextureId);
-        glBindTexture(GL_TEXTURE_2D, _colorBufferTextureId);
+        state.bindTexture(0, GL_TEXTURE_2D, _colorBufferTextureId);
         glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA, _width, _height, 0,GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -23,7 +28,7 @@ public:
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBufferId);
 
         glGenTextures(1, &_depthBufferTextureId);
-        glBindTexture(GL_TEXTURE_2D, _depthBufferTextureId);
+        state.bindTexture(0, GL_TEXTURE_2D, _depthBufferTextureId);
         glTexImage2D(GL_TEXTURE_2D, 0,GL_DEPTH_COMPONENT, _width, _height, 0,GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -35,13 +40,23 @@ public:
         glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _colorBufferTextureId, 0);
         glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _depthBufferTextureId, 0);
 
-        constexpr GLenum drawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-        glDrawBuffers(1, drawBuffers);
+        if (objectIds)
+        {
+            glGenTextures(1, &_objectIdTextureId);
+            state.bindTexture(0, GL_TEXTURE_2D, _objectIdTextureId);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, _width, _height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, _objectIdTextureId, 0);
+        }
+
+        constexpr GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(objectIds ? 2 : 1, drawBuffers);
 
         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
             throw std::runtime_error("Error on framebuffer creation");
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        state.bindFramebuffer(0);
     }
 
     ~FrameBuffer()
@@ -53,12 +68,14 @@ public:
                                                depthBufferId{other.depthBufferId},
                                                _colorBufferTextureId{other._colorBufferTextureId},
                                                _depthBufferTextureId{other._depthBufferTextureId},
+                                               _objectIdTextureId{other._objectIdTextureId},
                                                _width{other._width}, _height{other._height}
     {
         other.frameBufferId = 0;
         other.depthBufferId = 0;
         other._colorBufferTextureId = 0;
         other._depthBufferTextureId = 0;
+        other._objectIdTextureId = 0;
     };
 
     FrameBuffer& operator=(FrameBuffer&& other) noexcept
@@ -68,6 +85,7 @@ public:
         this->depthBufferId = other.depthBufferId;
         this->_colorBufferTextureId = other._colorBufferTextureId;
         this->_depthBufferTextureId = other._depthBufferTextureId;
+        this->_objectIdTextureId = other._objectIdTextureId;
         this->_width = other._width;
         this->_height = other._height;
 
@@ -75,19 +93,47 @@ public:
         other.depthBufferId = 0;
         other._colorBufferTextureId = 0;
         other._depthBufferTextureId = 0;
+        other._objectIdTextureId = 0;
         return *this;
     };
 
     void bind() const
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, frameBufferId);
-        glViewport(0, 0, _width, _height);
+        auto& state = GLState::get();
+        state.bindFramebuffer(frameBufferId);
+        state.viewport(0, 0, _width, _height);
+    }
+
+    // Bound framebuffer. glClear would leave the integer attachment undefined, every attachment is cleared by itself
+    void clear(const glm::vec4& color) const
+    {
+        glClearBufferfv(GL_COLOR, 0, &color[0]);
+        if (_objectIdTextureId)
+        {
+            constexpr GLuint none[4] = {0, 0, 0, 0};
+            glClearBufferuiv(GL_COLOR, 1, none);
+        }
+        constexpr GLfloat far = 1.0f;
+        glClearBufferfv(GL_DEPTH, 0, &far);
     }
 
     static void unbind(const GLuint width, const GLuint height)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, width, height);
+        auto& state = GLState::get();
+        state.bindFramebuffer(0);
+        state.viewport(0, 0, width, height);
+    }
+
+    // Scaled copy of the color attachment to the window framebuffer, which is left bound
+    void blitToWindow(const GLint width, const GLint height) const
+    {
+        auto& state = GLState::get();
+        state.bindFramebuffer(0);
+        state.viewport(0, 0, width, height);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, frameBufferId);
+        glBlitFramebuffer(0, 0, static_cast<GLint>(_width), static_cast<GLint>(_height), 0, 0, width, height,
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
     }
 
     [[nodiscard]] PboReadBuffer createPboReadColorBuffer() const
@@ -101,19 +147,28 @@ public:
         //TODO: the depth buffer is probably 24 bits
     }
 
+    // Only for a framebuffer created with objectIds
+    [[nodiscard]] PboReadBuffer createPboReadObjectIdBuffer() const
+    {
+        return PboReadBuffer(_width, _height, 1, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, GL_COLOR_ATTACHMENT1);
+    }
+
     [[nodiscard]] GLuint width() const { return _width; }
     [[nodiscard]] GLuint height() const { return _height; }
     [[nodiscard]] GLuint textureId() const { return _colorBufferTextureId; }
     [[nodiscard]] GLuint depthTextureId() const { return _depthBufferTextureId; }
+    [[nodiscard]] GLuint objectIdTextureId() const { return _objectIdTextureId; }
 
 private:
     GLuint frameBufferId{0}, depthBufferId{0}, _colorBufferTextureId{0}, _depthBufferTextureId{0};
+    GLuint _objectIdTextureId{0};
     GLuint _width, _height;
 
     void freeGPUResources()
     {
         if (frameBufferId)
         {
+            GLState::get().forgetFramebuffer(frameBufferId);
             glDeleteFramebuffers(1, &frameBufferId);
             frameBufferId = 0;
         }
@@ -124,13 +179,21 @@ private:
         }
         if (_colorBufferTextureId)
         {
+            GLState::get().forgetTexture(_colorBufferTextureId);
             glDeleteTextures(1, &_colorBufferTextureId);
             _colorBufferTextureId = 0;
         }
         if (_depthBufferTextureId)
         {
+            GLState::get().forgetTexture(_depthBufferTextureId);
             glDeleteTextures(1, &_depthBufferTextureId);
             _depthBufferTextureId = 0;
         }
+        if (_objectIdTextureId)
+        {
+            GLState::get().forgetTexture(_objectIdTextureId);
+            glDeleteTextures(1, &_objectIdTextureId);
+            _objectIdTextureId = 0;
+        }
     }
 };
@@ -0,0 +1,191 @@
+#pragma once
+#include <array>
+#include <utils/nocopy.h>
+
+/*
+Thin cache of the bound GL state.
+Every gpuobject goes through it to bind programs, textures, VAOs and framebuffers so that redundant state changes
+are skipped. Since other code (ImGui, benchmarks) may touch the context directly the cache is invalidated at the start
+of every frame and whenever a new context is created.
+*/
+class GLState : NoCopy
+{
+public:
+    struct Stats
+    {
+        unsigned int issued{0};
+        unsigned int elided{0};
+    };
+
+    static constexpr GLuint MAX_TEXTURE_UNITS = 16;
+
+    static GLState& get()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void useProgram(const GLuint program)
+    {
+        if (program == _program)
+        {
+            _current.elided++;
+            return;
+        }
+        glUseProgram(program);
+        _program = program;
+        _current.issued++;
+    }
+
+    void activeTexture(const GLuint unit)
+    {
+        if (unit == _activeUnit)
+        {
+            _current.elided++;
+            return;
+        }
+        glActiveTexture(GL_TEXTURE0 + unit);
+        _activeUnit = unit;
+        _current.issued++;
+    }
+
+    void bindTexture(const GLuint unit, const GLenum target, const GLuint texture)
+    {
+        const auto targetIdx = targetIndex(target);
+        if (unit >= MAX_TEXTURE_UNITS || targetIdx < 0)
+        {
+            // Not tracked, always forwarded
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, texture);
+            _activeUnit = unit;
+            _current.issued++;
+            return;
+        }
+        auto& bound = _textures[unit][targetIdx];
+        if (bound == texture)
+        {
+            _current.elided++;
+            return;
+        }
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        bound = texture;
+        _current.issued++;
+    }
+
+    void bindVertexArray(const GLuint vao)
+    {
+        if (vao == _vao)
+        {
+            _current.elided++;
+            return;
+        }
+        glBindVertexArray(vao);
+        _vao = vao;
+        _current.issued++;
+    }
+
+    void bindFramebuffer(const GLuint framebuffer)
+    {
+        if (framebuffer == _framebuffer)
+        {
+            _current.elided++;
+            return;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        _framebuffer = framebuffer;
+        _current.issued++;
+    }
+
+    void viewport(const GLint x, const GLint y, const GLsizei width, const GLsizei height)
+    {
+        if (const std::array<GLint, 4> v{x, y, width, height}; v == _viewport)
+        {
+            _current.elided++;
+            return;
+        }
+        glViewport(x, y, width, height);
+        _viewport = {x, y, width, height};
+        _current.issued++;
+    }
+
+    // Deleting a bound object resets the binding to 0, the cache must follow or a recycled name would be elided
+    void forgetProgram(const GLuint program)
+    {
+        if (_program == program)
+            _program = UNKNOWN;
+    }
+
+    void forgetTexture(const GLuint texture)
+    {
+        for (auto& unit : _textures)
+        {
+            for (auto& bound : unit)
+            {
+                if (bound == texture)
+                    bound = 0;
+            }
+        }
+    }
+
+    void forgetVertexArray(const GLuint vao)
+    {
+        if (_vao == vao)
+            _vao = 0;
+    }
+
+    void forgetFramebuffer(const GLuint framebuffer)
+    {
+        if (_framebuffer == framebuffer)
+            _framebuffer = 0;
+    }
+
+    void invalidate()
+    {
+        _program = UNKNOWN;
+        _activeUnit = UNKNOWN;
+        _vao = UNKNOWN;
+        _framebuffer = UNKNOWN;
+        _viewport = {-1, -1, -1, -1};
+        for (auto& unit : _textures)
+            unit.fill(UNKNOWN);
+    }
+
+    void beginFrame()
+    {
+        _lastFrame = _current;
+        _current = {};
+        invalidate();
+    }
+
+    [[nodiscard]] const Stats& lastFrameStats() const { return _lastFrame; }
+    [[nodiscard]] const Stats& currentFrameStats() const { return _current; }
+
+private:
+    static constexpr GLuint UNKNOWN = ~0u;
+    static constexpr int TRACKED_TARGETS = 3;
+
+    GLuint _program{UNKNOWN};
+    GLuint _activeUnit{UNKNOWN};
+    GLuint _vao{UNKNOWN};
+    GLuint _framebuffer{UNKNOWN};
+    std::array<GLint, 4> _viewport{-1, -1, -1, -1};
+    std::array<std::array<GLuint, TRACKED_TARGETS>, MAX_TEXTURE_UNITS> _textures{};
+    Stats _current{}, _lastFrame{};
+
+    GLState(): NoCopy{}
+    {
+        invalidate();
+    }
+
+    static int targetIndex(const GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_3D: return 2;
+        default: return -1;
+        }
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/nocopy.h>
+
+#include "glstate.h"
+
+// Per-instance data of an instanced draw, read in the vertex shader with texelFetch from a samplerBuffer of RGBA32F
+// texels. A buffer texture leaves the vertex layout of the meshes untouched and works with #version 410 shaders
+class InstanceBuffer : NoCopy
+{
+public:
+    InstanceBuffer(): NoCopy{}
+    {
+        glGenBuffers(1, &bufferId);
+        glBindBuffer(GL_TEXTURE_BUFFER, bufferId);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &textureId);
+        GLState::get().bindTexture(0, GL_TEXTURE_BUFFER, textureId);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bufferId);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // The storage is orphaned, the draws still reading the previous content are not waited for
+    void upload(const std::vector<glm::vec4>& texels)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, bufferId);
+        const auto bytes = static_cast<GLsizeiptr>(texels.size() * sizeof(glm::vec4));
+        glBufferData(GL_TEXTURE_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, texels.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void bind(const GLuint unit) const
+    {
+        GLState::get().bindTexture(unit, GL_TEXTURE_BUFFER, textureId);
+    }
+
+    ~InstanceBuffer()
+    {
+        freeGPUResources();
+    }
+
+    InstanceBuffer(InstanceBuffer&& other) noexcept: NoCopy{}, bufferId{other.bufferId}, textureId{other.textureId}
+    {
+        other.bufferId = 0;
+        other.textureId = 0;
+    };
+
+    InstanceBuffer& operator=(InstanceBuffer&& other) noexcept
+    {
+        freeGPUResources();
+        this->bufferId = other.bufferId;
+        this->textureId = other.textureId;
+
+        other.bufferId = 0;
+        other.textureId = 0;
+        return *this;
+    };
+
+private:
+    GLuint bufferId{0};
+    GLuint textureId{0};
+
+    void freeGPUResources()
+    {
+        if (textureId)
+        {
+            GLState::get().forgetTexture(textureId);
+            glDeleteTextures(1, &textureId);
+            textureId = 0;
+        }
+        if (bufferId)
+        {
+            glDeleteBuffers(1, &bufferId);
+            bufferId = 0;
+        }
+    }
+};
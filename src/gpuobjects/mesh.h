@@ -29,13 +29,21 @@ Universita' degli Studi di Milano
 using namespace std;
 
 // Std. Includes
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+#include <utils/mappedfile.h>
+
+#include "glstate.h"
+
 // data structure for vertices
 struct Vertex
 {
@@ -51,6 +59,150 @@ struct Vertex
     glm::vec3 Bitangent;
 };
 
+// Layout of the vertices in the VBO. Attribute locations are the same in every format (see the shaders):
+// 0 position, 1 normal, 2 texture coordinates, 3 tangent, 4 bitangent
+enum class VertexFormat
+{
+    // Vertex as it is, all the attributes as floats (56 bytes)
+    Float,
+    // position only (12 bytes)
+    Position,
+    // position and half float texture coordinates (16 bytes)
+    PositionUV,
+    // position, normal and tangent packed as GL_INT_2_10_10_10_REV, half float texture coordinates (24 bytes)
+    // there is no bitangent, the tangent w holds the sign to rebuild it as cross(normal, tangent.xyz) * tangent.w
+    Full,
+};
+
+// What happens to the CPU copy of the vertices and indices once they are in the GPU buffers
+enum class MeshResidency
+{
+    // Mesh keeps its vertices and indices vectors, for the features that read the geometry on the CPU
+    KeepCpuCopy,
+    // the vectors are freed after the upload, the geometry lives only in the VBO and EBO
+    GpuOnly,
+};
+
+// bits of Shader::activeAttributes(), one per attribute location
+namespace VertexAttribute
+{
+    constexpr GLuint POSITION = 1 << 0, NORMAL = 1 << 1, TEX_COORDS = 1 << 2, TANGENT = 1 << 3, BITANGENT = 1 << 4;
+}
+
+// smallest format with all the attributes read by a vertex shader
+inline VertexFormat vertexFormatFor(const GLuint activeAttributes)
+{
+    if (activeAttributes & VertexAttribute::BITANGENT)
+        return VertexFormat::Float;
+    if (activeAttributes & (VertexAttribute::NORMAL | VertexAttribute::TANGENT))
+        return VertexFormat::Full;
+    if (activeAttributes & VertexAttribute::TEX_COORDS)
+        return VertexFormat::PositionUV;
+    return VertexFormat::Position;
+}
+
+inline size_t vertexFormatStride(const VertexFormat format)
+{
+    switch (format)
+    {
+    case VertexFormat::Position: return 12;
+    case VertexFormat::PositionUV: return 16;
+    case VertexFormat::Full: return 24;
+    default: return sizeof(Vertex);
+    }
+}
+
+// Part of the index buffer with one level of detail, LOD 0 is the full mesh
+struct LodRange
+{
+    GLuint firstIndex;
+    GLuint indexCount;
+};
+
+// CPU side data of a mesh, produced by the importer (possibly on a loader thread) and uploaded by Mesh
+struct MeshData
+{
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+    // axis aligned bounding box in model space
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+
+    // Filled by pack() for the formats other than Float, it replaces the vertices in the VBO
+    VertexFormat format = VertexFormat::Float;
+    vector<unsigned char> packedVertices;
+    // Index ranges of the levels of detail, all in the same index buffer and on the same vertices
+    // Empty if the mesh has only LOD 0 made of all the indices
+    vector<LodRange> lods;
+
+    // When the data comes from the mesh cache it is read in place from the mapped file and the vectors above stay empty
+    shared_ptr<const MappedFile> mapping;
+    const Vertex* mappedVertices = nullptr;
+    size_t mappedVertexCount = 0;
+    const GLuint* mappedIndices = nullptr;
+    size_t mappedIndexCount = 0;
+
+    [[nodiscard]] const Vertex* vertexData() const { return mapping ? mappedVertices : vertices.data(); }
+    [[nodiscard]] size_t vertexCount() const { return mapping ? mappedVertexCount : vertices.size(); }
+    [[nodiscard]] const GLuint* indexData() const { return mapping ? mappedIndices : indices.data(); }
+    [[nodiscard]] size_t indexCount() const { return mapping ? mappedIndexCount : indices.size(); }
+    // What goes in the VBO: the packed vertices for the formats other than Float
+    [[nodiscard]] const void* gpuVertexData() const
+    {
+        return format == VertexFormat::Float ? static_cast<const void*>(vertexData()) : packedVertices.data();
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return vertexCount() * vertexFormatStride(format) + indexCount() * sizeof(GLuint);
+    }
+
+    // Converts the vertices to a compact format, meant to run on the loader threads
+    void pack(const VertexFormat vertexFormat)
+    {
+        format = vertexFormat;
+        if (format == VertexFormat::Float)
+            return;
+        const auto stride = vertexFormatStride(format);
+        const auto count = vertexCount();
+        const auto source = vertexData();
+        packedVertices.resize(count * stride);
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto& v = source[i];
+            unsigned char* out = packedVertices.data() + i * stride;
+            std::memcpy(out, &v.Position, 12);
+            if (format == VertexFormat::PositionUV)
+            {
+                const GLuint uv = glm::packHalf2x16(v.TexCoords);
+                std::memcpy(out + 12, &uv, 4);
+            }
+            else if (format == VertexFormat::Full)
+            {
+                const float handedness = glm::dot(glm::cross(v.Normal, v.Tangent), v.Bitangent) < 0.0f ? -1.0f : 1.0f;
+                const GLuint normal = glm::packSnorm3x10_1x2(glm::vec4(v.Normal, 0.0f));
+                const GLuint tangent = glm::packSnorm3x10_1x2(glm::vec4(v.Tangent, handedness));
+                const GLuint uv = glm::packHalf2x16(v.TexCoords);
+                std::memcpy(out + 12, &normal, 4);
+                std::memcpy(out + 16, &tangent, 4);
+                std::memcpy(out + 20, &uv, 4);
+            }
+        }
+    }
+
+    void computeBounds()
+    {
+        if (vertices.empty())
+            return;
+        boundsMin = boundsMax = vertices[0].Position;
+        for (const auto& v : vertices)
+        {
+            boundsMin = glm::min(boundsMin, v.Position);
+            boundsMax = glm::max(boundsMax, v.Position);
+        }
+    }
+};
+
 /////////////////// MESH class ///////////////////////
 class Mesh
 {
@@ -58,6 +210,11 @@ public:
     // data structures for vertices, and indices of vertices (for faces)
     vector<Vertex> vertices;
     vector<GLuint> indices;
+    // axis aligned bounding box in model space
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    // layout of the VBO, the vertices vector keeps the Float layout
+    VertexFormat format = VertexFormat::Float;
     // VAO
     GLuint VAO;
 
@@ -77,7 +234,87 @@ public:
     Mesh(vector<Vertex>& vertices, vector<GLuint>& indices) noexcept
         : vertices(std::move(vertices)), indices(std::move(indices))
     {
-        this->setupMesh();
+        this->setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+    }
+
+    // Merges all the parts (the meshes of a model, all packed in the same format) in a single VAO, VBO and EBO:
+    // the vertices of every part start at its base vertex and its indices are not offset, so a draw of the whole
+    // mesh is a single glMultiDrawElementsBaseVertex call with one command per part.
+    // Empties the parts. Data read from the mesh cache goes from the mapped file straight to the GPU buffers.
+    // With a packed format (see MeshData::pack) the VBO gets the packed vertices
+    // With MeshResidency::GpuOnly the vertices and indices vectors stay empty
+    explicit Mesh(vector<MeshData>& parts, const MeshResidency residency = MeshResidency::KeepCpuCopy) noexcept
+        : format(parts.empty() ? VertexFormat::Float : parts[0].format)
+    {
+        size_t vertexCount = 0, indexCount = 0;
+        for (const auto& part : parts)
+        {
+            vertexCount += part.vertexCount();
+            indexCount += part.indexCount();
+        }
+        this->setupMesh(nullptr, vertexCount, nullptr, indexCount);
+
+        // every part is copied to its own range of the buffers, the EBO is reached through the VAO
+        const auto stride = vertexFormatStride(this->format);
+        GLState::get().bindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        size_t firstVertex = 0, firstIndex = 0;
+        vector<GLint> baseVertices;
+        vector<size_t> firstIndices;
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            auto& part = parts[i];
+            glBufferSubData(GL_ARRAY_BUFFER, firstVertex * stride, part.vertexCount() * stride, part.gpuVertexData());
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(GLuint), part.indexCount() * sizeof(GLuint),
+                            part.indexData());
+            baseVertices.push_back(static_cast<GLint>(firstVertex));
+            firstIndices.push_back(firstIndex);
+            firstVertex += part.vertexCount();
+            firstIndex += part.indexCount();
+
+            this->boundsMin = i == 0 ? part.boundsMin : glm::min(this->boundsMin, part.boundsMin);
+            this->boundsMax = i == 0 ? part.boundsMax : glm::max(this->boundsMax, part.boundsMax);
+            if (part.lods.empty())
+                part.lods.push_back(LodRange{0, static_cast<GLuint>(part.indexCount())});
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLState::get().bindVertexArray(0);
+
+        // one batch of draw commands per level of detail, the parts with fewer levels use their coarsest one
+        size_t lodCount = 0;
+        for (const auto& part : parts)
+            lodCount = std::max(lodCount, part.lods.size());
+        if (lodCount > 0)
+            this->batches.assign(lodCount, DrawBatch{});
+        for (size_t lod = 0; lod < lodCount; lod++)
+        {
+            auto& batch = this->batches[lod];
+            for (size_t i = 0; i < parts.size(); i++)
+            {
+                const auto& range = parts[i].lods[std::min(lod, parts[i].lods.size() - 1)];
+                batch.counts.push_back(static_cast<GLsizei>(range.indexCount));
+                batch.offsets.push_back(
+                    reinterpret_cast<const void*>((firstIndices[i] + range.firstIndex) * sizeof(GLuint)));
+                batch.baseVertices.push_back(baseVertices[i]);
+                batch.triangleCount += range.indexCount / 3;
+            }
+        }
+
+        // the CPU copy keeps the Float layout, with the indices of every part relative to its base vertex
+        if (residency == MeshResidency::KeepCpuCopy && parts.size() == 1 && !parts[0].mapping)
+        {
+            this->vertices = std::move(parts[0].vertices);
+            this->indices = std::move(parts[0].indices);
+        }
+        else if (residency == MeshResidency::KeepCpuCopy)
+        {
+            for (auto& part : parts)
+            {
+                this->vertices.insert(this->vertices.end(), part.vertexData(), part.vertexData() + part.vertexCount());
+                this->indices.insert(this->indices.end(), part.indexData(), part.indexData() + part.indexCount());
+            }
+        }
+        parts.clear();
     }
 
     // We implement a user-defined move constructor and move assignment
@@ -93,8 +330,9 @@ public:
     // In our case it will no longer imply ownership of the GPU resources and its vectors will be empty.
     Mesh(Mesh&& move) noexcept
     // Calls move for both vectors, which internally consists of a simple pointer swap between the new instance and the source one.
-        : vertices(std::move(move.vertices)), indices(std::move(move.indices)),
-          VAO(move.VAO), VBO(move.VBO), EBO(move.EBO)
+        : vertices(std::move(move.vertices)), indices(std::move(move.indices)), boundsMin(move.boundsMin),
+          boundsMax(move.boundsMax), format(move.format), VAO(move.VAO), VBO(move.VBO), EBO(move.EBO),
+          bufferBytes(move.bufferBytes), batches(std::move(move.batches))
     {
         move.VAO = 0; // We *could* set VBO and EBO to 0 too,
         // but since we bring all the 3 values around we can use just one of them to check ownership of the 3 resources.
@@ -110,9 +348,14 @@ public:
         {
             vertices = std::move(move.vertices);
             indices = std::move(move.indices);
+            boundsMin = move.boundsMin;
+            boundsMax = move.boundsMax;
+            format = move.format;
             VAO = move.VAO;
             VBO = move.VBO;
             EBO = move.EBO;
+            bufferBytes = move.bufferBytes;
+            batches = std::move(move.batches);
 
             move.VAO = 0;
         }
@@ -133,19 +376,80 @@ public:
     //////////////////////////////////////////
 
     // rendering of mesh
-    void Draw() const
+    // lod is clamped to the coarsest level available
+    void Draw(const int lod = 0) const
     {
-        // VAO is made "active"
-        glBindVertexArray(this->VAO);
-        // rendering of data in the VAO
-        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, nullptr);
-        // VAO is "detached"
-        glBindVertexArray(0);
+        const auto& batch = this->batch(lod);
+        // VAO is made "active", the state cache skips the bind when the same mesh is drawn again (e.g. in a second pass)
+        GLState::get().bindVertexArray(this->VAO);
+        // rendering of data in the VAO, all the parts of the mesh with a single call
+        // the VAO is not detached: every code path binds its own VAO through GLState before touching the EBO binding
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), GL_UNSIGNED_INT, batch.offsets.data(),
+                                      static_cast<GLsizei>(batch.counts.size()), batch.baseVertices.data());
+    }
+
+    // same as Draw, every part is drawn instanceCount times: the shader tells the copies apart by gl_InstanceID
+    // there is no multi-draw for instances before GL 4.3 indirect draws, one call per part of the mesh
+    void DrawInstanced(const int lod, const GLsizei instanceCount) const
+    {
+        const auto& batch = this->batch(lod);
+        GLState::get().bindVertexArray(this->VAO);
+        for (size_t i = 0; i < batch.counts.size(); i++)
+        {
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, batch.counts[i], GL_UNSIGNED_INT, batch.offsets[i],
+                                              instanceCount, batch.baseVertices[i]);
+        }
+    }
+
+    [[nodiscard]] int lodCount() const
+    {
+        return static_cast<int>(this->batches.size());
+    }
+
+    [[nodiscard]] size_t triangleCount(const int lod) const
+    {
+        return this->batch(lod).triangleCount;
+    }
+
+    // host memory held by the CPU copy of the geometry
+    [[nodiscard]] size_t cpuBytes() const
+    {
+        return this->vertices.capacity() * sizeof(Vertex) + this->indices.capacity() * sizeof(GLuint);
+    }
+
+    // size of the VBO and the EBO
+    [[nodiscard]] size_t gpuBytes() const
+    {
+        return this->bufferBytes;
+    }
+
+    // frees the CPU copy, the mesh can still be drawn
+    void releaseCpuCopy()
+    {
+        vector<Vertex>().swap(this->vertices);
+        vector<GLuint>().swap(this->indices);
     }
 
 private:
+    // Arguments of the glMultiDrawElementsBaseVertex call that draws one level of detail, one command per part
+    struct DrawBatch
+    {
+        vector<GLsizei> counts;
+        vector<const void*> offsets;
+        vector<GLint> baseVertices;
+        size_t triangleCount = 0;
+    };
+
     // VBO and EBO
     GLuint VBO, EBO;
+    size_t bufferBytes = 0;
+    // one batch per level of detail
+    vector<DrawBatch> batches;
+
+    [[nodiscard]] const DrawBatch& batch(const int lod) const
+    {
+        return this->batches[std::min(static_cast<size_t>(std::max(lod, 0)), this->batches.size() - 1)];
+    }
 
     //////////////////////////////////////////
     // buffer objects\arrays are initialized
@@ -153,44 +457,83 @@ private:
     // https://learnopengl.com/#!Getting-started/Hello-Triangle
     // (in different parts of the page), or here:
     // http://www.informit.com/articles/article.aspx?p=1377833&seqNum=8
-    void setupMesh()
+    // with null data the buffers are only allocated
+    void setupMesh(const void* vertexData, const size_t vertexCount, const GLuint* indexData, const size_t indexCount)
     {
+        if (this->batches.empty())
+        {
+            this->batches.resize(1);
+            this->batches[0].counts.push_back(static_cast<GLsizei>(indexCount));
+            this->batches[0].offsets.push_back(nullptr);
+            this->batches[0].baseVertices.push_back(0);
+            this->batches[0].triangleCount = indexCount / 3;
+        }
+        this->bufferBytes = vertexCount * vertexFormatStride(this->format) + indexCount * sizeof(GLuint);
+
         // we create the buffers
         glGenVertexArrays(1, &this->VAO);
         glGenBuffers(1, &this->VBO);
         glGenBuffers(1, &this->EBO);
 
         // VAO is made "active"
-        glBindVertexArray(this->VAO);
+        GLState::get().bindVertexArray(this->VAO);
         // we copy data in the VBO - we must set the data dimension, and the pointer to the structure cointaining the data
         glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * vertexFormatStride(this->format), vertexData, GL_STATIC_DRAW);
         // we copy data in the EBO - we must set the data dimension, and the pointer to the structure cointaining the data
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), indexData, GL_STATIC_DRAW);
 
         // we set in the VAO the pointers to the different vertex attributes (with the relative offsets inside the data structure)
-        // vertex positions
         // these will be the positions to use in the layout qualifiers in the shaders ("layout (location = ...)"")
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-        // Normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-        // Texture Coordinates
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-        // Tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
-        // Bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
+        // the attributes missing from a compact format are left disabled, the shader that chose the format does not read them
+        const auto stride = static_cast<GLsizei>(vertexFormatStride(this->format));
+        switch (this->format)
+        {
+        case VertexFormat::Float:
+            // vertex positions
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
+            // Normals
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offsetof(Vertex, Normal));
+            // Texture Coordinates
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offsetof(Vertex, TexCoords));
+            // Tangent
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offsetof(Vertex, Tangent));
+            // Bitangent
+            glEnableVertexAttribArray(4);
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offsetof(Vertex, Bitangent));
+            break;
+        case VertexFormat::Position:
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
+            break;
+        case VertexFormat::PositionUV:
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (GLvoid*)12);
+            break;
+        case VertexFormat::Full:
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
+            // normalized: the signed 10 bit values are mapped to [-1, 1]
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid*)12);
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid*)16);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (GLvoid*)20);
+            break;
+        }
 
         // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
-        glBindVertexArray(0);
+        GLState::get().bindVertexArray(0);
     }
 
     //////////////////////////////////////////
@@ -201,6 +544,7 @@ private:
         // so there's no need for deleting.
         if (VAO)
         {
+            GLState::get().forgetVertexArray(this->VAO);
             glDeleteVertexArrays(1, &this->VAO);
             glDeleteBuffers(1, &this->VBO);
             glDeleteBuffers(1, &this->EBO);
@@ -0,0 +1,180 @@
+#pragma once
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utils/diskcache.h>
+#include <utils/mappedfile.h>
+
+#include "mesh.h"
+
+/*
+Binary cache of imported meshes, one file per (model path, import options variant) under ./.cache/meshes.
+Layout: FileHeader, meshCount MeshRecords (with the LOD index ranges), then for every mesh the interleaved Vertex blob
+and the GLuint index blob, each aligned to 16 bytes. The file is mapped and the blobs are handed to glBufferData as they are.
+An entry is rebuilt when the format version or the Vertex layout change, or when the source file size or modification
+time differ from the ones recorded in the header.
+*/
+class MeshCache
+{
+public:
+    // Bump when the layout of the file or the content of the imported data changes
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t MAX_LODS = 8;
+
+    static bool load(const string& path, const uint64_t variant, vector<MeshData>& meshes)
+    {
+        if (!diskCacheEnabled())
+            return false;
+        const auto cachePath = entryPath(path, variant);
+        if (!std::filesystem::exists(cachePath))
+            return false;
+        auto file = std::make_shared<const MappedFile>(cachePath.string());
+        const auto base = file->data();
+        const auto size = file->size();
+
+        FileHeader header{};
+        if (!base || size < sizeof(FileHeader))
+            return discard(cachePath);
+        std::memcpy(&header, base, sizeof(FileHeader));
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION ||
+            header.vertexSize != sizeof(Vertex))
+            return discard(cachePath);
+        if (header.sourceKey != sourceFileKey(path))
+            return false;
+        if (sizeof(FileHeader) + header.meshCount * sizeof(MeshRecord) > size)
+            return discard(cachePath);
+
+        vector<MeshData> result(header.meshCount);
+        for (uint32_t i = 0; i < header.meshCount; i++)
+        {
+            MeshRecord record{};
+            std::memcpy(&record, base + sizeof(FileHeader) + i * sizeof(MeshRecord), sizeof(MeshRecord));
+            if (record.vertexOffset % alignof(Vertex) != 0 || record.indexOffset % alignof(GLuint) != 0 ||
+                record.vertexOffset + record.vertexCount * sizeof(Vertex) > size ||
+                record.indexOffset + record.indexCount * sizeof(GLuint) > size)
+                return discard(cachePath);
+            auto& m = result[i];
+            m.mapping = file;
+            m.mappedVertices = reinterpret_cast<const Vertex*>(base + record.vertexOffset);
+            m.mappedVertexCount = record.vertexCount;
+            m.mappedIndices = reinterpret_cast<const GLuint*>(base + record.indexOffset);
+            m.mappedIndexCount = record.indexCount;
+            m.boundsMin = glm::vec3{record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]};
+            m.boundsMax = glm::vec3{record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]};
+            if (record.lodCount > MAX_LODS)
+                return discard(cachePath);
+            for (uint32_t l = 0; l < record.lodCount; l++)
+            {
+                if (static_cast<uint64_t>(record.lodFirstIndex[l]) + record.lodIndexCount[l] > record.indexCount)
+                    return discard(cachePath);
+                m.lods.push_back(LodRange{record.lodFirstIndex[l], record.lodIndexCount[l]});
+            }
+        }
+        meshes = std::move(result);
+        return true;
+    }
+
+    static void store(const string& path, const uint64_t variant, const vector<MeshData>& meshes)
+    {
+        if (!diskCacheEnabled())
+            return;
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.vertexSize = sizeof(Vertex);
+        header.sourceKey = sourceFileKey(path);
+        header.meshCount = static_cast<uint32_t>(meshes.size());
+
+        vector<MeshRecord> records(meshes.size());
+        uint64_t offset = align(sizeof(FileHeader) + records.size() * sizeof(MeshRecord));
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const auto& m = meshes[i];
+            auto& r = records[i];
+            r.vertexOffset = offset;
+            r.vertexCount = m.vertexCount();
+            offset = align(offset + r.vertexCount * sizeof(Vertex));
+            r.indexOffset = offset;
+            r.indexCount = m.indexCount();
+            offset = align(offset + r.indexCount * sizeof(GLuint));
+            for (int c = 0; c < 3; c++)
+            {
+                r.boundsMin[c] = m.boundsMin[c];
+                r.boundsMax[c] = m.boundsMax[c];
+            }
+            r.lodCount = static_cast<uint32_t>(std::min<size_t>(m.lods.size(), MAX_LODS));
+            for (uint32_t l = 0; l < r.lodCount; l++)
+            {
+                r.lodFirstIndex[l] = m.lods[l].firstIndex;
+                r.lodIndexCount[l] = m.lods[l].indexCount;
+            }
+        }
+
+        static constexpr char padding[ALIGNMENT] = {};
+        vector<std::pair<const void*, size_t>> parts;
+        parts.emplace_back(&header, sizeof(FileHeader));
+        parts.emplace_back(records.data(), records.size() * sizeof(MeshRecord));
+        uint64_t written = sizeof(FileHeader) + records.size() * sizeof(MeshRecord);
+        const auto pad = [&](const uint64_t to)
+        {
+            parts.emplace_back(padding, to - written);
+            written = to;
+        };
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            pad(records[i].vertexOffset);
+            parts.emplace_back(meshes[i].vertexData(), records[i].vertexCount * sizeof(Vertex));
+            written += records[i].vertexCount * sizeof(Vertex);
+            pad(records[i].indexOffset);
+            parts.emplace_back(meshes[i].indexData(), records[i].indexCount * sizeof(GLuint));
+            written += records[i].indexCount * sizeof(GLuint);
+        }
+        if (!writeFileAtomic(entryPath(path, variant), parts))
+            std::cout << "Failed to write the mesh cache for " << path << std::endl;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'T', 'G', 'P', 'M', 'S', 'H', '\0'};
+    static constexpr uint64_t ALIGNMENT = 16;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexSize;
+        // size and modification time of the source file
+        uint64_t sourceKey;
+        uint32_t meshCount;
+        uint32_t reserved;
+    };
+
+    struct MeshRecord
+    {
+        uint64_t vertexOffset, vertexCount;
+        uint64_t indexOffset, indexCount;
+        float boundsMin[3], boundsMax[3];
+        uint32_t lodCount;
+        uint32_t lodFirstIndex[MAX_LODS], lodIndexCount[MAX_LODS];
+    };
+
+    static uint64_t align(const uint64_t offset)
+    {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    static std::filesystem::path entryPath(const string& path, const uint64_t variant)
+    {
+        return diskCachePath("meshes", fnv1a(&variant, sizeof(variant), fnv1a(path)), ".mesh");
+    }
+
+    static bool discard(const std::filesystem::path& cachePath)
+    {
+        std::cout << "Discarding invalid mesh cache " << cachePath.string() << std::endl;
+        std::error_code ec;
+        std::filesystem::remove(cachePath, ec);
+        return false;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "mesh.h"
+
+/*
+Import-time reordering of the triangles and vertices of a mesh:
+1. triangles are reordered for the post-transform vertex cache with Tipsify
+   (Sander, Nehab, Barczak - Fast Triangle Reordering for Vertex Locality and Reduced Overdraw, 2007)
+2. the triangles are split in clusters at the points where the cache is flushed anyway, or where cutting costs little in
+   cache efficiency, and the clusters are sorted so that the ones facing outwards are drawn first, reducing overdraw
+3. vertices are renumbered in order of first use so that the vertex fetch reads the VBO almost sequentially
+*/
+class MeshOptimizer
+{
+public:
+    // Typical size of the post-transform cache, in vertices
+    static constexpr unsigned int CACHE_SIZE = 16;
+    // A cluster may be cut where its ACMR is below OVERDRAW_THRESHOLD * the ACMR of the whole mesh
+    static constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+    static void optimize(MeshData& mesh)
+    {
+        if (mesh.indices.size() < 3 || mesh.vertices.empty())
+            return;
+        std::vector<size_t> clusters;
+        mesh.indices = tipsify(mesh.indices, mesh.vertices.size(), CACHE_SIZE, clusters);
+        optimizeOverdraw(mesh, clusters);
+        optimizeVertexFetch(mesh);
+    }
+
+    // Average cache miss ratio: transformed vertices per triangle with a FIFO cache, 0.5 is the best case on large
+    // meshes, 3 the worst
+    static float acmr(const std::vector<GLuint>& indices, const size_t vertexCount,
+                      const unsigned int cacheSize = CACHE_SIZE)
+    {
+        if (indices.size() < 3)
+            return 0;
+        return static_cast<float>(cacheMisses(indices, 0, indices.size() / 3, vertexCount, cacheSize)) /
+            static_cast<float>(indices.size() / 3);
+    }
+
+    // Triangle order for the vertex cache. clusters gets the index of the first triangle of every cluster, a new one
+    // starts every time the algorithm has to jump to a vertex that is not in the cache
+    static std::vector<GLuint> tipsify(const std::vector<GLuint>& indices, const size_t vertexCount,
+                                       const unsigned int cacheSize, std::vector<size_t>& clusters)
+    {
+        const size_t triangleCount = indices.size() / 3;
+        // triangles adjacent to every vertex, stored as offsets/list
+        std::vector<unsigned int> liveTriangles(vertexCount, 0);
+        for (const auto i : indices)
+            liveTriangles[i]++;
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+        std::vector<GLuint> adjacency(indices.size());
+        {
+            std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t t = 0; t < triangleCount; t++)
+                for (int c = 0; c < 3; c++)
+                    adjacency[fill[indices[t * 3 + c]]++] = static_cast<GLuint>(t);
+        }
+
+        std::vector<unsigned int> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<GLuint> deadEnd;
+        std::vector<GLuint> candidates;
+        std::vector<GLuint> result;
+        result.reserve(indices.size());
+        clusters.clear();
+
+        unsigned int time = cacheSize + 1;
+        size_t cursor = 0;
+        long fanning = 0;
+        bool newCluster = true;
+        while (fanning >= 0)
+        {
+            candidates.clear();
+            for (auto a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+            {
+                const auto t = adjacency[a];
+                if (emitted[t])
+                    continue;
+                if (newCluster)
+                {
+                    clusters.push_back(result.size() / 3);
+                    newCluster = false;
+                }
+                for (int c = 0; c < 3; c++)
+                {
+                    const auto v = indices[t * 3 + c];
+                    result.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+                    if (time - cacheTime[v] > cacheSize)
+                    {
+                        cacheTime[v] = time;
+                        time++;
+                    }
+                }
+                emitted[t] = true;
+            }
+
+            // next fanning vertex: the candidate that stays in the cache while all its triangles are emitted
+            long next = -1;
+            int best = -1;
+            for (const auto v : candidates)
+            {
+                if (liveTriangles[v] == 0)
+                    continue;
+                int priority = 0;
+                if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                    priority = static_cast<int>(time - cacheTime[v]);
+                if (priority > best)
+                {
+                    best = priority;
+                    next = v;
+                }
+            }
+            if (next == -1)
+            {
+                next = skipDeadEnd(liveTriangles, deadEnd, cursor);
+                newCluster = true;
+            }
+            fanning = next;
+        }
+        return result;
+    }
+
+private:
+    static long skipDeadEnd(const std::vector<unsigned int>& liveTriangles, std::vector<GLuint>& deadEnd,
+                            size_t& cursor)
+    {
+        while (!deadEnd.empty())
+        {
+            const auto v = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[v] > 0)
+                return v;
+        }
+        while (cursor < liveTriangles.size())
+        {
+            if (liveTriangles[cursor] > 0)
+                return static_cast<long>(cursor);
+            cursor++;
+        }
+        return -1;
+    }
+
+    static size_t cacheMisses(const std::vector<GLuint>& indices, const size_t firstTriangle, const size_t lastTriangle,
+                              const size_t vertexCount, const unsigned int cacheSize)
+    {
+        // FIFO cache: a vertex is a hit if it entered the cache less than cacheSize misses ago
+        std::vector<size_t> entered(vertexCount, 0);
+        size_t misses = 0;
+        for (size_t i = firstTriangle * 3; i < lastTriangle * 3; i++)
+        {
+            const auto v = indices[i];
+            if (entered[v] == 0 || misses - entered[v] >= cacheSize)
+            {
+                misses++;
+                entered[v] = misses;
+            }
+        }
+        return misses;
+    }
+
+    static void optimizeOverdraw(MeshData& mesh, std::vector<size_t>& clusters)
+    {
+        const size_t triangleCount = mesh.indices.size() / 3;
+        const auto meshAcmr = acmr(mesh.indices, mesh.vertices.size());
+
+        // soft boundaries: a cluster is cut where its own ACMR dropped below the threshold, so the cut costs at most a
+        // few cache misses
+        std::vector<size_t> cuts;
+        clusters.push_back(triangleCount);
+        // entered: miss count at which the vertex entered the cache, the cache is considered flushed at every cut
+        std::vector<size_t> entered(mesh.vertices.size(), 0);
+        size_t totalMisses = 0;
+        for (size_t c = 0; c + 1 < clusters.size(); c++)
+        {
+            size_t flushedAt = totalMisses, start = clusters[c];
+            cuts.push_back(start);
+            for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    const auto v = mesh.indices[t * 3 + k];
+                    if (entered[v] <= flushedAt || totalMisses - entered[v] >= CACHE_SIZE)
+                    {
+                        totalMisses++;
+                        entered[v] = totalMisses;
+                    }
+                }
+                const auto triangles = t + 1 - start;
+                const auto misses = totalMisses - flushedAt;
+                if (t + 1 < clusters[c + 1] && triangles > 1 &&
+                    static_cast<float>(misses) / static_cast<float>(triangles) < OVERDRAW_THRESHOLD * meshAcmr)
+                {
+                    cuts.push_back(t + 1);
+                    start = t + 1;
+                    flushedAt = totalMisses;
+                }
+            }
+        }
+        cuts.push_back(triangleCount);
+
+        // clusters facing away from the mesh center are likely in front of the others and drawn first
+        glm::vec3 meshCenter{0.0f};
+        for (const auto& v : mesh.vertices)
+            meshCenter += v.Position;
+        meshCenter /= static_cast<float>(mesh.vertices.size());
+
+        const size_t clusterCount = cuts.size() - 1;
+        std::vector<float> sortKey(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++)
+        {
+            glm::vec3 center{0.0f}, normal{0.0f};
+            float area = 0;
+            for (size_t t = cuts[c]; t < cuts[c + 1]; t++)
+            {
+                const auto& p0 = mesh.vertices[mesh.indices[t * 3]].Position;
+                const auto& p1 = mesh.vertices[mesh.indices[t * 3 + 1]].Position;
+                const auto& p2 = mesh.vertices[mesh.indices[t * 3 + 2]].Position;
+                // length of the cross product is twice the area, the sum weights normals and centers by area
+                const auto n = glm::cross(p1 - p0, p2 - p0);
+                const auto a = glm::length(n);
+                center += (p0 + p1 + p2) / 3.0f * a;
+                normal += n;
+                area += a;
+            }
+            if (area > 0)
+                center /= area;
+            const auto len = glm::length(normal);
+            sortKey[c] = len > 0 ? glm::dot(center - meshCenter, normal / len) : 0;
+        }
+
+        std::vector<size_t> order(clusterCount);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b)
+        {
+            return sortKey[a] > sortKey[b];
+        });
+        std::vector<GLuint> sorted;
+        sorted.reserve(mesh.indices.size());
+        for (const auto c : order)
+            sorted.insert(sorted.end(), mesh.indices.begin() + cuts[c] * 3, mesh.indices.begin() + cuts[c + 1] * 3);
+        mesh.indices = std::move(sorted);
+    }
+
+    static void optimizeVertexFetch(MeshData& mesh)
+    {
+        constexpr GLuint UNUSED = ~0u;
+        std::vector<GLuint> remap(mesh.vertices.size(), UNUSED);
+        std::vector<Vertex> vertices;
+        vertices.reserve(mesh.vertices.size());
+        for (auto& i : mesh.indices)
+        {
+            if (remap[i] == UNUSED)
+            {
+                remap[i] = static_cast<GLuint>(vertices.size());
+                vertices.push_back(mesh.vertices[i]);
+            }
+            i = remap[i];
+        }
+        mesh.vertices = std::move(vertices);
+    }
+};
@@ -0,0 +1,484 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/threadpool.h>
+
+#include "mesh.h"
+
+/*
+Signed distance field of a model, for the collisions of the particles with it (see particlecollisions.h). Baked from
+LOD 0 of all the meshes on a grid of resolution^3 points with the same spacing on every axis, covering the model space
+bounding box and MARGIN_CELLS more cells on every side. Inside is negative, distances are in model units.
+A point stores (distance, gradient) as a vec4: a trilinear sample is 8 loads of 16 bytes and gives the distance and the
+direction out of the model at once. Apart, every point keeps the texture coordinates of its closest surface point, to
+test the dissolve mask there (see CollisionMask).
+The bake runs ranges of slices of the grid on the workers of the pool it receives, from a loader job too:
+1. distance to the closest triangle through a bounding volume hierarchy of the triangles. The query of a point starts
+   from the closest triangle of the previous point of the row, which prunes most of the tree. The texture coordinates
+   are interpolated at the closest point of that triangle
+2. sign: rows of points along each axis are crossed by the triangles, a point with an odd number of crossings before it
+   is inside. A point is inside when it is for at least 2 of the 3 axes, a hole in the mesh only breaks the rows that go
+   through it. The rows pass a small fraction of a cell away from the points, never exactly through an edge or a vertex
+   of an axis aligned mesh
+3. gradient by central differences of the signed distance
+*/
+class MeshSdf
+{
+public:
+    static constexpr int MARGIN_CELLS = 3;
+
+    MeshSdf() = default;
+
+    MeshSdf(const int resolution, const glm::vec3& origin, const float cellSize, std::vector<glm::vec4>&& cells,
+            std::vector<glm::vec2>&& uvs):
+        n{resolution}, _origin{origin}, _cellSize{cellSize}, cells{std::move(cells)}, uvs{std::move(uvs)}
+    {
+    }
+
+    // Empty if the meshes have no triangles. resolution is at least 2 * MARGIN_CELLS + 2
+    static MeshSdf bake(const std::vector<MeshData>& meshes, const int resolution,
+                        ThreadPool& pool = ThreadPool::shared())
+    {
+        Bvh bvh(meshes);
+        if (bvh.triangles.empty())
+            return MeshSdf{};
+        const auto n = std::max(resolution, 2 * MARGIN_CELLS + 2);
+        const auto extent = bvh.max - bvh.min;
+        const auto size = std::max(extent.x, std::max(extent.y, extent.z));
+        auto cellSize = size / static_cast<float>(n - 1 - 2 * MARGIN_CELLS);
+        if (cellSize <= 0)
+            cellSize = 1;
+        const auto origin = (bvh.min + bvh.max) * 0.5f - glm::vec3{cellSize * static_cast<float>(n - 1) * 0.5f};
+        const auto point = [&](const int x, const int y, const int z)
+        {
+            return origin + glm::vec3{static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)} * cellSize;
+        };
+        const auto index = [n](const int x, const int y, const int z)
+        {
+            return (static_cast<size_t>(z) * n + y) * n + x;
+        };
+        const auto count = static_cast<size_t>(n) * n * n;
+
+        std::vector<float> distances(count);
+        std::vector<glm::vec2> uvs(count);
+        pool.parallelFor(static_cast<size_t>(n), 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto z = static_cast<int>(begin); z < static_cast<int>(end); z++)
+            {
+                uint32_t closest = 0;
+                for (int y = 0; y < n; y++)
+                {
+                    for (int x = 0; x < n; x++)
+                    {
+                        const auto p = point(x, y, z);
+                        distances[index(x, y, z)] = std::sqrt(bvh.closest(p, closest));
+                        uvs[index(x, y, z)] = bvh.uv(p, closest);
+                    }
+                }
+            }
+        });
+
+        std::vector<uint8_t> insideVotes(count, 0);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const auto bins = crossingBins(bvh, axis, n, origin, cellSize);
+            pool.parallelFor(static_cast<size_t>(n), 1, [&](const size_t begin, const size_t end)
+            {
+                for (auto k = static_cast<int>(begin); k < static_cast<int>(end); k++)
+                {
+                    voteRowsInside(bvh, bins[k], axis, k, n, origin, cellSize, [&](const int i, const int j)
+                    {
+                        int c[3];
+                        c[axis] = i;
+                        c[(axis + 1) % 3] = j;
+                        c[(axis + 2) % 3] = k;
+                        insideVotes[index(c[0], c[1], c[2])]++;
+                    });
+                }
+            });
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (insideVotes[i] >= 2)
+                distances[i] = -distances[i];
+        }
+
+        std::vector<glm::vec4> cells(count);
+        const auto at = [&](const int x, const int y, const int z)
+        {
+            return distances[index(std::clamp(x, 0, n - 1), std::clamp(y, 0, n - 1), std::clamp(z, 0, n - 1))];
+        };
+        pool.parallelFor(static_cast<size_t>(n), 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto z = static_cast<int>(begin); z < static_cast<int>(end); z++)
+            {
+                for (int y = 0; y < n; y++)
+                {
+                    for (int x = 0; x < n; x++)
+                    {
+                        // one-sided at the borders of the grid
+                        const auto span = [n, cellSize](const int c)
+                        {
+                            return static_cast<float>(std::min(c + 1, n - 1) - std::max(c - 1, 0)) * cellSize;
+                        };
+                        const auto gradient = glm::vec3{
+                            (at(x + 1, y, z) - at(x - 1, y, z)) / span(x),
+                            (at(x, y + 1, z) - at(x, y - 1, z)) / span(y),
+                            (at(x, y, z + 1) - at(x, y, z - 1)) / span(z)
+                        };
+                        cells[index(x, y, z)] = glm::vec4{at(x, y, z), gradient.x, gradient.y, gradient.z};
+                    }
+                }
+            }
+        });
+        return MeshSdf(n, origin, cellSize, std::move(cells), std::move(uvs));
+    }
+
+    // (distance, gradient) at p in model space, trilinear. Outside the grid the distance is the max float and the
+    // gradient 0
+    [[nodiscard]] glm::vec4 sample(const glm::vec3& p) const
+    {
+        const auto f = (p - _origin) / _cellSize;
+        const auto last = static_cast<float>(n - 1);
+        // also false for NaN
+        if (!(f.x >= 0 && f.y >= 0 && f.z >= 0 && f.x <= last && f.y <= last && f.z <= last))
+            return glm::vec4{std::numeric_limits<float>::max(), 0, 0, 0};
+        const int ix = std::min(static_cast<int>(f.x), n - 2);
+        const int iy = std::min(static_cast<int>(f.y), n - 2);
+        const int iz = std::min(static_cast<int>(f.z), n - 2);
+        const auto t = f - glm::vec3{static_cast<float>(ix), static_cast<float>(iy), static_cast<float>(iz)};
+        const auto* c = cells.data() + (static_cast<size_t>(iz) * n + iy) * n + ix;
+        const size_t row = n, slice = static_cast<size_t>(n) * n;
+        const auto x00 = glm::mix(c[0], c[1], t.x);
+        const auto x10 = glm::mix(c[row], c[row + 1], t.x);
+        const auto x01 = glm::mix(c[slice], c[slice + 1], t.x);
+        const auto x11 = glm::mix(c[slice + row], c[slice + row + 1], t.x);
+        return glm::mix(glm::mix(x00, x10, t.y), glm::mix(x01, x11, t.y), t.z);
+    }
+
+    // Texture coordinates of the surface point closest to p in model space, from the nearest point of the grid: an
+    // interpolation would blend across the seams of the texture. p must be inside the grid, see sample()
+    [[nodiscard]] const glm::vec2& surfaceUv(const glm::vec3& p) const
+    {
+        const auto f = (p - _origin) / _cellSize + 0.5f;
+        const auto last = static_cast<float>(n - 1);
+        const auto ix = static_cast<size_t>(std::clamp(f.x, 0.0f, last));
+        const auto iy = static_cast<size_t>(std::clamp(f.y, 0.0f, last));
+        const auto iz = static_cast<size_t>(std::clamp(f.z, 0.0f, last));
+        return uvs[(iz * n + iy) * n + ix];
+    }
+
+    // points per side, 0 for an empty field
+    [[nodiscard]] int resolution() const
+    {
+        return n;
+    }
+
+    // model space position of point (0, 0, 0)
+    [[nodiscard]] const glm::vec3& origin() const
+    {
+        return _origin;
+    }
+
+    [[nodiscard]] float cellSize() const
+    {
+        return _cellSize;
+    }
+
+    // resolution^3 points of (distance, gradient), x first
+    [[nodiscard]] const std::vector<glm::vec4>& data() const
+    {
+        return cells;
+    }
+
+    // resolution^3 texture coordinates, in the order of data()
+    [[nodiscard]] const std::vector<glm::vec2>& uvData() const
+    {
+        return uvs;
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return cells.size() * sizeof(glm::vec4) + uvs.size() * sizeof(glm::vec2);
+    }
+
+private:
+    int n{0};
+    glm::vec3 _origin{0};
+    float _cellSize{1};
+    std::vector<glm::vec4> cells;
+    std::vector<glm::vec2> uvs;
+
+    struct Triangle
+    {
+        glm::vec3 a, b, c;
+        glm::vec2 uvA, uvB, uvC;
+    };
+
+    // Median split over the centroids, leaves of at most LEAF_SIZE triangles
+    struct Bvh
+    {
+        static constexpr uint32_t LEAF_SIZE = 4;
+
+        struct Node
+        {
+            glm::vec3 min, max;
+            // leaves: triangles[first, first + count). Inner nodes: count 0, the left child is the next node
+            uint32_t first, count;
+            uint32_t right;
+        };
+
+        std::vector<Triangle> triangles;
+        std::vector<Node> nodes;
+        glm::vec3 min{0}, max{0};
+
+        explicit Bvh(const std::vector<MeshData>& meshes)
+        {
+            for (const auto& mesh : meshes)
+            {
+                const auto* vertices = mesh.vertexData();
+                const auto* indices = mesh.indexData();
+                const size_t first = mesh.lods.empty() ? 0 : mesh.lods[0].firstIndex;
+                const size_t indexCount = mesh.lods.empty() ? mesh.indexCount() : mesh.lods[0].indexCount;
+                for (size_t i = first; i + 2 < first + indexCount; i += 3)
+                {
+                    const auto& a = vertices[indices[i]];
+                    const auto& b = vertices[indices[i + 1]];
+                    const auto& c = vertices[indices[i + 2]];
+                    triangles.push_back(Triangle{
+                        a.Position, b.Position, c.Position, a.TexCoords, b.TexCoords, c.TexCoords
+                    });
+                }
+            }
+            if (triangles.empty())
+                return;
+            nodes.reserve(triangles.size() / LEAF_SIZE * 2 + 1);
+            build(0, static_cast<uint32_t>(triangles.size()));
+            min = nodes[0].min;
+            max = nodes[0].max;
+        }
+
+        // Squared distance from p to the closest triangle, closest is the index of a triangle close to p on input and
+        // of the closest one on output
+        float closest(const glm::vec3& p, uint32_t& closest) const
+        {
+            auto best = distance2(p, triangles[closest]);
+            uint32_t stack[64];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0)
+            {
+                const auto& node = nodes[stack[--top]];
+                if (boxDistance2(p, node) >= best)
+                    continue;
+                if (node.count > 0)
+                {
+                    for (auto t = node.first; t < node.first + node.count; t++)
+                    {
+                        if (const auto d = distance2(p, triangles[t]); d < best)
+                        {
+                            best = d;
+                            closest = t;
+                        }
+                    }
+                    continue;
+                }
+                const auto left = static_cast<uint32_t>(&node - nodes.data()) + 1;
+                const auto leftDistance = boxDistance2(p, nodes[left]);
+                const auto rightDistance = boxDistance2(p, nodes[node.right]);
+                // the nearer child is visited first
+                if (leftDistance < rightDistance)
+                {
+                    stack[top++] = node.right;
+                    stack[top++] = left;
+                }
+                else
+                {
+                    stack[top++] = left;
+                    stack[top++] = node.right;
+                }
+            }
+            return best;
+        }
+
+        // Texture coordinates at the point of triangle t closest to p
+        [[nodiscard]] glm::vec2 uv(const glm::vec3& p, const uint32_t t) const
+        {
+            const auto& tri = triangles[t];
+            const auto weights = closestWeights(p, tri);
+            return tri.uvA * weights.x + tri.uvB * weights.y + tri.uvC * weights.z;
+        }
+
+    private:
+        uint32_t build(const uint32_t begin, const uint32_t end)
+        {
+            const auto nodeIndex = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node{});
+            glm::vec3 boundsMin{std::numeric_limits<float>::max()}, boundsMax{-std::numeric_limits<float>::max()};
+            glm::vec3 centroidMin = boundsMin, centroidMax = boundsMax;
+            for (auto t = begin; t < end; t++)
+            {
+                const auto& tri = triangles[t];
+                boundsMin = glm::min(boundsMin, glm::min(tri.a, glm::min(tri.b, tri.c)));
+                boundsMax = glm::max(boundsMax, glm::max(tri.a, glm::max(tri.b, tri.c)));
+                const auto centroid = (tri.a + tri.b + tri.c) / 3.0f;
+                centroidMin = glm::min(centroidMin, centroid);
+                centroidMax = glm::max(centroidMax, centroid);
+            }
+            nodes[nodeIndex].min = boundsMin;
+            nodes[nodeIndex].max = boundsMax;
+            if (end - begin <= LEAF_SIZE)
+            {
+                nodes[nodeIndex].first = begin;
+                nodes[nodeIndex].count = end - begin;
+                return nodeIndex;
+            }
+            const auto spread = centroidMax - centroidMin;
+            const int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : spread.y >= spread.z ? 1 : 2;
+            const auto middle = begin + (end - begin) / 2;
+            std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+                             [axis](const Triangle& l, const Triangle& r)
+                             {
+                                 return l.a[axis] + l.b[axis] + l.c[axis] < r.a[axis] + r.b[axis] + r.c[axis];
+                             });
+            build(begin, middle);
+            const auto right = build(middle, end);
+            nodes[nodeIndex].count = 0;
+            nodes[nodeIndex].right = right;
+            return nodeIndex;
+        }
+
+        static float boxDistance2(const glm::vec3& p, const Node& node)
+        {
+            const auto d = glm::max(glm::max(node.min - p, p - node.max), glm::vec3{0});
+            return glm::dot(d, d);
+        }
+
+        // Squared distance from p to t
+        static float distance2(const glm::vec3& p, const Triangle& t)
+        {
+            const auto w = closestWeights(p, t);
+            const auto d = p - (t.a * w.x + t.b * w.y + t.c * w.z);
+            return glm::dot(d, d);
+        }
+
+        // Barycentric weights of the point of t closest to p (Ericson, Real-Time Collision Detection, 5.1.5)
+        static glm::vec3 closestWeights(const glm::vec3& p, const Triangle& t)
+        {
+            const auto ab = t.b - t.a, ac = t.c - t.a, ap = p - t.a;
+            const auto d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+            if (d1 <= 0 && d2 <= 0)
+                return glm::vec3{1, 0, 0};
+            const auto bp = p - t.b;
+            const auto d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+            if (d3 >= 0 && d4 <= d3)
+                return glm::vec3{0, 1, 0};
+            const auto vc = d1 * d4 - d3 * d2;
+            if (vc <= 0 && d1 >= 0 && d3 <= 0)
+            {
+                const auto v = d1 / (d1 - d3);
+                return glm::vec3{1 - v, v, 0};
+            }
+            const auto cp = p - t.c;
+            const auto d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+            if (d6 >= 0 && d5 <= d6)
+                return glm::vec3{0, 0, 1};
+            const auto vb = d5 * d2 - d1 * d6;
+            if (vb <= 0 && d2 >= 0 && d6 <= 0)
+            {
+                const auto w = d2 / (d2 - d6);
+                return glm::vec3{1 - w, 0, w};
+            }
+            const auto va = d3 * d6 - d5 * d4;
+            if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+            {
+                const auto w = (d4 - d3) / (d4 - d3 + d5 - d6);
+                return glm::vec3{0, 1 - w, w};
+            }
+            const auto denominator = va + vb + vc;
+            if (denominator <= 0)
+            {
+                // degenerate: the closest vertex
+                const auto a2 = glm::dot(ap, ap), b2 = glm::dot(bp, bp), c2 = glm::dot(cp, cp);
+                if (a2 <= b2 && a2 <= c2)
+                    return glm::vec3{1, 0, 0};
+                return b2 <= c2 ? glm::vec3{0, 1, 0} : glm::vec3{0, 0, 1};
+            }
+            const auto v = vb / denominator, w = vc / denominator;
+            return glm::vec3{1 - v - w, v, w};
+        }
+    };
+
+    // Offset of the rows from the points, in cells, along the two other axes
+    static constexpr float ROW_OFFSET_U = 1.414213e-3f, ROW_OFFSET_V = 1.732051e-3f;
+
+    // For the rows along axis: the triangles that can cross the rows of every plane k of the third axis
+    static std::vector<std::vector<uint32_t>> crossingBins(const Bvh& bvh, const int axis, const int n,
+                                                          const glm::vec3& origin, const float cellSize)
+    {
+        const int v = (axis + 2) % 3;
+        std::vector<std::vector<uint32_t>> bins(n);
+        for (uint32_t t = 0; t < bvh.triangles.size(); t++)
+        {
+            const auto& tri = bvh.triangles[t];
+            const auto low = (std::min(tri.a[v], std::min(tri.b[v], tri.c[v])) - origin[v]) / cellSize - ROW_OFFSET_V;
+            const auto high = (std::max(tri.a[v], std::max(tri.b[v], tri.c[v])) - origin[v]) / cellSize - ROW_OFFSET_V;
+            for (int k = std::max(0, static_cast<int>(std::ceil(low))); k <= std::min(n - 1, static_cast<int>(
+                     std::floor(high))); k++)
+                bins[k].push_back(t);
+        }
+        return bins;
+    }
+
+    // inside(i, j) for the points of plane k with an odd number of crossings before them along axis
+    template <typename Inside>
+    static void voteRowsInside(const Bvh& bvh, const std::vector<uint32_t>& triangles, const int axis, const int k,
+                               const int n, const glm::vec3& origin, const float cellSize, const Inside& inside)
+    {
+        const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        const auto rowV = origin[v] + (static_cast<float>(k) + ROW_OFFSET_V) * cellSize;
+        // crossings of every row j, as a coordinate along axis
+        std::vector<std::vector<float>> crossings(n);
+        for (const auto t : triangles)
+        {
+            const auto& tri = bvh.triangles[t];
+            const auto low = (std::min(tri.a[u], std::min(tri.b[u], tri.c[u])) - origin[u]) / cellSize - ROW_OFFSET_U;
+            const auto high = (std::max(tri.a[u], std::max(tri.b[u], tri.c[u])) - origin[u]) / cellSize - ROW_OFFSET_U;
+            for (int j = std::max(0, static_cast<int>(std::ceil(low))); j <= std::min(n - 1, static_cast<int>(
+                     std::floor(high))); j++)
+            {
+                const auto rowU = origin[u] + (static_cast<float>(j) + ROW_OFFSET_U) * cellSize;
+                // twice the signed areas of the projections of the sub-triangles opposite to each vertex
+                const auto edge = [&](const glm::vec3& p1, const glm::vec3& p2)
+                {
+                    return (p2[u] - p1[u]) * (rowV - p1[v]) - (p2[v] - p1[v]) * (rowU - p1[u]);
+                };
+                const auto wa = edge(tri.b, tri.c), wb = edge(tri.c, tri.a), wc = edge(tri.a, tri.b);
+                const auto sum = wa + wb + wc;
+                if (sum == 0 || !((wa >= 0 && wb >= 0 && wc >= 0) || (wa <= 0 && wb <= 0 && wc <= 0)))
+                    continue;
+                crossings[j].push_back((wa * tri.a[axis] + wb * tri.b[axis] + wc * tri.c[axis]) / sum);
+            }
+        }
+        for (int j = 0; j < n; j++)
+        {
+            auto& row = crossings[j];
+            if (row.empty())
+                continue;
+            std::sort(row.begin(), row.end());
+            size_t before = 0;
+            for (int i = 0; i < n; i++)
+            {
+                const auto coordinate = origin[axis] + static_cast<float>(i) * cellSize;
+                while (before < row.size() && row[before] < coordinate)
+                    before++;
+                if (before % 2 == 1)
+                    inside(i, j);
+            }
+        }
+    }
+};
@@ -0,0 +1,263 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+
+/*
+Quadric error metric simplifier (Garland, Heckbert - Surface Simplification Using Quadric Error Metrics, 1997) with
+half-edge collapses: a vertex is merged into one of its neighbours, so every level of detail indexes the same vertex
+buffer and only needs its own index range.
+Collapses are done in passes: the cheapest collapses that do not share vertices are applied together, then the costs
+are recomputed. Vertices on open borders and on UV seams (several vertices with the same position) are never removed,
+collapses that would flip a triangle are rejected.
+*/
+class MeshSimplifier
+{
+public:
+    // Index buffer with about targetIndexCount indices (more if the mesh cannot be simplified that far)
+    static std::vector<GLuint> simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+                                        const size_t targetIndexCount)
+    {
+        const size_t vertexCount = vertices.size();
+        std::vector<GLuint> result = indices;
+        if (result.size() <= targetIndexCount)
+            return result;
+
+        const auto locked = lockedVertices(vertices, indices);
+        std::vector<Quadric> quadrics(vertexCount);
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            const auto& p0 = vertices[indices[t]].Position;
+            const auto& p1 = vertices[indices[t + 1]].Position;
+            const auto& p2 = vertices[indices[t + 2]].Position;
+            const auto n = glm::cross(p1 - p0, p2 - p0);
+            const auto area = glm::length(n);
+            if (area <= 0)
+                continue;
+            Quadric q(n / area, p0, area);
+            for (int c = 0; c < 3; c++)
+                quadrics[indices[t + c]] += q;
+        }
+
+        std::vector<GLuint> remap(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<Collapse> collapses;
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1);
+        std::vector<GLuint> adjacency;
+        for (int pass = 0; pass < MAX_PASSES && result.size() > targetIndexCount; pass++)
+        {
+            buildAdjacency(result, vertexCount, adjacencyOffsets, adjacency);
+
+            // cheapest direction of every edge
+            collapses.clear();
+            for (size_t t = 0; t < result.size(); t += 3)
+            {
+                for (int e = 0; e < 3; e++)
+                {
+                    const auto a = result[t + e], b = result[t + (e + 1) % 3];
+                    // every interior edge is seen twice, once per direction
+                    if (a > b)
+                        continue;
+                    Collapse best{0, 0, -1};
+                    for (const auto& [from, to] : {std::pair{a, b}, std::pair{b, a}})
+                    {
+                        if (locked[from])
+                            continue;
+                        Quadric q = quadrics[from];
+                        q += quadrics[to];
+                        const auto cost = q.error(vertices[to].Position);
+                        if (best.cost < 0 || cost < best.cost)
+                            best = Collapse{from, to, cost};
+                    }
+                    if (best.cost >= 0)
+                        collapses.push_back(best);
+                }
+            }
+            if (collapses.empty())
+                break;
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& l, const Collapse& r)
+            {
+                return l.cost < r.cost;
+            });
+
+            // independent collapses: no vertex of the triangles around a collapsed vertex is used twice in a pass
+            for (GLuint v = 0; v < vertexCount; v++)
+                remap[v] = v;
+            std::fill(touched.begin(), touched.end(), false);
+            const size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+            size_t removed = 0;
+            for (const auto& c : collapses)
+            {
+                if (touched[c.from] || touched[c.to])
+                    continue;
+                if (flips(vertices, result, adjacencyOffsets, adjacency, c.from, c.to))
+                    continue;
+                for (auto a = adjacencyOffsets[c.from]; a < adjacencyOffsets[c.from + 1]; a++)
+                {
+                    const auto t = adjacency[a] * 3;
+                    bool shared = false;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        touched[result[t + k]] = true;
+                        shared |= result[t + k] == c.to;
+                    }
+                    removed += shared;
+                }
+                remap[c.from] = c.to;
+                quadrics[c.to] += quadrics[c.from];
+                if (removed >= trianglesToRemove)
+                    break;
+            }
+
+            // apply the collapses, dropping the triangles that became degenerate
+            size_t write = 0;
+            for (size_t t = 0; t < result.size(); t += 3)
+            {
+                const auto a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+            if (write == result.size())
+                break;
+            result.resize(write);
+        }
+        return result;
+    }
+
+private:
+    static constexpr int MAX_PASSES = 64;
+
+    struct Collapse
+    {
+        GLuint from, to;
+        double cost;
+    };
+
+    // symmetric 4x4 matrix of the sum of the squared distances from a set of planes
+    struct Quadric
+    {
+        double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+        Quadric() = default;
+
+        Quadric(const glm::vec3& normal, const glm::vec3& point, const double weight)
+        {
+            const double a = normal.x, b = normal.y, c = normal.z;
+            const double d = -glm::dot(normal, point);
+            a2 = a * a * weight, ab = a * b * weight, ac = a * c * weight, ad = a * d * weight;
+            b2 = b * b * weight, bc = b * c * weight, bd = b * d * weight;
+            c2 = c * c * weight, cd = c * d * weight;
+            d2 = d * d * weight;
+        }
+
+        Quadric& operator+=(const Quadric& o)
+        {
+            a2 += o.a2, ab += o.ab, ac += o.ac, ad += o.ad, b2 += o.b2;
+            bc += o.bc, bd += o.bd, c2 += o.c2, cd += o.cd, d2 += o.d2;
+            return *this;
+        }
+
+        [[nodiscard]] double error(const glm::vec3& p) const
+        {
+            const double x = p.x, y = p.y, z = p.z;
+            const double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y + 2 * bc * y * z +
+                2 * bd * y + c2 * z * z + 2 * cd * z + d2;
+            return std::max(e, 0.0);
+        }
+    };
+
+    static std::vector<bool> lockedVertices(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+    {
+        std::vector<bool> locked(vertices.size(), false);
+
+        // UV seams: vertices split by the importer because of different attributes at the same position
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3& p) const
+            {
+                uint32_t bits[3];
+                std::memcpy(bits, &p, sizeof(bits));
+                return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+            }
+        };
+        std::unordered_map<glm::vec3, GLuint, PositionHash> firstAtPosition;
+        firstAtPosition.reserve(vertices.size());
+        for (GLuint v = 0; v < vertices.size(); v++)
+        {
+            const auto [iter, inserted] = firstAtPosition.emplace(vertices[v].Position, v);
+            if (!inserted)
+            {
+                locked[v] = true;
+                locked[iter->second] = true;
+            }
+        }
+
+        // open borders: edges used by a single triangle
+        std::unordered_map<uint64_t, int> edgeUses;
+        edgeUses.reserve(indices.size());
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            for (int e = 0; e < 3; e++)
+            {
+                const uint64_t a = indices[t + e], b = indices[t + (e + 1) % 3];
+                edgeUses[a < b ? a << 32 | b : b << 32 | a]++;
+            }
+        }
+        for (const auto& [edge, uses] : edgeUses)
+        {
+            if (uses == 1)
+            {
+                locked[edge >> 32] = true;
+                locked[edge & 0xffffffffu] = true;
+            }
+        }
+        return locked;
+    }
+
+    static void buildAdjacency(const std::vector<GLuint>& indices, const size_t vertexCount,
+                               std::vector<size_t>& offsets, std::vector<GLuint>& adjacency)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (const auto i : indices)
+            offsets[i + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        adjacency.resize(indices.size());
+        std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = static_cast<GLuint>(i / 3);
+    }
+
+    // true if moving from onto to turns any of the remaining triangles around from upside down
+    static bool flips(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+                      const std::vector<size_t>& offsets, const std::vector<GLuint>& adjacency, const GLuint from,
+                      const GLuint to)
+    {
+        for (auto a = offsets[from]; a < offsets[from + 1]; a++)
+        {
+            const auto t = adjacency[a] * 3;
+            glm::vec3 before[3], after[3];
+            bool hasTo = false;
+            for (int k = 0; k < 3; k++)
+            {
+                const auto v = indices[t + k];
+                hasTo |= v == to;
+                before[k] = vertices[v].Position;
+                after[k] = v == from ? vertices[to].Position : before[k];
+            }
+            if (hasTo)
+                continue;
+            const auto n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+            const auto n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(n0, n1) <= 0)
+                return true;
+        }
+        return false;
+    }
+};
@@ -26,15 +26,94 @@ using namespace std;
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <filesystem>
+
 // we include the Mesh class, which manages the "OpenGL side" (= creation and allocation of VBO, VAO, EBO buffers) of the loading of models
 #include "mesh.h"
+#include "meshcache.h"
+#include "meshoptimizer.h"
+#include "meshsimplifier.h"
+#include "objloader.h"
+#include "sdfcache.h"
+
+// Options that change the result of an import, part of the key of the model cache together with the path
+struct ModelImportOptions
+{
+    // Details on the different flags to use are available at: http://assimp.sourceforge.net/lib_html/postprocess_8h.html#a64795260b95f5a4b3f3dc1be4f52e410
+    // VERY IMPORTANT: calculation of Tangents and Bitangents is possible only if the model has Texture Coordinates
+    // If they are not present, the calculation is skipped (but no error is provided in the following checks!)
+    unsigned int postProcessFlags = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs |
+        aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
+    // layout of the vertices on the GPU, usually vertexFormatFor(shader.activeAttributes())
+    VertexFormat vertexFormat = VertexFormat::Float;
+    // reorders triangles and vertices for the vertex cache and overdraw (see meshoptimizer.h)
+    bool optimize = true;
+    // simplified levels of detail, see Model::LOD_RATIOS
+    bool generateLods = true;
+    // KeepCpuCopy only for the models whose geometry is read on the CPU
+    MeshResidency residency = MeshResidency::GpuOnly;
+    // .obj files are read by ObjLoader, Assimp is used for the other formats and when ObjLoader fails
+    bool nativeObjLoader = true;
+    // points per side of the signed distance field baked for the particle collisions (see meshsdf.h), 0 for none
+    int sdfResolution = 0;
+
+    bool operator==(const ModelImportOptions& other) const
+    {
+        return postProcessFlags == other.postProcessFlags && vertexFormat == other.vertexFormat &&
+            optimize == other.optimize && generateLods == other.generateLods && residency == other.residency &&
+            nativeObjLoader == other.nativeObjLoader && sdfResolution == other.sdfResolution;
+    }
+
+    // the options that change the data stored in the mesh cache
+    [[nodiscard]] uint64_t meshCacheVariant() const
+    {
+        return static_cast<uint64_t>(postProcessFlags) | static_cast<uint64_t>(optimize) << 32 |
+            static_cast<uint64_t>(generateLods) << 33 | static_cast<uint64_t>(nativeObjLoader) << 34;
+    }
+};
+
+namespace std
+{
+    template <>
+    struct hash<ModelImportOptions>
+    {
+        size_t operator()(const ModelImportOptions& options) const noexcept
+        {
+            return hash<uint64_t>{}(options.meshCacheVariant()) ^ static_cast<size_t>(options.vertexFormat) << 28 ^
+                static_cast<size_t>(options.residency) << 24 ^ static_cast<size_t>(options.sdfResolution) << 40;
+        }
+    };
+}
+
+// CPU side result of an import: it does not touch OpenGL, so it can be produced on a loader thread
+struct ModelData
+{
+    vector<MeshData> meshes;
+    MeshResidency residency = MeshResidency::GpuOnly;
+    // nullptr unless ModelImportOptions::sdfResolution is set
+    shared_ptr<const MeshSdf> sdf;
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        size_t size = 0;
+        for (const auto& m : meshes)
+            size += m.byteSize();
+        return size;
+    }
+};
 
 /////////////////// MODEL class ///////////////////////
 class Model
 {
 public:
-    // at the end of loading, we will have a vector of Mesh class instances
-    vector<Mesh> meshes;
+    // fraction of the triangles of the full mesh kept by LOD 1, 2, 3
+    static constexpr float LOD_RATIOS[] = {0.5f, 0.25f, 0.12f};
+
+    // at the end of loading, all the meshes of the file are merged in a single Mesh instance (one VAO, VBO and EBO)
+    // nullptr for an empty model
+    unique_ptr<Mesh> mesh;
+    // signed distance field of the model space geometry, nullptr unless ModelImportOptions::sdfResolution is set
+    shared_ptr<const MeshSdf> sdf;
 
     //////////////////////////////////////////
 
@@ -62,19 +141,124 @@ public:
     // to notice that Model class is not strictly following the Rules of 5
     // https://en.cppreference.com/w/cpp/language/rule_of_three
     // because we are not writing a user-defined destructor.
-    Model(const string& path)
+    Model(const string& path, const ModelImportOptions& options = {})
+    {
+        if (const auto data = import(path, options))
+            this->upload(*data);
+    }
+
+    // GL upload of data imported with import(), empties data
+    explicit Model(ModelData&& data)
+    {
+        this->upload(data);
+    }
+
+    // empty model, draws nothing (used as placeholder while the real model loads)
+    Model() = default;
+
+
+    //////////////////////////////////////////
+
+    // model rendering: a single draw call for all the meshes of the model
+    // meshes with fewer levels of detail are drawn with their coarsest one
+    void Draw(const int lod = 0) const
+    {
+        if (this->mesh)
+            this->mesh->Draw(lod);
+    }
+
+    void DrawInstanced(const int lod, const GLsizei instanceCount) const
+    {
+        if (this->mesh)
+            this->mesh->DrawInstanced(lod, instanceCount);
+    }
+
+    [[nodiscard]] int lodCount() const
+    {
+        return this->mesh ? this->mesh->lodCount() : 0;
+    }
+
+    [[nodiscard]] size_t triangleCount(const int lod) const
+    {
+        return this->mesh ? this->mesh->triangleCount(lod) : 0;
+    }
+
+    // memory accounting, see MeshResidency
+    [[nodiscard]] size_t cpuBytes() const
     {
-        this->loadModel(path);
+        return (this->mesh ? this->mesh->cpuBytes() : 0) + (this->sdf ? this->sdf->byteSize() : 0);
     }
 
+    [[nodiscard]] size_t gpuBytes() const
+    {
+        return this->mesh ? this->mesh->gpuBytes() : 0;
+    }
+
+    // bounding sphere of the model space bounding box of all the meshes, radius 0 if the model is empty
+    [[nodiscard]] glm::vec4 boundingSphere() const
+    {
+        if (!this->mesh)
+            return glm::vec4{0.0f};
+        const auto& min = this->mesh->boundsMin;
+        const auto& max = this->mesh->boundsMax;
+        return glm::vec4{(min + max) * 0.5f, glm::length(max - min) * 0.5f};
+    }
 
     //////////////////////////////////////////
 
-    // model rendering: calls rendering methods of each instance of Mesh class in the vector
-    void Draw() const
+    // loading of the model from the mesh cache (see meshcache.h) or, on a miss, from the source file with importSource()
+    // It does not call OpenGL, it is safe to call it from any thread. Returns nullptr on errors
+    static unique_ptr<ModelData> import(const string& path, const ModelImportOptions& options = {})
     {
-        for (GLuint i = 0; i < this->meshes.size(); i++)
-            this->meshes[i].Draw();
+        auto data = make_unique<ModelData>();
+        if (!MeshCache::load(path, options.meshCacheVariant(), data->meshes))
+        {
+            data = importSource(path, options);
+            if (!data)
+                return nullptr;
+            // the cache keeps the Float layout, every vertex format is packed from it
+            MeshCache::store(path, options.meshCacheVariant(), data->meshes);
+        }
+        if (options.sdfResolution > 0)
+            data->sdf = loadSdf(path, options, data->meshes);
+        for (auto& m : data->meshes)
+            m.pack(options.vertexFormat);
+        data->residency = options.residency;
+        return data;
+    }
+
+    // loading of the model using Assimp library. Nodes are processed to build the CPU side data of each mesh
+    // .obj files are read by ObjLoader (see objloader.h) unless options.nativeObjLoader is false
+    static unique_ptr<ModelData> importSource(const string& path, const ModelImportOptions& options = {})
+    {
+        auto data = make_unique<ModelData>();
+        const auto extension = std::filesystem::path(path).extension().string();
+        const bool isObj = extension == ".obj" || extension == ".OBJ";
+        if (!(options.nativeObjLoader && isObj && ObjLoader::load(path, options.postProcessFlags, data->meshes)))
+        {
+            // loading using Assimp
+            // N.B.: it is possible to set, if needed, some operations to be performed by Assimp after the loading (see ModelImportOptions).
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, options.postProcessFlags);
+
+            // check for errors (see comment above)
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+            {
+                cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+                return nullptr;
+            }
+
+            // we start the recursive processing of nodes in the Assimp data structure
+            processNode(scene->mRootNode, scene, *data);
+        }
+        for (auto& m : data->meshes)
+        {
+            if (options.optimize)
+                MeshOptimizer::optimize(m);
+            if (options.generateLods)
+                buildLods(m, options.optimize);
+        }
+        return data;
     }
 
     //////////////////////////////////////////
@@ -82,34 +266,59 @@ public:
 
 private:
     //////////////////////////////////////////
-    // loading of the model using Assimp library. Nodes are processed to build a vector of Mesh class instances
-    void loadModel(string path)
-    {
-        // loading using Assimp
-        // N.B.: it is possible to set, if needed, some operations to be performed by Assimp after the loading.
-        // Details on the different flags to use are available at: http://assimp.sourceforge.net/lib_html/postprocess_8h.html#a64795260b95f5a4b3f3dc1be4f52e410
-        // VERY IMPORTANT: calculation of Tangents and Bitangents is possible only if the model has Texture Coordinates
-        // If they are not present, the calculation is skipped (but no error is provided in the following checks!)
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(
-            path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs |
-            aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
-
-        // check for errors (see comment above)
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    // creation of the GL buffers shared by all the meshes
+    void upload(ModelData& data)
+    {
+        if (!data.meshes.empty())
+            this->mesh = make_unique<Mesh>(data.meshes, data.residency);
+        this->sdf = std::move(data.sdf);
+    }
+
+    // from the SDF cache (see sdfcache.h) or baked from LOD 0 of the meshes and stored in the cache
+    static shared_ptr<const MeshSdf> loadSdf(const string& path, const ModelImportOptions& options,
+                                             const vector<MeshData>& meshes)
+    {
+        auto sdf = make_shared<MeshSdf>();
+        if (!SdfCache::load(path, options.meshCacheVariant(), options.sdfResolution, *sdf))
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            *sdf = MeshSdf::bake(meshes, options.sdfResolution);
+            if (sdf->resolution() == 0)
+                return nullptr;
+            SdfCache::store(path, options.meshCacheVariant(), options.sdfResolution, *sdf);
         }
+        return sdf;
+    }
 
-        // we start the recursive processing of nodes in the Assimp data structure
-        this->processNode(scene->mRootNode, scene);
+    //////////////////////////////////////////
+
+    // appends the simplified levels of detail to the index buffer, every level is simplified from the previous one
+    // a level is skipped if the simplifier could not remove at least 10% of the triangles of the previous one
+    static void buildLods(MeshData& mesh, const bool optimize)
+    {
+        const auto fullCount = static_cast<GLuint>(mesh.indices.size());
+        mesh.lods = {LodRange{0, fullCount}};
+        vector<GLuint> previous = mesh.indices;
+        for (const auto ratio : LOD_RATIOS)
+        {
+            const auto target = static_cast<size_t>(fullCount / 3 * ratio) * 3;
+            auto lod = MeshSimplifier::simplify(mesh.vertices, previous, target);
+            if (lod.size() > previous.size() * 9 / 10)
+                break;
+            if (optimize)
+            {
+                vector<size_t> clusters;
+                lod = MeshOptimizer::tipsify(lod, mesh.vertices.size(), MeshOptimizer::CACHE_SIZE, clusters);
+            }
+            mesh.lods.push_back(LodRange{static_cast<GLuint>(mesh.indices.size()), static_cast<GLuint>(lod.size())});
+            mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+            previous = std::move(lod);
+        }
     }
 
     //////////////////////////////////////////
 
     // Recursive processing of nodes of Assimp data structure
-    void processNode(aiNode* node, const aiScene* scene)
+    static void processNode(aiNode* node, const aiScene* scene, ModelData& data)
     {
         // we process each mesh inside the current node
         for (GLuint i = 0; i < node->mNumMeshes; i++)
@@ -118,24 +327,24 @@ private:
             // "Scene" contains all the data. Class node is used only to point to one or more mesh inside the scene and to maintain informations on relations between nodes
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
             // we start processing of the Assimp mesh using processMesh method.
-            // the result (an istance of the Mesh class) is added to the vector
+            // the result (the CPU side data of the mesh) is added to the vector
             // we use emplace_back instead as push_back, so to have the instance created directly in the
             // vector memory, without the creation of a temp copy.
             // https://en.cppreference.com/w/cpp/container/vector/emplace_back
-            this->meshes.emplace_back(processMesh(mesh));
+            data.meshes.emplace_back(processMesh(mesh));
         }
         // we then recursively process each of the children nodes
         for (GLuint i = 0; i < node->mNumChildren; i++)
         {
-            this->processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, data);
         }
     }
 
     //////////////////////////////////////////
 
-    // Processing of the Assimp mesh in order to obtain an "OpenGL mesh"
-    // = we create and allocate the buffers used to send mesh data to the GPU
-    Mesh processMesh(aiMesh* mesh)
+    // Processing of the Assimp mesh in order to obtain the data of an "OpenGL mesh"
+    // = the data that will be sent to the GPU buffers
+    static MeshData processMesh(aiMesh* mesh)
     {
         // data structures for vertices and indices of vertices (for faces)
         vector<Vertex> vertices;
@@ -196,7 +405,11 @@ private:
                 indices.emplace_back(face->mIndices[j]);
         }
 
-        // we return an instance of the Mesh class created using the vertices and faces data structures we have created above.
-        return Mesh(vertices, indices);
+        // we return the vertices and faces data structures we have created above, the Mesh class will upload them.
+        MeshData data;
+        data.vertices = std::move(vertices);
+        data.indices = std::move(indices);
+        data.computeBounds();
+        return data;
     }
 };
@@ -0,0 +1,503 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <assimp/postprocess.h>
+#include <utils/mappedfile.h>
+#include <utils/threadpool.h>
+
+#include "mesh.h"
+
+/*
+Native Wavefront OBJ importer, used by Model::importSource in place of Assimp for .obj files.
+The file is mapped and split in chunks at line boundaries. A first parallel pass counts the v/vt/vn lines of every
+chunk, so that the second parallel pass can parse each chunk straight into the global attribute arrays and resolve the
+relative (negative) indices. Faces are triangulated as fans, "o" and "g" lines start a new mesh.
+The Assimp post-process flags used by ModelImportOptions are honoured: JoinIdenticalVertices (vertices are deduplicated
+on their position/uv/normal indices), FlipUVs, GenSmoothNormals (only for meshes without normals, computed in
+parallel) and CalcTangentSpace. Materials, smoothing groups, lines and points are ignored.
+load() returns false on anything it cannot parse and the caller falls back to Assimp.
+*/
+class ObjLoader
+{
+public:
+    // Files smaller than this are parsed by a single thread
+    static constexpr size_t CHUNK_SIZE = 256 * 1024;
+
+    // The chunks and the normals are processed on the workers of pool
+    static bool load(const string& path, const unsigned int postProcessFlags, vector<MeshData>& meshes,
+                     ThreadPool& pool = ThreadPool::shared())
+    {
+        const MappedFile file(path);
+        if (!file.data())
+            return false;
+        const auto text = reinterpret_cast<const char*>(file.data());
+        const auto size = file.size();
+
+        // chunk boundaries right after a newline
+        vector<size_t> bounds{0};
+        for (size_t target = CHUNK_SIZE; target < size; target = bounds.back() + CHUNK_SIZE)
+        {
+            const auto newline = static_cast<const char*>(std::memchr(text + target, '\n', size - target));
+            if (!newline)
+                break;
+            bounds.push_back(newline + 1 - text);
+        }
+        bounds.push_back(size);
+        const size_t chunkCount = bounds.size() - 1;
+
+        vector<Chunk> chunks(chunkCount);
+        pool.parallelFor(chunkCount, 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto c = begin; c < end; c++)
+                countAttributes(text + bounds[c], text + bounds[c + 1], chunks[c]);
+        });
+        Attributes attributes;
+        size_t positions = 0, uvs = 0, normals = 0;
+        for (auto& chunk : chunks)
+        {
+            chunk.firstPosition = positions;
+            chunk.firstUv = uvs;
+            chunk.firstNormal = normals;
+            positions += chunk.positionCount;
+            uvs += chunk.uvCount;
+            normals += chunk.normalCount;
+        }
+        attributes.positions.resize(positions);
+        attributes.uvs.resize(uvs);
+        attributes.normals.resize(normals);
+        pool.parallelFor(chunkCount, 1, [&](const size_t begin, const size_t end)
+        {
+            for (auto c = begin; c < end; c++)
+                chunks[c].valid = parseChunk(text + bounds[c], text + bounds[c + 1], chunks[c], attributes);
+        });
+
+        // the meshes may span several chunks
+        vector<Corner> corners;
+        vector<size_t> meshStarts{0};
+        for (const auto& chunk : chunks)
+        {
+            if (!chunk.valid)
+                return false;
+            for (const auto start : chunk.meshStarts)
+                meshStarts.push_back(corners.size() + start);
+            corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+        }
+        meshStarts.push_back(corners.size());
+
+        for (const auto& c : corners)
+        {
+            if (c.position < 0 || static_cast<size_t>(c.position) >= positions || c.uv >= static_cast<int64_t>(uvs) ||
+                c.normal >= static_cast<int64_t>(normals))
+                return false;
+        }
+
+        vector<MeshData> result;
+        for (size_t m = 0; m + 1 < meshStarts.size(); m++)
+        {
+            if (meshStarts[m + 1] > meshStarts[m])
+                result.push_back(buildMesh(corners.data() + meshStarts[m], meshStarts[m + 1] - meshStarts[m],
+                                           attributes, postProcessFlags, pool));
+        }
+        if (result.empty())
+            return false;
+        meshes = std::move(result);
+        return true;
+    }
+
+private:
+    // 0 based indices in the attribute arrays, -1 if missing
+    struct Corner
+    {
+        int64_t position, uv, normal;
+    };
+
+    struct Attributes
+    {
+        vector<glm::vec3> positions;
+        vector<glm::vec2> uvs;
+        vector<glm::vec3> normals;
+    };
+
+    struct Chunk
+    {
+        size_t positionCount = 0, uvCount = 0, normalCount = 0;
+        size_t firstPosition = 0, firstUv = 0, firstNormal = 0;
+        // three corners per triangle
+        vector<Corner> corners;
+        // offsets in corners where an "o" or "g" line starts a new mesh
+        vector<size_t> meshStarts;
+        bool valid = false;
+    };
+
+    struct CornerKey
+    {
+        int64_t position, uv, normal;
+
+        bool operator==(const CornerKey& other) const
+        {
+            return position == other.position && uv == other.uv && normal == other.normal;
+        }
+    };
+
+    struct CornerKeyHash
+    {
+        size_t operator()(const CornerKey& key) const
+        {
+            return static_cast<size_t>(key.position * 73856093ll ^ key.uv * 19349663ll ^ key.normal * 83492791ll);
+        }
+    };
+
+    static bool isSpace(const char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static const char* skipSpaces(const char* p, const char* end)
+    {
+        while (p < end && isSpace(*p))
+            p++;
+        return p;
+    }
+
+    static const char* lineEnd(const char* p, const char* end)
+    {
+        const auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        return newline ? newline : end;
+    }
+
+    static void countAttributes(const char* p, const char* end, Chunk& chunk)
+    {
+        while (p < end)
+        {
+            const auto next = lineEnd(p, end);
+            p = skipSpaces(p, next);
+            if (next - p > 1 && p[0] == 'v')
+            {
+                if (isSpace(p[1]))
+                    chunk.positionCount++;
+                else if (p[1] == 't' && next - p > 2 && isSpace(p[2]))
+                    chunk.uvCount++;
+                else if (p[1] == 'n' && next - p > 2 && isSpace(p[2]))
+                    chunk.normalCount++;
+            }
+            p = next + 1;
+        }
+    }
+
+    // Decimal float without locale or allocations: sign, digits, fraction, exponent
+    static const char* parseFloat(const char* p, const char* end, float& out)
+    {
+        static constexpr double POWERS[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+            1e19, 1e20, 1e21, 1e22
+        };
+        p = skipSpaces(p, end);
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        {
+            if (mantissa < 1000000000000000000ull)
+                mantissa = mantissa * 10 + (*p - '0');
+            else
+                exponent++;
+        }
+        if (p < end && *p == '.')
+        {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+            {
+                if (mantissa < 1000000000000000000ull)
+                {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    exponent--;
+                }
+            }
+        }
+        if (digits == 0)
+            return nullptr;
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negativeExponent = *p++ == '-';
+            int value = 0;
+            if (p >= end || *p < '0' || *p > '9')
+                return nullptr;
+            for (; p < end && *p >= '0' && *p <= '9'; p++)
+                value = std::min(value * 10 + (*p - '0'), 1000);
+            exponent += negativeExponent ? -value : value;
+        }
+        double value = static_cast<double>(mantissa);
+        if (exponent < 0)
+            value = -exponent <= 22 ? value / POWERS[-exponent] : value * std::pow(10.0, exponent);
+        else if (exponent > 0)
+            value = exponent <= 22 ? value * POWERS[exponent] : value * std::pow(10.0, exponent);
+        out = static_cast<float>(negative ? -value : value);
+        return p;
+    }
+
+    static const char* parseInt(const char* p, const char* end, int64_t& out)
+    {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        if (p >= end || *p < '0' || *p > '9')
+            return nullptr;
+        int64_t value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            value = value * 10 + (*p - '0');
+        out = negative ? -value : value;
+        return p;
+    }
+
+    // 1 based absolute or negative relative to the elements seen so far, 0 is invalid
+    static int64_t resolve(const int64_t index, const size_t seen)
+    {
+        if (index > 0)
+            return index - 1;
+        if (index < 0 && static_cast<int64_t>(seen) + index >= 0)
+            return static_cast<int64_t>(seen) + index;
+        return INT64_MIN;
+    }
+
+    static bool parseChunk(const char* p, const char* end, Chunk& chunk, Attributes& attributes)
+    {
+        size_t positions = chunk.firstPosition, uvs = chunk.firstUv, normals = chunk.firstNormal;
+        vector<Corner> face;
+        while (p < end)
+        {
+            const auto next = lineEnd(p, end);
+            p = skipSpaces(p, next);
+            if (p == next || *p == '#')
+            {
+                p = next + 1;
+                continue;
+            }
+            const char* keyword = p;
+            while (p < next && !isSpace(*p))
+                p++;
+            const auto length = p - keyword;
+
+            if (length == 1 && keyword[0] == 'v')
+            {
+                if (positions == chunk.firstPosition + chunk.positionCount)
+                    return false;
+                auto& v = attributes.positions[positions++];
+                for (int c = 0; c < 3; c++)
+                {
+                    if (!(p = parseFloat(p, next, v[c])))
+                        return false;
+                }
+            }
+            else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't')
+            {
+                if (uvs == chunk.firstUv + chunk.uvCount)
+                    return false;
+                auto& uv = attributes.uvs[uvs++];
+                for (int c = 0; c < 2; c++)
+                {
+                    if (!(p = parseFloat(p, next, uv[c])))
+                        return false;
+                }
+            }
+            else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+            {
+                if (normals == chunk.firstNormal + chunk.normalCount)
+                    return false;
+                auto& n = attributes.normals[normals++];
+                for (int c = 0; c < 3; c++)
+                {
+                    if (!(p = parseFloat(p, next, n[c])))
+                        return false;
+                }
+            }
+            else if (length == 1 && keyword[0] == 'f')
+            {
+                face.clear();
+                while ((p = skipSpaces(p, next)) < next)
+                {
+                    // p, p/t, p//n or p/t/n
+                    int64_t index;
+                    Corner corner{0, -1, -1};
+                    if (!(p = parseInt(p, next, index)))
+                        return false;
+                    corner.position = resolve(index, positions);
+                    if (p < next && *p == '/')
+                    {
+                        p++;
+                        if (p < next && *p != '/')
+                        {
+                            if (!(p = parseInt(p, next, index)))
+                                return false;
+                            corner.uv = resolve(index, uvs);
+                        }
+                        if (p < next && *p == '/')
+                        {
+                            if (!(p = parseInt(p + 1, next, index)))
+                                return false;
+                            corner.normal = resolve(index, normals);
+                        }
+                    }
+                    if (corner.position < 0 || corner.uv == INT64_MIN || corner.normal == INT64_MIN)
+                        return false;
+                    face.push_back(corner);
+                }
+                // faces with less than 3 corners are lines or points, they are skipped
+                for (size_t i = 1; i + 1 < face.size(); i++)
+                {
+                    chunk.corners.push_back(face[0]);
+                    chunk.corners.push_back(face[i]);
+                    chunk.corners.push_back(face[i + 1]);
+                }
+            }
+            else if ((length == 1 && keyword[0] == 'o') || (length == 1 && keyword[0] == 'g'))
+            {
+                chunk.meshStarts.push_back(chunk.corners.size());
+            }
+            p = next + 1;
+        }
+        return true;
+    }
+
+    static MeshData buildMesh(const Corner* corners, const size_t cornerCount, const Attributes& attributes,
+                              const unsigned int flags, ThreadPool& pool)
+    {
+        MeshData mesh;
+        // position index in the file of every vertex, for the smooth normals
+        vector<int64_t> vertexPositions;
+        mesh.indices.reserve(cornerCount);
+        const bool join = flags & aiProcess_JoinIdenticalVertices;
+        std::unordered_map<CornerKey, GLuint, CornerKeyHash> unique;
+        if (join)
+            unique.reserve(cornerCount);
+        bool hasUvs = true, hasNormals = true;
+        for (size_t i = 0; i < cornerCount; i++)
+        {
+            const auto& c = corners[i];
+            hasUvs &= c.uv >= 0;
+            hasNormals &= c.normal >= 0;
+            if (join)
+            {
+                const auto [iter, inserted] = unique.emplace(CornerKey{c.position, c.uv, c.normal},
+                                                             static_cast<GLuint>(mesh.vertices.size()));
+                if (!inserted)
+                {
+                    mesh.indices.push_back(iter->second);
+                    continue;
+                }
+            }
+            Vertex vertex{};
+            vertex.Position = attributes.positions[c.position];
+            if (c.normal >= 0)
+                vertex.Normal = attributes.normals[c.normal];
+            if (c.uv >= 0)
+            {
+                vertex.TexCoords = attributes.uvs[c.uv];
+                if (flags & aiProcess_FlipUVs)
+                    vertex.TexCoords.y = 1.0f - vertex.TexCoords.y;
+            }
+            mesh.indices.push_back(static_cast<GLuint>(mesh.vertices.size()));
+            mesh.vertices.push_back(vertex);
+            vertexPositions.push_back(c.position);
+        }
+
+        if (!hasNormals && flags & (aiProcess_GenSmoothNormals | aiProcess_GenNormals))
+            smoothNormals(mesh, vertexPositions, attributes.positions.size(), pool);
+        if (hasUvs && flags & aiProcess_CalcTangentSpace)
+            tangentSpace(mesh);
+        else if (!hasUvs)
+            cout << "WARNING::OBJ:: MODEL WITHOUT UV COORDINATES -> TANGENT AND BITANGENT ARE = 0" << endl;
+        mesh.computeBounds();
+        return mesh;
+    }
+
+    // Area weighted average of the normals of the triangles around every position of the file, so the vertices split
+    // by a UV seam get the same normal
+    static void smoothNormals(MeshData& mesh, const vector<int64_t>& vertexPositions, const size_t positionCount,
+                              ThreadPool& pool)
+    {
+        const size_t triangleCount = mesh.indices.size() / 3;
+        vector<glm::vec3> faceNormals(triangleCount);
+        pool.parallelFor(triangleCount, 4096, [&](const size_t begin, const size_t end)
+        {
+            for (auto t = begin; t < end; t++)
+            {
+                const auto& p0 = mesh.vertices[mesh.indices[t * 3]].Position;
+                const auto& p1 = mesh.vertices[mesh.indices[t * 3 + 1]].Position;
+                const auto& p2 = mesh.vertices[mesh.indices[t * 3 + 2]].Position;
+                // the length of the cross product is twice the area
+                faceNormals[t] = glm::cross(p1 - p0, p2 - p0);
+            }
+        });
+
+        // triangles around every position, as offsets/list
+        vector<size_t> offsets(positionCount + 1, 0);
+        for (const auto i : mesh.indices)
+            offsets[vertexPositions[i] + 1]++;
+        for (size_t p = 0; p < positionCount; p++)
+            offsets[p + 1] += offsets[p];
+        vector<GLuint> adjacency(mesh.indices.size());
+        {
+            vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < mesh.indices.size(); i++)
+                adjacency[fill[vertexPositions[mesh.indices[i]]]++] = static_cast<GLuint>(i / 3);
+        }
+
+        pool.parallelFor(mesh.vertices.size(), 4096, [&](const size_t begin, const size_t end)
+        {
+            for (auto v = begin; v < end; v++)
+            {
+                const auto p = vertexPositions[v];
+                glm::vec3 sum{0.0f};
+                for (auto a = offsets[p]; a < offsets[p + 1]; a++)
+                    sum += faceNormals[adjacency[a]];
+                const auto length = glm::length(sum);
+                mesh.vertices[v].Normal = length > 0 ? sum / length : glm::vec3{0.0f};
+            }
+        });
+    }
+
+    // Per vertex tangent and bitangent from the texture coordinates, orthogonalized against the normal
+    static void tangentSpace(MeshData& mesh)
+    {
+        vector<glm::vec3> tangents(mesh.vertices.size(), glm::vec3{0.0f});
+        vector<glm::vec3> bitangents(mesh.vertices.size(), glm::vec3{0.0f});
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+        {
+            const auto& v0 = mesh.vertices[mesh.indices[t]];
+            const auto& v1 = mesh.vertices[mesh.indices[t + 1]];
+            const auto& v2 = mesh.vertices[mesh.indices[t + 2]];
+            const auto e1 = v1.Position - v0.Position, e2 = v2.Position - v0.Position;
+            const auto d1 = v1.TexCoords - v0.TexCoords, d2 = v2.TexCoords - v0.TexCoords;
+            const auto det = d1.x * d2.y - d2.x * d1.y;
+            if (std::abs(det) < 1e-12f)
+                continue;
+            const auto r = 1.0f / det;
+            const auto tangent = (e1 * d2.y - e2 * d1.y) * r;
+            const auto bitangent = (e2 * d1.x - e1 * d2.x) * r;
+            for (int c = 0; c < 3; c++)
+            {
+                tangents[mesh.indices[t + c]] += tangent;
+                bitangents[mesh.indices[t + c]] += bitangent;
+            }
+        }
+        for (size_t v = 0; v < mesh.vertices.size(); v++)
+        {
+            auto& vertex = mesh.vertices[v];
+            const auto& n = vertex.Normal;
+            const auto tangent = tangents[v] - n * glm::dot(n, tangents[v]);
+            const auto bitangent = bitangents[v] - n * glm::dot(n, bitangents[v]);
+            const auto tangentLength = glm::length(tangent), bitangentLength = glm::length(bitangent);
+            vertex.Tangent = tangentLength > 0 ? tangent / tangentLength : glm::vec3{0.0f};
+            vertex.Bitangent = bitangentLength > 0 ? bitangent / bitangentLength : glm::vec3{0.0f};
+        }
+    }
+};
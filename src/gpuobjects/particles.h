@@ -1,4 +1,9 @@
 #pragma once
+#include <algorithm>
+#include <utils/curlnoise.h>
+#include <utils/gridfluid.h>
+#include <utils/threadpool.h>
+#include "glstate.h"
 
 class Particles : NoCopy
 {
@@ -16,6 +21,7 @@ public:
               _life{life}
         {
             this->pos(pos);
+            this->previousPos(pos);
             this->size(size);
             this->color(color);
         }
@@ -32,6 +38,19 @@ public:
             memcpy(&raw_data[POS_OFFSET], &newPos, sizeof(glm::vec3));
         }
 
+        // Position at the previous simulation step, the particles are drawn in between (see interpolation())
+        [[nodiscard]] glm::vec3 previousPos() const
+        {
+            glm::vec3 out_vec;
+            memcpy(&out_vec, &raw_data[PREVIOUS_POS_OFFSET], sizeof(glm::vec3));
+            return out_vec;
+        }
+
+        void previousPos(const glm::vec3& newPos)
+        {
+            memcpy(&raw_data[PREVIOUS_POS_OFFSET], &newPos, sizeof(glm::vec3));
+        }
+
         [[nodiscard]] GLfloat size() const
         {
             GLfloat out_size;
@@ -77,16 +96,18 @@ public:
         }
 
     private:
-        static constexpr unsigned int RAW_DATA_SIZE = sizeof(glm::vec3) + sizeof(GLfloat) + sizeof(glm::u8vec4);
+        static constexpr unsigned int RAW_DATA_SIZE = 2 * sizeof(glm::vec3) + sizeof(GLfloat) + sizeof(glm::u8vec4);
         static constexpr unsigned int POS_OFFSET = 0;
         static constexpr unsigned int SIZE_OFFSET = sizeof(glm::vec3);
         static constexpr unsigned int COLOR_OFFSET = sizeof(glm::vec3) + sizeof(GLfloat);
+        static constexpr unsigned int PREVIOUS_POS_OFFSET = sizeof(glm::vec3) + sizeof(GLfloat) + sizeof(glm::u8vec4);
         byte raw_data[RAW_DATA_SIZE]{};
         /*
         raw_data:
             glm::vec3 pos{}; // 12 bytes
             GLfloat size{}; // 4 bytes
             glm::u8vec4 color{}; // 4 bytes
+            glm::vec3 previous_pos{}; // 12 bytes
         */
         glm::vec3 _velocity{};
         float _life{};
@@ -110,7 +131,7 @@ public:
         glBufferData(GL_ARRAY_BUFFER, maxParticles * sizeof(Particle), nullptr,GL_STREAM_DRAW);
 
         glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+        GLState::get().bindVertexArray(vao);
 
         glBindBuffer(GL_ARRAY_BUFFER, vertex_data_buffer);
         glEnableVertexAttribArray(0);
@@ -126,11 +147,17 @@ public:
         glVertexAttribPointer(2, 4,GL_UNSIGNED_BYTE,GL_TRUE, sizeof(Particle),
                               reinterpret_cast<GLvoid*>(Particle::COLOR_OFFSET));
 
+        glBindBuffer(GL_ARRAY_BUFFER, particles_data_buffer);
+        glEnableVertexAttribArray(3); // Previous position
+        glVertexAttribPointer(3, 3,GL_FLOAT,GL_FALSE, sizeof(Particle),
+                              reinterpret_cast<GLvoid*>(Particle::PREVIOUS_POS_OFFSET));
+
         glVertexAttribDivisor(0, 0); // particles vertices : always reuse the same 4 vertices -> 0
         glVertexAttribDivisor(1, 1); // positions : one per quad (its center) -> 1
         glVertexAttribDivisor(2, 1); // color : one per quad -> 1
+        glVertexAttribDivisor(3, 1); // previous positions : one per quad -> 1
 
-        glBindVertexArray(0);
+        GLState::get().bindVertexArray(0);
 
         particles.reserve(maxParticles);
         for (auto i = 0; i < maxParticles; i++)
@@ -150,12 +177,33 @@ public:
             auto& p = particles[i];
             p.life(startLife);
             p.pos(startPos);
+            p.previousPos(startPos);
             p.velocity(velocity);
             p.color(color);
             p.size(size);
         }
     }
 
+    // One particle per entry of the arrays, as many as there are dead particles. Returns how many were spawned
+    size_t spawnParticles(const size_t count, const glm::vec3* positions, const glm::vec3* velocities,
+                          const float* lives, const glm::u8vec4* colors, const float size)
+    {
+        const auto spawned = std::min<size_t>(count, getDeadParticles());
+        for (size_t j = 0; j < spawned; j++)
+        {
+            auto& p = particles[livingParticles + j];
+            p.life(lives[j]);
+            p.pos(positions[j]);
+            p.previousPos(positions[j]);
+            p.velocity(velocities[j]);
+            p.color(colors[j]);
+            p.size(size);
+        }
+        livingParticles += static_cast<int>(spawned);
+        return spawned;
+    }
+
+    // One simulation step, the positions before it are kept for the interpolation
     void updateParticles(const float dt, const std::function<void(Particle&, float dt)>& updateFunc)
     {
         for (auto i = 0; i < livingParticles; i++)
@@ -170,11 +218,70 @@ public:
             }
             else
             {
+                p.previousPos(p.pos());
                 updateFunc(p, dt);
             }
         }
     }
 
+    // Moves the living particles along the field by strength * dt world units at its RMS velocity, the field is sampled
+    // at the positions times frequency
+    void advect(const CurlNoiseField& field, const float frequency, const float strength, const float dt,
+                ThreadPool& pool = ThreadPool::shared())
+    {
+        const auto step = strength * dt;
+        forEachPositionChunk(pool, [&](const int first, const int n, const glm::vec3* positions)
+        {
+            glm::vec3 flow[SAMPLE_CHUNK];
+            field.sample(positions, flow, n, frequency);
+            for (int i = 0; i < n; i++)
+                particles[first + i].pos(positions[i] + flow[i] * step);
+        });
+    }
+
+    // Pulls the velocity of the living particles towards the one of the air around them, by 1 - e^(-coupling * dt) of
+    // the difference: with a high coupling they are carried by the air. The ones outside the grid are left alone
+    void drag(const GridFluid& air, const float coupling, const float dt, ThreadPool& pool = ThreadPool::shared())
+    {
+        const auto blend = 1 - std::exp(-coupling * dt);
+        forEachPositionChunk(pool, [&](const int first, const int n, const glm::vec3* positions)
+        {
+            glm::vec4 flow[SAMPLE_CHUNK];
+            air.sample(positions, flow, n);
+            for (int i = 0; i < n; i++)
+            {
+                if (flow[i].w == 0)
+                    continue;
+                auto& particle = particles[first + i];
+                const auto velocity = particle.velocity();
+                particle.velocity(velocity + (glm::vec3{flow[i]} - velocity) * blend);
+            }
+        });
+    }
+
+    // Particles per batch sample of advect() and drag()
+    static constexpr int SAMPLE_CHUNK = 256;
+
+    // body(first, n, positions) for the living particles in chunks of SAMPLE_CHUNK, with their positions gathered for a
+    // batch sample. Ranges of chunks run on the workers of pool, each chunk is only touched by its own body
+    template <typename F>
+    void forEachPositionChunk(ThreadPool& pool, F&& body)
+    {
+        const auto chunks = (static_cast<size_t>(livingParticles) + SAMPLE_CHUNK - 1) / SAMPLE_CHUNK;
+        pool.parallelFor(chunks, 8, [&](const size_t begin, const size_t end)
+        {
+            glm::vec3 positions[SAMPLE_CHUNK];
+            for (auto c = begin; c < end; c++)
+            {
+                const auto first = static_cast<int>(c) * SAMPLE_CHUNK;
+                const auto n = std::min(SAMPLE_CHUNK, livingParticles - first);
+                for (int i = 0; i < n; i++)
+                    positions[i] = particles[first + i].pos();
+                body(first, n, positions);
+            }
+        });
+    }
+
     void drawParticles()
     {
         glBindBuffer(GL_ARRAY_BUFFER, particles_data_buffer);
@@ -189,11 +296,11 @@ public:
                            value_ptr(renderer.viewMatrix()));
         glUniformMatrix3fv(glGetUniformLocation(shader.program(), "cameraOrientation"), 1, GL_FALSE,
                            value_ptr(renderer.getCamera().orientation()));
+        glUniform1f(glGetUniformLocation(shader.program(), "interpolation"), _interpolation);
 
-        glBindVertexArray(vao);
+        GLState::get().bindVertexArray(vao);
         shader.validateProgram();
         glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, livingParticles);
-        glBindVertexArray(0);
     }
 
     void reset()
@@ -201,6 +308,27 @@ public:
         livingParticles = 0;
     }
 
+    // Where the particles are drawn between their previous and their current position, in [0, 1]. 1 draws the last
+    // simulation step as is
+    void interpolation(const float alpha)
+    {
+        _interpolation = alpha;
+    }
+
+    [[nodiscard]] float interpolation() const
+    {
+        return _interpolation;
+    }
+
+    // The living particles that fit in the new pool are kept, the GL buffer is sized every frame by drawParticles
+    void resize(const GLuint newMaxParticles)
+    {
+        maxParticles = newMaxParticles;
+        particles.resize(maxParticles);
+        particles.shrink_to_fit();
+        livingParticles = glm::min(livingParticles, static_cast<int>(maxParticles));
+    }
+
     [[nodiscard]] GLuint getMaxParticles() const
     {
         return maxParticles;
@@ -222,7 +350,8 @@ public:
                                            vao{other.vao},
                                            maxParticles{other.maxParticles},
                                            particles(std::move(other.particles)),
-                                           livingParticles{other.livingParticles}
+                                           livingParticles{other.livingParticles},
+                                           _interpolation{other._interpolation}
     {
         other.vertex_data_buffer = 0;
         other.particles_data_buffer = 0;
@@ -242,6 +371,7 @@ public:
     GLuint maxParticles{0};
     std::vector<Particle> particles{};
     int livingParticles{0}; //also first position of dead particles
+    float _interpolation{1};
 
     void freeGPUResources()
     {
@@ -249,6 +379,7 @@ public:
         {
             glDeleteBuffers(1, &vertex_data_buffer);
             glDeleteBuffers(1, &particles_data_buffer);
+            GLState::get().forgetVertexArray(vao);
             glDeleteVertexArrays(1, &vao);
             vao = 0;
         }
@@ -1,14 +1,17 @@
 #pragma once
+#include <stdexcept>
 #include <utils/nocopy.h>
 
+// readBuffer selects the color attachment read, GL_NONE keeps the one of the framebuffer (attachment 0)
 class PboReadBuffer : NoCopy
 {
 public:
     explicit PboReadBuffer(const GLuint width, const GLuint height, const GLubyte channels,
-                           const GLubyte sizeOfChannel, const GLenum format, const GLenum pixelDataType):
+                           const GLubyte sizeOfChannel, const GLenum format, const GLenum pixelDataType,
+                           const GLenum readBuffer = GL_NONE):
         NoCopy{}, _bufferSize{static_cast<GLsizeiptr>(width * height * channels * sizeOfChannel)}, _width{width}, _height{height},
         _channels{channels},
-        _sizeOfChannel{sizeOfChannel}, _format{format}, _pixelDataType{pixelDataType}
+        _sizeOfChannel{sizeOfChannel}, _format{format}, _pixelDataType{pixelDataType}, _readBuffer{readBuffer}
     {
         glGenBuffers(1, &pboId);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, pboId);
@@ -19,15 +22,39 @@ public:
     void bind()
     {
         glBindBuffer(GL_PIXEL_PACK_BUFFER, pboId);
+        if (_readBuffer != GL_NONE)
+            glReadBuffer(_readBuffer);
         glReadPixels(0, 0, _width, _height, _format, _pixelDataType, nullptr);
+        if (_readBuffer != GL_NONE)
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
         bound = true;
     }
 
+    // Queues the copy of the bound framebuffer and returns without binding the PBO, mapRead() gets the pixels later
+    void readAsync() const
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pboId);
+        if (_readBuffer != GL_NONE)
+            glReadBuffer(_readBuffer);
+        glReadPixels(0, 0, _width, _height, _format, _pixelDataType, nullptr);
+        if (_readBuffer != GL_NONE)
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Maps the pixels of the last readAsync(), waits for the copy if it is not done. unbind() unmaps them
+    [[nodiscard]] const GLubyte* mapRead()
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pboId);
+        bound = true;
+        return static_cast<const GLubyte*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, _bufferSize, GL_MAP_READ_BIT));
+    }
+
     [[nodiscard]] GLubyte* read()
     {
         if (!bound)
         {
-            throw runtime_error("can't read pixels without binding the pbo");
+            throw std::runtime_error("can't read pixels without binding the pbo");
         }
         //TODO: try BGRA for better performance https://stackoverflow.com/a/11414173
         return static_cast<GLubyte*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
@@ -54,7 +81,7 @@ public:
                                                    _width{other._width}, _height{other._height},
                                                    _channels{other._channels}, _sizeOfChannel{other._sizeOfChannel},
                                                    _format{other._format}, _pixelDataType{other._pixelDataType},
-                                                   bound{other.bound}
+                                                   _readBuffer{other._readBuffer}, bound{other.bound}
     {
         other.pboId = 0;
     };
@@ -70,6 +97,7 @@ public:
         this->_sizeOfChannel = other._sizeOfChannel;
         this->_format = other._format;
         this->_pixelDataType = other._pixelDataType;
+        this->_readBuffer = other._readBuffer;
         this->bound = other.bound;
 
         other.pboId = 0;
@@ -82,6 +110,7 @@ private:
     GLuint _width, _height;
     GLubyte _channels, _sizeOfChannel;
     GLenum _format, _pixelDataType;
+    GLenum _readBuffer;
     bool bound{false};
 
     void freeGPUResources()
@@ -0,0 +1,92 @@
+#pragma once
+#include <utils/nocopy.h>
+
+// GL_PIXEL_UNPACK_BUFFER used as staging memory for texture uploads: while it is mapped any thread can write the
+// pixels, the texture is then filled from it by glTexSubImage2D calls with offsets in place of pointers
+class PboWriteBuffer : NoCopy
+{
+public:
+    explicit PboWriteBuffer(const GLsizeiptr size): NoCopy{}, _bufferSize{size}
+    {
+        glGenBuffers(1, &pboId);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, _bufferSize, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // Render thread. The pointer stays valid until unmap(), the writes can come from other threads
+    [[nodiscard]] GLubyte* map()
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
+        mapped = static_cast<GLubyte*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, _bufferSize,
+                                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return mapped;
+    }
+
+    // Render thread, before the buffer is used as the source of an upload
+    void unmap()
+    {
+        if (!mapped)
+            return;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        mapped = nullptr;
+    }
+
+    // While bound the pixel pointers of the texture upload calls are offsets in this buffer
+    void bind() const
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pboId);
+    }
+
+    static void unbind()
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    [[nodiscard]] GLsizeiptr bufferSize() const
+    {
+        return _bufferSize;
+    }
+
+    ~PboWriteBuffer()
+    {
+        freeGPUResources();
+    }
+
+    PboWriteBuffer(PboWriteBuffer&& other) noexcept: NoCopy{}, pboId{other.pboId}, _bufferSize{other._bufferSize},
+                                                     mapped{other.mapped}
+    {
+        other.pboId = 0;
+        other.mapped = nullptr;
+    };
+
+    PboWriteBuffer& operator=(PboWriteBuffer&& other) noexcept
+    {
+        freeGPUResources();
+        this->pboId = other.pboId;
+        this->_bufferSize = other._bufferSize;
+        this->mapped = other.mapped;
+
+        other.pboId = 0;
+        other.mapped = nullptr;
+        return *this;
+    };
+
+private:
+    GLuint pboId{0};
+    GLsizeiptr _bufferSize;
+    GLubyte* mapped{nullptr};
+
+    void freeGPUResources()
+    {
+        if (pboId)
+        {
+            // deleting a mapped buffer unmaps it
+            glDeleteBuffers(1, &pboId);
+            pboId = 0;
+        }
+    }
+};
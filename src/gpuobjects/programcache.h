@@ -0,0 +1,138 @@
+#pragma once
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <utils/diskcache.h>
+#include <utils/nocopy.h>
+
+/*
+On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+Entries are keyed by a hash of the shader sources and of GL_VENDOR/GL_RENDERER/GL_VERSION, a driver update therefore
+misses the cache instead of feeding it a stale binary. The driver may still reject a binary, in that case the entry is
+deleted and the caller compiles from source.
+*/
+class ProgramBinaryCache : NoCopy
+{
+public:
+    struct Stats
+    {
+        unsigned int compiled{0};
+        unsigned int loaded{0};
+        unsigned int rejected{0};
+        // Time spent creating programs, from reading the sources to the end of linking
+        double seconds{0};
+    };
+
+    static ProgramBinaryCache& get()
+    {
+        static ProgramBinaryCache cache;
+        return cache;
+    }
+
+    static uint64_t key(const std::string& vertexSource, const std::string& fragmentSource)
+    {
+        auto hash = fnv1a(vertexSource);
+        hash = fnv1a(fragmentSource, hash);
+        for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        {
+            const auto str = reinterpret_cast<const char*>(glGetString(name));
+            hash = fnv1a(str ? std::string(str) : std::string(), hash);
+        }
+        return hash;
+    }
+
+    // The driver must expose at least one binary format
+    [[nodiscard]] bool enabled() const
+    {
+        if (!diskCacheEnabled())
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // Links the program from the cached binary. Returns false on a miss or if the driver rejects the binary
+    bool load(const GLuint program, const uint64_t key)
+    {
+        if (!enabled())
+            return false;
+        const auto path = diskCachePath("programs", key, ".bin");
+        std::vector<char> file;
+        if (!readFile(path, file))
+            return false;
+
+        Header header{};
+        if (file.size() < sizeof(Header))
+            return reject(path);
+        std::memcpy(&header, file.data(), sizeof(Header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.key != key ||
+            header.length != file.size() - sizeof(Header))
+            return reject(path);
+
+        glProgramBinary(program, header.format, file.data() + sizeof(Header), static_cast<GLsizei>(header.length));
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (linked == GL_FALSE)
+            return reject(path);
+        _stats.loaded++;
+        return true;
+    }
+
+    // Call after linking a program created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+    void store(const GLuint program, const uint64_t key)
+    {
+        _stats.compiled++;
+        if (!enabled())
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.key = key;
+        glGetProgramBinary(program, length, &length, &header.format, binary.data());
+        header.length = static_cast<uint32_t>(length);
+        if (!writeFileAtomic(diskCachePath("programs", key, ".bin"), {{&header, sizeof(Header)},
+                                                                       {binary.data(), header.length}}))
+        {
+            std::cout << "Failed to write the program binary cache" << std::endl;
+        }
+    }
+
+    void addTime(const double seconds)
+    {
+        _stats.seconds += seconds;
+    }
+
+    [[nodiscard]] const Stats& stats() const { return _stats; }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'T', 'G', 'P', 'P', 'R', 'G', '1'};
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t key;
+        GLenum format;
+        uint32_t length;
+    };
+
+    Stats _stats{};
+
+    ProgramBinaryCache(): NoCopy{}
+    {
+    }
+
+    bool reject(const std::filesystem::path& path)
+    {
+        std::cout << "Discarding cached program binary " << path.string() << std::endl;
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        _stats.rejected++;
+        return false;
+    }
+};
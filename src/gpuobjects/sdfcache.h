@@ -0,0 +1,99 @@
+#pragma once
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utils/diskcache.h>
+
+#include "meshsdf.h"
+
+/*
+Binary cache of baked MeshSdfs, one file per (model path, mesh import variant, resolution) under ./.cache/sdf.
+Layout: FileHeader, the resolution^3 vec4 points of the field and their vec2 texture coordinates. Like the mesh cache, an entry is rebuilt when the
+format version changes or when the source file size or modification time differ from the ones in the header.
+*/
+class SdfCache
+{
+public:
+    // Bump when the layout of the file or the baked values change
+    static constexpr uint32_t VERSION = 2;
+
+    static bool load(const string& path, const uint64_t variant, const int resolution, MeshSdf& sdf)
+    {
+        if (!diskCacheEnabled())
+            return false;
+        const auto cachePath = entryPath(path, variant, resolution);
+        if (!std::filesystem::exists(cachePath))
+            return false;
+        std::vector<char> file;
+        if (!readFile(cachePath, file) || file.size() < sizeof(FileHeader))
+            return discard(cachePath);
+        FileHeader header{};
+        std::memcpy(&header, file.data(), sizeof(FileHeader));
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION)
+            return discard(cachePath);
+        if (header.sourceKey != sourceFileKey(path))
+            return false;
+        const auto count = static_cast<size_t>(header.resolution) * header.resolution * header.resolution;
+        if (file.size() != sizeof(FileHeader) + count * (sizeof(glm::vec4) + sizeof(glm::vec2)))
+            return discard(cachePath);
+        std::vector<glm::vec4> cells(count);
+        std::vector<glm::vec2> uvs(count);
+        std::memcpy(cells.data(), file.data() + sizeof(FileHeader), count * sizeof(glm::vec4));
+        std::memcpy(uvs.data(), file.data() + sizeof(FileHeader) + count * sizeof(glm::vec4),
+                    count * sizeof(glm::vec2));
+        sdf = MeshSdf(static_cast<int>(header.resolution),
+                      glm::vec3{header.origin[0], header.origin[1], header.origin[2]}, header.cellSize,
+                      std::move(cells), std::move(uvs));
+        return true;
+    }
+
+    static void store(const string& path, const uint64_t variant, const int resolution, const MeshSdf& sdf)
+    {
+        if (!diskCacheEnabled())
+            return;
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.resolution = static_cast<uint32_t>(sdf.resolution());
+        header.sourceKey = sourceFileKey(path);
+        for (int c = 0; c < 3; c++)
+            header.origin[c] = sdf.origin()[c];
+        header.cellSize = sdf.cellSize();
+        if (!writeFileAtomic(entryPath(path, variant, resolution), {
+                                 {&header, sizeof(FileHeader)},
+                                 {sdf.data().data(), sdf.data().size() * sizeof(glm::vec4)},
+                                 {sdf.uvData().data(), sdf.uvData().size() * sizeof(glm::vec2)}
+                             }))
+            std::cout << "Failed to write the SDF cache for " << path << std::endl;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'T', 'G', 'P', 'S', 'D', 'F', '\0'};
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t resolution;
+        // size and modification time of the source file
+        uint64_t sourceKey;
+        float origin[3];
+        float cellSize;
+    };
+
+    static std::filesystem::path entryPath(const string& path, const uint64_t variant, const int resolution)
+    {
+        const auto key = fnv1a(&resolution, sizeof(resolution), fnv1a(&variant, sizeof(variant), fnv1a(path)));
+        return diskCachePath("sdf", key, ".sdf");
+    }
+
+    static bool discard(const std::filesystem::path& cachePath)
+    {
+        std::cout << "Discarding invalid SDF cache " << cachePath.string() << std::endl;
+        std::error_code ec;
+        std::filesystem::remove(cachePath, ec);
+        return false;
+    }
+};
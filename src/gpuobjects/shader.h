@@ -16,11 +16,16 @@ Universita' degli Studi di Milano
 #pragma once
 
 // Std. Includes
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <utils/nocopy.h>
+#include <diagnostics.h>
+
+#include "glstate.h"
+#include "programcache.h"
 
 using std::string;
 using std::ifstream;
@@ -33,18 +38,45 @@ class Shader : NoCopy
 public:
     explicit Shader(const string& vertexPath, const string& fragmentPath): NoCopy{}
     {
-        const GLuint fragmentShader = compileFragmentShader(fragmentPath);
-        const GLuint vertexShader = compileVertexShader(vertexPath);
-        // Step 3: Shader Program creation
+        const auto start = std::chrono::steady_clock::now();
+        const string vertexSource = readSource(vertexPath);
+        const string fragmentSource = readSource(fragmentPath);
+
+        // Skip compiling and linking if the driver accepts the binary cached by a previous run
+        auto& cache = ProgramBinaryCache::get();
+        const auto key = ProgramBinaryCache::key(vertexSource, fragmentSource);
         this->_program = glCreateProgram();
-        glAttachShader(this->_program, vertexShader);
-        glAttachShader(this->_program, fragmentShader);
-        glLinkProgram(this->_program);
-        // check linking errors
-        checkCompileErrors(this->_program, GL_PROGRAM);
-
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        if (!cache.load(this->_program, key))
+        {
+            // A program that failed glProgramBinary is not reused
+            glDeleteProgram(this->_program);
+            this->_program = glCreateProgram();
+
+            const GLuint fragmentShader = compileSingleShader(fragmentSource, GL_FRAGMENT_SHADER);
+            const GLuint vertexShader = compileSingleShader(vertexSource, GL_VERTEX_SHADER);
+            // Step 3: Shader Program creation
+            glProgramParameteri(this->_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            glAttachShader(this->_program, vertexShader);
+            glAttachShader(this->_program, fragmentShader);
+            glLinkProgram(this->_program);
+            // check linking errors
+            if (checkCompileErrors(this->_program, GL_PROGRAM))
+                cache.store(this->_program, key);
+
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+        }
+        cache.addTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+        queryActiveAttributes();
+        assignSamplerUnits();
+
+        // Validated once here, before every draw only with DiagnosticsLevel::Debug
+        if (GLchar infoLog[512]; !isValid(infoLog))
+        {
+            std::cerr << "Program validation failed after linking for program " << this->program() << ": " << infoLog
+                << std::endl;
+        }
     }
 
     ~Shader()
@@ -52,7 +84,7 @@ public:
         freeGPUResources();
     }
 
-    Shader(Shader&& other) noexcept: NoCopy{}, _program{other._program}
+    Shader(Shader&& other) noexcept: NoCopy{}, _program{other._program}, _activeAttributes{other._activeAttributes}
     {
         other._program = 0;
     };
@@ -61,6 +93,7 @@ public:
     {
         freeGPUResources();
         this->_program = other._program;
+        this->_activeAttributes = other._activeAttributes;
 
         other._program = 0;
         return *this;
@@ -68,20 +101,23 @@ public:
 
     void use() const
     {
-        glUseProgram(this->_program);
+        GLState::get().useProgram(this->_program);
     }
 
     GLuint program() const { return this->_program; }
 
+    // Bit i is set if the vertex shader reads the attribute at location i (unused inputs are removed by the linker)
+    [[nodiscard]] GLuint activeAttributes() const { return this->_activeAttributes; }
+
+    // Per-draw validation, a no-op unless the diagnostics level is Debug
     void validateProgram() const
     {
-        glValidateProgram(this->_program);
-        GLint isValid;
-        glGetProgramiv(this->_program, GL_VALIDATE_STATUS, &isValid);
-        if (isValid == GL_FALSE)
+        if (!Diagnostics::get().perDrawValidation())
+        {
+            return;
+        }
+        if (GLchar infoLog[512]; !isValid(infoLog))
         {
-            GLchar infoLog[512];
-            glGetProgramInfoLog(this->_program, 512, nullptr, infoLog);
             std::cerr << "Program validation failed for program " << this->program() << ": " << infoLog << std::endl;
             throw std::runtime_error("Program validation failed");
         }
@@ -89,31 +125,69 @@ public:
 
 private:
     GLuint _program;
+    GLuint _activeAttributes = 0;
 
-    void freeGPUResources()
+    void queryActiveAttributes()
     {
-        if (_program)
+        GLint count = 0;
+        glGetProgramiv(this->_program, GL_ACTIVE_ATTRIBUTES, &count);
+        for (GLint i = 0; i < count; i++)
         {
-            glDeleteProgram(this->_program);
-            _program = 0;
+            GLchar name[256];
+            GLint size;
+            GLenum type;
+            glGetActiveAttrib(this->_program, i, sizeof(name), nullptr, &size, &type, name);
+            if (const GLint location = glGetAttribLocation(this->_program, name); location >= 0 && location < 32)
+                this->_activeAttributes |= 1u << location;
         }
     }
 
-    static GLuint compileVertexShader(const string& shaderPath)
+    // Every sampler starts on unit 0, samplers of different types on the same unit make the program invalid. The draws
+    // still set the units they bind
+    void assignSamplerUnits() const
     {
-        return compileSingleShader(shaderPath, GL_VERTEX_SHADER);
-    };
+        GLint count = 0;
+        glGetProgramiv(this->_program, GL_ACTIVE_UNIFORMS, &count);
+        GLint unit = 0;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(this->_program, i, sizeof(name), nullptr, &size, &type, name);
+            if (type != GL_SAMPLER_2D && type != GL_SAMPLER_2D_ARRAY && type != GL_SAMPLER_3D &&
+                type != GL_SAMPLER_BUFFER && type != GL_SAMPLER_CUBE)
+                continue;
+            glProgramUniform1i(this->_program, glGetUniformLocation(this->_program, name), unit++);
+        }
+    }
 
-    static GLuint compileFragmentShader(const string& shaderPath)
+    bool isValid(GLchar (&infoLog)[512]) const
     {
-        return compileSingleShader(shaderPath, GL_FRAGMENT_SHADER);
-    };
+        glValidateProgram(this->_program);
+        GLint isValid;
+        glGetProgramiv(this->_program, GL_VALIDATE_STATUS, &isValid);
+        if (isValid == GL_FALSE)
+        {
+            glGetProgramInfoLog(this->_program, 512, nullptr, infoLog);
+            return false;
+        }
+        return true;
+    }
 
-    static GLuint compileSingleShader(const string& shaderPath, GLuint shaderType)
+    void freeGPUResources()
     {
-        string shaderString;
-        ifstream shaderFile;
+        if (_program)
+        {
+            GLState::get().forgetProgram(this->_program);
+            glDeleteProgram(this->_program);
+            _program = 0;
+        }
+    }
 
+    static string readSource(const string& shaderPath)
+    {
+        ifstream shaderFile;
         shaderFile.exceptions(ifstream::failbit | ifstream::badbit);
         try
         {
@@ -121,14 +195,18 @@ private:
             stringstream shaderStream;
             shaderStream << shaderFile.rdbuf();
             shaderFile.close();
-            shaderString = shaderStream.str();
+            return shaderStream.str();
         }
         catch (ifstream::failure& e)
         {
             cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
             cout << "Path: " << shaderPath << endl;
         }
+        return {};
+    }
 
+    static GLuint compileSingleShader(const string& shaderString, GLuint shaderType)
+    {
         const GLchar* shaderCode = shaderString.c_str();
 
         GLuint shader;
@@ -141,9 +219,10 @@ private:
         return shader;
     }
 
-    static void checkCompileErrors(const GLuint shader, const GLuint type)
+    // Returns false on errors
+    static bool checkCompileErrors(const GLuint shader, const GLuint type)
     {
-        GLint success;
+        GLint success = GL_FALSE;
         GLchar infoLog[1024];
         if (type == GL_VERTEX_SHADER || type == GL_FRAGMENT_SHADER)
         {
@@ -167,5 +246,6 @@ private:
                     "\n| -- --------------------------------------------------- -- |" << endl;
             }
         }
+        return success;
     }
 };
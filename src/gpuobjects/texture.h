@@ -1,45 +1,72 @@
 #pragma once
 #define STB_IMAGE_IMPLEMENTATION
 #include <stbimage/stb_image.h>
+#include <cstdlib>
+#include <memory>
 #include <utils/nocopy.h>
 
+#include "glstate.h"
+#include "texturecodec.h"
+
+// Decoded image, produced by Texture::decode (possibly on a loader thread)
+struct ImageData
+{
+    int width = 0, height = 0, nrChannels = 0;
+    std::unique_ptr<unsigned char, void (*)(void*)> pixels{nullptr, stbi_image_free};
+};
+
 class Texture : NoCopy
 {
 public:
     explicit Texture(const string& pathToTextureFile): NoCopy{}
     {
-        unsigned char* data = stbi_load(pathToTextureFile.c_str(), &_width, &_height, &_nrChannels, 0);
-        if (data)
+        if (const auto image = decode(pathToTextureFile))
         {
-            glGenTextures(1, &_textureId);
-            glBindTexture(GL_TEXTURE_2D, _textureId);
-            GLuint internalFormat = 0;
-            if (_nrChannels == 3)
-            {
-                internalFormat = GL_RGB;
-            }
-            else if (_nrChannels == 4)
-            {
-                internalFormat = GL_RGBA;
-            }
-            else
-            {
-                std::cout << "Panic: Texture with " << _nrChannels << " channels" << std::endl;
-            }
-
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _width, _height, 0, internalFormat, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            STBI_FREE(data);
+            upload(image->width, image->height, image->nrChannels, image->pixels.get());
         }
-        else
+    }
+
+    // Texture from raw 8 bit per channel pixels, e.g. a 1x1 placeholder
+    explicit Texture(const int width, const int height, const int nrChannels, const unsigned char* pixels): NoCopy{}
+    {
+        upload(width, height, nrChannels, pixels);
+    }
+
+    // Size and channels read from the header of the image file, without decoding it
+    static bool probe(const string& pathToTextureFile, int& width, int& height, int& nrChannels)
+    {
+        if (!stbi_info(pathToTextureFile.c_str(), &width, &height, &nrChannels))
         {
             std::cout << "Failed to load texture: " + pathToTextureFile << std::endl;
+            return false;
         }
+        return true;
+    }
+
+    // Reads and decodes the image file without calling OpenGL, it is safe to call it from any thread.
+    // Returns nullptr on errors
+    static std::unique_ptr<ImageData> decode(const string& pathToTextureFile)
+    {
+        auto image = std::make_unique<ImageData>();
+        image->pixels.reset(stbi_load(pathToTextureFile.c_str(), &image->width, &image->height, &image->nrChannels,
+                                      0));
+        if (!image->pixels)
+        {
+            std::cout << "Failed to load texture: " + pathToTextureFile << std::endl;
+            return nullptr;
+        }
+        if (image->nrChannels == 2)
+        {
+            // grey + alpha has no matching pixel format, expanded to RGBA. stbi_image_free is STBI_FREE, free()
+            const auto pixelCount = static_cast<size_t>(image->width) * image->height;
+            auto* rgba = static_cast<unsigned char*>(std::malloc(pixelCount * 4));
+            if (!rgba)
+                return nullptr;
+            TextureCodec::convert(image->pixels.get(), 2, pixelCount, 4, rgba);
+            image->pixels.reset(rgba);
+            image->nrChannels = 4;
+        }
+        return image;
     }
 
     ~Texture()
@@ -48,7 +75,7 @@ public:
     }
 
     Texture(Texture&& other) noexcept: NoCopy{}, _textureId{other._textureId}, _width{other._width},
-                                       _height{other._height}, _nrChannels{other._nrChannels}
+                                       _height{other._height}, _format{other._format}
     {
         other._textureId = 0;
     };
@@ -59,7 +86,7 @@ public:
         this->_textureId = other._textureId;
         this->_width = other._width;
         this->_height = other._height;
-        this->_nrChannels = other._nrChannels;
+        this->_format = other._format;
 
         other._textureId = 0;
         return *this;
@@ -72,23 +99,70 @@ public:
 
     void bind(const GLuint offset) const
     {
-        glActiveTexture(GL_TEXTURE0 + offset);
-        glBindTexture(GL_TEXTURE_2D, _textureId);
+        GLState::get().bindTexture(offset, GL_TEXTURE_2D, _textureId);
     }
 
     [[nodiscard]] int width() const { return _width; }
     [[nodiscard]] int height() const { return _height; }
-    [[nodiscard]] int nrChannels() const { return _nrChannels; }
+    [[nodiscard]] int nrChannels() const { return TextureCodec::channels(_format); }
+    [[nodiscard]] TextureFormat format() const { return _format; }
     [[nodiscard]] GLuint textureId() const { return _textureId; }
 
+    // The pixels are not kept on the CPU after the upload
+    [[nodiscard]] size_t gpuBytes() const
+    {
+        return TextureCodec::chainBytes(_format, _width, _height);
+    }
+
 private:
     GLuint _textureId = 0;
-    int _width = 0, _height = 0, _nrChannels = 0;
+    int _width = 0, _height = 0;
+    TextureFormat _format = TextureFormat::RGBA8;
+
+    void create()
+    {
+        glGenTextures(1, &_textureId);
+        GLState::get().bindTexture(0, GL_TEXTURE_2D, _textureId);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    void upload(const int width, const int height, const int nrChannels, const unsigned char* data)
+    {
+        if (nrChannels == 2)
+            std::cout << "Panic: Texture with " << nrChannels << " channels" << std::endl;
+        _width = width;
+        _height = height;
+        _format = TextureCodec::uncompressed(nrChannels);
+        create();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, TextureCodec::internalFormat(_format), _width, _height, 0, pixelFormat(),
+                     GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    [[nodiscard]] GLenum pixelFormat() const
+    {
+        switch (_format)
+        {
+        case TextureFormat::RGB8: return GL_RGB;
+        case TextureFormat::RGBA8: return GL_RGBA;
+        case TextureFormat::R8: return GL_RED;
+        default:
+            std::cout << "Panic: compressed texture uploaded as pixels" << std::endl;
+            return 0;
+        }
+    }
 
     void freeGPUResources()
     {
         if (_textureId)
         {
+            GLState::get().forgetTexture(_textureId);
             glDeleteTextures(1, &_textureId);
             _textureId = 0;
         }
@@ -0,0 +1,131 @@
+#pragma once
+#include <utils/nocopy.h>
+
+#include "glstate.h"
+#include "texturecodec.h"
+
+// GL_TEXTURE_2D_ARRAY of layers with the same size and format, the storage of every layer and mip level is allocated
+// up front. The layers are filled in parts, the mipmaps of the uncompressed formats are generated once they all are
+class TextureArray : NoCopy
+{
+public:
+    TextureArray(const int width, const int height, const int layers, const TextureFormat format): NoCopy{},
+        _width{width}, _height{height}, _layers{layers}, _format{format}
+    {
+        glGenTextures(1, &_textureId);
+        GLState::get().bindTexture(0, GL_TEXTURE_2D_ARRAY, _textureId);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, TextureCodec::levelCount(_width, _height),
+                       TextureCodec::internalFormat(_format), _width, _height, _layers);
+    }
+
+    ~TextureArray()
+    {
+        freeGPUResources();
+    }
+
+    TextureArray(TextureArray&& other) noexcept: NoCopy{}, _textureId{other._textureId}, _width{other._width},
+                                                 _height{other._height}, _layers{other._layers}, _format{other._format},
+                                                 _filledLayers{other._filledLayers}
+    {
+        other._textureId = 0;
+    };
+
+    TextureArray& operator=(TextureArray&& other) noexcept
+    {
+        freeGPUResources();
+        this->_textureId = other._textureId;
+        this->_width = other._width;
+        this->_height = other._height;
+        this->_layers = other._layers;
+        this->_format = other._format;
+        this->_filledLayers = other._filledLayers;
+
+        other._textureId = 0;
+        return *this;
+    };
+
+    void bind(const GLuint offset) const
+    {
+        GLState::get().bindTexture(offset, GL_TEXTURE_2D_ARRAY, _textureId);
+    }
+
+    // Rows [firstRow, firstRow + rowCount) of the base level of an uncompressed layer, tightly packed pixels with
+    // TextureCodec::channels(format) channels. While a PboWriteBuffer is bound pixels is an offset in it
+    void uploadRows(const int layer, const int firstRow, const int rowCount, const void* pixels) const
+    {
+        GLState::get().bindTexture(0, GL_TEXTURE_2D_ARRAY, _textureId);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, firstRow, layer, _width, rowCount, 1, pixelFormat(),
+                        GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // One mip level of a compressed layer, as laid out by TextureCodec::transcode. Returns its bytes
+    // While a PboWriteBuffer is bound data is an offset in it
+    size_t uploadCompressedLevel(const int layer, const int level, const void* data) const
+    {
+        const int w = TextureCodec::levelSize(_width, level), h = TextureCodec::levelSize(_height, level);
+        const auto bytes = TextureCodec::levelBytes(_format, w, h);
+        GLState::get().bindTexture(0, GL_TEXTURE_2D_ARRAY, _textureId);
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, w, h, 1,
+                                  TextureCodec::internalFormat(_format), static_cast<GLsizei>(bytes), data);
+        return bytes;
+    }
+
+    // Render thread, after the upload of a layer (or its failure). Returns true once every layer is filled
+    bool layerFilled()
+    {
+        _filledLayers++;
+        if (complete() && !TextureCodec::compressed(_format))
+        {
+            GLState::get().bindTexture(0, GL_TEXTURE_2D_ARRAY, _textureId);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+        return complete();
+    }
+
+    [[nodiscard]] bool complete() const
+    {
+        return _filledLayers == _layers;
+    }
+
+    [[nodiscard]] int width() const { return _width; }
+    [[nodiscard]] int height() const { return _height; }
+    [[nodiscard]] int layers() const { return _layers; }
+    [[nodiscard]] TextureFormat format() const { return _format; }
+
+    [[nodiscard]] size_t gpuBytes() const
+    {
+        return TextureCodec::chainBytes(_format, _width, _height) * _layers;
+    }
+
+private:
+    GLuint _textureId = 0;
+    int _width = 0, _height = 0, _layers = 0;
+    TextureFormat _format = TextureFormat::RGBA8;
+    int _filledLayers = 0;
+
+    [[nodiscard]] GLenum pixelFormat() const
+    {
+        switch (_format)
+        {
+        case TextureFormat::RGB8: return GL_RGB;
+        case TextureFormat::R8: return GL_RED;
+        default: return GL_RGBA;
+        }
+    }
+
+    void freeGPUResources()
+    {
+        if (_textureId)
+        {
+            GLState::get().forgetTexture(_textureId);
+            glDeleteTextures(1, &_textureId);
+            _textureId = 0;
+        }
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <utils/diskcache.h>
+#include <utils/mappedfile.h>
+
+#include "texturecodec.h"
+
+/*
+Binary cache of transcoded textures, one file per (image path, format) under ./.cache/textures.
+Layout: FileHeader followed by the encoded mip levels, largest first, as glCompressedTexSubImage2D takes them.
+A hit skips both the image decoding and the encoding. An entry is rebuilt when the format version changes, or when the
+source file size or modification time differ from the ones recorded in the header.
+*/
+class TextureCache
+{
+public:
+    // Bump when the layout of the file or the output of the encoders changes
+    static constexpr uint32_t VERSION = 1;
+
+    // Copies the cached levels to dst, which holds TextureCodec::chainBytes(format, width, height) bytes
+    static bool load(const string& path, const TextureFormat format, const int width, const int height,
+                     unsigned char* dst)
+    {
+        if (!diskCacheEnabled())
+            return false;
+        const auto cachePath = entryPath(path, format);
+        if (!std::filesystem::exists(cachePath))
+            return false;
+        const MappedFile file(cachePath.string());
+        const auto bytes = TextureCodec::chainBytes(format, width, height);
+
+        FileHeader header{};
+        if (!file.data() || file.size() < sizeof(FileHeader))
+            return discard(cachePath);
+        std::memcpy(&header, file.data(), sizeof(FileHeader));
+        if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION)
+            return discard(cachePath);
+        if (header.sourceKey != sourceFileKey(path) || header.width != static_cast<uint32_t>(width) ||
+            header.height != static_cast<uint32_t>(height))
+            return false;
+        if (header.format != static_cast<uint32_t>(format) || header.dataBytes != bytes ||
+            sizeof(FileHeader) + bytes > file.size())
+            return discard(cachePath);
+        std::memcpy(dst, file.data() + sizeof(FileHeader), bytes);
+        return true;
+    }
+
+    static void store(const string& path, const TextureFormat format, const int width, const int height,
+                      const unsigned char* data)
+    {
+        if (!diskCacheEnabled())
+            return;
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.format = static_cast<uint32_t>(format);
+        header.sourceKey = sourceFileKey(path);
+        header.width = static_cast<uint32_t>(width);
+        header.height = static_cast<uint32_t>(height);
+        header.dataBytes = TextureCodec::chainBytes(format, width, height);
+        if (!writeFileAtomic(entryPath(path, format), {{&header, sizeof(FileHeader)}, {data, header.dataBytes}}))
+            std::cout << "Failed to write the texture cache for " << path << std::endl;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'T', 'G', 'P', 'T', 'E', 'X', '\0'};
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t format;
+        // size and modification time of the source file
+        uint64_t sourceKey;
+        uint32_t width, height;
+        uint64_t dataBytes;
+    };
+
+    static std::filesystem::path entryPath(const string& path, const TextureFormat format)
+    {
+        const auto variant = static_cast<uint32_t>(format);
+        return diskCachePath("textures", fnv1a(&variant, sizeof(variant), fnv1a(path)), ".tex");
+    }
+
+    static bool discard(const std::filesystem::path& cachePath)
+    {
+        std::cout << "Discarding invalid texture cache " << cachePath.string() << std::endl;
+        std::error_code ec;
+        std::filesystem::remove(cachePath, ec);
+        return false;
+    }
+};
@@ -0,0 +1,352 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utils/threadpool.h>
+
+// How the texels are stored on the GPU
+enum class TextureFormat
+{
+    RGB8,
+    RGBA8,
+    R8,
+    // BC4, one channel in 8 bytes per 4x4 block
+    RGTC1,
+    // BC7, RGBA in 16 bytes per 4x4 block
+    BPTC,
+};
+
+/*
+CPU side of the texture formats: size of the mip levels and the encoders of the block compressed formats.
+RGTC and BPTC are core since GL 3.0 and 4.2, S3TC (BC1-3) is an extension and is not used.
+glGenerateMipmap can't write compressed formats, so the whole mip chain of a compressed texture is built and encoded here.
+The encoders favour speed over quality: the result is stored in the texture cache (see texturecache.h).
+*/
+class TextureCodec
+{
+public:
+    [[nodiscard]] static bool compressed(const TextureFormat format)
+    {
+        return format == TextureFormat::RGTC1 || format == TextureFormat::BPTC;
+    }
+
+    // Channels of the pixels given to the upload or to transcode()
+    [[nodiscard]] static int channels(const TextureFormat format)
+    {
+        switch (format)
+        {
+        case TextureFormat::RGB8: return 3;
+        case TextureFormat::R8:
+        case TextureFormat::RGTC1: return 1;
+        default: return 4;
+        }
+    }
+
+    // Uncompressed format for 8 bit pixels with the given channels
+    [[nodiscard]] static TextureFormat uncompressed(const int nrChannels)
+    {
+        return nrChannels == 1 ? TextureFormat::R8 : nrChannels == 3 ? TextureFormat::RGB8 : TextureFormat::RGBA8;
+    }
+
+    [[nodiscard]] static GLenum internalFormat(const TextureFormat format)
+    {
+        switch (format)
+        {
+        case TextureFormat::RGB8: return GL_RGB8;
+        case TextureFormat::RGBA8: return GL_RGBA8;
+        case TextureFormat::R8: return GL_R8;
+        case TextureFormat::RGTC1: return GL_COMPRESSED_RED_RGTC1;
+        default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        }
+    }
+
+    // Down to 1x1
+    [[nodiscard]] static int levelCount(const int width, const int height)
+    {
+        int levels = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2)
+            levels++;
+        return levels;
+    }
+
+    [[nodiscard]] static int levelSize(const int size, const int level)
+    {
+        return std::max(1, size >> level);
+    }
+
+    [[nodiscard]] static size_t levelBytes(const TextureFormat format, const int width, const int height)
+    {
+        if (!compressed(format))
+            return static_cast<size_t>(width) * height * channels(format);
+        const size_t blocks = static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4);
+        return blocks * (format == TextureFormat::RGTC1 ? 8 : 16);
+    }
+
+    // Bytes uploaded from the CPU: every level for compressed formats, the base level otherwise (the GPU builds the mipmaps)
+    [[nodiscard]] static size_t uploadBytes(const TextureFormat format, const int width, const int height)
+    {
+        return compressed(format) ? chainBytes(format, width, height) : levelBytes(format, width, height);
+    }
+
+    [[nodiscard]] static size_t chainBytes(const TextureFormat format, const int width, const int height)
+    {
+        size_t bytes = 0;
+        for (int l = 0; l < levelCount(width, height); l++)
+            bytes += levelBytes(format, levelSize(width, l), levelSize(height, l));
+        return bytes;
+    }
+
+    // Converts 8 bit pixels between channel counts. To one channel the red one is kept, grey sources are expanded to RGB
+    // and a missing alpha is opaque
+    static void convert(const unsigned char* src, const int srcChannels, const size_t pixelCount,
+                        const int dstChannels, unsigned char* dst)
+    {
+        if (srcChannels == dstChannels)
+        {
+            std::memcpy(dst, src, pixelCount * srcChannels);
+            return;
+        }
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const unsigned char* s = src + i * srcChannels;
+            unsigned char* d = dst + i * dstChannels;
+            const bool grey = srcChannels < 3;
+            const unsigned char alpha = srcChannels == 2 || srcChannels == 4 ? s[srcChannels - 1] : 255;
+            d[0] = s[0];
+            if (dstChannels >= 3)
+            {
+                d[1] = grey ? s[0] : s[1];
+                d[2] = grey ? s[0] : s[2];
+            }
+            if (dstChannels == 4)
+                d[3] = alpha;
+            else if (dstChannels == 2)
+                d[1] = alpha;
+        }
+    }
+
+    // Builds the mip chain of pixels (channels(format) channels) and encodes every level on the workers of pool, out
+    // must hold chainBytes(format, width, height) bytes
+    static void transcode(const unsigned char* pixels, const int width, const int height, const TextureFormat format,
+                          unsigned char* out, ThreadPool& pool = ThreadPool::shared())
+    {
+        const int nrChannels = channels(format);
+        std::vector<unsigned char> level(pixels, pixels + static_cast<size_t>(width) * height * nrChannels);
+        std::vector<unsigned char> next;
+        int w = width, h = height;
+        for (int l = 0; l < levelCount(width, height); l++)
+        {
+            if (l > 0)
+            {
+                downsample(level, w, h, nrChannels, next);
+                level.swap(next);
+                w = std::max(1, w / 2);
+                h = std::max(1, h / 2);
+            }
+            encodeLevel(level.data(), w, h, format, out, pool);
+            out += levelBytes(format, w, h);
+        }
+    }
+
+private:
+    // 2x2 box filter, odd sizes drop the last row/column
+    static void downsample(const std::vector<unsigned char>& src, const int width, const int height,
+                           const int nrChannels, std::vector<unsigned char>& dst)
+    {
+        const int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        dst.resize(static_cast<size_t>(w) * h * nrChannels);
+        for (int y = 0; y < h; y++)
+        {
+            const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < w; x++)
+            {
+                const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                for (int c = 0; c < nrChannels; c++)
+                {
+                    const auto at = [&](const int px, const int py)
+                    {
+                        return src[(static_cast<size_t>(py) * width + px) * nrChannels + c];
+                    };
+                    dst[(static_cast<size_t>(y) * w + x) * nrChannels + c] = static_cast<unsigned char>(
+                        (at(x0, y0) + at(x1, y0) + at(x0, y1) + at(x1, y1) + 2) / 4);
+                }
+            }
+        }
+    }
+
+    static void encodeLevel(const unsigned char* pixels, const int width, const int height, const TextureFormat format,
+                            unsigned char* out, ThreadPool& pool)
+    {
+        const int nrChannels = channels(format);
+        const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        const size_t blockBytes = format == TextureFormat::RGTC1 ? 8 : 16;
+        // Ranges of block rows of at least 256 blocks, the small levels are not worth the workers
+        pool.parallelFor(blocksY, std::max(1, 256 / blocksX), [&](const size_t begin, const size_t end)
+        {
+            unsigned char block[16 * 4];
+            for (auto by = begin; by < end; by++)
+            {
+                for (int bx = 0; bx < blocksX; bx++)
+                {
+                    // the blocks that overhang the edge repeat the last row/column
+                    for (int i = 0; i < 16; i++)
+                    {
+                        const int x = std::min(bx * 4 + i % 4, width - 1);
+                        const int y = std::min(static_cast<int>(by) * 4 + i / 4, height - 1);
+                        std::memcpy(block + i * nrChannels,
+                                    pixels + (static_cast<size_t>(y) * width + x) * nrChannels, nrChannels);
+                    }
+                    unsigned char* dst = out + (by * blocksX + bx) * blockBytes;
+                    if (format == TextureFormat::RGTC1)
+                        encodeBC4(block, dst);
+                    else
+                        encodeBC7(block, dst);
+                }
+            }
+        });
+    }
+
+    // Endpoints on the min and max of the block, the 8 value mode spreads 6 interpolated values between them
+    static void encodeBC4(const unsigned char block[16], unsigned char out[8])
+    {
+        const auto [lo, hi] = std::minmax_element(block, block + 16);
+        const int min = *lo, max = *hi;
+        out[0] = static_cast<unsigned char>(max);
+        out[1] = static_cast<unsigned char>(min);
+        uint64_t indices = 0;
+        if (max > min)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                // step from min (0) to max (7), mapped to the codes: 0 = max, 1 = min, 2..7 from max to min
+                const int step = ((block[i] - min) * 14 + (max - min)) / (2 * (max - min));
+                const uint64_t code = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+                indices |= code << (3 * i);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+    }
+
+    // Mode 6: one subset, RGBA endpoints of 7 bits + a shared low bit each, 4 bit indices.
+    // The endpoints are the extremes of the block along its principal axis
+    static void encodeBC7(const unsigned char block[16 * 4], unsigned char out[16])
+    {
+        float mean[4] = {};
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 4; c++)
+                mean[c] += block[i * 4 + c] / 16.0f;
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++)
+            for (int a = 0; a < 4; a++)
+                for (int b = 0; b < 4; b++)
+                    covariance[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+        float axis[4] = {1, 1, 1, 1};
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {};
+            for (int a = 0; a < 4; a++)
+                for (int b = 0; b < 4; b++)
+                    next[a] += covariance[a][b] * axis[b];
+            const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+            if (length < 1e-6f)
+                break;
+            for (int a = 0; a < 4; a++)
+                axis[a] = next[a] / length;
+        }
+        float tMin = 0, tMax = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = 0;
+            for (int c = 0; c < 4; c++)
+                t += (block[i * 4 + c] - mean[c]) * axis[c];
+            tMin = std::min(tMin, t);
+            tMax = std::max(tMax, t);
+        }
+
+        // 7 bit endpoint and p bit, p chosen for the smallest error over the 4 channels
+        int endpoints[2][4], pBits[2];
+        for (int e = 0; e < 2; e++)
+        {
+            float target[4];
+            for (int c = 0; c < 4; c++)
+                target[c] = std::clamp(mean[c] + axis[c] * (e == 0 ? tMin : tMax), 0.0f, 255.0f);
+            float bestError = 1e30f;
+            for (int p = 0; p < 2; p++)
+            {
+                int quantized[4];
+                float error = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    quantized[c] = std::clamp(static_cast<int>(std::lround((target[c] - p) / 2)), 0, 127);
+                    const float d = static_cast<float>(quantized[c] << 1 | p) - target[c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    pBits[e] = p;
+                    std::copy(quantized, quantized + 4, endpoints[e]);
+                }
+            }
+        }
+
+        static constexpr int WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+        int palette[16][4];
+        for (int w = 0; w < 16; w++)
+            for (int c = 0; c < 4; c++)
+            {
+                const int e0 = endpoints[0][c] << 1 | pBits[0], e1 = endpoints[1][c] << 1 | pBits[1];
+                palette[w][c] = ((64 - WEIGHTS[w]) * e0 + WEIGHTS[w] * e1 + 32) >> 6;
+            }
+        int indices[16];
+        for (int i = 0; i < 16; i++)
+        {
+            int bestError = INT32_MAX;
+            for (int w = 0; w < 16; w++)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    const int d = palette[w][c] - block[i * 4 + c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    indices[i] = w;
+                }
+            }
+        }
+        // the top bit of the first index is implicit 0, swapping the endpoints inverts the indices
+        if (indices[0] & 8)
+        {
+            for (int c = 0; c < 4; c++)
+                std::swap(endpoints[0][c], endpoints[1][c]);
+            std::swap(pBits[0], pBits[1]);
+            for (int& index : indices)
+                index = 15 - index;
+        }
+
+        std::memset(out, 0, 16);
+        int bit = 0;
+        const auto put = [&](const uint32_t value, const int count)
+        {
+            for (int i = 0; i < count; i++, bit++)
+                out[bit / 8] |= static_cast<unsigned char>((value >> i & 1) << (bit % 8));
+        };
+        put(1 << 6, 7);
+        for (int c = 0; c < 4; c++)
+        {
+            put(endpoints[0][c], 7);
+            put(endpoints[1][c], 7);
+        }
+        put(pBits[0], 1);
+        put(pBits[1], 1);
+        put(indices[0], 3);
+        for (int i = 1; i < 16; i++)
+            put(indices[i], 4);
+    }
+};
@@ -0,0 +1,567 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include <gpuobjects/meshsdf.h>
+#include <gpuobjects/particles.h>
+#include <utils/nocopy.h>
+#include <utils/spatialhash.h>
+#include <utils/threadpool.h>
+
+// The particles stay on the side normal points to of the plane dot(normal, p) = offset
+struct CollisionPlane
+{
+    glm::vec3 normal{0, 1, 0};
+    float offset{0};
+};
+
+// The particles stay outside
+struct CollisionSphere
+{
+    glm::vec3 center{0};
+    float radius{1};
+};
+
+// The dissolve of a CollisionMesh, the test of disappearing_mesh.frag: the surface is gone where the mask at its
+// texture coordinates is not above threshold. width x height texels of 0 to 255 row by row, repeated like the texture.
+// Without texels the surface is whole
+struct CollisionMask
+{
+    const unsigned char* texels{nullptr};
+    int width{0}, height{0};
+    float threshold{0};
+
+    [[nodiscard]] bool solid(const glm::vec2& uv) const
+    {
+        if (!texels)
+            return true;
+        const auto x = std::min(static_cast<int>((uv.x - std::floor(uv.x)) * static_cast<float>(width)), width - 1);
+        const auto y = std::min(static_cast<int>((uv.y - std::floor(uv.y)) * static_cast<float>(height)), height - 1);
+        return static_cast<float>(texels[static_cast<size_t>(y) * width + x]) > threshold * 255;
+    }
+};
+
+// A model through its signed distance field, the particles stay outside the part of it the mask leaves
+struct CollisionMesh
+{
+    const MeshSdf* sdf{nullptr};
+    // model to world
+    glm::mat4 worldMatrix{1};
+    CollisionMask mask;
+};
+
+/*
+The surfaces seen from a camera at low resolution, from a depth buffer read back by DepthCollider. Its cost does not
+depend on the meshes drawn in it, but it only knows the front of them: a particle collides when it goes from in front
+of the surface of its pixel to at most thickness (CollisionSettings::screen_thickness) behind it
+*/
+struct ScreenDepth
+{
+    int width{0}, height{0};
+    // world to clip space when the depth was drawn
+    glm::mat4 viewProjection{1};
+    // clip w (distance along the view axis) of the surface in every pixel, infinity where there is none
+    std::vector<float> surfaceW;
+    // world space normals of the surfaces, facing the camera
+    std::vector<glm::vec3> normals;
+
+    // depth: width * height values of a depth buffer in [0, 1], rows from the bottom
+    void build(const float* depth, const int width, const int height, const glm::mat4& viewProjection)
+    {
+        this->width = width;
+        this->height = height;
+        this->viewProjection = viewProjection;
+        const auto count = static_cast<size_t>(width) * height;
+        surfaceW.resize(count);
+        normals.resize(count);
+        positions.resize(count);
+        // the inverse of viewProjection times the NDC of every pixel, a row at a time
+        const auto m = glm::inverse(viewProjection);
+        const auto wRow = glm::vec3{viewProjection[0][3], viewProjection[1][3], viewProjection[2][3]};
+        for (int y = 0; y < height; y++)
+        {
+            const auto ndcY = (y + 0.5f) * 2 / height - 1;
+            const auto rowX = m[1][0] * ndcY + m[3][0], rowY = m[1][1] * ndcY + m[3][1];
+            const auto rowZ = m[1][2] * ndcY + m[3][2], rowW = m[1][3] * ndcY + m[3][3];
+            for (int x = 0; x < width; x++)
+            {
+                const auto i = static_cast<size_t>(y) * width + x;
+                if (depth[i] >= 1)
+                {
+                    surfaceW[i] = std::numeric_limits<float>::infinity();
+                    continue;
+                }
+                const auto ndcX = (x + 0.5f) * 2 / width - 1;
+                const auto ndcZ = depth[i] * 2 - 1;
+                const auto inverseW = 1 / (m[0][3] * ndcX + m[2][3] * ndcZ + rowW);
+                const auto world = glm::vec3{
+                    (m[0][0] * ndcX + m[2][0] * ndcZ + rowX) * inverseW,
+                    (m[0][1] * ndcX + m[2][1] * ndcZ + rowY) * inverseW,
+                    (m[0][2] * ndcX + m[2][2] * ndcZ + rowZ) * inverseW
+                };
+                positions[i] = world;
+                surfaceW[i] = wRow.x * world.x + wRow.y * world.y + wRow.z * world.z + viewProjection[3][3];
+            }
+        }
+        // Cross product of the differences with the neighbors along x and y, on each axis the side closer in depth:
+        // the normals do not bleed across the silhouettes. The view axis (wRow) where there is no neighbor
+        const auto away = glm::normalize(wRow);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const auto i = static_cast<size_t>(y) * width + x;
+                if (std::isinf(surfaceW[i]))
+                    continue;
+                const auto dx = difference(i, x > 0 ? i - 1 : i, x + 1 < width ? i + 1 : i);
+                const auto dy = difference(i, y > 0 ? i - width : i, y + 1 < height ? i + width : i);
+                auto n = glm::cross(dx, dy);
+                const auto length2 = glm::dot(n, n);
+                if (length2 == 0)
+                {
+                    normals[i] = -away;
+                    continue;
+                }
+                n /= std::sqrt(length2);
+                normals[i] = glm::dot(n, away) > 0 ? -n : n;
+            }
+        }
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return width == 0 || height == 0;
+    }
+
+    [[nodiscard]] size_t byteSize() const
+    {
+        return surfaceW.capacity() * sizeof(float) + (normals.capacity() + positions.capacity()) * sizeof(glm::vec3);
+    }
+
+private:
+    // world positions of the pixels, for the normals
+    std::vector<glm::vec3> positions;
+
+    // From pixel i to the neighbor (before or after it) closer in depth, zero if there is none
+    [[nodiscard]] glm::vec3 difference(const size_t i, const size_t before, const size_t after) const
+    {
+        const auto gap = [&](const size_t j)
+        {
+            return j == i || std::isinf(surfaceW[j])
+                       ? std::numeric_limits<float>::infinity()
+                       : std::abs(surfaceW[j] - surfaceW[i]);
+        };
+        const auto gapBefore = gap(before);
+        const auto gapAfter = gap(after);
+        if (std::isinf(gapBefore) && std::isinf(gapAfter))
+            return glm::vec3{0};
+        return gapBefore < gapAfter ? positions[i] - positions[before] : positions[after] - positions[i];
+    }
+};
+
+struct CollisionSettings
+{
+    std::vector<CollisionPlane> planes;
+    std::vector<CollisionSphere> spheres;
+    // set by Scene every step, the instances of the object not yet dissolved
+    std::vector<CollisionMesh> meshes;
+    // set by Scene every step while Scene::depth_collisions is on, null otherwise
+    const ScreenDepth* screen{nullptr};
+    // how far behind a surface of screen a particle is still pushed back on it, world units
+    float screen_thickness{0.5f};
+    // fraction of the velocity towards a collider kept, reversed, after the contact
+    float restitution{0.3f};
+    // fraction of the velocity along a collider lost at every contact
+    float friction{0.2f};
+    // radius of the particles against the colliders, and between them: two particles closer than twice this are pushed
+    // apart. 0 turns off the particle-particle pass
+    float particle_radius{0};
+
+    [[nodiscard]] bool enabled() const
+    {
+        return !planes.empty() || !spheres.empty() || !meshes.empty() || (screen && !screen->empty()) ||
+            particle_radius > 0;
+    }
+};
+
+// Work of the last ParticleCollisions::resolve
+struct CollisionStats
+{
+    // particles pushed out of a plane, a sphere, a mesh or the screen depth
+    unsigned int contacts{0};
+    // particles pushed apart by their neighbors
+    unsigned int separated{0};
+    double ms{0};
+};
+
+/*
+Collisions of the living particles, after every simulation step (Scene::simulate):
+1. particle-particle, when particle_radius > 0: the positions are bucketed in a SpatialHash with cells of twice the
+   radius, rebuilt every step, and every particle is pushed away from the neighbors it overlaps by half the overlap.
+   The pushes are all computed from the positions before the pass and then applied, the particles are independent
+2. particle against the planes, the spheres and the meshes: the particle is moved back to the surface and its velocity
+   is reflected with restitution and friction. The meshes go through a broad phase first: their fields' boxes in world
+   space, grown by the particle radius, are bucketed in a coarse grid of MAX_MESH_CELLS^3 cells at most, and a particle
+   is only transformed to the model space of the meshes of its cell whose box it is in. There a trilinear sample gives
+   distance and gradient, the depth is scaled to world units by the smallest scale of the mesh
+3. particle against the screen depth: the particles are projected LANES at a time, in plain float loops the compiler
+   vectorizes, and only the ones that crossed the surface of their pixel since the previous step are moved back to
+   where they crossed it and respond like above
+All passes are split in ranges of particles on the workers of the pool it receives.
+*/
+class ParticleCollisions : NoCopy
+{
+public:
+    CollisionSettings settings;
+
+    explicit ParticleCollisions(ThreadPool& pool = ThreadPool::shared()): NoCopy{}, pool{pool}
+    {
+    }
+
+    void resolve(Particles& particles)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        _lastStats = CollisionStats{};
+        const auto count = static_cast<size_t>(particles.livingParticles);
+        if (!settings.enabled() || count == 0)
+            return;
+        auto* data = particles.particles.data();
+        if (settings.particle_radius > 0)
+            separate(data, count);
+        if (!settings.planes.empty() || !settings.spheres.empty() || !settings.meshes.empty())
+            collide(data, count);
+        if (settings.screen && !settings.screen->empty())
+            collideScreen(data, count);
+        _lastStats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    [[nodiscard]] const CollisionStats& lastStats() const
+    {
+        return _lastStats;
+    }
+
+    // CPU memory of the particle-particle pass, bounded by the pool size
+    [[nodiscard]] size_t byteSize() const
+    {
+        return grid.byteSize() + (positions.capacity() + pushes.capacity()) * sizeof(glm::vec3) +
+            placedMeshes.capacity() * sizeof(PlacedMesh) + meshBuckets.byteSize();
+    }
+
+private:
+    static constexpr size_t GRAIN = 2048;
+    static constexpr size_t LANES = 8;
+    static constexpr int MAX_MESH_CELLS = 32;
+
+    // A CollisionMesh with what the particles need, once per step
+    struct PlacedMesh
+    {
+        const MeshSdf* sdf;
+        glm::mat4 toModel;
+        // gradients to world
+        glm::mat3 normalMatrix;
+        float scale;
+        // world box of the field grown by the particle radius, outside it the field is never reached
+        glm::vec3 min, max;
+        CollisionMask mask;
+    };
+
+    // The meshes whose box overlaps each cell of a grid over all of them, the cells about the size of a box
+    struct MeshBuckets
+    {
+        glm::vec3 origin{0};
+        glm::vec3 cellsPerUnit{0};
+        glm::ivec3 dims{0};
+        // meshes of cell c: indices[starts[c]] to indices[starts[c + 1]]
+        std::vector<uint32_t> starts;
+        std::vector<uint32_t> indices;
+
+        void build(const std::vector<PlacedMesh>& meshes)
+        {
+            dims = glm::ivec3{0};
+            if (meshes.empty())
+                return;
+            auto min = meshes[0].min, max = meshes[0].max;
+            auto meanSize = glm::vec3{0};
+            for (const auto& mesh : meshes)
+            {
+                min = glm::min(min, mesh.min);
+                max = glm::max(max, mesh.max);
+                meanSize += mesh.max - mesh.min;
+            }
+            meanSize /= static_cast<float>(meshes.size());
+            const auto cellSize = std::max(meanSize.x, std::max(meanSize.y, meanSize.z));
+            const auto size = glm::max(max - min, glm::vec3{1e-6f});
+            for (int axis = 0; axis < 3; axis++)
+                dims[axis] = std::clamp(static_cast<int>(std::ceil(size[axis] / cellSize)), 1, MAX_MESH_CELLS);
+            origin = min;
+            cellsPerUnit = glm::vec3{dims} / size;
+
+            const auto cellCount = static_cast<size_t>(dims.x) * dims.y * dims.z;
+            starts.assign(cellCount + 1, 0);
+            const auto forEachCell = [&](const PlacedMesh& mesh, auto&& f)
+            {
+                const auto lo = cellOf(mesh.min), hi = cellOf(mesh.max);
+                for (int z = lo.z; z <= hi.z; z++)
+                {
+                    for (int y = lo.y; y <= hi.y; y++)
+                    {
+                        for (int x = lo.x; x <= hi.x; x++)
+                            f((static_cast<size_t>(z) * dims.y + y) * dims.x + x);
+                    }
+                }
+            };
+            for (const auto& mesh : meshes)
+                forEachCell(mesh, [&](const size_t c) { starts[c + 1]++; });
+            for (size_t c = 0; c < cellCount; c++)
+                starts[c + 1] += starts[c];
+            indices.resize(starts[cellCount]);
+            std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+            for (size_t m = 0; m < meshes.size(); m++)
+                forEachCell(meshes[m], [&](const size_t c) { indices[fill[c]++] = static_cast<uint32_t>(m); });
+        }
+
+        // f(index of the mesh) for the meshes of the cell of p, none outside the grid or without meshes
+        template <typename F>
+        void forEachNear(const glm::vec3& p, F&& f) const
+        {
+            if (dims.x == 0)
+                return;
+            const auto cell = (p - origin) * cellsPerUnit;
+            if (!(cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x <= static_cast<float>(dims.x) &&
+                cell.y <= static_cast<float>(dims.y) && cell.z <= static_cast<float>(dims.z)))
+                return;
+            const auto c = (static_cast<size_t>(std::min(static_cast<int>(cell.z), dims.z - 1)) * dims.y +
+                std::min(static_cast<int>(cell.y), dims.y - 1)) * dims.x + std::min(static_cast<int>(cell.x), dims.x - 1);
+            for (auto i = starts[c]; i < starts[c + 1]; i++)
+                f(indices[i]);
+        }
+
+        [[nodiscard]] glm::ivec3 cellOf(const glm::vec3& p) const
+        {
+            return glm::clamp(glm::ivec3{(p - origin) * cellsPerUnit}, glm::ivec3{0}, dims - 1);
+        }
+
+        [[nodiscard]] size_t byteSize() const
+        {
+            return (starts.capacity() + indices.capacity()) * sizeof(uint32_t);
+        }
+    };
+
+    SpatialHash grid;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> pushes;
+    std::vector<PlacedMesh> placedMeshes;
+    MeshBuckets meshBuckets;
+    CollisionStats _lastStats;
+    ThreadPool& pool;
+
+    void separate(Particles::Particle* data, const size_t count)
+    {
+        const auto radius = settings.particle_radius;
+        const auto diameter = 2 * radius;
+        positions.resize(count);
+        pushes.resize(count);
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                positions[i] = data[i].pos();
+        });
+        grid.cellSize(diameter);
+        grid.build(positions.data(), count, pool);
+
+        // in the order of the grid, consecutive particles have the same neighbors
+        const auto& order = grid.order();
+        std::atomic<unsigned int> separated{0};
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            unsigned int moved = 0;
+            for (size_t k = begin; k < end; k++)
+            {
+                const auto i = order[k];
+                const auto p = positions[i];
+                auto push = glm::vec3{0};
+                grid.forEachNear(p, [&](const uint32_t j, const glm::vec3& q)
+                {
+                    const auto d = p - q;
+                    const auto distance2 = glm::dot(d, d);
+                    // coincident particles are left alone, there is no direction to push them in
+                    if (j == i || distance2 >= diameter * diameter || distance2 == 0)
+                        return;
+                    const auto distance = std::sqrt(distance2);
+                    push += d * ((diameter - distance) * 0.5f / distance);
+                });
+                pushes[i] = push;
+                moved += push != glm::vec3{0};
+            }
+            separated += moved;
+        });
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                if (pushes[i] != glm::vec3{0})
+                    data[i].pos(positions[i] + pushes[i]);
+            }
+        });
+        _lastStats.separated = separated;
+    }
+
+    void collide(Particles::Particle* data, const size_t count)
+    {
+        placedMeshes.clear();
+        for (const auto& mesh : settings.meshes)
+        {
+            const auto linear = glm::mat3{mesh.worldMatrix};
+            const auto scale = std::min(glm::length(linear[0]),
+                                        std::min(glm::length(linear[1]), glm::length(linear[2])));
+            if (!mesh.sdf || mesh.sdf->resolution() == 0 || scale <= 0)
+                continue;
+            // the box of the field around its center, its half size through the absolute values of the matrix
+            const auto halfSize = glm::vec3{mesh.sdf->cellSize() * static_cast<float>(mesh.sdf->resolution() - 1) *
+                0.5f};
+            const auto center = glm::vec3{mesh.worldMatrix * glm::vec4{mesh.sdf->origin() + halfSize, 1}};
+            const auto reach = glm::abs(linear[0]) * halfSize.x + glm::abs(linear[1]) * halfSize.y +
+                glm::abs(linear[2]) * halfSize.z + glm::vec3{settings.particle_radius};
+            placedMeshes.push_back(PlacedMesh{
+                mesh.sdf, glm::inverse(mesh.worldMatrix), glm::transpose(glm::inverse(linear)), scale, center - reach,
+                center + reach, mesh.mask
+            });
+        }
+        meshBuckets.build(placedMeshes);
+        std::atomic<unsigned int> contacts{0};
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            unsigned int touched = 0;
+            for (size_t i = begin; i < end; i++)
+            {
+                auto& particle = data[i];
+                auto p = particle.pos();
+                auto v = particle.velocity();
+                bool contact = false;
+                const auto respond = [&](const glm::vec3& n, const float depth)
+                {
+                    contact |= bounce(p, v, n, depth);
+                };
+                for (const auto& plane : settings.planes)
+                    respond(plane.normal, settings.particle_radius + plane.offset - glm::dot(plane.normal, p));
+                for (const auto& sphere : settings.spheres)
+                {
+                    const auto d = p - sphere.center;
+                    const auto distance2 = glm::dot(d, d);
+                    const auto reach = sphere.radius + settings.particle_radius;
+                    if (distance2 >= reach * reach || distance2 == 0)
+                        continue;
+                    const auto distance = std::sqrt(distance2);
+                    respond(d / distance, reach - distance);
+                }
+                meshBuckets.forEachNear(p, [&](const uint32_t m)
+                {
+                    const auto& mesh = placedMeshes[m];
+                    if (p.x < mesh.min.x || p.y < mesh.min.y || p.z < mesh.min.z || p.x > mesh.max.x ||
+                        p.y > mesh.max.y || p.z > mesh.max.z)
+                        return;
+                    const auto model = glm::vec3{mesh.toModel * glm::vec4{p, 1}};
+                    const auto sample = mesh.sdf->sample(model);
+                    const auto reach = settings.particle_radius / mesh.scale;
+                    // dissolved at the closest surface point, no contact even if intact surface is within reach
+                    if (sample.x >= reach || !mesh.mask.solid(mesh.sdf->surfaceUv(model)))
+                        return;
+                    const auto n = mesh.normalMatrix * glm::vec3{sample.y, sample.z, sample.w};
+                    const auto length2 = glm::dot(n, n);
+                    if (length2 == 0)
+                        return;
+                    respond(n / std::sqrt(length2), (reach - sample.x) * mesh.scale);
+                });
+                if (contact)
+                {
+                    particle.pos(p);
+                    particle.velocity(v);
+                    touched++;
+                }
+            }
+            contacts += touched;
+        });
+        _lastStats.contacts = contacts;
+    }
+
+    void collideScreen(Particles::Particle* data, const size_t count)
+    {
+        const auto& screen = *settings.screen;
+        const auto& m = screen.viewProjection;
+        const auto width = static_cast<float>(screen.width);
+        const auto height = static_cast<float>(screen.height);
+        std::atomic<unsigned int> contacts{0};
+        pool.parallelFor(count, GRAIN, [&](const size_t begin, const size_t end)
+        {
+            unsigned int touched = 0;
+            float x[LANES], y[LANES], z[LANES], w[LANES];
+            int pixel[LANES];
+            for (size_t first = begin; first < end; first += LANES)
+            {
+                const auto lanes = std::min(LANES, end - first);
+                for (size_t l = 0; l < LANES; l++)
+                {
+                    const auto p = l < lanes ? data[first + l].pos() : glm::vec3{0};
+                    x[l] = p.x;
+                    y[l] = p.y;
+                    z[l] = p.z;
+                }
+                // pixel of every lane, -1 behind the camera or off screen
+                for (size_t l = 0; l < LANES; l++)
+                {
+                    const auto clipX = m[0][0] * x[l] + m[1][0] * y[l] + m[2][0] * z[l] + m[3][0];
+                    const auto clipY = m[0][1] * x[l] + m[1][1] * y[l] + m[2][1] * z[l] + m[3][1];
+                    w[l] = m[0][3] * x[l] + m[1][3] * y[l] + m[2][3] * z[l] + m[3][3];
+                    const auto u = (clipX / w[l] * 0.5f + 0.5f) * width;
+                    const auto v = (clipY / w[l] * 0.5f + 0.5f) * height;
+                    const bool inside = w[l] > 0 && u >= 0 && u < width && v >= 0 && v < height;
+                    pixel[l] = inside ? static_cast<int>(v) * screen.width + static_cast<int>(u) : -1;
+                }
+                for (size_t l = 0; l < lanes; l++)
+                {
+                    if (pixel[l] < 0)
+                        continue;
+                    const auto surface = screen.surfaceW[pixel[l]];
+                    if (w[l] <= surface || w[l] > surface + settings.screen_thickness)
+                        continue;
+                    // only the particles that were in front of the surface, the ones that went behind the object
+                    // some other way stay there
+                    auto& particle = data[first + l];
+                    const auto previous = particle.previousPos();
+                    const auto previousW = m[0][3] * previous.x + m[1][3] * previous.y + m[2][3] * previous.z +
+                        m[3][3];
+                    if (previousW >= surface)
+                        continue;
+                    auto p = glm::vec3{x[l], y[l], z[l]};
+                    const auto crossing = glm::mix(previous, p, (surface - previousW) / (w[l] - previousW));
+                    const auto& n = screen.normals[pixel[l]];
+                    auto v = particle.velocity();
+                    if (bounce(p, v, n, glm::dot(n, crossing - p) + settings.particle_radius))
+                    {
+                        particle.pos(p);
+                        particle.velocity(v);
+                        touched++;
+                    }
+                }
+            }
+            contacts += touched;
+        });
+        _lastStats.contacts += contacts;
+    }
+
+    // depth > 0 is inside the collider, n its outward normal: p is moved out and v reflected, false if depth <= 0
+    [[nodiscard]] bool bounce(glm::vec3& p, glm::vec3& v, const glm::vec3& n, const float depth) const
+    {
+        if (depth <= 0)
+            return false;
+        p += n * depth;
+        if (const auto vn = glm::dot(v, n); vn < 0)
+            v = (v - n * vn) * (1 - settings.friction) - n * (vn * settings.restitution);
+        return true;
+    }
+};
@@ -1,14 +1,27 @@
 #pragma once
 #include <camera.h>
+#include <diagnostics.h>
+#include <resources.h>
+#include <stagetimer.h>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <gpuobjects/framebuffer.h>
+#include <gpuobjects/glstate.h>
 #include <gpuobjects/model.h>
 #include <gpuobjects/shader.h>
 #include <gpuobjects/texture.h>
+#include <texturelibrary.h>
+#include <utils/threadpool.h>
+
+using ModelHandle = ResourceHandle<Model>;
+using TextureHandle = ResourceHandle<Texture>;
 
 void message_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
                       const GLchar* message,
@@ -31,6 +44,8 @@ public:
         //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
         glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+        // Debug context in both diagnostics levels, Release only makes its output asynchronous
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
 
         if (no_window)
             glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
@@ -51,14 +66,16 @@ public:
             std::cout << "Failed to initialize OpenGL context" << std::endl;
             return -1;
         }
+        // Fresh context, nothing cached from a previous one is valid
+        GLState::get().invalidate();
 
         glEnable(GL_DEBUG_OUTPUT);
-        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
         glDebugMessageCallback(reinterpret_cast<GLDEBUGPROC>(message_callback), nullptr);
+        setDiagnosticsLevel(Diagnostics::get().level());
 
         int width, height;
         glfwGetFramebufferSize(_window, &width, &height);
-        glViewport(0, 0, width, height);
+        GLState::get().viewport(0, 0, width, height);
 
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -68,9 +85,33 @@ public:
 
         glClearColor(0.5, 0.5, 0.5, 1.0f);
         glfwSwapInterval(true);
+
+        _textureLibrary = std::make_unique<TextureLibrary>();
         return 0;
     }
 
+    // Can be changed at any time, also before init
+    void setDiagnosticsLevel(const DiagnosticsLevel level)
+    {
+        Diagnostics::get().level(level);
+        if (!_window)
+        {
+            return;
+        }
+        if (level == DiagnosticsLevel::Debug)
+        {
+            glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+        }
+        else
+        {
+            // The driver can report from its own thread instead of stalling the call that generated the message
+            glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+            glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_LOW, 0, nullptr, GL_FALSE);
+        }
+    }
+
     bool shouldClose() const
     {
         return glfwWindowShouldClose(_window);
@@ -81,43 +122,158 @@ public:
         glfwSetWindowShouldClose(_window, GL_TRUE);
     }
 
-    const Model& loadModel(const string& filePath)
+    // Starts loading the model on the loader threads. Until it is ready the handle returns an empty model
+    ModelHandle requestModel(const string& filePath, const ModelImportOptions& options = {})
     {
-        const auto iter = _models.find(filePath);
-        if (iter == _models.end())
+        auto key = std::make_pair(filePath, options);
+        if (const auto iter = _models.find(key); iter != _models.end())
         {
-            _models[filePath] = std::make_unique<Model const>(filePath);
-            return *_models[filePath].get();
+            return ModelHandle(iter->second);
         }
-        return *iter->second.get();
+        auto slot = std::make_shared<PendingResource<Model, ModelData>>(_placeholderModel);
+        _models.emplace(std::move(key), slot);
+        _loaderJobs.submit([this, slot, filePath, options]
+        {
+            guarded(filePath, [&]
+            {
+                auto data = Model::import(filePath, options);
+                const auto bytes = data ? data->byteSize() : 0;
+                slot->decoded(std::move(data), bytes);
+            }, [&] { slot->fail(); });
+            queueUpload(slot);
+        });
+        return ModelHandle(slot);
+    }
+
+    // Same as above, the vertices get the most compact layout with the attributes read by the shader
+    ModelHandle requestModel(const string& filePath, const Shader& shader, ModelImportOptions options = {})
+    {
+        options.vertexFormat = vertexFormatFor(shader.activeAttributes());
+        return requestModel(filePath, options);
+    }
+
+    // Adds the files missing from the texture library and starts loading them on the loader threads
+    const TextureLibrary& requestLibraryTextures(const std::vector<string>& filePaths)
+    {
+        for (auto* entry : _textureLibrary->add(filePaths))
+        {
+            _loaderJobs.submit([this, entry]
+            {
+                guarded(entry->path(), [&] { TextureLibrary::decode(*entry); },
+                        [&] { TextureLibrary::fail(*entry); });
+                queueLibraryUpload(entry);
+            });
+        }
+        return *_textureLibrary;
+    }
+
+    [[nodiscard]] const TextureLibrary& textureLibrary() const
+    {
+        return *_textureLibrary;
+    }
+
+    // Blocking version of requestModel
+    const Model& loadModel(const string& filePath, const ModelImportOptions& options = {})
+    {
+        return finishLoading(requestModel(filePath, options));
     }
 
     const Shader& loadShader(const string& vertexPath, const string& fragmentPath)
     {
-        const auto joinedPath = vertexPath + fragmentPath;
-        const auto iter = _shaders.find(joinedPath);
+        auto key = std::make_pair(vertexPath, fragmentPath);
+        const auto iter = _shaders.find(key);
         if (iter == _shaders.end())
         {
-            _shaders[joinedPath] = std::make_unique<Shader const>(vertexPath, fragmentPath);
-            return *_shaders[joinedPath].get();
+            // Compiling needs the GL context, shaders are loaded synchronously on the render thread
+            const auto& shader = *_shaders.emplace(std::move(key), std::make_unique<Shader const>(
+                                                       vertexPath, fragmentPath)).first->second;
+            return shader;
         }
         return *iter->second.get();
     }
 
-    const Texture& loadTexture(const string& filePath)
+    // Waits for the loader threads and uploads the resource right away instead of waiting for its turn
+    template <typename T>
+    const T& finishLoading(const ResourceHandle<T>& handle)
     {
-        const auto iter = _textures.find(filePath);
-        if (iter == _textures.end())
+        handle.getSlot()->wait();
+        handle.getSlot()->upload();
+        return handle.get();
+    }
+
+    // GL uploads of the resources decoded by the loader threads, at least one per call and then until the budget is spent
+    // A texture bigger than what is left of the budget uploads part of its rows and goes back in the queue
+    void processUploads()
+    {
+        size_t spent = 0;
+        bool first = true;
+        while (first || spent < _uploadBudgetBytes)
         {
-            _textures[filePath] = std::make_unique<Texture const>(filePath);
-            return *_textures[filePath].get();
+            std::function<size_t(size_t)> upload;
+            {
+                std::lock_guard lock(_uploadsMutex);
+                if (_uploads.empty())
+                    break;
+                upload = std::move(_uploads.front());
+                _uploads.pop_front();
+            }
+            spent += upload(_uploadBudgetBytes > spent ? _uploadBudgetBytes - spent : 0);
+            first = false;
         }
-        return *iter->second.get();
     }
 
-    void setPipeline(std::vector<function<void()>>& newPipeline)
+    // Blocks until every requested resource is loaded and uploaded
+    void waitForResources()
+    {
+        _loaderJobs.wait();
+        std::deque<std::function<size_t(size_t)>> uploads;
+        {
+            std::lock_guard lock(_uploadsMutex);
+            uploads.swap(_uploads);
+        }
+        for (const auto& upload : uploads)
+        {
+            upload(SIZE_MAX);
+        }
+    }
+
+    // CPU and GPU bytes of every model and texture in the caches that is ready
+    [[nodiscard]] std::vector<ResourceMemory> resourceMemory() const
+    {
+        std::vector<ResourceMemory> result;
+        for (const auto& [key, slot] : _models)
+        {
+            if (slot->state() == ResourceState::Ready)
+                result.push_back({key.first, slot->get().cpuBytes(), slot->get().gpuBytes()});
+        }
+        if (_textureLibrary)
+            result.push_back({"texture library", 0, _textureLibrary->gpuBytes()});
+        return result;
+    }
+
+    void setUploadBudget(const size_t bytesPerFrame)
+    {
+        _uploadBudgetBytes = bytesPerFrame;
+    }
+
+    // names label the steps in the stage timings, the unnamed ones are called by their index
+    void setPipeline(std::vector<function<void()>>& newPipeline, std::vector<string> names = {})
     {
         _pipeline = std::move(newPipeline);
+        _pipelineNames = std::move(names);
+        for (auto i = _pipelineNames.size(); i < _pipeline.size(); i++)
+            _pipelineNames.push_back("step " + std::to_string(i));
+    }
+
+    [[nodiscard]] const std::vector<string>& pipelineNames() const
+    {
+        return _pipelineNames;
+    }
+
+    // Every step of the frames rendered from now on is timed in timer, nullptr stops timing
+    void setStageTimer(StageTimer* timer)
+    {
+        _stageTimer = timer;
     }
 
     const std::vector<function<void()>>& getPipeline()
@@ -132,13 +288,63 @@ public:
         _lastFrame = _currentFrame;
     }
 
+    // The frames are rendered in target instead of the window and the screen size becomes its size, e.g. to capture
+    // them at another resolution. nullptr renders to the window again
+    void setRenderTarget(const FrameBuffer* target)
+    {
+        _renderTarget = target;
+    }
+
+    // While on, the frames meant for the window are rendered in an off-screen framebuffer of the window size, copied to
+    // the window at the end of render(), so that the pipeline steps can read their depth (DepthCollider)
+    void setOffscreenWindow(const bool offscreen)
+    {
+        _offscreenWindow = offscreen;
+    }
+
+    // The framebuffer the frame is rendered in: the render target, the off-screen window frame, nullptr for the window
+    [[nodiscard]] const FrameBuffer* renderTarget() const
+    {
+        return _renderTarget ? _renderTarget : _windowFrame.get();
+    }
+
+    // The framebuffer the frame ends up in, for the pipeline steps that draw off-screen first
+    void bindRenderTarget() const
+    {
+        if (const auto target = renderTarget())
+            target->bind();
+        else
+            FrameBuffer::unbind(_screenWidth, _screenHeight);
+    }
+
     void render()
     {
+        GLState::get().beginFrame();
+        processUploads();
+        if (!_offscreenWindow)
+            _windowFrame.reset();
+        else if (!_renderTarget && !_windowFrame)
+            _windowFrame = std::make_unique<FrameBuffer>(_screenWidth, _screenHeight);
+        bindRenderTarget();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        for (const auto& f : _pipeline)
+        auto& diagnostics = Diagnostics::get();
+        const auto steps = static_cast<int>(_pipeline.size());
+        if (_stageTimer)
+            _stageTimer->beginFrame(steps);
+        for (int i = 0; i < steps; i++)
         {
-            f();
+            diagnostics.stage(i);
+            if (_stageTimer)
+                _stageTimer->beginStage(i);
+            _pipeline[i]();
+            if (_stageTimer)
+                _stageTimer->endStage(i);
         }
+        if (_stageTimer)
+            _stageTimer->endFrame();
+        diagnostics.stage(Diagnostics::STAGE_OUTSIDE_PIPELINE);
+        if (!_renderTarget && _windowFrame)
+            _windowFrame->blitToWindow(_screenWidth, _screenHeight);
     }
 
     void swapBuffers() const
@@ -178,12 +384,12 @@ public:
 
     int screenWidth() const
     {
-        return _screenWidth;
+        return _renderTarget ? static_cast<int>(_renderTarget->width()) : _screenWidth;
     }
 
     int screenHeight() const
     {
-        return _screenHeight;
+        return _renderTarget ? static_cast<int>(_renderTarget->height()) : _screenHeight;
     }
 
     const Camera& getCamera() const
@@ -193,9 +399,14 @@ public:
 
     ~Renderer()
     {
+        // the jobs not started are dropped, the running ones still use the caches below
+        _loaderJobs.cancel();
+        _loaderJobs.wait();
+        _uploads.clear();
         _models.clear();
         _shaders.clear();
-        _textures.clear();
+        _textureLibrary.reset();
+        _windowFrame.reset();
         glfwDestroyWindow(_window);
         glfwMakeContextCurrent(nullptr);
         glfwTerminate(); // shaders, models and textures need to be destructed BEFORE calling this
@@ -211,57 +422,72 @@ private:
     int _screenWidth, _screenHeight;
     float _deltaTime = 0, _lastFrame = 0, _currentFrame = 0;
     GLFWwindow* _window = nullptr;
+    const FrameBuffer* _renderTarget = nullptr;
+    bool _offscreenWindow = false;
+    unique_ptr<FrameBuffer> _windowFrame;
     glm::mat4 _projectionMatrix{};
-    std::unordered_map<string, unique_ptr<Model const>> _models;
-    std::unordered_map<string, unique_ptr<Shader const>> _shaders;
-    //TODO: change implementation to something like unordered_map<pair/tuple, value>
-    std::unordered_map<string, unique_ptr<Texture const>> _textures;
+    // Keyed by (path, import options) and by (vertex path, fragment path)
+    std::unordered_map<std::pair<string, ModelImportOptions>, std::shared_ptr<ResourceSlot<Model>>, ResourceKeyHash>
+    _models;
+    std::unordered_map<std::pair<string, string>, unique_ptr<Shader const>, ResourceKeyHash> _shaders;
     std::vector<function<void()>> _pipeline;
-};
-
-inline void message_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
-                             const GLchar* message,
-                             const void* user_param)
-{
-    auto const src_str = [source]()
+    std::vector<string> _pipelineNames;
+    StageTimer* _stageTimer = nullptr;
+    Model _placeholderModel{};
+    unique_ptr<TextureLibrary> _textureLibrary;
+    std::mutex _uploadsMutex;
+    // Called with the bytes left in the budget of the frame, they return the bytes uploaded
+    std::deque<std::function<size_t(size_t)>> _uploads;
+    size_t _uploadBudgetBytes{8 * 1024 * 1024};
+    // loading jobs on the shared pool, last: they use the members above
+    JobGroup _loaderJobs{};
+
+    // Loader threads. A job that throws (no memory for a huge image, an importer error) fails its resource instead of
+    // escaping into the pool and leaving the resource Loading forever
+    template <typename Job, typename Fail>
+    static void guarded(const string& path, Job&& job, Fail&& fail)
     {
-        switch (source)
+        try
         {
-        case GL_DEBUG_SOURCE_API: return "API";
-        case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "WINDOW SYSTEM";
-        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "SHADER COMPILER";
-        case GL_DEBUG_SOURCE_THIRD_PARTY: return "THIRD PARTY";
-        case GL_DEBUG_SOURCE_APPLICATION: return "APPLICATION";
-        case GL_DEBUG_SOURCE_OTHER: return "OTHER";
-        default: return "GL_DEBUG source Enum not recognized";
+            job();
         }
-    }();
-
-    auto const type_str = [type]()
-    {
-        switch (type)
+        catch (const std::exception& e)
+        {
+            std::cout << "Failed to load " << path << ": " << e.what() << std::endl;
+            fail();
+        }
+        catch (...)
         {
-        case GL_DEBUG_TYPE_ERROR: return "ERROR";
-        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED_BEHAVIOR";
-        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "UNDEFINED_BEHAVIOR";
-        case GL_DEBUG_TYPE_PORTABILITY: return "PORTABILITY";
-        case GL_DEBUG_TYPE_PERFORMANCE: return "PERFORMANCE";
-        case GL_DEBUG_TYPE_MARKER: return "MARKER";
-        case GL_DEBUG_TYPE_OTHER: return "OTHER";
-        default: return "GL_DEBUG type Enum not recognized";
+            std::cout << "Failed to load " << path << std::endl;
+            fail();
         }
-    }();
+    }
 
-    auto const severity_str = [severity]()
+    // Loader threads
+    template <typename Slot>
+    void queueUpload(const std::shared_ptr<Slot>& slot)
     {
-        switch (severity)
+        std::lock_guard lock(_uploadsMutex);
+        _uploads.emplace_back([slot](size_t) { return slot->upload() ? slot->uploadBytes() : 0; });
+    }
+
+    // Loader threads, and the render thread for the library entries that need more frames
+    void queueLibraryUpload(TextureLibrary::Entry* entry)
+    {
+        std::lock_guard lock(_uploadsMutex);
+        _uploads.emplace_back([this, entry](const size_t budget)
         {
-        case GL_DEBUG_SEVERITY_NOTIFICATION: return "NOTIFICATION";
-        case GL_DEBUG_SEVERITY_LOW: return "LOW";
-        case GL_DEBUG_SEVERITY_MEDIUM: return "MEDIUM";
-        case GL_DEBUG_SEVERITY_HIGH: return "HIGH";
-        default: return "GL_DEBUG severity Enum not recognized";
-        }
-    }();
-    std::cout << src_str << ", " << type_str << ", " << severity_str << ", " << id << ": " << message << '\n';
+            const auto spent = _textureLibrary->uploadStep(*entry, budget);
+            if (entry->uploading())
+                queueLibraryUpload(entry);
+            return spent;
+        });
+    }
+};
+
+inline void message_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+                             const GLchar* message,
+                             const void* user_param)
+{
+    Diagnostics::get().record(source, type, id, severity, message);
 }
@@ -8,16 +8,35 @@ class RenderObject
 {
 public:
     explicit RenderObject(const Shader& shader, const Renderer& renderer,
-                          const std::vector<std::reference_wrapper<const Texture>>& textures,
-                          const Model& model, const SceneObject& sceneObject)
+                          const std::vector<TextureHandle>& textures,
+                          const ModelHandle& model, const SceneObject& sceneObject)
         : shader(shader), renderer(renderer), model{model}, textures(textures), sceneObject{sceneObject}
     {
     }
 
+    // True once the model and the textures are uploaded (or failed to load)
+    [[nodiscard]] bool loaded() const
+    {
+        if (!model.settled())
+            return false;
+        for (const auto& texture : textures)
+        {
+            if (!texture.settled())
+                return false;
+        }
+        return true;
+    }
+
+    // Swaps the model drawn, e.g. when the scene is reconfigured
+    void setModel(const ModelHandle& handle)
+    {
+        model = handle;
+    }
+
     void bindTextures() const
     {
         GLuint i = 0;
-        for (auto texture : textures)
+        for (const auto& texture : textures)
         {
             texture.get().bind(i);
             i++;
@@ -27,7 +46,8 @@ public:
 protected:
     const Shader& shader;
     const Renderer& renderer;
-    const Model& model;
-    const std::vector<std::reference_wrapper<const Texture>> textures;
+    // Until loaded they resolve to the renderer placeholders
+    ModelHandle model;
+    const std::vector<TextureHandle> textures;
     const SceneObject& sceneObject;
 };
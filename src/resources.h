@@ -0,0 +1,188 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+enum class ResourceState
+{
+    // CPU side work (parsing, decoding) is running on the loader threads
+    Loading,
+    // CPU side data is ready and waits for its GL upload on the render thread
+    Decoded,
+    Ready,
+    Failed,
+};
+
+/*
+Shared between the cache, the handles and the loader.
+The loader thread moves it from Loading to Decoded (or Failed), the render thread uploads it and moves it to Ready.
+*/
+template <typename T>
+class ResourceSlot
+{
+public:
+    explicit ResourceSlot(const T& placeholder): placeholder{placeholder}
+    {
+    }
+
+    virtual ~ResourceSlot() = default;
+
+    [[nodiscard]] ResourceState state() const
+    {
+        return _state.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] const T& get() const
+    {
+        return state() == ResourceState::Ready ? *resource : placeholder;
+    }
+
+    // Bytes that the GL upload will transfer, used for the per-frame upload budget
+    [[nodiscard]] size_t uploadBytes() const
+    {
+        return _uploadBytes;
+    }
+
+    // Render thread only. Returns false if there was nothing to upload
+    bool upload()
+    {
+        if (state() != ResourceState::Decoded)
+            return false;
+        resource = createResource();
+        setState(resource ? ResourceState::Ready : ResourceState::Failed);
+        return true;
+    }
+
+    // Loader thread, the decoding threw: there is nothing to upload
+    void fail()
+    {
+        setState(ResourceState::Failed);
+    }
+
+    void wait() const
+    {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [this] { return state() != ResourceState::Loading; });
+    }
+
+protected:
+    size_t _uploadBytes{0};
+
+    virtual std::unique_ptr<const T> createResource() = 0;
+
+    void setState(const ResourceState state)
+    {
+        {
+            std::lock_guard lock(mutex);
+            _state.store(state, std::memory_order_release);
+        }
+        changed.notify_all();
+    }
+
+private:
+    const T& placeholder;
+    std::unique_ptr<const T> resource;
+    std::atomic<ResourceState> _state{ResourceState::Loading};
+    mutable std::mutex mutex;
+    mutable std::condition_variable changed;
+};
+
+// Slot whose CPU side data (CpuData) is produced by a loader thread and turned into a T by the GL upload
+template <typename T, typename CpuData>
+class PendingResource : public ResourceSlot<T>
+{
+public:
+    explicit PendingResource(const T& placeholder): ResourceSlot<T>(placeholder)
+    {
+    }
+
+    // Loader thread
+    void decoded(std::unique_ptr<CpuData> data, const size_t uploadBytes)
+    {
+        if (!data)
+        {
+            this->setState(ResourceState::Failed);
+            return;
+        }
+        cpuData = std::move(data);
+        this->_uploadBytes = uploadBytes;
+        this->setState(ResourceState::Decoded);
+    }
+
+protected:
+    std::unique_ptr<const T> createResource() override
+    {
+        auto resource = std::make_unique<const T>(std::move(*cpuData));
+        cpuData.reset();
+        return resource;
+    }
+
+private:
+    std::unique_ptr<CpuData> cpuData;
+};
+
+// Cheap to copy reference to a cached resource. Until the resource is ready get() returns a placeholder
+template <typename T>
+class ResourceHandle
+{
+public:
+    ResourceHandle() = default;
+
+    explicit ResourceHandle(std::shared_ptr<ResourceSlot<T>> slot): slot{std::move(slot)}
+    {
+    }
+
+    [[nodiscard]] const T& get() const
+    {
+        return slot->get();
+    }
+
+    [[nodiscard]] ResourceState state() const
+    {
+        return slot ? slot->state() : ResourceState::Failed;
+    }
+
+    [[nodiscard]] bool ready() const
+    {
+        return state() == ResourceState::Ready;
+    }
+
+    // Ready or Failed, nothing left to wait for
+    [[nodiscard]] bool settled() const
+    {
+        const auto s = state();
+        return s == ResourceState::Ready || s == ResourceState::Failed;
+    }
+
+    [[nodiscard]] const std::shared_ptr<ResourceSlot<T>>& getSlot() const
+    {
+        return slot;
+    }
+
+private:
+    std::shared_ptr<ResourceSlot<T>> slot;
+};
+
+// Memory used by a cached resource that finished loading
+struct ResourceMemory
+{
+    std::string path;
+    size_t cpuBytes{0};
+    size_t gpuBytes{0};
+};
+
+// Hash for the (path, options) keys of the resource caches
+struct ResourceKeyHash
+{
+    template <typename A, typename B>
+    size_t operator()(const std::pair<A, B>& key) const
+    {
+        const size_t h1 = std::hash<A>{}(key.first);
+        const size_t h2 = std::hash<B>{}(key.second);
+        return h1 ^ (h2 + 0x9e3779b97f4a7c15ull + (h1 << 6) + (h1 >> 2));
+    }
+};
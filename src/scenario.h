@@ -0,0 +1,440 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <glm/glm.hpp>
+#include <scene.h>
+#include <stagetimer.h>
+#include <utils/jsonwriter.h>
+
+/*
+A scripted run of the scene for performance tracking, read from a text file of "key value" lines, # starts a comment.
+Vectors are three numbers, planes a normal and an offset, spheres a center and a radius, and sizes are <width>x<height>, e.g.
+
+    model ./assets/models/bunny.obj
+    particles 500000
+    spawn_buffer 1600x1200
+    object_rotation 0 45 0
+    camera_position 0 0 30
+    frames 600
+    collision_plane 0 1 0 -5
+    seed 42
+
+Every key is optional, see the members for the defaults. collision_plane and collision_sphere can be repeated,
+collision_object is the resolution of the signed distance field of the model (0 for none), collision_depth the thickness
+of the surfaces the particles bounce off through the depth buffer (see DepthCollider).
+The run itself is in main.cpp (--scenario)
+*/
+struct Scenario
+{
+    string path;
+    // model, textures, particle pool, spawn buffer, object count and particle options
+    SceneConfig scene{
+        "./assets/models/bunny_lp.obj", "./assets/textures/UV_Grid_Sm.png",
+        "./assets/textures/Voronoi 7 - 512x512.png"
+    };
+    // unless the scenario sets particle_size it scales with the spawn buffer, like the menu option
+    bool particle_size_auto{true};
+    SpawnDistribution spawn{
+        glm::normalize(glm::vec3{0.775614f, 0.441849f, -0.450769f}), glm::vec3{0.15f}, 3.5f, 5, 0.8f
+    };
+    glm::vec3 object_position{1};
+    // Euler angles in degrees, applied X then Y then Z
+    glm::vec3 object_rotation{0};
+    float object_scale{2};
+    glm::vec3 camera_position{0, 0, 30};
+    glm::vec3 camera_target{0, 0, -7};
+    // size of the off-screen target the frames are rendered in
+    int width{1920}, height{1080};
+    // the warmup frames are rendered before the measured ones and left out of the report
+    int frames{300};
+    int warmup_frames{10};
+    // every frame is 1 / fps seconds long, whatever it takes to render, and is simulated in steps of
+    // 1 / simulation_rate seconds, at most max_substeps of them
+    float fps{60};
+    float simulation_rate{60};
+    int max_substeps{8};
+    // curl-noise motion of the particles, see Turbulence
+    float turbulence_strength{0};
+    float turbulence_frequency{0.05f};
+    // air carrying the particles, see GridFluid
+    GridFluidSettings air;
+    CollisionSettings collisions;
+    bool collision_depth{false};
+    uint64_t seed{1};
+    string output{"scenario.json"};
+
+    // Prints the first error and returns false
+    static bool load(const string& path, Scenario& scenario)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "Failed to open the scenario " << path << std::endl;
+            return false;
+        }
+        scenario.path = path;
+        string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            if (const auto comment = line.find('#'); comment != string::npos)
+                line.erase(comment);
+            std::istringstream in(line);
+            string key;
+            if (!(in >> key))
+                continue;
+            string rest;
+            std::getline(in >> std::ws, rest);
+            while (!rest.empty() && std::isspace(static_cast<unsigned char>(rest.back())))
+                rest.pop_back();
+            if (!scenario.set(key, rest))
+            {
+                std::cout << path << ":" << lineNumber << ": unknown key or invalid value: " << key << " " << rest <<
+                    std::endl;
+                return false;
+            }
+        }
+        if (scenario.frames <= 0 || scenario.warmup_frames < 0 || scenario.fps <= 0 || scenario.simulation_rate <= 0 ||
+            scenario.max_substeps < 1 || scenario.width <= 0 || scenario.height <= 0 ||
+            scenario.scene.particles_framebuffer_width == 0 || scenario.scene.particles_framebuffer_height == 0 ||
+            scenario.scene.particle_number < 0 || scenario.scene.object_count < 1)
+        {
+            std::cout << path << ": frames, fps, simulation_rate, max_substeps, size, spawn_buffer and object_count " <<
+                "must be positive" << std::endl;
+            return false;
+        }
+        if (scenario.particle_size_auto)
+        {
+            const auto ratio = static_cast<float>(scenario.scene.particles_framebuffer_width *
+                scenario.scene.particles_framebuffer_height) / static_cast<float>(scenario.width * scenario.height);
+            scenario.scene.particle_size = (1 / (ratio + 0.08f)) * 0.03f;
+        }
+        return true;
+    }
+
+    [[nodiscard]] glm::quat objectRotation() const
+    {
+        auto m = glm::rotate(glm::mat4{1}, glm::radians(object_rotation.z), glm::vec3{0, 0, 1});
+        m = glm::rotate(m, glm::radians(object_rotation.y), glm::vec3{0, 1, 0});
+        return toQuat(glm::rotate(m, glm::radians(object_rotation.x), glm::vec3{1, 0, 0}));
+    }
+
+private:
+    bool set(const string& key, const string& value)
+    {
+        if (value.empty())
+            return false;
+        std::istringstream in(value);
+        const auto number = [&in](auto& out) { return static_cast<bool>(in >> out) && (in >> std::ws).eof(); };
+        const auto vector = [&in](glm::vec3& out)
+        {
+            return static_cast<bool>(in >> out.x >> out.y >> out.z) && (in >> std::ws).eof();
+        };
+        const auto vector4 = [&in](glm::vec3& out, float& w)
+        {
+            return static_cast<bool>(in >> out.x >> out.y >> out.z >> w) && (in >> std::ws).eof();
+        };
+        // <width>x<height>, both whole and positive. Read as signed so that -1 is refused instead of wrapping around
+        // in an unsigned size
+        const auto size = [&value](auto& w, auto& h)
+        {
+            const auto x = value.find('x');
+            if (x == string::npos)
+                return false;
+            const auto part = [](const string& text, auto& out)
+            {
+                std::istringstream in(text);
+                long long parsed = 0;
+                if (!(in >> parsed) || !(in >> std::ws).eof())
+                    return false;
+                if (parsed <= 0 || parsed > std::numeric_limits<int>::max())
+                    return false;
+                out = static_cast<std::remove_reference_t<decltype(out)>>(parsed);
+                return true;
+            };
+            return part(value.substr(0, x), w) && part(value.substr(x + 1), h);
+        };
+        if (key == "model")
+            scene.model = value;
+        else if (key == "texture")
+            scene.texture = value;
+        else if (key == "noise_texture")
+            scene.noise_texture = value;
+        else if (key == "particles")
+            return number(scene.particle_number);
+        else if (key == "spawn_buffer")
+            return size(scene.particles_framebuffer_width, scene.particles_framebuffer_height);
+        else if (key == "draw_particles")
+            return number(scene.draw_particles);
+        else if (key == "particle_size")
+        {
+            particle_size_auto = false;
+            return number(scene.particle_size);
+        }
+        else if (key == "object_count")
+            return number(scene.object_count);
+        else if (key == "object_position")
+            return vector(object_position);
+        else if (key == "object_rotation")
+            return vector(object_rotation);
+        else if (key == "object_scale")
+            return number(object_scale);
+        else if (key == "camera_position")
+            return vector(camera_position);
+        else if (key == "camera_target")
+            return vector(camera_target);
+        else if (key == "spawn_direction")
+        {
+            if (!vector(spawn.direction) || glm::dot(spawn.direction, spawn.direction) == 0)
+                return false;
+            spawn.direction = glm::normalize(spawn.direction);
+        }
+        else if (key == "spawn_randomness")
+            return vector(spawn.randomness);
+        else if (key == "spawn_speed")
+            return number(spawn.speed);
+        else if (key == "spawn_life")
+            return number(spawn.life);
+        else if (key == "spawn_life_randomness")
+            return number(spawn.life_randomness);
+        else if (key == "size")
+            return size(width, height);
+        else if (key == "frames")
+            return number(frames);
+        else if (key == "warmup_frames")
+            return number(warmup_frames);
+        else if (key == "fps")
+            return number(fps);
+        else if (key == "simulation_rate")
+            return number(simulation_rate);
+        else if (key == "max_substeps")
+            return number(max_substeps);
+        else if (key == "turbulence_strength")
+            return number(turbulence_strength);
+        else if (key == "turbulence_frequency")
+            return number(turbulence_frequency);
+        else if (key == "air_coupling")
+            return number(air.coupling);
+        else if (key == "air_resolution")
+            return number(air.resolution);
+        else if (key == "air_budget_ms")
+            return number(air.budget_ms);
+        else if (key == "air_dissipation")
+            return number(air.dissipation);
+        else if (key == "collision_plane")
+        {
+            CollisionPlane plane;
+            if (!vector4(plane.normal, plane.offset) || glm::dot(plane.normal, plane.normal) == 0)
+                return false;
+            // the offset is along the normal as given
+            plane.offset /= glm::length(plane.normal);
+            plane.normal = glm::normalize(plane.normal);
+            collisions.planes.push_back(plane);
+        }
+        else if (key == "collision_sphere")
+        {
+            CollisionSphere sphere;
+            if (!vector4(sphere.center, sphere.radius))
+                return false;
+            collisions.spheres.push_back(sphere);
+        }
+        else if (key == "collision_object")
+            return number(scene.model_options.sdfResolution);
+        else if (key == "collision_depth")
+        {
+            collision_depth = true;
+            return number(collisions.screen_thickness);
+        }
+        else if (key == "particle_radius")
+            return number(collisions.particle_radius);
+        else if (key == "restitution")
+            return number(collisions.restitution);
+        else if (key == "friction")
+            return number(collisions.friction);
+        else if (key == "seed")
+            return number(seed);
+        else if (key == "output")
+            output = value;
+        else
+            return false;
+        return true;
+    }
+};
+
+// Measured frames of a scenario, written as JSON
+class ScenarioReport
+{
+public:
+    // CPU side of a frame, the stage timings come from the StageTimer
+    struct Frame
+    {
+        // whole frame: update, render and the wait for the GPU
+        double frameMs{0};
+        // Scene::mainLoop, the simulation steps
+        double updateMs{0};
+        int steps{0};
+        SpawnStats spawn;
+        unsigned int living{0};
+    };
+
+    void add(const Frame& frame)
+    {
+        frames.push_back(frame);
+    }
+
+    // Per-frame values and their mean, min, median, 95th percentile and max. The stage timings are matched to the
+    // frames by index, the timer must have been attached for the measured frames only
+    bool write(const Scenario& scenario, const std::vector<string>& stageNames, const StageTimer& timer,
+               const double seconds) const
+    {
+        std::ofstream file(scenario.output);
+        if (!file)
+        {
+            std::cout << "Failed to write " << scenario.output << std::endl;
+            return false;
+        }
+        const auto& stages = timer.frames();
+        const auto stageCount = stageNames.size();
+        JsonWriter json(file);
+        json.beginObject();
+
+        json.key("scenario").beginObject()
+            .field("path", scenario.path)
+            .field("model", scenario.scene.model)
+            .field("texture", scenario.scene.texture)
+            .field("noise_texture", scenario.scene.noise_texture)
+            .field("particles", scenario.scene.particle_number)
+            .field("spawn_buffer", std::to_string(scenario.scene.particles_framebuffer_width) + "x" +
+                   std::to_string(scenario.scene.particles_framebuffer_height))
+            .field("object_count", scenario.scene.object_count)
+            .field("size", std::to_string(scenario.width) + "x" + std::to_string(scenario.height))
+            .field("frames", scenario.frames)
+            .field("warmup_frames", scenario.warmup_frames)
+            .field("fps", scenario.fps)
+            .field("simulation_rate", scenario.simulation_rate)
+            .field("max_substeps", scenario.max_substeps)
+            .field("turbulence_strength", scenario.turbulence_strength)
+            .field("air_coupling", scenario.air.coupling)
+            .field("air_resolution", scenario.air.resolution)
+            .field("air_budget_ms", scenario.air.budget_ms)
+            .field("collision_planes", scenario.collisions.planes.size())
+            .field("collision_spheres", scenario.collisions.spheres.size())
+            .field("collision_object", scenario.scene.model_options.sdfResolution)
+            .field("collision_depth", scenario.collision_depth ? scenario.collisions.screen_thickness : 0.f)
+            .field("particle_radius", scenario.collisions.particle_radius)
+            .field("seed", scenario.seed)
+            .endObject();
+        json.field("seconds", seconds);
+        json.key("stages").beginArray();
+        for (const auto& name : stageNames)
+            json.value(name);
+        json.endArray();
+
+        json.key("aggregate").beginObject();
+        std::vector<double> values(frames.size());
+        const auto summary = [&](const string& name, const auto& valueOf)
+        {
+            for (size_t i = 0; i < frames.size(); i++)
+                values[i] = valueOf(i);
+            writeSummary(json.key(name), values);
+        };
+        summary("frame_ms", [&](const size_t i) { return frames[i].frameMs; });
+        summary("update_ms", [&](const size_t i) { return frames[i].updateMs; });
+        json.key("stages").beginObject();
+        for (size_t s = 0; s < stageCount; s++)
+        {
+            json.key(stageNames[s]).beginObject();
+            summary("cpu_ms", [&](const size_t i) { return stageValue(stages, i, s, false); });
+            summary("gpu_ms", [&](const size_t i) { return stageValue(stages, i, s, true); });
+            json.endObject();
+        }
+        json.endObject();
+        summary("spawned", [&](const size_t i) { return frames[i].spawn.spawned; });
+        summary("dropped", [&](const size_t i) { return frames[i].spawn.dropped; });
+        summary("living", [&](const size_t i) { return frames[i].living; });
+        summary("steps", [&](const size_t i) { return frames[i].steps; });
+        unsigned long long spawned = 0, dropped = 0, full = 0;
+        for (const auto& frame : frames)
+        {
+            spawned += frame.spawn.spawned;
+            dropped += frame.spawn.dropped;
+            full += frame.spawn.full;
+        }
+        json.field("total_spawned", spawned).field("total_dropped", dropped).field("pool_full_frames", full);
+        json.endObject();
+
+        json.key("frames").beginArray();
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            const auto& frame = frames[i];
+            json.beginObject()
+                .field("frame", i)
+                .field("frame_ms", frame.frameMs)
+                .field("update_ms", frame.updateMs)
+                .field("steps", frame.steps);
+            json.key("cpu_ms").beginArray();
+            for (size_t s = 0; s < stageCount; s++)
+                json.value(stageValue(stages, i, s, false));
+            json.endArray();
+            json.key("gpu_ms").beginArray();
+            for (size_t s = 0; s < stageCount; s++)
+                json.value(stageValue(stages, i, s, true));
+            json.endArray();
+            json.field("spawned", frame.spawn.spawned)
+                .field("dropped", frame.spawn.dropped)
+                .field("pool_full", frame.spawn.full)
+                .field("living", frame.living)
+                .endObject();
+        }
+        json.endArray();
+        json.endObject();
+        return static_cast<bool>(file);
+    }
+
+private:
+    std::vector<Frame> frames;
+
+    // NaN when the frame or the stage has no timing
+    static double stageValue(const std::vector<StageTimer::Frame>& stages, const size_t frame, const size_t stage,
+                             const bool gpu)
+    {
+        if (frame >= stages.size())
+            return std::nan("");
+        const auto& times = gpu ? stages[frame].gpuMs : stages[frame].cpuMs;
+        return stage < times.size() ? times[stage] : std::nan("");
+    }
+
+    static void writeSummary(JsonWriter& json, std::vector<double> values)
+    {
+        values.erase(std::remove_if(values.begin(), values.end(), [](const double v) { return std::isnan(v); }),
+                     values.end());
+        std::sort(values.begin(), values.end());
+        const auto percentile = [&values](const double p)
+        {
+            return values[static_cast<size_t>(p * static_cast<double>(values.size() - 1) + 0.5)];
+        };
+        json.beginObject();
+        if (!values.empty())
+        {
+            double sum = 0;
+            for (const auto v : values)
+                sum += v;
+            json.field("mean", sum / static_cast<double>(values.size()))
+                .field("min", values.front())
+                .field("p50", percentile(0.5))
+                .field("p95", percentile(0.95))
+                .field("max", values.back());
+        }
+        json.endObject();
+    }
+};
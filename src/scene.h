@@ -6,7 +6,95 @@
 #include "renderobject.h"
 #include "debugbuffer.h"
 #include "disappearingobject.h"
+#include "particlecollisions.h"
+#include "depthcollider.h"
 #include <gpuobjects/framebuffer.h>
+#include <utils/curlnoise.h>
+#include <utils/fixedstep.h>
+#include <utils/random_utils.h>
+#include <chrono>
+#include <limits>
+#include <string>
+
+// What a Scene is built from, Scene::reconfigure applies the differences in place
+struct SceneConfig
+{
+    string model;
+    string texture;
+    string noise_texture;
+    int particle_number{100000};
+    GLuint particles_framebuffer_width{800};
+    GLuint particles_framebuffer_height{600};
+    ModelImportOptions model_options{};
+    bool draw_particles{true};
+    float particle_size{0.1f};
+    // instances of the model dissolving at once, see DisappearingObject::layoutInstances
+    int object_count{1};
+};
+
+// Start velocity and life of the spawned particles, sampled in batches from the thread generator (see random_utils.h)
+struct SpawnDistribution
+{
+    glm::vec3 direction{0, 1, 0};
+    // per axis, how much a random direction in [-1, 1]^3 replaces direction
+    glm::vec3 randomness{0.15f, 0.15f, 0.15f};
+    float speed{1};
+    float life{5};
+    // the life is extended by up to life * life_randomness
+    float life_randomness{0};
+
+    // count velocities and lives, the random numbers are drawn a component at a time into scratch
+    void sample(Random& random, const size_t count, glm::vec3* velocities, float* lives,
+                std::vector<float>& scratch) const
+    {
+        scratch.resize(count * 3);
+        float* x = scratch.data();
+        float* y = x + count;
+        float* z = y + count;
+        random.fill(x, count, -1, 1);
+        random.fill(y, count, -1, 1);
+        random.fill(z, count, -1, 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto d = glm::vec3{
+                glm::mix(direction.x, x[i], randomness.x),
+                glm::mix(direction.y, y[i], randomness.y),
+                glm::mix(direction.z, z[i], randomness.z),
+            };
+            velocities[i] = d * (speed / std::sqrt(glm::dot(d, d)));
+        }
+        random.fill(lives, count, life, life + life * life_randomness);
+    }
+};
+
+// Curl-noise motion added to the particles in every simulation step, off while field is null or strength is 0
+struct Turbulence
+{
+    const CurlNoiseField* field{nullptr};
+    // tiles of the field per world unit
+    float frequency{0.05f};
+    // world units per second at the RMS velocity of the field
+    float strength{0};
+};
+
+// Duration and content of the last Scene::reconfigure
+struct ReconfigureStats
+{
+    double ms{0};
+    // comma separated parts of the scene that were rebuilt, empty if nothing changed
+    std::string changed;
+    unsigned int count{0};
+};
+
+// Particles of the last spawn step
+struct SpawnStats
+{
+    unsigned int spawned{0};
+    // particles the pool refused
+    unsigned int dropped{0};
+    // the pool ran out of dead particles before the end of the spawn buffer, the pixels left were not read
+    bool full{false};
+};
 
 class Scene
 {
@@ -16,32 +104,60 @@ public:
     float disappearing_object_scale{1.f};
     glm::vec3 disappearing_object_position{1.f};
     std::function<void(Particles::Particle&, float dt)> particles_update_func;
-    std::function<glm::vec3()> start_velocity_func;
-    std::function<float()> start_life_func;
+    SpawnDistribution spawn_distribution;
+    // step and maximum substeps of mainLoop, can be changed at any time
+    FixedStep fixed_step;
+    Turbulence turbulence;
+    // colliders of the particles, checked after every simulation step
+    ParticleCollisions collisions;
+    // the particles also bounce off the intact part of the objects as they are drawn, see DepthCollider. Meanwhile the
+    // frames meant for the window are rendered off-screen (Renderer::setOffscreenWindow)
+    bool depth_collisions{false};
+    // air around the objects, pushed by their motion, it carries the particles while air.settings.coupling is not 0
+    GridFluid air;
     Particles particles;
 
     explicit Scene(Renderer& renderer, const string& disappearing_model, const string& texture,
                    const string& noise_texture, const int particle_number, const GLuint particles_framebuffer_width,
-                   const GLuint particles_framebuffer_height)
+                   const GLuint particles_framebuffer_height, const ModelImportOptions& model_options = {})
+        : Scene(renderer, SceneConfig{
+                    disappearing_model, texture, noise_texture, particle_number, particles_framebuffer_width,
+                    particles_framebuffer_height, model_options
+                })
+    {
+    }
+
+    explicit Scene(Renderer& renderer, const SceneConfig& config)
         : particles{
-              Particles(particle_number, renderer.loadShader(
+              Particles(config.particle_number, renderer.loadShader(
                             "./src/shaders/billboard_particle.vert",
                             "./src/shaders/billboard_particle.frag"), renderer)
           },
           renderer(renderer),
+          config(config),
           re_disappearingModel(
-              renderer.loadShader("./src/shaders/apply_texture.vert", "./src/shaders/disappearing_mesh.frag"),
+              disappearingShader(),
               renderer,
-              std::vector<std::reference_wrapper<const Texture>>{
-                  renderer.loadTexture(texture),
-                  renderer.loadTexture(noise_texture)
-              },
-              renderer.loadModel(disappearing_model), sc_disappearingModel),
-          disappearingFragmentsFb(particles_framebuffer_width, particles_framebuffer_height),
+              renderer.requestLibraryTextures({config.texture, config.noise_texture}),
+              renderer.requestModel(config.model, disappearingShader(), config.model_options),
+              sc_disappearingModel),
+          disappearingFragmentsFb(config.particles_framebuffer_width, config.particles_framebuffer_height, true),
           pboColorRBuf{disappearingFragmentsFb.createPboReadColorBuffer()},
           debugBuffer(renderer, 1, 1),
-          pboDepthRBuf{disappearingFragmentsFb.createPboReadDepthBuffer()}
+          pboDepthRBuf{disappearingFragmentsFb.createPboReadDepthBuffer()},
+          pboObjectIdRBuf{disappearingFragmentsFb.createPboReadObjectIdBuffer()}
     {
+        textures(config.texture, config.noise_texture);
+        re_disappearingModel.layoutInstances(config.object_count);
+    }
+
+    // Color and noise of the disappearing object, files already in the texture library are switched without any GL work
+    void textures(const string& texture, const string& noise_texture)
+    {
+        config.texture = texture;
+        config.noise_texture = noise_texture;
+        const auto& library = renderer.requestLibraryTextures({texture, noise_texture});
+        re_disappearingModel.textures(library.find(texture), library.find(noise_texture));
     }
 
     void init()
@@ -51,23 +167,21 @@ public:
 
     void init(const bool draw_particles, const float particle_size)
     {
+        config.draw_particles = draw_particles;
+        config.particle_size = particle_size;
         sc_disappearingModel.worldSpaceTransform = translate(glm::mat4(1.), glm::vec3(0, -2, 2));
         disappearingFragmentsFb.bind();
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearColor(0.5, 0.5, 0.5, 1.0f);
-        FrameBuffer::unbind(renderer.screenWidth(), renderer.screenHeight());
+        disappearingFragmentsFb.clear(glm::vec4{0});
+        renderer.bindRenderTarget();
 
         std::vector<function<void()>> p;
         p.emplace_back([&]
         {
             // Draw particles to off-screen buffer
             disappearingFragmentsFb.bind();
-            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            glClearColor(0.5, 0.5, 0.5, 1.0f);
+            disappearingFragmentsFb.clear(glm::vec4{0, 0, 0, 1});
             re_disappearingModel.drawRemovedFragments();
-            FrameBuffer::unbind(renderer.screenWidth(), renderer.screenHeight());
+            renderer.bindRenderTarget();
             if (show_debug_buffer)
                 debugBuffer.DisplayFramebufferTexture(disappearingFragmentsFb.depthTextureId());
         });
@@ -76,8 +190,27 @@ public:
             // Draw the disappearing object
             re_disappearingModel.draw();
         });
-        p.emplace_back([&, particle_size]
+        p.emplace_back([&]
         {
+            if (!depth_collisions)
+                return;
+            // Depth of the intact objects, small, for the particle collisions: downsampled from the frame they were
+            // just drawn in. The window frame is off-screen from the first mainLoop with depth_collisions on
+            const auto frame = renderer.renderTarget();
+            if (!frame)
+                return;
+            const auto width = static_cast<GLuint>(renderer.screenWidth());
+            const auto height = static_cast<GLuint>(renderer.screenHeight());
+            if (!_depthCollider || !_depthCollider->matches(width, height))
+                _depthCollider = std::make_unique<DepthCollider>(
+                    renderer.loadShader("./src/shaders/fullscreen.vert", "./src/shaders/depth_min.frag"), width,
+                    height);
+            _depthCollider->downsample(*frame, renderer.projectionMatrix() * renderer.viewMatrix());
+            renderer.bindRenderTarget();
+        });
+        p.emplace_back([&]
+        {
+            const auto particle_size = config.particle_size;
             // Copy off-screen buffer to CPU memory
             disappearingFragmentsFb.bind();
             pboColorRBuf.bind();
@@ -87,91 +220,325 @@ public:
             pboDepthRBuf.bind();
             const auto depth = reinterpret_cast<GLfloat*>(pboDepthRBuf.read());
             pboDepthRBuf.unbind();
-            FrameBuffer::unbind(renderer.screenWidth(), renderer.screenHeight());
+            pboObjectIdRBuf.bind();
+            const auto objectIds = reinterpret_cast<GLuint*>(pboObjectIdRBuf.read());
+            pboObjectIdRBuf.unbind();
+            renderer.bindRenderTarget();
 
             const auto inverse_mat = inverse(renderer.projectionMatrix() * renderer.viewMatrix());
-            // Find pixels that are not black and spawn particles at their position
+            // Find pixels that are not black, the ones beyond the number of dead particles are dropped
             const unsigned long num_of_words = pboColorRBuf.bufferSize() / 8;
             constexpr auto zero_vec3 = glm::vec3{0};
             const auto w = disappearingFragmentsFb.width();
             const auto h = disappearingFragmentsFb.height();
-            random_life_vector.clear();
-            random_velocity_vector.clear();
-            for (auto i = 0; i < random_vectors_size; i++)
-            {
-                random_life_vector.emplace_back(start_life_func());
-                random_velocity_vector.emplace_back(start_velocity_func());
-            }
+            const auto capacity = particles.getDeadParticles();
 
-            unsigned int spawned_particles = 0;
-            for (auto j = 0; j < num_of_words; j++)
+            const auto& instances = re_disappearingModel.instances();
+            instance_colors.assign(1, glm::vec4{1});
+            for (const auto& instance : instances)
+                instance_colors.push_back(instance.particleColor);
+            instance_spawned.assign(instance_colors.size(), 0);
+
+            spawn_positions.clear();
+            spawn_colors.clear();
+            bool full = false;
+            // Queues a particle at pixel i tinted by the instance that drew it, the pixels past a full pool are skipped
+            const auto collect = [&](const unsigned long i)
+            {
+                const auto pixel = pixels[i];
+                if (glm::vec3{pixel.x, pixel.y, pixel.z} == zero_vec3)
+                    return;
+                if (spawn_positions.size() == capacity)
+                {
+                    full = true;
+                    return;
+                }
+                const auto x = 2 * (static_cast<GLfloat>(i % w) / static_cast<GLfloat>(w)) - 1;
+                const auto y = 2 * (static_cast<GLfloat>(i / w) / static_cast<GLfloat>(h)) - 1;
+                const auto pixelNDC = glm::vec4{x, y, depth[i] * depth[i], 1};
+                auto worldSpacePos = inverse_mat * pixelNDC;
+                worldSpacePos /= worldSpacePos.w;
+                const auto id = objectIds[i] < instance_colors.size() ? objectIds[i] : 0;
+                spawn_positions.emplace_back(worldSpacePos.x, worldSpacePos.y, worldSpacePos.z);
+                spawn_colors.emplace_back(glm::vec4{pixel} * instance_colors[id]);
+                instance_spawned[id]++;
+            };
+            for (unsigned long j = 0; j < num_of_words && !full; j++)
             {
                 if (pixels_size_t[j] != 0)
                 {
-                    unsigned long i = j * 2;
-                    if (const auto pixel = pixels[i]; glm::vec3{pixel.x, pixel.y, pixel.z} != zero_vec3)
-                    {
-                        const auto x = 2 * (static_cast<GLfloat>(i % w) / static_cast<GLfloat>(w)) - 1;
-                        const auto y = 2 * (static_cast<GLfloat>(i / w) / static_cast<GLfloat>(h)) - 1;
-                        const auto pixelNDC = glm::vec4{x, y, depth[i] * depth[i], 1};
-                        auto worldSpacePos = inverse_mat * pixelNDC;
-                        worldSpacePos /= worldSpacePos.w;
-                        particles.spawnParticles(1, glm::vec3{worldSpacePos.x, worldSpacePos.y, worldSpacePos.z},
-                                                 random_velocity_vector[spawned_particles % random_vectors_size],
-                                                 random_life_vector[spawned_particles % random_vectors_size],
-                                                 pixel, particle_size);
-                        spawned_particles++;
-                    }
-                    i++;
-                    if (const auto pixel = pixels[i]; glm::vec3{pixel.x, pixel.y, pixel.z} != zero_vec3)
-                    {
-                        const auto x = 2 * (static_cast<GLfloat>(i % w) / static_cast<GLfloat>(w)) - 1;
-                        const auto y = 2 * (static_cast<GLfloat>(i / w) / static_cast<GLfloat>(h)) - 1;
-                        const auto pixelNDC = glm::vec4{x, y, depth[i] * depth[i], 1};
-                        auto worldSpacePos = inverse_mat * pixelNDC;
-                        worldSpacePos /= worldSpacePos.w;
-                        particles.spawnParticles(1, glm::vec3{worldSpacePos.x, worldSpacePos.y, worldSpacePos.z},
-                                                 random_velocity_vector[spawned_particles % random_vectors_size],
-                                                 random_life_vector[spawned_particles % random_vectors_size],
-                                                 pixel, particle_size);
-                        spawned_particles++;
-                    }
+                    collect(j * 2);
+                    collect(j * 2 + 1);
                 }
             }
+
+            // Every particle gets its own velocity and life, drawn in one batch
+            const auto count = spawn_positions.size();
+            spawn_velocities.resize(count);
+            spawn_lives.resize(count);
+            spawn_distribution.sample(threadRandom(), count, spawn_velocities.data(), spawn_lives.data(),
+                                      spawn_scratch);
+            const auto spawned = particles.spawnParticles(count, spawn_positions.data(), spawn_velocities.data(),
+                                                          spawn_lives.data(), spawn_colors.data(), particle_size);
+            _lastSpawn = SpawnStats{
+                static_cast<unsigned int>(spawned), static_cast<unsigned int>(count - spawned), full
+            };
+            for (GLuint id = 1; id < instance_spawned.size(); id++)
+            {
+                if (instance_spawned[id])
+                    re_disappearingModel.spawned(id, instance_spawned[id]);
+            }
         });
-        if (draw_particles)
+        p.emplace_back([&]
         {
-            p.emplace_back([&]
-            {
-                glDisable(GL_CULL_FACE);
-                particles.drawParticles();
-                glEnable(GL_CULL_FACE);
-            });
+            if (!config.draw_particles)
+                return;
+            glDisable(GL_CULL_FACE);
+            particles.drawParticles();
+            glEnable(GL_CULL_FACE);
+        });
+
+        renderer.setPipeline(p, {"spawn buffer", "object", "depth collider", "spawn particles", "particles"});
+    }
+
+    // Applies a new configuration keeping everything that did not change: the living particles survive a resize of
+    // the pool, a new spawn buffer size reallocates only the framebuffer and its PBOs, a new model or texture is
+    // requested from the renderer caches and swapped in. The time it takes is in lastReconfigure()
+    void reconfigure(const SceneConfig& next)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::string changed;
+        const auto mark = [&changed](const char* part)
+        {
+            changed += changed.empty() ? part : std::string(", ") + part;
+        };
+        if (next.particle_number != config.particle_number)
+        {
+            particles.resize(next.particle_number);
+            mark("particles");
         }
+        if (next.particles_framebuffer_width != config.particles_framebuffer_width ||
+            next.particles_framebuffer_height != config.particles_framebuffer_height)
+        {
+            // the PBOs are created from the framebuffer, the old ones are freed by the move assignments
+            disappearingFragmentsFb = FrameBuffer(next.particles_framebuffer_width, next.particles_framebuffer_height,
+                                                  true);
+            pboColorRBuf = disappearingFragmentsFb.createPboReadColorBuffer();
+            pboDepthRBuf = disappearingFragmentsFb.createPboReadDepthBuffer();
+            pboObjectIdRBuf = disappearingFragmentsFb.createPboReadObjectIdBuffer();
+            mark("framebuffer");
+        }
+        if (next.model != config.model || !(next.model_options == config.model_options))
+        {
+            re_disappearingModel.setModel(renderer.requestModel(next.model, disappearingShader(), next.model_options));
+            // the new object starts disappearing from the beginning
+            re_disappearingModel.restart();
+            mark("model");
+        }
+        if (next.texture != config.texture || next.noise_texture != config.noise_texture)
+        {
+            textures(next.texture, next.noise_texture);
+            mark("textures");
+        }
+        if (next.object_count != config.object_count)
+        {
+            re_disappearingModel.layoutInstances(next.object_count);
+            mark("objects");
+        }
+        if (next.draw_particles != config.draw_particles || next.particle_size != config.particle_size)
+            mark("particle options");
+        config = next;
+
+        _lastReconfigure.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        _lastReconfigure.changed = std::move(changed);
+        _lastReconfigure.count++;
+    }
+
+    // Restarts the simulation: the object is whole again and the particles are gone, nothing is reallocated
+    void reset()
+    {
+        re_disappearingModel.restart();
+        particles.reset();
+        fixed_step.reset();
+    }
+
+    [[nodiscard]] const SceneConfig& configuration() const
+    {
+        return config;
+    }
 
-        renderer.setPipeline(p);
+    [[nodiscard]] const DisappearingObject& disappearingObject() const
+    {
+        return re_disappearingModel;
     }
 
+    [[nodiscard]] const ReconfigureStats& lastReconfigure() const
+    {
+        return _lastReconfigure;
+    }
+
+    [[nodiscard]] const SpawnStats& lastSpawn() const
+    {
+        return _lastSpawn;
+    }
+
+    // Null until the first frame drawn with depth_collisions
+    [[nodiscard]] const DepthCollider* depthCollider() const
+    {
+        return _depthCollider.get();
+    }
+
+    // A frame of dt seconds: the simulation runs in steps of fixed_step.step, as many as fit in the time accumulated
+    // so far and at most fixed_step.maxSubsteps, the particles are drawn between the last two steps. The particles
+    // spawned by the next render are the ones of every step of the frame, none if there was no step
     void mainLoop(const float dt)
     {
-        sc_disappearingModel.modelMatrix = scale(toMat4(disappearing_object_rotation),
-                                                 glm::vec3{disappearing_object_scale});
-        sc_disappearingModel.worldSpaceTransform = translate(glm::mat4{1}, disappearing_object_position);
-        re_disappearingModel.threshold(re_disappearingModel.threshold() + 0.1f * dt);
+        re_disappearingModel.startSpawnBand();
+        // the depth collider reads the depth of the frame, which the window can not give
+        renderer.setOffscreenWindow(depth_collisions);
+        if (depth_collisions && _depthCollider)
+            _depthCollider->update();
+        collisions.settings.screen = depth_collisions && _depthCollider ? &_depthCollider->depth() : nullptr;
+        const auto steps = fixed_step.advance(dt);
+        stepsThisFrame = std::max(steps, 1);
+        if (steps > 0 && air.settings.enabled() && !loading())
+        {
+            applyTransform();
+            moveAir(static_cast<float>(steps) * fixed_step.step);
+        }
+        for (int i = 0; i < steps; i++)
+            simulate(fixed_step.step);
+        applyTransform();
+        particles.interpolation(fixed_step.alpha());
+    }
+
+    // One simulation step of exactly dt seconds, whatever the fixed step is
+    void simulate(const float dt)
+    {
+        applyTransform();
+        // The object starts disappearing only once it is drawn with its own model and textures
+        if (!loading())
+            re_disappearingModel.advance(0.1f * dt);
         particles.updateParticles(dt, particles_update_func);
+        if (air.settings.enabled() && !loading())
+            stirAir(dt);
+        if (turbulence.field && turbulence.strength != 0)
+            particles.advect(*turbulence.field, turbulence.frequency, turbulence.strength, dt);
+        placeMeshColliders();
+        collisions.resolve(particles);
+    }
+
+    [[nodiscard]] bool loading() const
+    {
+        return !re_disappearingModel.loaded();
     }
 
 private:
     Renderer& renderer;
+    SceneConfig config;
+    ReconfigureStats _lastReconfigure;
+    SpawnStats _lastSpawn;
     SceneObject sc_disappearingModel;
     DisappearingObject re_disappearingModel;
     FrameBuffer disappearingFragmentsFb;
     PboReadBuffer pboColorRBuf;
     DebugBuffer debugBuffer;
     PboReadBuffer pboDepthRBuf;
-    vector<float> random_life_vector;
-    vector<glm::vec3> random_velocity_vector;
-    unsigned int random_vectors_size = 1000;
+    PboReadBuffer pboObjectIdRBuf;
+    std::unique_ptr<DepthCollider> _depthCollider;
+    // particles spawned this frame
+    vector<glm::vec3> spawn_positions;
+    vector<glm::u8vec4> spawn_colors;
+    vector<glm::vec3> spawn_velocities;
+    vector<float> spawn_lives;
+    vector<float> spawn_scratch;
+    // particle color and particles spawned this frame per instance, indexed by object ID (0 is no instance)
+    vector<glm::vec4> instance_colors;
+    vector<unsigned int> instance_spawned;
     float angleY{0};
     float threshold{0};
+    // simulation steps of the current frame, they share the budget of the air
+    int stepsThisFrame{1};
+    // instance matrices of the last frame with steps, how the instances moved since
+    vector<glm::mat4> air_matrices;
+    vector<FluidMover> air_movers;
+
+    void applyTransform()
+    {
+        sc_disappearingModel.modelMatrix = scale(toMat4(disappearing_object_rotation),
+                                                 glm::vec3{disappearing_object_scale});
+        sc_disappearingModel.worldSpaceTransform = translate(glm::mat4{1}, disappearing_object_position);
+    }
+
+    // The particles bounce off the part of the instances not yet dissolved, masked on the CPU copy of the mask layer.
+    // Only if the model was imported with a signed distance field (SceneConfig::model_options)
+    void placeMeshColliders()
+    {
+        auto& meshes = collisions.settings.meshes;
+        meshes.clear();
+        const auto* sdf = re_disappearingModel.sdf();
+        if (!sdf || loading())
+            return;
+        // the shader samples the white placeholder until the mask is ready: the whole surface
+        CollisionMask mask;
+        if (const auto* entry = re_disappearingModel.mask(); entry && entry->ready())
+            mask = CollisionMask{entry->cpuMask().data(), entry->cpuMaskWidth(), entry->cpuMaskHeight(), 0};
+        const auto spacing = re_disappearingModel.instanceSpacing();
+        for (const auto& instance : re_disappearingModel.instances())
+        {
+            if (instance.threshold >= 1)
+                continue;
+            mask.threshold = instance.threshold;
+            meshes.push_back(CollisionMesh{sdf, re_disappearingModel.instanceMatrix(instance, spacing), mask});
+        }
+    }
+
+    // Once per frame, before its steps: the instance matrices change with the frame, not with the steps, so the motion
+    // since the last frame with steps is spread over the seconds of the steps of this one, the instances not yet
+    // dissolved push the air at that velocity in every step. The grid is three times the size of the box around them,
+    // it is placed again, the air still, once they get close to its walls
+    void moveAir(const float seconds)
+    {
+        const auto sphere = re_disappearingModel.boundingSphere();
+        if (sphere.w <= 0)
+            return;
+        const auto spacing = re_disappearingModel.instanceSpacing();
+        const auto& instances = re_disappearingModel.instances();
+        const bool moved = air_matrices.size() == instances.size();
+        air_matrices.resize(instances.size());
+        air_movers.clear();
+        auto min = glm::vec3{std::numeric_limits<float>::max()};
+        auto max = glm::vec3{std::numeric_limits<float>::lowest()};
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            const auto matrix = re_disappearingModel.instanceMatrix(instances[i], spacing);
+            const auto scale = glm::max(glm::length(glm::vec3{matrix[0]}),
+                                        glm::max(glm::length(glm::vec3{matrix[1]}), glm::length(glm::vec3{matrix[2]})));
+            const auto center = glm::vec3{matrix * glm::vec4{glm::vec3{sphere}, 1}};
+            const auto radius = sphere.w * scale;
+            min = glm::min(min, center - radius);
+            max = glm::max(max, center + radius);
+            if (moved && instances[i].threshold < 1)
+                air_movers.push_back(FluidMover{center, radius, matrix * glm::inverse(air_matrices[i]), seconds});
+            air_matrices[i] = matrix;
+        }
+        if (air.resolution() != std::max(air.settings.resolution, 2) || !air.contains(min, max, 2))
+        {
+            const auto extent = max - min;
+            const auto size = 3 * glm::max(extent.x, glm::max(extent.y, extent.z));
+            air.place((min + max) * 0.5f - glm::vec3{size * 0.5f}, size);
+        }
+    }
+
+    // One step of the air with the movers of the frame (moveAir), the particles are dragged by it
+    void stirAir(const float dt)
+    {
+        air.step(dt, air_movers, air.settings.budget_ms / static_cast<float>(stepsThisFrame));
+        particles.drag(air, air.settings.coupling, dt);
+    }
+
+    [[nodiscard]] const Shader& disappearingShader() const
+    {
+        return renderer.loadShader("./src/shaders/dissolve_instanced.vert", "./src/shaders/disappearing_mesh.frag");
+    }
 };
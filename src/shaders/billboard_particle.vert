@@ -3,17 +3,21 @@
 layout (location = 0) in vec3 vertex_position;
 layout (location = 1) in vec4 position_in_space;
 layout (location = 2) in vec4 color;
+layout (location = 3) in vec3 previous_position;
 
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
 uniform mat3 cameraOrientation;
+// between the previous simulation step (0) and the last one (1)
+uniform float interpolation;
 
 out vec4 ParticleColor;
 
 void main()
 {
     ParticleColor = vec4(vec3(color), 1);
+    vec3 center = mix(previous_position, position_in_space.xyz, interpolation);
     gl_Position = projectionMatrix * viewMatrix * vec4(
-        cameraOrientation[0] * (vertex_position.x * position_in_space.w) + cameraOrientation[1] * (vertex_position.y * position_in_space.w) + position_in_space.xyz
+        cameraOrientation[0] * (vertex_position.x * position_in_space.w) + cameraOrientation[1] * (vertex_position.y * position_in_space.w) + center
     , 1.0f);
 }
@@ -0,0 +1,20 @@
+#version 410 core
+
+// Nearest depth of the downsample x downsample block of frameDepth under the fragment, written as its depth: thin
+// geometry covering a single texel of the block is kept
+
+uniform sampler2D frameDepth;
+uniform int downsample;
+
+void main()
+{
+    ivec2 last = textureSize(frameDepth, 0) - 1;
+    ivec2 first = ivec2(gl_FragCoord.xy) * downsample;
+    float nearest = 1;
+    for (int y = 0; y < downsample; y++)
+    {
+        for (int x = 0; x < downsample; x++)
+            nearest = min(nearest, texelFetch(frameDepth, min(first + ivec2(x, y), last), 0).r);
+    }
+    gl_FragDepth = nearest;
+}
@@ -1,28 +1,36 @@
 #version 410 core
 
 layout(location = 0) out vec4 color;
+// instance id + 1 in the object-ID attachment of the spawn framebuffer
+layout(location = 1) out uint objectId;
 //in vec3 Normal;
 in vec2 TexCoord;
+// per instance (see dissolve_instanced.vert)
+flat in float Threshold;
+flat in float LowerBoundThreshold;
+flat in uint ObjectId;
 
-uniform sampler2D texSampler;
-uniform sampler2D maskSampler;
-uniform float threshold;
-uniform float lowerBoundThreshold;
+// layers of the texture library (see texturelibrary.h)
+uniform sampler2DArray texSampler;
+uniform sampler2DArray maskSampler;
+uniform int texLayer;
+uniform int maskLayer;
 uniform bool invert;//TODO: Change with subroutine
 
 
 void main() {
-    vec4 sampledTexture = texture(texSampler, TexCoord);
-    vec4 sampledMask = texture(maskSampler, TexCoord);
+    vec4 sampledTexture = texture(texSampler, vec3(TexCoord, texLayer));
+    vec4 sampledMask = texture(maskSampler, vec3(TexCoord, maskLayer));
+    objectId = ObjectId + 1u;
 
     if (!invert){
-        if (sampledMask.r > threshold){
+        if (sampledMask.r > Threshold){
             color = sampledTexture;
         } else {
             discard;
         }
     } else {
-        if (sampledMask.r > lowerBoundThreshold && sampledMask.r <= threshold){
+        if (sampledMask.r > LowerBoundThreshold && sampledMask.r <= Threshold){
             color = sampledTexture;
         } else {
             discard;
@@ -0,0 +1,31 @@
+#version 410 core
+
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoord;
+layout (location = 3) in vec3 tangent;
+layout (location = 4) in vec3 biTangent;
+
+// INSTANCE_TEXELS texels per instance: the columns of the model matrix, then (threshold, lower bound threshold, id, 0)
+const int INSTANCE_TEXELS = 5;
+uniform samplerBuffer instances;
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+
+out vec2 TexCoord;
+flat out float Threshold;
+flat out float LowerBoundThreshold;
+flat out uint ObjectId;
+
+void main()
+{
+    int base = gl_InstanceID * INSTANCE_TEXELS;
+    mat4 modelMatrix = mat4(texelFetch(instances, base), texelFetch(instances, base + 1),
+                            texelFetch(instances, base + 2), texelFetch(instances, base + 3));
+    vec4 dissolve = texelFetch(instances, base + 4);
+    gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(position, 1.0f);
+    TexCoord = texCoord;
+    Threshold = dissolve.x;
+    LowerBoundThreshold = dissolve.y;
+    ObjectId = uint(dissolve.z);
+}
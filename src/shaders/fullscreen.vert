@@ -0,0 +1,9 @@
+#version 410 core
+
+// One triangle covering the viewport, drawn with glDrawArrays(GL_TRIANGLES, 0, 3) and no vertex attributes
+
+void main()
+{
+    const vec2 corners[3] = vec2[3](vec2(-1, -1), vec2(3, -1), vec2(-1, 3));
+    gl_Position = vec4(corners[gl_VertexID], 0, 1);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <chrono>
+#include <vector>
+#include <glad/glad.h>
+#include <utils/nocopy.h>
+
+/*
+CPU and GPU time of every pipeline step, frame by frame. The CPU time is the wall time of the step on the render thread,
+the GPU time comes from a GL_TIME_ELAPSED query around it. The queries of a frame are read LATENCY frames later, when
+the GPU is done with them, so timing does not stall the pipeline. finish() waits for the frames still in flight.
+*/
+class StageTimer : NoCopy
+{
+public:
+    static constexpr int LATENCY = 3;
+
+    struct Frame
+    {
+        int index{0};
+        std::vector<double> cpuMs, gpuMs;
+    };
+
+    StageTimer(): NoCopy{}
+    {
+    }
+
+    ~StageTimer()
+    {
+        freeGPUResources();
+    }
+
+    // Render thread, the renderer calls these around its pipeline
+    void beginFrame(const int stages)
+    {
+        auto& slot = ring[nextFrame % (LATENCY + 1)];
+        if (slot.pending)
+            collect(slot);
+        if (static_cast<int>(slot.queries.size()) != stages)
+        {
+            if (!slot.queries.empty())
+                glDeleteQueries(static_cast<GLsizei>(slot.queries.size()), slot.queries.data());
+            slot.queries.assign(stages, 0);
+            glGenQueries(stages, slot.queries.data());
+        }
+        slot.frame = Frame{nextFrame++, std::vector<double>(stages, 0), std::vector<double>(stages, 0)};
+        current = &slot;
+    }
+
+    void beginStage(const int stage)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, current->queries[stage]);
+        stageStart = std::chrono::steady_clock::now();
+    }
+
+    void endStage(const int stage)
+    {
+        current->frame.cpuMs[stage] = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - stageStart).count();
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+
+    void endFrame()
+    {
+        current->pending = true;
+        current = nullptr;
+    }
+
+    // Collects the frames still waiting for their queries, in order
+    void finish()
+    {
+        for (int i = 0; i <= LATENCY; i++)
+        {
+            if (auto& slot = ring[(nextFrame + i) % (LATENCY + 1)]; slot.pending)
+                collect(slot);
+        }
+    }
+
+    // Every frame whose GPU times are known, oldest first
+    [[nodiscard]] const std::vector<Frame>& frames() const
+    {
+        return _frames;
+    }
+
+    void clear()
+    {
+        finish();
+        _frames.clear();
+    }
+
+private:
+    struct Slot
+    {
+        std::vector<GLuint> queries;
+        Frame frame;
+        bool pending{false};
+    };
+
+    Slot ring[LATENCY + 1];
+    Slot* current{nullptr};
+    int nextFrame{0};
+    std::chrono::steady_clock::time_point stageStart;
+    std::vector<Frame> _frames;
+
+    void collect(Slot& slot)
+    {
+        for (size_t i = 0; i < slot.queries.size(); i++)
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &ns);
+            slot.frame.gpuMs[i] = static_cast<double>(ns) / 1e6;
+        }
+        _frames.push_back(std::move(slot.frame));
+        slot.pending = false;
+    }
+
+    void freeGPUResources()
+    {
+        for (auto& slot : ring)
+        {
+            if (!slot.queries.empty())
+                glDeleteQueries(static_cast<GLsizei>(slot.queries.size()), slot.queries.data());
+            slot.queries.clear();
+        }
+    }
+};
@@ -9,7 +9,7 @@ class TexturedModel : public RenderObject
 {
 public:
     TexturedModel(const Shader& shader, const Renderer& renderer,
-                  const std::vector<std::reference_wrapper<const Texture>>& textures, const Model& model,
+                  const std::vector<TextureHandle>& textures, const ModelHandle& model,
                   const SceneObject& scene_object): RenderObject(shader, renderer, textures, model, scene_object)
     {
     }
@@ -29,6 +29,6 @@ public:
                            value_ptr(viewMatrix));
         glUniformMatrix4fv(glGetUniformLocation(shader.program(), "modelMatrix"), 1, GL_FALSE,
                            value_ptr(modelMatrix));
-        model.Draw();
+        model.get().Draw();
     }
 };
@@ -0,0 +1,307 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <gpuobjects/pbowritebuffer.h>
+#include <gpuobjects/texture.h>
+#include <gpuobjects/texturearray.h>
+#include <gpuobjects/texturecache.h>
+
+#include "resources.h"
+
+/*
+The textures that can be selected for the dissolve, packed in GL_TEXTURE_2D_ARRAYs: for every image size one RGBA8
+array with the colors and one RGTC1 array with the masks (the red channel). Every file gets a layer in both, switching
+the color or the mask of an object only changes the layers it samples, nothing is allocated.
+1. render thread (add): the sizes are read from the file headers, the new files are grouped by size and new arrays are
+   allocated for each group, the arrays already in the library are not touched. Every new file gets a pixel unpack
+   buffer for its color pixels followed by its mask levels, mapped for the loader
+2. loader thread (decode): the image is decoded, converted to RGBA and encoded to the mask straight into the mapped
+   buffer, the mask comes from the texture cache when possible. A small copy of the mask stays on the CPU for the
+   particle collisions (Entry::cpuMask)
+3. render thread (uploadStep): the buffer is unmapped and both layers are filled from it within the upload budget of the
+   frame, a band of color rows at a time and then the mask a mip level at a time. After the last part the buffer is
+   freed and the entry becomes Ready, the mipmaps of a color array are generated once all its layers are
+*/
+class TextureLibrary
+{
+public:
+    struct Layer
+    {
+        const TextureArray* array{nullptr};
+        int layer{0};
+    };
+
+    class Entry
+    {
+    public:
+        [[nodiscard]] const std::string& path() const { return _path; }
+
+        [[nodiscard]] ResourceState state() const
+        {
+            return _state.load(std::memory_order_acquire);
+        }
+
+        // Render thread. The layers are filled and the arrays are complete
+        [[nodiscard]] bool ready() const
+        {
+            return state() == ResourceState::Ready && color.array->complete() && mask.array->complete();
+        }
+
+        [[nodiscard]] bool settled() const
+        {
+            return state() == ResourceState::Failed || ready();
+        }
+
+        // Decoded and not completely uploaded, uploadStep() has parts left
+        [[nodiscard]] bool uploading() const
+        {
+            return state() == ResourceState::Decoded;
+        }
+
+        // Once ready: the red channel point sampled to at most CPU_MASK_SIZE texels per side, row by row like the
+        // layer, cpuMaskWidth() x cpuMaskHeight()
+        [[nodiscard]] const std::vector<unsigned char>& cpuMask() const { return _cpuMask; }
+        [[nodiscard]] int cpuMaskWidth() const { return cpuWidth; }
+        [[nodiscard]] int cpuMaskHeight() const { return cpuHeight; }
+
+    private:
+        friend class TextureLibrary;
+        std::string _path;
+        int width{0}, height{0};
+        Layer color, mask;
+        TextureArray* colorArray{nullptr};
+        TextureArray* maskArray{nullptr};
+        // Color pixels and then mask levels, written by the loader thread while mapped, freed after the upload
+        std::unique_ptr<PboWriteBuffer> pbo;
+        GLubyte* staging{nullptr};
+        size_t colorBytes{0};
+        // color rows and mask levels already uploaded, and the offset of the next level in the buffer
+        int uploadedRows{0}, uploadedLevels{0};
+        size_t maskOffset{0};
+        std::vector<unsigned char> _cpuMask;
+        int cpuWidth{0}, cpuHeight{0};
+        std::atomic<ResourceState> _state{ResourceState::Loading};
+    };
+
+    static constexpr TextureFormat COLOR_FORMAT = TextureFormat::RGBA8;
+    static constexpr TextureFormat MASK_FORMAT = TextureFormat::RGTC1;
+    static constexpr int CPU_MASK_SIZE = 256;
+
+    // Render thread, needs the GL context
+    TextureLibrary()
+    {
+        constexpr unsigned char white[] = {255, 255, 255, 255};
+        placeholder = std::make_unique<TextureArray>(1, 1, 1, COLOR_FORMAT);
+        placeholder->uploadRows(0, 0, 1, white);
+        placeholder->layerFilled();
+    }
+
+    // Render thread. Returns the entries of the files that were not in the library yet, to be decoded and uploaded
+    std::vector<Entry*> add(const std::vector<std::string>& paths)
+    {
+        std::vector<Entry*> added;
+        std::map<std::pair<int, int>, std::vector<Entry*>> groups;
+        for (const auto& path : paths)
+        {
+            if (entries.count(path))
+                continue;
+            auto& entry = *entries.emplace(path, std::make_unique<Entry>()).first->second;
+            entry._path = path;
+            int nrChannels;
+            if (!Texture::probe(path, entry.width, entry.height, nrChannels))
+            {
+                entry._state.store(ResourceState::Failed, std::memory_order_release);
+                continue;
+            }
+            groups[{entry.width, entry.height}].push_back(&entry);
+            added.push_back(&entry);
+        }
+        for (const auto& [size, group] : groups)
+        {
+            const auto layers = static_cast<int>(group.size());
+            const auto color = arrays.emplace_back(std::make_unique<TextureArray>(size.first, size.second, layers,
+                                                                                  COLOR_FORMAT)).get();
+            const auto mask = arrays.emplace_back(std::make_unique<TextureArray>(size.first, size.second, layers,
+                                                                                 MASK_FORMAT)).get();
+            for (int i = 0; i < layers; i++)
+            {
+                auto& entry = *group[i];
+                entry.colorArray = color;
+                entry.maskArray = mask;
+                entry.color = Layer{color, i};
+                entry.mask = Layer{mask, i};
+                entry.colorBytes = TextureCodec::levelBytes(COLOR_FORMAT, entry.width, entry.height);
+                entry.maskOffset = entry.colorBytes;
+                entry.pbo = std::make_unique<PboWriteBuffer>(static_cast<GLsizeiptr>(
+                    entry.colorBytes + TextureCodec::chainBytes(MASK_FORMAT, entry.width, entry.height)));
+                entry.staging = entry.pbo->map();
+                // still uploaded, as a failed entry, to count for the arrays
+                if (!entry.staging)
+                    entry._state.store(ResourceState::Failed, std::memory_order_release);
+            }
+        }
+        return added;
+    }
+
+    // Loader thread
+    static void decode(Entry& entry)
+    {
+        if (entry.state() != ResourceState::Loading)
+            return;
+        const size_t pixelCount = static_cast<size_t>(entry.width) * entry.height;
+        const auto maskLevels = entry.staging + entry.colorBytes;
+        const bool cachedMask = TextureCache::load(entry._path, MASK_FORMAT, entry.width, entry.height, maskLevels);
+        const auto image = Texture::decode(entry._path);
+        if (!image || image->width != entry.width || image->height != entry.height)
+        {
+            fail(entry);
+            return;
+        }
+        TextureCodec::convert(image->pixels.get(), image->nrChannels, pixelCount, TextureCodec::channels(COLOR_FORMAT),
+                              entry.staging);
+        if (!cachedMask)
+        {
+            // the buffer is write-combined memory, the cache file is written from a copy
+            std::vector<unsigned char> red(pixelCount);
+            std::vector<unsigned char> encoded(TextureCodec::chainBytes(MASK_FORMAT, entry.width, entry.height));
+            TextureCodec::convert(image->pixels.get(), image->nrChannels, pixelCount, 1, red.data());
+            TextureCodec::transcode(red.data(), entry.width, entry.height, MASK_FORMAT, encoded.data());
+            TextureCache::store(entry._path, MASK_FORMAT, entry.width, entry.height, encoded.data());
+            std::memcpy(maskLevels, encoded.data(), encoded.size());
+        }
+        entry.cpuWidth = std::min(entry.width, CPU_MASK_SIZE);
+        entry.cpuHeight = std::min(entry.height, CPU_MASK_SIZE);
+        entry._cpuMask.resize(static_cast<size_t>(entry.cpuWidth) * entry.cpuHeight);
+        for (int y = 0; y < entry.cpuHeight; y++)
+        {
+            const auto sy = static_cast<size_t>((2 * y + 1) * entry.height / (2 * entry.cpuHeight));
+            for (int x = 0; x < entry.cpuWidth; x++)
+            {
+                const auto sx = static_cast<size_t>((2 * x + 1) * entry.width / (2 * entry.cpuWidth));
+                entry._cpuMask[static_cast<size_t>(y) * entry.cpuWidth + x] =
+                    image->pixels.get()[(sy * entry.width + sx) * image->nrChannels];
+            }
+        }
+        entry._state.store(ResourceState::Decoded, std::memory_order_release);
+    }
+
+    // Loader thread, also when decode() threw. The entry is uploaded anyway to fill its layers, which frees its buffer
+    static void fail(Entry& entry)
+    {
+        entry._state.store(ResourceState::Failed, std::memory_order_release);
+    }
+
+    // Render thread, after decode(). Uploads at least one part and then as many as fit in budget bytes, returns the
+    // bytes uploaded. Call it again while entry.uploading(). A failed entry leaves its layers empty but still counts
+    // for the arrays
+    size_t uploadStep(Entry& entry, const size_t budget)
+    {
+        if (entry.state() != ResourceState::Decoded)
+        {
+            entry.pbo.reset();
+            entry.colorArray->layerFilled();
+            entry.maskArray->layerFilled();
+            return 0;
+        }
+        const auto rowBytes = static_cast<size_t>(entry.width) * TextureCodec::channels(COLOR_FORMAT);
+        const int levels = TextureCodec::levelCount(entry.width, entry.height);
+        // bytes of the smallest next part, 0 once everything is uploaded
+        const auto nextPart = [&]() -> size_t
+        {
+            if (entry.uploadedRows < entry.height)
+                return rowBytes;
+            if (entry.uploadedLevels < levels)
+                return TextureCodec::levelBytes(MASK_FORMAT, TextureCodec::levelSize(entry.width, entry.uploadedLevels),
+                                                TextureCodec::levelSize(entry.height, entry.uploadedLevels));
+            return 0;
+        };
+        size_t bytes = 0;
+        entry.pbo->unmap();
+        entry.pbo->bind();
+        do
+        {
+            if (entry.uploadedRows < entry.height)
+            {
+                const auto rows = static_cast<int>(std::clamp<size_t>((budget - bytes) / rowBytes, 1,
+                                                                      entry.height - entry.uploadedRows));
+                entry.colorArray->uploadRows(entry.color.layer, entry.uploadedRows, rows,
+                                             offset(entry.uploadedRows * rowBytes));
+                entry.uploadedRows += rows;
+                bytes += rows * rowBytes;
+            }
+            else
+            {
+                const auto levelBytes = entry.maskArray->uploadCompressedLevel(
+                    entry.mask.layer, entry.uploadedLevels++, offset(entry.maskOffset));
+                entry.maskOffset += levelBytes;
+                bytes += levelBytes;
+            }
+        }
+        while (nextPart() != 0 && bytes + nextPart() <= budget);
+        PboWriteBuffer::unbind();
+        if (nextPart() == 0)
+        {
+            entry.pbo.reset();
+            entry.staging = nullptr;
+            entry._state.store(ResourceState::Ready, std::memory_order_release);
+            entry.colorArray->layerFilled();
+            entry.maskArray->layerFilled();
+        }
+        return bytes;
+    }
+
+    // nullptr if the file was never added
+    [[nodiscard]] const Entry* find(const std::string& path) const
+    {
+        const auto iter = entries.find(path);
+        return iter != entries.end() ? iter->second.get() : nullptr;
+    }
+
+    // Layers to sample for an entry, a white placeholder until it is ready
+    [[nodiscard]] Layer color(const Entry* entry) const
+    {
+        return entry && entry->ready() ? entry->color : Layer{placeholder.get(), 0};
+    }
+
+    [[nodiscard]] Layer mask(const Entry* entry) const
+    {
+        return entry && entry->ready() ? entry->mask : Layer{placeholder.get(), 0};
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return entries.size();
+    }
+
+    [[nodiscard]] size_t arrayCount() const
+    {
+        return arrays.size();
+    }
+
+    // Every array is resident for the whole run, the pixels are not kept on the CPU after the upload
+    [[nodiscard]] size_t gpuBytes() const
+    {
+        size_t bytes = placeholder->gpuBytes();
+        for (const auto& array : arrays)
+            bytes += array->gpuBytes();
+        return bytes;
+    }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries;
+    std::vector<std::unique_ptr<TextureArray>> arrays;
+    std::unique_ptr<TextureArray> placeholder;
+
+    static const void* offset(const size_t bytes)
+    {
+        return reinterpret_cast<const void*>(static_cast<uintptr_t>(bytes));
+    }
+};